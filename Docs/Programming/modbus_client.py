@@ -0,0 +1,167 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+
+################################################################
+#
+#   Copyright notice
+#
+#   Control software for a Room Ventilation System
+#   https://github.com/svenjust/room-ventilation-system
+#
+#   Copyright (C) 2018  Ivan Schréter (schreter@gmx.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+#   This copyright notice MUST APPEAR in all copies of the script!
+#
+################################################################
+import argparse
+import socket
+import struct
+import sys
+####################################################################
+# WHAT DOES THIS SCRIPT DO?
+# Minimal Modbus TCP client for the Modbus server of the controller
+# (see ../Modbus.md for the register map). It can show the state,
+# read and write registers and run a check of the server protocol
+# handling, e.g., against a host build with loopback transport.
+#
+# Usage: modbus_client.py 192.168.20.201 status
+#        modbus_client.py 192.168.20.201 read input 0 14
+#        modbus_client.py 192.168.20.201 write 0 2
+#        modbus_client.py 192.168.20.201 write 1 1300 1350
+#        modbus_client.py 127.0.0.1 --port 1502 check
+####################################################################
+
+INPUT_REGISTERS = ['errors', 'info', 'T1 outside', 'T2 inlet', 'T3 outlet', 'T4 exhaust',
+                   'efficiency', 'fan1 speed', 'fan2 speed', 'fan mode', 'antifreeze',
+                   'preheater', 'bypass flap', 'bypass running']
+HOLDING_REGISTERS = ['ventilation mode', 'fan1 standard speed', 'fan2 standard speed',
+                     'bypass mode', 'bypass manual flap']
+TEMPERATURES = range(2, 6)
+
+class ModbusError(Exception):
+    def __init__(self, function, code):
+        Exception.__init__(self, 'exception %d for function %d' % (code, function))
+        self.code = code
+
+class Client:
+    def __init__(self, host, port, timeout=5.0):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.tid = 0
+
+    def _recv(self, size):
+        data = b''
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise RuntimeError('connection closed by server')
+            data += chunk
+        return data
+
+    def request(self, pdu):
+        """Send a request PDU and return the response PDU."""
+        self.tid = (self.tid + 1) & 0xffff
+        self.sock.sendall(struct.pack('>HHHB', self.tid, 0, len(pdu) + 1, 1) + pdu)
+        tid, proto, length, _ = struct.unpack('>HHHB', self._recv(7))
+        if tid != self.tid or proto != 0:
+            raise RuntimeError('unexpected response header')
+        response = self._recv(length - 1)
+        if response[0] & 0x80:
+            raise ModbusError(pdu[0], response[1])
+        return response
+
+    def read(self, input, addr, count):
+        response = self.request(struct.pack('>BHH', 4 if input else 3, addr, count))
+        return list(struct.unpack('>%dH' % count, response[2:]))
+
+    def write(self, addr, values):
+        if len(values) == 1:
+            self.request(struct.pack('>BHH', 6, addr, values[0]))
+        else:
+            self.request(struct.pack('>BHHB%dH' % len(values), 16, addr, len(values), 2 * len(values), *values))
+
+def signed(value):
+    return value - 0x10000 if value & 0x8000 else value
+
+def status(client):
+    for i, value in enumerate(client.read(True, 0, len(INPUT_REGISTERS))):
+        if i < 2:
+            text = '0x%04X' % value
+        elif i in TEMPERATURES:
+            text = '%.2f' % (signed(value) / 100.0)
+        else:
+            text = str(value)
+        print('input   %2d %-20s %s' % (i, INPUT_REGISTERS[i], text))
+    for i, value in enumerate(client.read(False, 0, len(HOLDING_REGISTERS))):
+        print('holding %2d %-20s %d' % (i, HOLDING_REGISTERS[i], value))
+
+def expect_exception(code, func, *args):
+    try:
+        func(*args)
+    except ModbusError as e:
+        if e.code != code:
+            raise RuntimeError('expected exception %d, got %d' % (code, e.code))
+        return
+    raise RuntimeError('expected exception %d, got none' % code)
+
+def check(client):
+    """Check protocol handling. Holding registers are written with their current values."""
+    inputs = client.read(True, 0, len(INPUT_REGISTERS))
+    for i in TEMPERATURES:
+        if not -12700 <= signed(inputs[i]) <= 10000:
+            raise RuntimeError('implausible temperature in register %d' % i)
+    holding = client.read(False, 0, len(HOLDING_REGISTERS))
+    client.write(0, holding[0:1])
+    client.write(0, holding)
+    if client.read(False, 0, len(HOLDING_REGISTERS)) != holding:
+        raise RuntimeError('holding registers changed by writing the same values')
+    expect_exception(1, client.request, struct.pack('>BHH', 1, 0, 1))
+    expect_exception(2, client.read, True, len(INPUT_REGISTERS), 1)
+    expect_exception(2, client.read, False, len(HOLDING_REGISTERS) - 1, 2)
+    expect_exception(3, client.read, True, 0, 0)
+    expect_exception(3, client.write, 3, [7])
+    # invalid value in a multiple write must not apply any value
+    expect_exception(3, client.write, 0, [holding[0], holding[1], holding[2], 7])
+    if client.read(False, 0, len(HOLDING_REGISTERS)) != holding:
+        raise RuntimeError('rejected write changed holding registers')
+    print('OK')
+
+def main():
+    parser = argparse.ArgumentParser(description='Modbus TCP client for the controller.')
+    parser.add_argument('host', help='controller IP address')
+    parser.add_argument('command', choices=['status', 'read', 'write', 'check'])
+    parser.add_argument('args', nargs='*', help='read: input|holding address count, write: address value...')
+    parser.add_argument('--port', type=int, default=502)
+    args = parser.parse_args()
+
+    client = Client(args.host, args.port)
+    try:
+        if args.command == 'status':
+            status(client)
+        elif args.command == 'read':
+            if len(args.args) != 3 or args.args[0] not in ('input', 'holding'):
+                parser.error('read requires input|holding, address and count')
+            print(' '.join(str(v) for v in client.read(args.args[0] == 'input', int(args.args[1]), int(args.args[2]))))
+        elif args.command == 'write':
+            if len(args.args) < 2:
+                parser.error('write requires address and values')
+            client.write(int(args.args[0]), [int(v) for v in args.args[1:]])
+        else:
+            check(client)
+    except (ModbusError, RuntimeError) as e:
+        sys.exit(str(e))
+
+if __name__ == '__main__':
+    main()
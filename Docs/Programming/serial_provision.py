@@ -0,0 +1,149 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+
+################################################################
+#
+#   Copyright notice
+#
+#   Control software for a Room Ventilation System
+#   https://github.com/svenjust/room-ventilation-system
+#
+#   Copyright (C) 2018  Ivan Schréter (schreter@gmx.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+#   This copyright notice MUST APPEAR in all copies of the script!
+#
+################################################################
+import argparse
+import os
+import sys
+import termios
+import time
+####################################################################
+# WHAT DOES THIS SCRIPT DO?
+# Reads or writes the complete persistent configuration (including
+# program table) of the controller over the serial port using binary
+# frames of SerialConsole. Use it for fast provisioning of controllers.
+#
+# Frame: STX, command, length (16 bits LE), payload, CRC-16/MODBUS over
+# command, length and payload (16 bits LE).
+#
+# Usage: serial_provision.py /dev/ttyACM0 info
+#        serial_provision.py /dev/ttyACM0 read config.bin
+#        serial_provision.py /dev/ttyACM0 write config.bin
+#
+# Any serial device can be used, also a pseudo-terminal for testing.
+####################################################################
+
+STX = 0x02
+# maximum payload length (EEPROM size)
+MAX_PAYLOAD = 1024
+ERRORS = {1: 'checksum', 2: 'length', 3: 'version', 4: 'command', 5: 'timeout'}
+
+def crc16(data):
+    crc = 0xffff
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xa001 if crc & 1 else crc >> 1
+    return crc
+
+def make_frame(cmd, payload=b''):
+    body = bytes([ord(cmd)]) + len(payload).to_bytes(2, 'little') + payload
+    return bytes([STX]) + body + crc16(body).to_bytes(2, 'little')
+
+def open_port(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    attrs = termios.tcgetattr(fd)
+    attrs[0] = 0                                    # iflag
+    attrs[1] = 0                                    # oflag
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0                                    # lflag
+    speed = getattr(termios, 'B%d' % baud)
+    attrs[4] = attrs[5] = speed
+    attrs[6][termios.VMIN] = 0
+    attrs[6][termios.VTIME] = 1
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+def transfer(fd, cmd, payload=b'', timeout=5.0):
+    """Send a request frame and return the payload of the response frame."""
+    termios.tcflush(fd, termios.TCIFLUSH)   # drop stale output
+    os.write(fd, make_frame(cmd, payload))
+    deadline = time.time() + timeout
+    buf = b''
+    while True:
+        if time.time() > deadline:
+            raise RuntimeError('timeout waiting for response')
+        buf += os.read(fd, 1024)
+        # skip debug output until start of a valid frame
+        while True:
+            start = buf.find(bytes([STX]))
+            if start < 0:
+                buf = b''
+                break
+            buf = buf[start:]
+            if len(buf) < 4:
+                break
+            length = int.from_bytes(buf[2:4], 'little')
+            if length > MAX_PAYLOAD:
+                buf = buf[1:]   # not a frame, debug output containing STX
+                continue
+            if len(buf) < length + 6:
+                break
+            body = buf[1:length + 4]
+            if crc16(body) != int.from_bytes(buf[length + 4:length + 6], 'little'):
+                buf = buf[1:]
+                continue
+            payload = body[3:]
+            if body[0] == ord('E'):
+                raise RuntimeError('controller reported error: %s' % ERRORS.get(payload[0], payload[0]))
+            if body[0] != ord(cmd):
+                raise RuntimeError('unexpected response %r' % chr(body[0]))
+            return payload
+
+def main():
+    parser = argparse.ArgumentParser(description='Read or write controller configuration over serial port.')
+    parser.add_argument('port', help='serial device')
+    parser.add_argument('command', choices=['info', 'read', 'write'])
+    parser.add_argument('file', nargs='?', help='configuration image file')
+    parser.add_argument('--baud', type=int, default=57600)
+    args = parser.parse_args()
+    if args.command != 'info' and not args.file:
+        parser.error('file required')
+
+    fd = open_port(args.port, args.baud)
+    # terminate any partial command line
+    os.write(fd, b'\n')
+    info = transfer(fd, 'I')
+    version = int.from_bytes(info[0:2], 'little')
+    size = int.from_bytes(info[2:4], 'little')
+    if args.command == 'info':
+        print('version %d, size %d' % (version, size))
+    elif args.command == 'read':
+        image = transfer(fd, 'R')
+        with open(args.file, 'wb') as f:
+            f.write(image)
+        print('read %d bytes' % len(image))
+    else:
+        with open(args.file, 'rb') as f:
+            image = f.read()
+        if len(image) != size or int.from_bytes(image[0:2], 'little') != version:
+            sys.exit('image does not match controller (version %d, size %d)' % (version, size))
+        transfer(fd, 'W', image)
+        print('written %d bytes, controller restarts' % len(image))
+
+if __name__ == '__main__':
+    main()
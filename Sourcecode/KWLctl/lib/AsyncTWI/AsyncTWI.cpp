@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "AsyncTWI.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+// TWI status codes (master transmitter, see ATmega2560 datasheet)
+static constexpr uint8_t TW_STATUS_START      = 0x08;
+static constexpr uint8_t TW_STATUS_REP_START  = 0x10;
+static constexpr uint8_t TW_STATUS_SLA_ACK    = 0x18;
+static constexpr uint8_t TW_STATUS_SLA_NACK   = 0x20;
+static constexpr uint8_t TW_STATUS_DATA_ACK   = 0x28;
+static constexpr uint8_t TW_STATUS_DATA_NACK  = 0x30;
+static constexpr uint8_t TW_STATUS_ARB_LOST   = 0x38;
+
+// TWCR bits
+static constexpr uint8_t BIT_TWINT = 0x80;
+static constexpr uint8_t BIT_TWSTA = 0x20;
+static constexpr uint8_t BIT_TWSTO = 0x10;
+static constexpr uint8_t BIT_TWEN  = 0x04;
+static constexpr uint8_t BIT_TWIE  = 0x01;
+
+/// Send next byte (address or data).
+static constexpr uint8_t CMD_SEND = BIT_TWINT | BIT_TWEN | BIT_TWIE;
+/// Send START (or repeated START).
+static constexpr uint8_t CMD_START = CMD_SEND | BIT_TWSTA;
+/// Send STOP followed by START.
+static constexpr uint8_t CMD_STOP_START = CMD_START | BIT_TWSTO;
+/// Send STOP, no interrupt follows.
+static constexpr uint8_t CMD_STOP = BIT_TWINT | BIT_TWEN | BIT_TWSTO;
+/// Release the bus without STOP (after arbitration lost), no interrupt follows.
+static constexpr uint8_t CMD_RELEASE = BIT_TWINT | BIT_TWEN;
+
+static constexpr uint8_t QUEUE_MASK = AsyncTWI::QUEUE_SIZE - 1;
+static_assert((AsyncTWI::QUEUE_SIZE & QUEUE_MASK) == 0, "Queue size must be power of 2");
+
+#ifdef __AVR__
+
+static inline uint8_t hwStatus() { return TWSR & 0xf8; }
+static inline void hwData(uint8_t data) { TWDR = data; }
+static inline void hwCommand(uint8_t command) { TWCR = command; }
+static inline void hwReset() { TWCR = 0; TWCR = BIT_TWEN; }
+
+ISR(TWI_vect)
+{
+  AsyncTWI::handleInterrupt();
+}
+
+#else
+
+// Simulated bus, the interrupt is called from poll().
+
+static AsyncTWI::Slave* s_sim_slave_ = nullptr;  ///< Simulated slave.
+static uint8_t s_sim_status_ = 0;       ///< Simulated TWSR.
+static uint8_t s_sim_data_ = 0;         ///< Simulated TWDR.
+static bool s_sim_interrupt_ = false;   ///< Simulated pending interrupt.
+static bool s_sim_active_ = false;      ///< Set while the bus is taken by us.
+static bool s_sim_address_ = false;     ///< Set if the next byte is address.
+
+static inline uint8_t hwStatus() { return s_sim_status_; }
+static inline void hwData(uint8_t data) { s_sim_data_ = data; }
+
+static void hwCommand(uint8_t command)
+{
+  if ((command & BIT_TWSTO) && s_sim_active_) {
+    if (s_sim_slave_)
+      s_sim_slave_->stop();
+    s_sim_active_ = false;
+  }
+  if (command & BIT_TWSTA) {
+    s_sim_status_ = s_sim_active_ ? TW_STATUS_REP_START : TW_STATUS_START;
+    s_sim_active_ = true;
+    s_sim_address_ = true;
+    s_sim_interrupt_ = true;
+    return;
+  }
+  if (command != CMD_SEND) {
+    s_sim_active_ = false;  // STOP or release
+    return;
+  }
+  bool ack;
+  if (s_sim_address_) {
+    s_sim_address_ = false;
+    ack = s_sim_slave_ && s_sim_slave_->start(uint8_t(s_sim_data_ >> 1));
+    s_sim_status_ = ack ? TW_STATUS_SLA_ACK : TW_STATUS_SLA_NACK;
+  } else {
+    ack = s_sim_slave_->receive(s_sim_data_);
+    s_sim_status_ = ack ? TW_STATUS_DATA_ACK : TW_STATUS_DATA_NACK;
+  }
+  s_sim_interrupt_ = true;
+}
+
+static void hwReset()
+{
+  s_sim_active_ = false;
+  s_sim_interrupt_ = false;
+}
+
+void AsyncTWI::setSlave(Slave* slave) noexcept
+{
+  s_sim_slave_ = slave;
+}
+
+#endif
+
+AsyncTWI::Transaction AsyncTWI::s_queue_[QUEUE_SIZE];
+uint8_t AsyncTWI::s_first_ = 0;
+volatile uint8_t AsyncTWI::s_next_ = 0;
+volatile uint8_t AsyncTWI::s_end_ = 0;
+volatile bool AsyncTWI::s_busy_ = false;
+volatile uint8_t AsyncTWI::s_pos_ = 0;
+volatile uint8_t AsyncTWI::s_retries_ = 0;
+volatile unsigned long AsyncTWI::s_start_ms_ = 0;
+volatile unsigned long AsyncTWI::s_ok_count_ = 0;
+volatile unsigned long AsyncTWI::s_error_count_ = 0;
+unsigned long AsyncTWI::s_timeout_count_ = 0;
+volatile unsigned long AsyncTWI::s_retry_count_ = 0;
+
+void AsyncTWI::begin(unsigned long frequency) noexcept
+{
+#ifdef __AVR__
+  // internal pull-ups, prescaler 1
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+  TWSR = 0;
+  TWBR = uint8_t(((F_CPU / frequency) - 16) / 2);
+#else
+  (void) frequency;
+#endif
+  hwReset();
+}
+
+bool AsyncTWI::write(uint8_t address, const uint8_t* data, uint8_t length, Callback callback, void* arg) noexcept
+{
+  if (length > MAX_DATA || uint8_t(s_end_ - s_first_) >= QUEUE_SIZE)
+    return false;
+  auto& t = s_queue_[s_end_ & QUEUE_MASK];
+  t.callback = callback;
+  t.arg = arg;
+  t.address = address;
+  t.length = length;
+  memcpy(t.data, data, length);
+
+  noInterrupts();
+  s_end_ = uint8_t(s_end_ + 1);
+  if (!s_busy_) {
+    s_busy_ = true;
+    s_retries_ = 0;
+    s_start_ms_ = millis();
+    hwCommand(CMD_START);
+  }
+  interrupts();
+  return true;
+}
+
+void AsyncTWI::poll() noexcept
+{
+#ifndef __AVR__
+  while (s_sim_interrupt_) {
+    s_sim_interrupt_ = false;
+    handleInterrupt();
+  }
+#endif
+
+  noInterrupts();
+  if (s_busy_ && millis() - s_start_ms_ > TIMEOUT_MS) {
+    // slave holding the bus or TWI unit stuck, start over
+    hwReset();
+    ++s_timeout_count_;
+    finish(Status::Timeout, CMD_START);
+  }
+  interrupts();
+
+  while (s_first_ != s_next_) {
+    auto& t = s_queue_[s_first_ & QUEUE_MASK];
+    if (t.callback)
+      t.callback(t.arg, t.status, t.data, t.length);
+    ++s_first_;
+  }
+}
+
+void AsyncTWI::handleInterrupt() noexcept
+{
+  auto& t = s_queue_[s_next_ & QUEUE_MASK];
+  switch (hwStatus()) {
+    case TW_STATUS_START:
+    case TW_STATUS_REP_START:
+      s_pos_ = 0;
+      hwData(uint8_t(t.address << 1));  // SLA+W
+      hwCommand(CMD_SEND);
+      return;
+
+    case TW_STATUS_SLA_ACK:
+    case TW_STATUS_DATA_ACK:
+      if (s_pos_ < t.length) {
+        hwData(t.data[s_pos_]);
+        s_pos_ = uint8_t(s_pos_ + 1);
+        hwCommand(CMD_SEND);
+      } else {
+        finish(Status::Ok, CMD_STOP_START);
+      }
+      return;
+
+    case TW_STATUS_SLA_NACK:
+      fail(Status::AddressNack);
+      return;
+
+    case TW_STATUS_DATA_NACK:
+      // slave may refuse further data after the last byte
+      if (s_pos_ == t.length)
+        finish(Status::Ok, CMD_STOP_START);
+      else
+        fail(Status::DataNack);
+      return;
+
+    case TW_STATUS_ARB_LOST:
+      fail(Status::ArbitrationLost);
+      return;
+
+    default:
+      fail(Status::BusError);
+      return;
+  }
+}
+
+void AsyncTWI::fail(Status status) noexcept
+{
+  // after lost arbitration, we are not master and must not send STOP
+  const uint8_t command = (status == Status::ArbitrationLost) ? CMD_START : CMD_STOP_START;
+  if (s_retries_ < MAX_RETRIES) {
+    s_retries_ = uint8_t(s_retries_ + 1);
+    s_retry_count_ = s_retry_count_ + 1;
+    hwCommand(command);
+  } else {
+    finish(status, command);
+  }
+}
+
+void AsyncTWI::finish(Status status, uint8_t command) noexcept
+{
+  s_queue_[s_next_ & QUEUE_MASK].status = status;
+  if (status == Status::Ok)
+    s_ok_count_ = s_ok_count_ + 1;
+  else
+    s_error_count_ = s_error_count_ + 1;
+  s_next_ = uint8_t(s_next_ + 1);
+  next(command);
+}
+
+void AsyncTWI::next(uint8_t command) noexcept
+{
+  s_retries_ = 0;
+  if (s_next_ != s_end_) {
+    s_start_ms_ = millis();
+    hwCommand(command);
+  } else {
+    s_busy_ = false;
+    hwCommand((command & BIT_TWSTO) ? CMD_STOP : CMD_RELEASE);
+  }
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+/*!
+ * @file
+ * @brief Non-blocking interrupt-driven I2C (TWI) master with transaction queue.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*!
+ * @brief Non-blocking interrupt-driven I2C (TWI) master with transaction queue.
+ *
+ * Unlike Wire, which busy-waits for each transmission, write transactions are
+ * put into a queue and sent byte by byte from the TWI interrupt. The caller
+ * never waits for the bus, so a bus glitch can't stall the main loop.
+ *
+ * A transaction which fails (NACK, arbitration lost, bus error) is retried
+ * up to MAX_RETRIES times by a repeated START. A transaction which doesn't
+ * complete within TIMEOUT_MS (e.g., slave holding SCL low) is aborted by
+ * resetting the TWI unit. Completion callbacks are called from poll() in
+ * the main loop, never from the interrupt.
+ *
+ * There is only one TWI unit, so the class is static. It replaces Wire,
+ * which must not be linked, since both define the TWI interrupt.
+ *
+ * Builds for other platforms than AVR use a simulated bus instead of the TWI
+ * unit. Bytes are delivered to a Slave set by setSlave() on poll().
+ */
+class AsyncTWI
+{
+public:
+  /// Status of a transaction.
+  enum class Status : uint8_t
+  {
+    Ok,               ///< Transaction sent successfully.
+    AddressNack,      ///< Slave didn't acknowledge its address.
+    DataNack,         ///< Slave didn't acknowledge a data byte.
+    ArbitrationLost,  ///< Another master took over the bus.
+    BusError,         ///< Illegal START or STOP condition on the bus.
+    Timeout           ///< Transaction didn't complete in time, TWI unit was reset.
+  };
+
+  /*!
+   * @brief Completion callback.
+   *
+   * @param arg argument passed to write().
+   * @param status status of the transaction.
+   * @param data data sent in the transaction.
+   * @param length length of the data.
+   */
+  using Callback = void (*)(void* arg, Status status, const uint8_t* data, uint8_t length);
+
+  /// Count of queued transactions (power of 2).
+  static constexpr uint8_t QUEUE_SIZE = 4;
+  /// Maximum data length of a transaction.
+  static constexpr uint8_t MAX_DATA = 9;
+  /// Count of retries of a failed transaction.
+  static constexpr uint8_t MAX_RETRIES = 2;
+  /// Timeout of a transaction including retries in milliseconds.
+  static constexpr unsigned long TIMEOUT_MS = 20;
+
+  /*!
+   * @brief Start the TWI unit as master.
+   *
+   * @param frequency SCL frequency in Hz.
+   */
+  static void begin(unsigned long frequency = 100000) noexcept;
+
+  /*!
+   * @brief Queue a write transaction.
+   *
+   * @param address 7-bit slave address.
+   * @param data data to send (copied).
+   * @param length length of the data (at most MAX_DATA).
+   * @param callback callback to call on completion (optional).
+   * @param arg argument for the callback.
+   * @return @c true, if queued, @c false, if the queue is full or data too long.
+   */
+  static bool write(uint8_t address, const uint8_t* data, uint8_t length, Callback callback = nullptr, void* arg = nullptr) noexcept;
+
+  /// Call completion callbacks of finished transactions and check for timeout.
+  static void poll() noexcept;
+
+  /// Check whether there are no transactions queued or unreported.
+  static bool isIdle() noexcept { return s_first_ == s_end_; }
+
+  /// Get count of transactions completed successfully.
+  static unsigned long getOkCount() noexcept { return s_ok_count_; }
+
+  /// Get count of transactions failed after retries (including timeouts).
+  static unsigned long getErrorCount() noexcept { return s_error_count_; }
+
+  /// Get count of transactions aborted by timeout.
+  static unsigned long getTimeoutCount() noexcept { return s_timeout_count_; }
+
+  /// Get count of retries.
+  static unsigned long getRetryCount() noexcept { return s_retry_count_; }
+
+  /// Handle TWI interrupt (internal).
+  static void handleInterrupt() noexcept;
+
+#ifndef __AVR__
+  /// Simulated slave on the host.
+  class Slave
+  {
+  public:
+    /// Called on START with the slave address, return @c true to acknowledge.
+    virtual bool start(uint8_t address) = 0;
+    /// Called for each data byte, return @c true to acknowledge.
+    virtual bool receive(uint8_t data) = 0;
+    /// Called on STOP.
+    virtual void stop() {}
+    virtual ~Slave() {}
+  };
+
+  /// Set simulated slave (@c nullptr for none, all addresses are not acknowledged).
+  static void setSlave(Slave* slave) noexcept;
+#endif
+
+private:
+  /// One queued transaction.
+  struct Transaction
+  {
+    Callback callback;          ///< Completion callback.
+    void* arg;                  ///< Callback argument.
+    uint8_t address;            ///< 7-bit slave address.
+    uint8_t length;             ///< Data length.
+    Status status;              ///< Status after completion.
+    uint8_t data[MAX_DATA];     ///< Data to send.
+  };
+
+  /// Send START for the next transaction or release the bus, if none.
+  static void next(uint8_t command) noexcept;
+
+  /// Retry current transaction or finish it with error.
+  static void fail(Status status) noexcept;
+
+  /// Finish current transaction and continue with the next one.
+  static void finish(Status status, uint8_t command) noexcept;
+
+  static Transaction s_queue_[QUEUE_SIZE];     ///< Queue of transactions (ring buffer).
+  static uint8_t s_first_;                     ///< Oldest transaction not yet reported.
+  static volatile uint8_t s_next_;             ///< Transaction being sent (others up to s_end_ wait).
+  static volatile uint8_t s_end_;              ///< End of the queue.
+  static volatile bool s_busy_;                ///< Set while the TWI unit is sending.
+  static volatile uint8_t s_pos_;              ///< Position of the next data byte to send.
+  static volatile uint8_t s_retries_;          ///< Retries of the current transaction.
+  static volatile unsigned long s_start_ms_;   ///< Start time of the current transaction.
+  static volatile unsigned long s_ok_count_;       ///< Count of successful transactions.
+  static volatile unsigned long s_error_count_;    ///< Count of failed transactions.
+  static unsigned long s_timeout_count_;           ///< Count of timed out transactions.
+  static volatile unsigned long s_retry_count_;    ///< Count of retries.
+};
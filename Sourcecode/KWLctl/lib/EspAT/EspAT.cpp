@@ -0,0 +1,641 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "EspAT.h"
+
+#include <stdlib.h>
+
+/// Timeout for simple commands (1s).
+static constexpr uint16_t CMD_TIMEOUT = 1000;
+/// Timeout for joining WiFi network (20s).
+static constexpr uint16_t JOIN_TIMEOUT = 20000;
+/// Timeout for opening a link (5s).
+static constexpr uint16_t OPEN_TIMEOUT = 5000;
+/// Timeout for sending data (2s).
+static constexpr uint16_t SEND_TIMEOUT = 2000;
+/// Interval for retrying initialization of the module (1s).
+static constexpr uint16_t INIT_RETRY_INTERVAL = 1000;
+/// Interval for link status query to detect lost messages (10s).
+static constexpr uint16_t STATUS_INTERVAL = 10000;
+
+namespace
+{
+  /// Parse IPv4 address in dotted form, advance the pointer past it.
+  bool parseIP(const char*& p, uint8_t* ip)
+  {
+    for (uint8_t i = 0; i < 4; ++i) {
+      if (i > 0) {
+        if (*p != '.')
+          return false;
+        ++p;
+      }
+      char* end;
+      auto v = strtoul(p, &end, 10);
+      if (end == p || v > 255)
+        return false;
+      ip[i] = uint8_t(v);
+      p = end;
+    }
+    return true;
+  }
+}
+
+EspAT::EspAT() noexcept {}
+
+void EspAT::begin(Stream& uart) noexcept
+{
+  uart_ = &uart;
+  restart();
+  op_start_ = millis() - INIT_RETRY_INTERVAL;
+}
+
+void EspAT::loop() noexcept
+{
+  if (!uart_)
+    return;
+  receive();
+  if (op_ != Op::None && millis() - op_start_ >= op_timeout_) {
+    ++timeout_count_;
+    if (op_ == Op::Status) {
+      // module doesn't respond to a simple query, initialize it again
+      restart();
+    } else {
+      complete(false);
+    }
+  }
+  if (op_ == Op::None)
+    startNext();
+}
+
+bool EspAT::join(const char* ssid, const char* password) noexcept
+{
+  if (!uart_ || !isReady() || op_ != Op::None)
+    return false;
+  uart_->print(F("AT+CWJAP_CUR="));
+  printQuoted(ssid);
+  uart_->print(',');
+  printQuoted(password);
+  uart_->print(F("\r\n"));
+  startOp(Op::Join, 0, JOIN_TIMEOUT);
+  return true;
+}
+
+int8_t EspAT::allocLink() noexcept
+{
+  for (uint8_t i = 0; i < MAX_LINKS; ++i) {
+    auto& l = links_[i];
+    if (!l.used && !l.incoming && l.state == LinkState::Closed && !l.close_pending) {
+      l.used = true;
+      l.server = false;
+      l.open_pending = false;
+      l.new_packet = false;
+      l.rx.clear();
+      return int8_t(i);
+    }
+  }
+  return -1;
+}
+
+void EspAT::freeLink(uint8_t link) noexcept
+{
+  close(link);
+  links_[link].used = false;
+  links_[link].rx.clear();
+}
+
+void EspAT::listen(uint16_t port) noexcept
+{
+  server_port_ = port;
+  server_pending_ = true;
+}
+
+int8_t EspAT::accept() noexcept
+{
+  for (uint8_t i = 0; i < MAX_LINKS; ++i) {
+    auto& l = links_[i];
+    if (l.incoming && !l.used) {
+      l.incoming = false;
+      l.used = true;
+      return int8_t(i);
+    }
+  }
+  return -1;
+}
+
+void EspAT::open(uint8_t link, const IPAddress& ip, uint16_t port, uint16_t local_port) noexcept
+{
+  auto& l = links_[link];
+  for (uint8_t i = 0; i < 4; ++i)
+    l.ip[i] = ip[i];
+  l.port = port;
+  l.local_port = local_port;
+  l.state = LinkState::Opening;
+  l.open_pending = true;
+  l.new_packet = false;
+  l.rx.clear();
+}
+
+void EspAT::close(uint8_t link) noexcept
+{
+  auto& l = links_[link];
+  if (l.open_pending) {
+    // not sent yet, nothing to close
+    l.open_pending = false;
+    l.state = LinkState::Closed;
+  } else if (l.state == LinkState::Open || l.state == LinkState::Opening) {
+    // buffered data is sent before closing
+    l.close_pending = true;
+  }
+}
+
+void EspAT::setDestination(uint8_t link, const IPAddress& ip, uint16_t port) noexcept
+{
+  auto& l = links_[link];
+  for (uint8_t i = 0; i < 4; ++i)
+    l.ip[i] = ip[i];
+  l.port = port;
+}
+
+size_t EspAT::writeSpace(uint8_t link) const noexcept
+{
+  auto state = links_[link].state;
+  if (state != LinkState::Open && state != LinkState::Opening)
+    return 0;
+  if (tx_len_ && tx_link_ != link)
+    return 0; // buffer in use by another link
+  return TX_SIZE - tx_len_;
+}
+
+size_t EspAT::write(uint8_t link, const uint8_t* data, size_t size) noexcept
+{
+  auto count = writeSpace(link);
+  if (size <= TX_SIZE && size > count)
+    return 0; // don't split short packets, wait until it fits as a whole
+  if (count > size)
+    count = size;
+  // data may be appended while a send is in flight, only tx_send_len_ bytes are sent by it
+  memcpy(tx_ + tx_len_, data, count);
+  tx_len_ = uint16_t(tx_len_ + count);
+  tx_link_ = link;
+  return count;
+}
+
+bool EspAT::flush(uint8_t link) const noexcept
+{
+  return tx_link_ != link || !tx_failed_;
+}
+
+int EspAT::available(uint8_t link) noexcept
+{
+  loop();
+  return links_[link].rx.size();
+}
+
+int EspAT::read(uint8_t link) noexcept
+{
+  auto& rx = links_[link].rx;
+  if (rx.empty())
+    loop();
+  if (rx.empty())
+    return -1;
+  return rx.pop();
+}
+
+int EspAT::peek(uint8_t link) noexcept
+{
+  auto& rx = links_[link].rx;
+  if (rx.empty())
+    loop();
+  if (rx.empty())
+    return -1;
+  return rx.peek();
+}
+
+int EspAT::takePacket(uint8_t link) noexcept
+{
+  loop();
+  auto& l = links_[link];
+  if (!l.new_packet)
+    return 0;
+  l.new_packet = false;
+  return l.rx.size();
+}
+
+void EspAT::receive() noexcept
+{
+  while (uart_->available() > 0) {
+    if (rx_state_ == RxState::Data) {
+      // always drain data from the UART, the module doesn't wait for us and
+      // responses following the data would be lost if the UART buffer overflows
+      auto c = uint8_t(uart_->read());
+      bool valid = rx_link_ < MAX_LINKS && (links_[rx_link_].used || links_[rx_link_].incoming);
+      if (!valid) {
+        ++overflow_count_;
+        rx_dropped_ = true;
+      } else if (!links_[rx_link_].rx.push(c)) {
+        ++overflow_count_;
+        auto& l = links_[rx_link_];
+        if (l.server) {
+          // server requests are parsed up to their end only, keep the newest bytes
+          l.rx.pop();
+          l.rx.push(c);
+        } else {
+          rx_dropped_ = true;
+        }
+      }
+      if (--rx_left_ == 0) {
+        rx_state_ = RxState::Line;
+        if (valid) {
+          auto& l = links_[rx_link_];
+          if (l.local_port) {
+            // datagram received, truncated datagrams are discarded
+            if (rx_dropped_)
+              l.rx.clear();
+            else
+              l.new_packet = true;
+          } else if (rx_dropped_ && l.state == LinkState::Open) {
+            // the stream has a gap, the reader can't continue
+            ++overflow_close_count_;
+            close(rx_link_);
+          }
+        }
+      }
+      continue;
+    }
+
+    auto c = char(uart_->read());
+    if (c == '\n') {
+      if (line_len_ && line_[line_len_ - 1] == '\r')
+        --line_len_;
+      line_[line_len_] = 0;
+      handleLine();
+      line_len_ = 0;
+    } else if (line_len_ == 0 && c == '>' && op_ == Op::SendPrompt) {
+      // module is ready to receive data
+      uart_->write(tx_, tx_send_len_);
+      op_ = Op::SendData;
+      op_start_ = millis();
+    } else if (line_len_ == 0 && (c == ' ' || c == '\r')) {
+      // ignore leading whitespace (e.g., after prompt)
+    } else if (c == ':' && line_len_ >= 5 && lineStartsWith(F("+IPD,"))) {
+      line_[line_len_] = 0;
+      handleData();
+      line_len_ = 0;
+    } else if (line_len_ < sizeof(line_) - 1) {
+      line_[line_len_++] = c;
+    }
+  }
+}
+
+void EspAT::handleData() noexcept
+{
+  // format: +IPD,<link>,<length>[,<remote IP>,<remote port>]:
+  const char* p = line_ + 5;
+  char* end;
+  auto link = strtoul(p, &end, 10);
+  if (*end != ',')
+    return;
+  p = end + 1;
+  auto len = strtoul(p, &end, 10);
+  p = end;
+  if (!len)
+    return;
+  rx_state_ = RxState::Data;
+  rx_left_ = uint16_t(len);
+  rx_dropped_ = false;
+  rx_link_ = uint8_t(link < MAX_LINKS ? link : MAX_LINKS);
+  if (rx_link_ == MAX_LINKS)
+    return;
+  auto& l = links_[rx_link_];
+  if (l.local_port) {
+    // UDP link, keep only the newest datagram
+    l.rx.clear();
+    l.new_packet = false;
+  }
+  if (*p == ',') {
+    ++p;
+    if (parseIP(p, l.remote_ip) && *p == ',')
+      l.remote_port = uint16_t(strtoul(p + 1, nullptr, 10));
+  }
+}
+
+void EspAT::handleLine() noexcept
+{
+  if (!line_len_)
+    return;
+  if (lineEquals(F("OK"))) {
+    // send requests are completed by prompt and SEND OK
+    if (op_ != Op::None && op_ != Op::SendPrompt && op_ != Op::SendData)
+      complete(true);
+  } else if (lineEquals(F("ERROR")) || lineEquals(F("FAIL")) || lineEquals(F("SEND FAIL"))) {
+    if (op_ != Op::None)
+      complete(false);
+  } else if (lineEquals(F("SEND OK"))) {
+    if (op_ == Op::SendData)
+      complete(true);
+  } else if (lineEquals(F("WIFI GOT IP"))) {
+    link_up_ = true;
+    local_ip_pending_ = true;
+  } else if (lineEquals(F("WIFI DISCONNECT"))) {
+    linkDown();
+  } else if (lineEquals(F("ready"))) {
+    // module restarted
+    restart();
+    server_pending_ = server_port_ != 0;
+  } else if (lineEquals(F("ALREADY CONNECTED"))) {
+    if (op_ == Op::Open)
+      links_[op_link_].state = LinkState::Open;
+  } else if (lineStartsWith(F("STATUS:"))) {
+    // 2 = got IP, 3 = connected, 4 = disconnected, 5 = not connected to WiFi
+    auto status = line_[7];
+    if (status >= '2' && status <= '4') {
+      if (!link_up_)
+        local_ip_pending_ = true;
+      link_up_ = true;
+    } else if (status == '5') {
+      linkDown();
+    }
+  } else if (lineStartsWith(F("+CIPSTATUS:"))) {
+    auto link = uint8_t(line_[11] - '0');
+    if (link < MAX_LINKS)
+      status_links_ |= uint8_t(1 << link);
+  } else if (lineStartsWith(F("+CIFSR:STAIP,\""))) {
+    const char* p = line_ + 14;
+    uint8_t ip[4];
+    if (parseIP(p, ip))
+      memcpy(local_ip_, ip, sizeof(local_ip_));
+  } else if (line_[0] >= '0' && line_[0] < char('0' + MAX_LINKS) && line_[1] == ',') {
+    // link state change
+    auto link = uint8_t(line_[0] - '0');
+    const char* msg = line_ + 2;
+    if (strcmp_P(msg, PSTR("CONNECT")) == 0) {
+      auto& l = links_[link];
+      if (!l.used && l.state == LinkState::Closed && server_port_) {
+        // incoming connection, to be accepted
+        l.incoming = true;
+        l.server = true;
+        l.new_packet = false;
+        l.rx.clear();
+      }
+      l.state = LinkState::Open;
+    } else if (strcmp_P(msg, PSTR("CLOSED")) == 0 || strcmp_P(msg, PSTR("CONNECT FAIL")) == 0) {
+      linkClosed(link);
+    }
+  }
+  // other messages (e.g., "WIFI CONNECTED", "busy p...", echo) are ignored
+}
+
+void EspAT::startNext() noexcept
+{
+  auto now = millis();
+  if (!isReady()) {
+    if (init_step_ == 0 && now - op_start_ < INIT_RETRY_INTERVAL)
+      return;
+    switch (init_step_) {
+      case 0: uart_->print(F("AT\r\n")); break;
+      case 1: uart_->print(F("ATE0\r\n")); break;
+      case 2: uart_->print(F("AT+CWMODE_CUR=1\r\n")); break;
+      case 3: uart_->print(F("AT+CIPMUX=1\r\n")); break;
+      case 4: uart_->print(F("AT+CIPDINFO=1\r\n")); break;
+      default: uart_->print(F("AT+CIPSTATUS\r\n")); break;
+    }
+    startOp(Op::Init, 0, CMD_TIMEOUT);
+    return;
+  }
+
+  for (uint8_t i = 0; i < MAX_LINKS; ++i) {
+    auto& l = links_[i];
+    if (l.close_pending && !(tx_len_ && tx_link_ == i)) {
+      l.close_pending = false;
+      if (!l.open_pending)
+        l.state = LinkState::Closing;
+      uart_->print(F("AT+CIPCLOSE="));
+      uart_->print(i);
+      uart_->print(F("\r\n"));
+      startOp(Op::Close, i, CMD_TIMEOUT);
+      return;
+    }
+  }
+
+  for (uint8_t i = 0; i < MAX_LINKS; ++i) {
+    auto& l = links_[i];
+    if (l.open_pending) {
+      l.open_pending = false;
+      if (!link_up_) {
+        l.state = LinkState::Closed;
+        continue;
+      }
+      uart_->print(F("AT+CIPSTART="));
+      uart_->print(i);
+      uart_->print(l.local_port ? F(",\"UDP\",") : F(",\"TCP\","));
+      printIP(l.ip);
+      uart_->print(',');
+      uart_->print(l.port);
+      if (l.local_port) {
+        uart_->print(',');
+        uart_->print(l.local_port);
+        uart_->print(F(",2"));
+      }
+      uart_->print(F("\r\n"));
+      startOp(Op::Open, i, OPEN_TIMEOUT);
+      return;
+    }
+  }
+
+  if (tx_len_) {
+    auto& l = links_[tx_link_];
+    if (l.state == LinkState::Open) {
+      tx_failed_ = false;
+      tx_send_len_ = tx_len_;
+      uart_->print(F("AT+CIPSEND="));
+      uart_->print(tx_link_);
+      uart_->print(',');
+      uart_->print(tx_send_len_);
+      if (l.local_port) {
+        // UDP, send explicitly to the remote address
+        uart_->print(',');
+        printIP(l.ip);
+        uart_->print(',');
+        uart_->print(l.port);
+      }
+      uart_->print(F("\r\n"));
+      startOp(Op::SendPrompt, tx_link_, SEND_TIMEOUT);
+      return;
+    } else if (l.state != LinkState::Opening) {
+      // link closed, drop data
+      tx_len_ = 0;
+      tx_failed_ = true;
+    }
+  }
+
+  if (server_pending_) {
+    server_pending_ = false;
+    uart_->print(F("AT+CIPSERVER=1,"));
+    uart_->print(server_port_);
+    uart_->print(F("\r\n"));
+    startOp(Op::Server, 0, CMD_TIMEOUT);
+    return;
+  }
+
+  if (local_ip_pending_ && link_up_) {
+    local_ip_pending_ = false;
+    uart_->print(F("AT+CIFSR\r\n"));
+    startOp(Op::LocalIP, 0, CMD_TIMEOUT);
+    return;
+  }
+
+  if (now - last_status_ >= STATUS_INTERVAL) {
+    // check link state periodically, in case a message from the module was lost
+    last_status_ = now;
+    status_links_ = 0;
+    uart_->print(F("AT+CIPSTATUS\r\n"));
+    startOp(Op::Status, 0, CMD_TIMEOUT);
+  }
+}
+
+void EspAT::startOp(Op op, uint8_t link, uint16_t timeout) noexcept
+{
+  op_ = op;
+  op_link_ = link;
+  op_timeout_ = timeout;
+  op_start_ = millis();
+  ++command_count_;
+}
+
+void EspAT::complete(bool ok) noexcept
+{
+  auto op = op_;
+  op_ = Op::None;
+  switch (op) {
+    case Op::Init:
+      if (ok)
+        ++init_step_;
+      else
+        init_step_ = 0; // start over
+      break;
+    case Op::Status:
+      if (ok) {
+        // links not reported as open by the module were closed
+        for (uint8_t i = 0; i < MAX_LINKS; ++i)
+          if (links_[i].state == LinkState::Open && !(status_links_ & (1 << i)))
+            linkClosed(i);
+      }
+      break;
+    case Op::Join:
+      if (ok) {
+        link_up_ = true;
+        local_ip_pending_ = true;
+      }
+      break;
+    case Op::Open:
+      if (ok)
+        links_[op_link_].state = LinkState::Open;
+      else if (links_[op_link_].state == LinkState::Opening)
+        links_[op_link_].state = LinkState::Closed;
+      break;
+    case Op::Close:
+      linkClosed(op_link_);
+      break;
+    case Op::SendPrompt:
+    case Op::SendData:
+      if (ok) {
+        // keep data appended during the send for the next one
+        tx_len_ = uint16_t(tx_len_ - tx_send_len_);
+        memmove(tx_, tx_ + tx_send_len_, tx_len_);
+      } else {
+        tx_failed_ = true;
+        tx_len_ = 0;
+        // the stream has a gap, the peer can't continue
+        if (!links_[tx_link_].local_port)
+          close(tx_link_);
+      }
+      tx_send_len_ = 0;
+      break;
+    default:
+      break;
+  }
+}
+
+void EspAT::linkClosed(uint8_t link) noexcept
+{
+  links_[link].incoming = false;
+  // if reopening was already requested, the message refers to the old connection
+  links_[link].state = links_[link].open_pending ? LinkState::Opening : LinkState::Closed;
+  if (tx_len_ && tx_link_ == link && op_ != Op::SendPrompt && op_ != Op::SendData) {
+    tx_len_ = 0;
+    tx_failed_ = true;
+  }
+}
+
+void EspAT::restart() noexcept
+{
+  op_ = Op::None;
+  init_step_ = 0;
+  // framing of received data is lost, start with a new line
+  rx_state_ = RxState::Line;
+  rx_left_ = 0;
+  line_len_ = 0;
+  tx_send_len_ = 0;
+  linkDown();
+}
+
+void EspAT::linkDown() noexcept
+{
+  link_up_ = false;
+  for (uint8_t i = 0; i < MAX_LINKS; ++i) {
+    auto& l = links_[i];
+    l.open_pending = false;
+    l.close_pending = false;
+    linkClosed(i);
+  }
+}
+
+void EspAT::printIP(const uint8_t* ip) noexcept
+{
+  uart_->print('"');
+  for (uint8_t i = 0; i < 4; ++i) {
+    if (i)
+      uart_->print('.');
+    uart_->print(ip[i]);
+  }
+  uart_->print('"');
+}
+
+void EspAT::printQuoted(const char* s) noexcept
+{
+  uart_->print('"');
+  for (; *s; ++s) {
+    if (*s == '"' || *s == ',' || *s == '\\')
+      uart_->print('\\');
+    uart_->print(*s);
+  }
+  uart_->print('"');
+}
+
+bool EspAT::lineStartsWith(const __FlashStringHelper* prefix) const noexcept
+{
+  auto p = reinterpret_cast<const char*>(prefix);
+  return strncmp_P(line_, p, strlen_P(p)) == 0;
+}
+
+bool EspAT::lineEquals(const __FlashStringHelper* s) const noexcept
+{
+  return strcmp_P(line_, reinterpret_cast<const char*>(s)) == 0;
+}
@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Lean non-blocking driver for ESP8266 modules with AT firmware.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+/*!
+ * @brief Ring buffer for bytes.
+ *
+ * It can be written by an interrupt service routine and read by the main
+ * program (single producer, single consumer) without locking.
+ *
+ * @tparam Size size of the buffer, must be a power of 2 and at most 256.
+ */
+template<uint16_t Size>
+class EspRingBuffer
+{
+  static_assert(Size <= 256 && (Size & (Size - 1)) == 0, "Size must be a power of 2 and at most 256");
+public:
+  /// Check if the buffer is empty.
+  bool empty() const noexcept { return head_ == tail_; }
+
+  /// Get count of bytes in the buffer.
+  uint8_t size() const noexcept { return uint8_t((head_ - tail_) & (Size - 1)); }
+
+  /// Check if the buffer is full.
+  bool full() const noexcept { return size() == Size - 1; }
+
+  /// Add a byte, return false if the buffer is full.
+  bool push(uint8_t c) noexcept {
+    uint8_t next = uint8_t((head_ + 1) & (Size - 1));
+    if (next == tail_)
+      return false;
+    data_[head_] = c;
+    head_ = next;
+    return true;
+  }
+
+  /// Get the next byte without removing it (buffer must not be empty).
+  uint8_t peek() const noexcept { return data_[tail_]; }
+
+  /// Remove and return the next byte (buffer must not be empty).
+  uint8_t pop() noexcept {
+    uint8_t c = data_[tail_];
+    tail_ = uint8_t((tail_ + 1) & (Size - 1));
+    return c;
+  }
+
+  /// Remove all bytes.
+  void clear() noexcept { tail_ = head_; }
+
+private:
+  volatile uint8_t head_ = 0;   ///< Write position.
+  volatile uint8_t tail_ = 0;   ///< Read position.
+  uint8_t data_[Size];          ///< Buffered data.
+};
+
+/*!
+ * @brief Lean non-blocking driver for ESP8266 modules with AT firmware.
+ *
+ * The driver talks to the module via a Stream (typically EspUart, which
+ * receives via interrupt into a ring buffer). Responses are parsed
+ * incrementally byte by byte, so no call waits for a response, except
+ * of the explicit bounded wait in waitUntil(). Writes never wait either,
+ * they only accept as much data as fits into the send buffer.
+ *
+ * At most one command is in flight. Requests (opening/closing links, sending
+ * data) are recorded and issued by loop() as soon as the module is idle.
+ * Link state (WiFi connection and state of each link) is cached and updated
+ * from unsolicited messages of the module, so querying it is free.
+ *
+ * Use EspClient and EspUDP to communicate via the driver through standard
+ * Client and UDP interfaces.
+ */
+class EspAT
+{
+public:
+  /// Maximum count of links (connections) used concurrently, including one incoming connection.
+  static constexpr uint8_t MAX_LINKS = 4;
+  /**
+   * @brief Size of receive buffer per link.
+   *
+   * If the buffer of a client link overflows, the link is closed, since the
+   * received stream has a gap. Links accepted by the server keep the newest
+   * bytes instead, since a request larger than the buffer may arrive before
+   * the server polls it and only its end is relevant.
+   */
+  static constexpr uint16_t LINK_RX_SIZE = 64;
+  /// Size of send buffer (shared by all links).
+  static constexpr uint16_t TX_SIZE = 256;
+
+  /// State of a link.
+  enum class LinkState : uint8_t
+  {
+    Closed,   ///< Link is closed.
+    Opening,  ///< Link is being opened.
+    Open,     ///< Link is open.
+    Closing   ///< Link is being closed.
+  };
+
+  EspAT(const EspAT&) = delete;
+  EspAT& operator=(const EspAT&) = delete;
+
+  EspAT() noexcept;
+
+  /*!
+   * @brief Start communication with the module.
+   *
+   * The module is initialized asynchronously by loop().
+   *
+   * @param uart stream connected to the module.
+   */
+  void begin(Stream& uart) noexcept;
+
+  /// Process received data, timeouts and pending requests. Call regularly.
+  void loop() noexcept;
+
+  /// Check whether the module is initialized and responding.
+  bool isReady() const noexcept { return init_step_ == INIT_DONE; }
+
+  /// Check whether the module is connected to WiFi network and has an IP address (cached).
+  bool isLinkUp() const noexcept { return link_up_; }
+
+  /// Get local IP address, as reported by the module.
+  IPAddress localIP() const noexcept { return IPAddress(local_ip_); }
+
+  /*!
+   * @brief Start joining WiFi network.
+   *
+   * @param ssid network name.
+   * @param password network password.
+   * @return @c true, if the join request was sent, @c false if the module is
+   *    not ready or busy (try again later).
+   */
+  bool join(const char* ssid, const char* password) noexcept;
+
+  /// Check whether joining WiFi network is in progress.
+  bool isJoining() const noexcept { return op_ == Op::Join; }
+
+  /*!
+   * @brief Allocate a link.
+   *
+   * @return link ID or -1, if no free link available.
+   */
+  int8_t allocLink() noexcept;
+
+  /// Close and free a link.
+  void freeLink(uint8_t link) noexcept;
+
+  /*!
+   * @brief Start listening for incoming TCP connections.
+   *
+   * The server is started asynchronously as soon as the module is idle (and
+   * again after module restart). Use accept() to get incoming connections.
+   *
+   * @param port local port.
+   */
+  void listen(uint16_t port) noexcept;
+
+  /*!
+   * @brief Accept an incoming connection.
+   *
+   * @return link ID of the connection, which is allocated to the caller, or
+   *    -1, if no new incoming connection.
+   */
+  int8_t accept() noexcept;
+
+  /*!
+   * @brief Request opening a TCP or UDP link.
+   *
+   * @param link link ID.
+   * @param ip remote IP address.
+   * @param port remote port.
+   * @param local_port local port for UDP link or 0 for TCP link.
+   */
+  void open(uint8_t link, const IPAddress& ip, uint16_t port, uint16_t local_port = 0) noexcept;
+
+  /// Request closing a link.
+  void close(uint8_t link) noexcept;
+
+  /*!
+   * @brief Set destination for data sent on an open UDP link.
+   *
+   * @param link link ID.
+   * @param ip remote IP address.
+   * @param port remote port.
+   */
+  void setDestination(uint8_t link, const IPAddress& ip, uint16_t port) noexcept;
+
+  /// Get state of a link (cached).
+  LinkState getLinkState(uint8_t link) const noexcept { return links_[link].state; }
+
+  /*!
+   * @brief Get count of bytes which can be written to the link now.
+   *
+   * @param link link ID.
+   * @return free space in the send buffer or 0, if the buffer is in use by
+   *    another link or the link is not open.
+   */
+  size_t writeSpace(uint8_t link) const noexcept;
+
+  /*!
+   * @brief Write data to the link without waiting.
+   *
+   * Data is buffered and sent by loop() as soon as the module is idle, so
+   * multiple small writes are sent in one packet. Data not larger than the
+   * send buffer is accepted either as a whole or not at all, so short
+   * packets are never split. Larger data is accepted partially. The caller
+   * retries the rest after loop() sent the buffer.
+   *
+   * @param link link ID.
+   * @param data data to write.
+   * @param size size of the data.
+   * @return count of bytes accepted.
+   */
+  size_t write(uint8_t link, const uint8_t* data, size_t size) noexcept;
+
+  /*!
+   * @brief Check whether buffered data of the link was sent successfully (doesn't wait).
+   *
+   * @param link link ID.
+   * @return @c false, if the last send on the link failed, @c true if it
+   *    succeeded or is still pending.
+   */
+  bool flush(uint8_t link) const noexcept;
+
+  /// Get count of received bytes available for reading on the link.
+  int available(uint8_t link) noexcept;
+
+  /// Read one received byte from the link or return -1, if none available.
+  int read(uint8_t link) noexcept;
+
+  /// Peek at the next received byte on the link or return -1, if none available.
+  int peek(uint8_t link) noexcept;
+
+  /*!
+   * @brief Check for a new datagram received on an UDP link.
+   *
+   * @param link link ID.
+   * @return size of the new datagram or 0, if no new datagram.
+   */
+  int takePacket(uint8_t link) noexcept;
+
+  /// Get remote IP address of last data received on the link.
+  IPAddress remoteIP(uint8_t link) const noexcept { return IPAddress(links_[link].remote_ip); }
+
+  /// Get remote port of last data received on the link.
+  uint16_t remotePort(uint8_t link) const noexcept { return links_[link].remote_port; }
+
+  /*!
+   * @brief Run loop() until the condition is met or timeout expires.
+   *
+   * @param cond condition to check.
+   * @param timeout timeout in milliseconds.
+   * @return @c true, if the condition is met, @c false on timeout.
+   */
+  template<typename Cond>
+  bool waitUntil(Cond&& cond, unsigned long timeout) noexcept
+  {
+    auto start = millis();
+    while (!cond()) {
+      if (millis() - start >= timeout)
+        return false;
+      loop();
+    }
+    return true;
+  }
+
+  /// Get count of commands sent to the module.
+  unsigned long getCommandCount() const noexcept { return command_count_; }
+
+  /// Get count of commands which timed out.
+  unsigned long getTimeoutCount() const noexcept { return timeout_count_; }
+
+  /// Get count of received bytes dropped due to full receive buffer.
+  unsigned long getOverflowCount() const noexcept { return overflow_count_; }
+
+  /// Get count of client links closed due to dropped received bytes.
+  unsigned long getOverflowCloseCount() const noexcept { return overflow_close_count_; }
+
+private:
+  /// Command in flight.
+  enum class Op : uint8_t
+  {
+    None,       ///< No command in flight.
+    Init,       ///< Initialization command.
+    Status,     ///< Link status query.
+    LocalIP,    ///< Local IP address query.
+    Server,     ///< Starting server.
+    Join,       ///< Joining WiFi network.
+    Open,       ///< Opening a link.
+    Close,      ///< Closing a link.
+    SendPrompt, ///< Send request, waiting for prompt.
+    SendData    ///< Data sent, waiting for confirmation.
+  };
+
+  /// Receive parser state.
+  enum class RxState : uint8_t
+  {
+    Line,       ///< Receiving a response line.
+    Data        ///< Receiving data of a link.
+  };
+
+  /// State of one link.
+  struct Link
+  {
+    LinkState state = LinkState::Closed;  ///< Current state.
+    bool used = false;                    ///< Set, if allocated.
+    bool open_pending = false;            ///< Set, if open request is to be sent.
+    bool close_pending = false;           ///< Set, if close request is to be sent.
+    bool new_packet = false;              ///< Set, if a new datagram was received.
+    bool incoming = false;                ///< Set, if opened by remote side and not accepted yet.
+    bool server = false;                  ///< Set, if opened by remote side (keeps newest bytes on overflow).
+    uint8_t ip[4] = {0, 0, 0, 0};         ///< Remote IP address to connect to.
+    uint16_t port = 0;                    ///< Remote port to connect to.
+    uint16_t local_port = 0;              ///< Local port for UDP links (0 for TCP).
+    uint8_t remote_ip[4] = {0, 0, 0, 0};  ///< Remote IP address of last received data.
+    uint16_t remote_port = 0;             ///< Remote port of last received data.
+    EspRingBuffer<LINK_RX_SIZE> rx;       ///< Received data.
+  };
+
+  /// Initialization step after which the module is ready.
+  static constexpr uint8_t INIT_DONE = 6;
+
+  /// Parse received bytes.
+  void receive() noexcept;
+
+  /// Handle one complete response line.
+  void handleLine() noexcept;
+
+  /// Handle start of data of a link (line buffer contains "+IPD,...").
+  void handleData() noexcept;
+
+  /// Start a new command, if idle and some request is pending.
+  void startNext() noexcept;
+
+  /// Mark the command as sent.
+  void startOp(Op op, uint8_t link, uint16_t timeout) noexcept;
+
+  /// Complete command in flight.
+  void complete(bool ok) noexcept;
+
+  /// Mark a link as closed.
+  void linkClosed(uint8_t link) noexcept;
+
+  /// Handle loss of WiFi connection.
+  void linkDown() noexcept;
+
+  /// Initialize the module again after restart or if it doesn't respond.
+  void restart() noexcept;
+
+  /// Print IP address to the module in quotes.
+  void printIP(const uint8_t* ip) noexcept;
+
+  /// Print a string parameter to the module in quotes, escaping special characters.
+  void printQuoted(const char* s) noexcept;
+
+  /// Check if the line buffer starts with given Flash string.
+  bool lineStartsWith(const __FlashStringHelper* prefix) const noexcept;
+
+  /// Check if the line buffer is equal to given Flash string.
+  bool lineEquals(const __FlashStringHelper* s) const noexcept;
+
+  Stream* uart_ = nullptr;            ///< Stream connected to the module.
+  Link links_[MAX_LINKS];             ///< Links.
+  uint8_t tx_[TX_SIZE];               ///< Buffered data to send.
+  uint16_t tx_len_ = 0;               ///< Size of buffered data to send.
+  uint16_t tx_send_len_ = 0;          ///< Size of data being sent by the command in flight.
+  uint8_t tx_link_ = 0;               ///< Link to which buffered data belongs.
+  bool tx_failed_ = false;            ///< Set, if last send failed.
+  char line_[64];                     ///< Current response line.
+  uint8_t line_len_ = 0;              ///< Length of current response line.
+  RxState rx_state_ = RxState::Line;  ///< Receive parser state.
+  uint8_t rx_link_ = 0;               ///< Link receiving data.
+  uint16_t rx_left_ = 0;              ///< Remaining data bytes to receive.
+  bool rx_dropped_ = false;           ///< Set, if bytes of the current data block were dropped.
+  Op op_ = Op::None;                  ///< Command in flight.
+  uint8_t op_link_ = 0;               ///< Link of the command in flight.
+  uint16_t op_timeout_ = 0;           ///< Timeout of the command in flight in milliseconds.
+  unsigned long op_start_ = 0;        ///< Time when the command was sent (millis).
+  unsigned long last_status_ = 0;     ///< Time of last link status query (millis).
+  uint8_t init_step_ = 0;             ///< Current initialization step.
+  uint8_t status_links_ = 0;          ///< Bitmask of open links reported by status query.
+  bool link_up_ = false;              ///< Set, if connected to WiFi network.
+  bool local_ip_pending_ = false;     ///< Set, if local IP address is to be queried.
+  bool server_pending_ = false;       ///< Set, if server is to be started.
+  uint16_t server_port_ = 0;          ///< Port to listen on or 0, if not listening.
+  uint8_t local_ip_[4] = {0, 0, 0, 0};  ///< Local IP address.
+  unsigned long command_count_ = 0;   ///< Count of commands sent.
+  unsigned long timeout_count_ = 0;   ///< Count of commands timed out.
+  unsigned long overflow_count_ = 0;  ///< Count of received bytes dropped.
+  unsigned long overflow_close_count_ = 0;  ///< Count of links closed due to dropped bytes.
+};
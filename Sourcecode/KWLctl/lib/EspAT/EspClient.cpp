@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "EspClient.h"
+
+/// Maximum time to wait for opening connection in connect(), well below watchdog timeout.
+static constexpr unsigned long CONNECT_WAIT = 1000;
+
+bool EspClient::connectAsync(const IPAddress& ip, uint16_t port) noexcept
+{
+  stop();
+  link_ = esp_.allocLink();
+  if (link_ < 0)
+    return false;
+  esp_.open(uint8_t(link_), ip, port);
+  return true;
+}
+
+bool EspClient::isConnecting() const noexcept
+{
+  return link_ >= 0 && esp_.getLinkState(uint8_t(link_)) == EspAT::LinkState::Opening;
+}
+
+int EspClient::connect(IPAddress ip, uint16_t port)
+{
+  if (!connectAsync(ip, port))
+    return 0;
+  esp_.waitUntil([this]() { return !isConnecting(); }, CONNECT_WAIT);
+  if (esp_.getLinkState(uint8_t(link_)) != EspAT::LinkState::Open) {
+    // failed or still opening, give up
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+int EspClient::connect(const char*, uint16_t)
+{
+  return 0;
+}
+
+size_t EspClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t EspClient::write(const uint8_t* buf, size_t size)
+{
+  if (link_ < 0)
+    return 0;
+  return esp_.write(uint8_t(link_), buf, size);
+}
+
+int EspClient::availableForWrite()
+{
+  if (link_ < 0)
+    return 0;
+  return int(esp_.writeSpace(uint8_t(link_)));
+}
+
+int EspClient::available()
+{
+  if (link_ < 0)
+    return 0;
+  return esp_.available(uint8_t(link_));
+}
+
+int EspClient::read()
+{
+  if (link_ < 0)
+    return -1;
+  return esp_.read(uint8_t(link_));
+}
+
+int EspClient::read(uint8_t* buf, size_t size)
+{
+  if (link_ < 0)
+    return -1;
+  size_t count = 0;
+  while (count < size) {
+    auto c = esp_.read(uint8_t(link_));
+    if (c < 0)
+      break;
+    buf[count++] = uint8_t(c);
+  }
+  return count ? int(count) : -1;
+}
+
+int EspClient::peek()
+{
+  if (link_ < 0)
+    return -1;
+  return esp_.peek(uint8_t(link_));
+}
+
+void EspClient::flush()
+{
+  // buffered data is sent by the driver as soon as possible, also before closing
+  if (link_ >= 0)
+    esp_.loop();
+}
+
+void EspClient::stop()
+{
+  if (link_ >= 0) {
+    esp_.freeLink(uint8_t(link_));
+    link_ = -1;
+  }
+}
+
+uint8_t EspClient::connected()
+{
+  if (link_ < 0)
+    return 0;
+  // received data can still be read after the remote side closed the connection
+  return esp_.getLinkState(uint8_t(link_)) == EspAT::LinkState::Open || esp_.available(uint8_t(link_)) > 0;
+}
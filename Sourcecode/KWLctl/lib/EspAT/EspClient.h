@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief TCP client over ESP8266 AT driver.
+ */
+#pragma once
+
+#include "EspAT.h"
+
+#include <Client.h>
+
+/*!
+ * @brief TCP client over ESP8266 AT driver.
+ *
+ * Connection state is cached by the driver, so connected() is cheap and can
+ * be called in each loop (as PubSubClient does). Written data is buffered
+ * and sent asynchronously by the driver. Writes don't wait, if the send
+ * buffer is full, they return a short count (see EspAT::write()).
+ */
+class EspClient : public Client
+{
+public:
+  EspClient(const EspClient&) = delete;
+  EspClient& operator=(const EspClient&) = delete;
+
+  /// Construct client using given driver.
+  explicit EspClient(EspAT& esp) noexcept : esp_(esp) {}
+
+  virtual ~EspClient() { stop(); }
+
+  /*!
+   * @brief Start opening connection without waiting for the result.
+   *
+   * Use isConnecting() to find out when the connection attempt is finished
+   * and connected() to find out the result.
+   *
+   * @param ip remote IP address.
+   * @param port remote port.
+   * @return @c true, if the request was accepted, @c false if no link is free.
+   */
+  bool connectAsync(const IPAddress& ip, uint16_t port) noexcept;
+
+  /// Check whether the connection is being opened.
+  bool isConnecting() const noexcept;
+
+  /// Take over an incoming connection accepted by EspAT::accept().
+  void attach(uint8_t link) noexcept { stop(); link_ = int8_t(link); }
+
+  /// Open connection and wait for the result (at most 1s, use connectAsync() to not wait).
+  virtual int connect(IPAddress ip, uint16_t port) override;
+
+  /// Host names are not supported, always fails.
+  virtual int connect(const char* host, uint16_t port) override;
+
+  virtual size_t write(uint8_t c) override;
+  virtual size_t write(const uint8_t* buf, size_t size) override;
+  /// Get count of bytes which can be written now without splitting them.
+  virtual int availableForWrite() override;
+  virtual int available() override;
+  virtual int read() override;
+  virtual int read(uint8_t* buf, size_t size) override;
+  virtual int peek() override;
+  virtual void flush() override;
+  virtual void stop() override;
+  virtual uint8_t connected() override;
+  virtual operator bool() override { return link_ >= 0; }
+
+private:
+  EspAT& esp_;        ///< Driver.
+  int8_t link_ = -1;  ///< Link ID or -1, if no link allocated.
+};
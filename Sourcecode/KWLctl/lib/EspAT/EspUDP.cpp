@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "EspUDP.h"
+
+uint8_t EspUDP::begin(uint16_t port)
+{
+  if (link_ < 0)
+    link_ = esp_.allocLink();
+  local_port_ = port;
+  return link_ >= 0;
+}
+
+void EspUDP::stop()
+{
+  if (link_ >= 0) {
+    esp_.freeLink(uint8_t(link_));
+    link_ = -1;
+  }
+}
+
+int EspUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+  if (link_ < 0)
+    return 0;
+  write_failed_ = false;
+  auto state = esp_.getLinkState(uint8_t(link_));
+  if (state == EspAT::LinkState::Open || state == EspAT::LinkState::Opening)
+    esp_.setDestination(uint8_t(link_), ip, port);
+  else
+    esp_.open(uint8_t(link_), ip, port, local_port_);
+  return 1;
+}
+
+int EspUDP::beginPacket(const char*, uint16_t)
+{
+  return 0;
+}
+
+int EspUDP::endPacket()
+{
+  if (link_ < 0 || write_failed_)
+    return 0;
+  // datagram is sent asynchronously, report only failure of the previous one
+  return esp_.flush(uint8_t(link_));
+}
+
+size_t EspUDP::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t EspUDP::write(const uint8_t* buffer, size_t size)
+{
+  if (link_ < 0)
+    return 0;
+  auto count = esp_.write(uint8_t(link_), buffer, size);
+  if (count < size)
+    write_failed_ = true; // datagram incomplete
+  return count;
+}
+
+int EspUDP::parsePacket()
+{
+  if (link_ < 0)
+    return 0;
+  return esp_.takePacket(uint8_t(link_));
+}
+
+int EspUDP::available()
+{
+  if (link_ < 0)
+    return 0;
+  return esp_.available(uint8_t(link_));
+}
+
+int EspUDP::read()
+{
+  if (link_ < 0)
+    return -1;
+  return esp_.read(uint8_t(link_));
+}
+
+int EspUDP::read(unsigned char* buffer, size_t len)
+{
+  if (link_ < 0)
+    return -1;
+  size_t count = 0;
+  while (count < len) {
+    auto c = esp_.read(uint8_t(link_));
+    if (c < 0)
+      break;
+    buffer[count++] = uint8_t(c);
+  }
+  return int(count);
+}
+
+int EspUDP::read(char* buffer, size_t len)
+{
+  return read(reinterpret_cast<unsigned char*>(buffer), len);
+}
+
+int EspUDP::peek()
+{
+  if (link_ < 0)
+    return -1;
+  return esp_.peek(uint8_t(link_));
+}
+
+void EspUDP::flush()
+{
+  // discard rest of the current datagram
+  if (link_ >= 0)
+    while (esp_.read(uint8_t(link_)) >= 0) {}
+}
+
+IPAddress EspUDP::remoteIP()
+{
+  if (link_ < 0)
+    return IPAddress();
+  return esp_.remoteIP(uint8_t(link_));
+}
+
+uint16_t EspUDP::remotePort()
+{
+  if (link_ < 0)
+    return 0;
+  return esp_.remotePort(uint8_t(link_));
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief UDP over ESP8266 AT driver.
+ */
+#pragma once
+
+#include "EspAT.h"
+
+#include <Udp.h>
+
+/*!
+ * @brief UDP over ESP8266 AT driver.
+ *
+ * The link is opened on the first packet sent and kept open. Only the newest
+ * received datagram is kept and datagrams are limited to the size of driver
+ * buffers (EspAT::TX_SIZE for sending, EspAT::LINK_RX_SIZE for receiving).
+ */
+class EspUDP : public UDP
+{
+public:
+  EspUDP(const EspUDP&) = delete;
+  EspUDP& operator=(const EspUDP&) = delete;
+
+  /// Construct UDP instance using given driver.
+  explicit EspUDP(EspAT& esp) noexcept : esp_(esp) {}
+
+  virtual uint8_t begin(uint16_t port) override;
+  virtual void stop() override;
+  virtual int beginPacket(IPAddress ip, uint16_t port) override;
+  /// Host names are not supported, always fails.
+  virtual int beginPacket(const char* host, uint16_t port) override;
+  virtual int endPacket() override;
+  virtual size_t write(uint8_t c) override;
+  virtual size_t write(const uint8_t* buffer, size_t size) override;
+  virtual int parsePacket() override;
+  virtual int available() override;
+  virtual int read() override;
+  virtual int read(unsigned char* buffer, size_t len) override;
+  virtual int read(char* buffer, size_t len) override;
+  virtual int peek() override;
+  virtual void flush() override;
+  virtual IPAddress remoteIP() override;
+  virtual uint16_t remotePort() override;
+
+private:
+  EspAT& esp_;              ///< Driver.
+  int8_t link_ = -1;        ///< Link ID or -1, if not started.
+  uint16_t local_port_ = 0; ///< Local port.
+  bool write_failed_ = false; ///< Set, if the current datagram didn't fit into the send buffer.
+};
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "EspUart.h"
+
+#include <util/atomic.h>
+
+EspRingBuffer<EspUart::RX_SIZE> EspUart::s_rx_;
+EspRingBuffer<EspUart::TX_SIZE> EspUart::s_tx_;
+volatile unsigned long EspUart::s_overflow_count_ = 0;
+
+void EspUart::begin(unsigned long baud) noexcept
+{
+  // double speed mode gives smaller error at 115200 baud with 16MHz clock
+  uint16_t ubrr = uint16_t((F_CPU / 4 / baud - 1) / 2);
+  UCSR3A = _BV(U2X3);
+  UBRR3H = uint8_t(ubrr >> 8);
+  UBRR3L = uint8_t(ubrr);
+  UCSR3C = _BV(UCSZ31) | _BV(UCSZ30);
+  UCSR3B = _BV(RXEN3) | _BV(TXEN3) | _BV(RXCIE3);
+}
+
+int EspUart::available()
+{
+  return s_rx_.size();
+}
+
+int EspUart::read()
+{
+  if (s_rx_.empty())
+    return -1;
+  return s_rx_.pop();
+}
+
+int EspUart::peek()
+{
+  if (s_rx_.empty())
+    return -1;
+  return s_rx_.peek();
+}
+
+void EspUart::flush()
+{
+  while (!s_tx_.empty()) {
+    if (bit_is_clear(SREG, SREG_I) && bit_is_set(UCSR3A, UDRE3))
+      txInterrupt();  // interrupts disabled, send manually
+  }
+}
+
+size_t EspUart::write(uint8_t c)
+{
+  if (s_tx_.empty() && bit_is_set(UCSR3A, UDRE3)) {
+    // fast path, data register empty
+    UDR3 = c;
+    return 1;
+  }
+  while (!s_tx_.push(c)) {
+    if (bit_is_clear(SREG, SREG_I) && bit_is_set(UCSR3A, UDRE3))
+      txInterrupt();  // interrupts disabled, send manually
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    UCSR3B |= _BV(UDRIE3);
+  }
+  return 1;
+}
+
+void EspUart::rxInterrupt() noexcept
+{
+  uint8_t c = UDR3;
+  if (!s_rx_.push(c))
+    ++s_overflow_count_;
+}
+
+void EspUart::txInterrupt() noexcept
+{
+  if (s_tx_.empty()) {
+    UCSR3B &= uint8_t(~_BV(UDRIE3));
+    return;
+  }
+  UDR3 = s_tx_.pop();
+}
+
+ISR(USART3_RX_vect)
+{
+  EspUart::rxInterrupt();
+}
+
+ISR(USART3_UDRE_vect)
+{
+  EspUart::txInterrupt();
+}
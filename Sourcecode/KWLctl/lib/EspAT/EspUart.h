@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Interrupt-driven serial port for the ESP8266 module.
+ */
+#pragma once
+
+#include "EspAT.h"
+
+/*!
+ * @brief Interrupt-driven serial port for the ESP8266 module on USART3.
+ *
+ * In contrast to HardwareSerial, the receive buffer is large enough to hold
+ * several response lines, so the driver doesn't need to poll the port in
+ * tight loops. Sending is also interrupt-driven, so writing blocks only
+ * if the send buffer is full.
+ *
+ * @note Serial3 must not be used together with this class, since both
+ *  use the same interrupt vectors.
+ */
+class EspUart : public Stream
+{
+public:
+  /// Size of the receive buffer.
+  static constexpr uint16_t RX_SIZE = 256;
+  /// Size of the send buffer.
+  static constexpr uint16_t TX_SIZE = 64;
+
+  /// Start the serial port with given baud rate (8N1).
+  void begin(unsigned long baud) noexcept;
+
+  virtual int available() override;
+  virtual int read() override;
+  virtual int peek() override;
+  virtual void flush() override;
+  virtual size_t write(uint8_t c) override;
+  using Print::write;
+
+  /// Get count of received bytes dropped due to full receive buffer.
+  static unsigned long getOverflowCount() noexcept { return s_overflow_count_; }
+
+  /// Handle receive interrupt (internal).
+  static void rxInterrupt() noexcept;
+
+  /// Handle send interrupt (internal).
+  static void txInterrupt() noexcept;
+
+private:
+  static EspRingBuffer<RX_SIZE> s_rx_;          ///< Received data.
+  static EspRingBuffer<TX_SIZE> s_tx_;          ///< Data to send.
+  static volatile unsigned long s_overflow_count_;  ///< Count of dropped bytes.
+};
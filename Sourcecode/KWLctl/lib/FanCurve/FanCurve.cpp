@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "FanCurve.h"
+
+void FanCurve::load(const uint8_t* stored, int nominal_speed) noexcept
+{
+  for (uint8_t i = 0; i < POINTS; ++i) {
+    if (stored[i] == UNKNOWN)
+      speed_[i] = uint16_t(long(nominal_speed) * i / (POINTS - 1));
+    else
+      speed_[i] = uint16_t(stored[i] * SPEED_UNIT);
+  }
+  makeMonotonic();
+}
+
+void FanCurve::save(uint8_t* stored) const noexcept
+{
+  for (uint8_t i = 0; i < POINTS; ++i)
+    stored[i] = uint8_t((speed_[i] + SPEED_UNIT / 2) / SPEED_UNIT);
+}
+
+bool FanCurve::movedFrom(const uint8_t* stored) const noexcept
+{
+  for (uint8_t i = 0; i < POINTS; ++i) {
+    const int diff = int((speed_[i] + SPEED_UNIT / 2) / SPEED_UNIT) - stored[i];
+    if (stored[i] == UNKNOWN || diff > 1 || diff < -1)
+      return true;
+  }
+  return false;
+}
+
+void FanCurve::setKnot(uint8_t index, int speed) noexcept
+{
+  speed_[index] = 0;
+  adjust(index, speed);
+  makeMonotonic();
+}
+
+int FanCurve::getSpeed(int pwm) const noexcept
+{
+  if (pwm < 0)
+    pwm = 0;
+  else if (pwm > MAX_PWM)
+    pwm = MAX_PWM;
+  const uint8_t i = segment(pwm);
+  const int offset = pwm - i * PWM_STEP;
+  return speed_[i] + int(long(speed_[i + 1] - speed_[i]) * offset / PWM_STEP);
+}
+
+int FanCurve::getPWM(int speed) const noexcept
+{
+  if (speed <= int(speed_[0]))
+    return 0;
+  for (uint8_t i = 1; i < POINTS; ++i) {
+    // speed > speed_[i - 1], so the segment is not flat, if the speed is in it
+    if (speed <= int(speed_[i]))
+      return (i - 1) * PWM_STEP + int(long(speed - speed_[i - 1]) * PWM_STEP / (speed_[i] - speed_[i - 1]));
+  }
+  return MAX_PWM;  // out of reach
+}
+
+void FanCurve::learn(int pwm, int speed, uint8_t shift) noexcept
+{
+  if (pwm < 0 || pwm > MAX_PWM)
+    return;
+  const uint8_t i = segment(pwm);
+  const int offset = pwm - i * PWM_STEP;
+  const long error = long(speed) - getSpeed(pwm);
+  const long divisor = long(PWM_STEP) << shift;
+  adjust(i, error * (PWM_STEP - offset) / divisor);
+  adjust(uint8_t(i + 1), error * offset / divisor);
+  makeMonotonic();
+}
+
+uint8_t FanCurve::segment(int pwm) noexcept
+{
+  uint8_t i = uint8_t(pwm / PWM_STEP);
+  return (i > POINTS - 2) ? POINTS - 2 : i;
+}
+
+void FanCurve::adjust(uint8_t index, long delta) noexcept
+{
+  long speed = speed_[index] + delta;
+  if (speed < 0)
+    speed = 0;
+  else if (speed > MAX_SPEED)
+    speed = MAX_SPEED;
+  speed_[index] = uint16_t(speed);
+}
+
+void FanCurve::makeMonotonic() noexcept
+{
+  for (uint8_t i = 1; i < POINTS; ++i)
+    if (speed_[i] < speed_[i - 1])
+      speed_[i] = speed_[i - 1];
+}
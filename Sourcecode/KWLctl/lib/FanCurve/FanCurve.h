@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+/*!
+ * @file
+ * @brief Learned PWM to RPM characteristic of a fan.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*!
+ * @brief Learned PWM to RPM characteristic of a fan.
+ *
+ * The characteristic is a monotonic piecewise-linear curve with knots at
+ * fixed PWM values (0, 100, ..., 1000). It is refined by observations of
+ * the steady-state fan speed at a given PWM signal, each observation moves
+ * the two neighboring knots towards the observed speed proportionally to
+ * their distance from the observed PWM (least mean squares).
+ *
+ * The inverse of the curve provides PWM signal for a desired speed, so
+ * the fan can be set directly to the new speed when the setpoint changes.
+ *
+ * For persistent storage, each knot is stored compactly in one byte
+ * in units of SPEED_UNIT RPM.
+ */
+class FanCurve
+{
+public:
+  /// Count of knots.
+  static constexpr uint8_t POINTS = 11;
+  /// PWM distance of knots.
+  static constexpr int PWM_STEP = 100;
+  /// Maximum PWM signal.
+  static constexpr int MAX_PWM = (POINTS - 1) * PWM_STEP;
+  /// Speed unit of a knot in persistent storage (in RPM).
+  static constexpr int SPEED_UNIT = 16;
+  /// Value of an unknown knot in persistent storage (erased EEPROM).
+  static constexpr uint8_t UNKNOWN = 0xff;
+  /// Maximum speed which can be stored.
+  static constexpr int MAX_SPEED = (UNKNOWN - 1) * SPEED_UNIT;
+
+  /*!
+   * @brief Load the curve from persistent storage.
+   *
+   * @param stored persistent representation of POINTS bytes.
+   * @param nominal_speed speed at maximum PWM to use for a linear curve for unknown knots.
+   */
+  void load(const uint8_t* stored, int nominal_speed) noexcept;
+
+  /*!
+   * @brief Store the curve into persistent representation.
+   *
+   * @param stored persistent representation of POINTS bytes to fill.
+   */
+  void save(uint8_t* stored) const noexcept;
+
+  /*!
+   * @brief Check whether the curve moved away from its persistent representation.
+   *
+   * A knot differing by a single unit is not counted, so a knot oscillating
+   * around a rounding boundary doesn't cause repeated writes.
+   *
+   * @param stored persistent representation of POINTS bytes.
+   * @return @c true, if some knot differs by more than one SPEED_UNIT.
+   */
+  bool movedFrom(const uint8_t* stored) const noexcept;
+
+  /// Get the speed at the given knot.
+  int getKnot(uint8_t index) const noexcept { return speed_[index]; }
+
+  /// Set the speed at the given knot (e.g., from calibration).
+  void setKnot(uint8_t index, int speed) noexcept;
+
+  /// Get expected speed for the given PWM signal.
+  int getSpeed(int pwm) const noexcept;
+
+  /// Get PWM signal needed for the given speed.
+  int getPWM(int speed) const noexcept;
+
+  /*!
+   * @brief Refine the curve by steady-state observation.
+   *
+   * @param pwm PWM signal.
+   * @param speed observed speed at this PWM signal.
+   * @param shift learning rate as a power of two, the knots move by 1/2^shift of the error.
+   */
+  void learn(int pwm, int speed, uint8_t shift) noexcept;
+
+private:
+  /// Get index of the knot below the PWM signal (at most POINTS - 2).
+  static uint8_t segment(int pwm) noexcept;
+
+  /// Move the knot by the given speed difference.
+  void adjust(uint8_t index, long delta) noexcept;
+
+  /// Ensure the curve doesn't decrease.
+  void makeMonotonic() noexcept;
+
+  uint16_t speed_[POINTS] = {};  ///< Speed at knots in RPM.
+};
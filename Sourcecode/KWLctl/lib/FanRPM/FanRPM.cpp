@@ -21,26 +21,32 @@
 
 #include <Arduino.h>
 
-FanRPM::FanRPM(multiplier_t multiplier) noexcept : multiplier_(multiplier)
+FanRPM::FanRPM(multiplier_t multiplier) noexcept :
+  multiplier_(multiplier),
+  time_source_(micros)
 {
   memset(measurements_, 0, sizeof(measurements_));
 }
 
 void FanRPM::interrupt() noexcept {
+  edge(micros());
+}
+
+void FanRPM::edge(unsigned long timer) noexcept {
+  SeqLock<State>::Writer writer(state_);
+  auto& state = writer.data();
+
   // perform one measurement
-  unsigned long timer = micros();
-  if (!last_time_) {
-    last_time_ = timer;  // no measurements yet
+  if (!state.last_time) {
+    state.last_time = timer;  // no measurements yet
     return;
   }
-  unsigned long measurement = timer - last_time_;
+  unsigned long measurement = timer - state.last_time;
   if (measurement > ((60000000UL / MIN_RPM / RPM_MULTIPLIER_BASE) * multiplier_)) {
     // assume fan stopped - it is too slow (more than 1s between rotations)
     // NOTE: after considering the multiplier, the error of this computation
     // is about +/-0.01%. Pay attention when changing this code in the future.
-    last_time_ = 0;
-    last_ = 0;
-    valid_ = false;
+    reset(state);
     return;
   }
   if (measurement < ((60000000UL / MAX_RPM / RPM_MULTIPLIER_BASE) * multiplier_)) {
@@ -50,83 +56,168 @@ void FanRPM::interrupt() noexcept {
     // but pay attention when changing the code in the future.
     return;
   }
-  last_time_ = timer;
-
-  if (last_) {
-    // now check for validity of the new measurement (not more than 25% off)
-    auto diff = measurement >> 2;
-    auto low_bound = last_ - diff;
-    if (measurement < low_bound) {
-      last_ = low_bound;
+
+  unsigned char periods = 1;
+  if (state.count >= MEDIAN_MEASUREMENTS) {
+    // now check for validity of the new measurement against the median
+    // of last measurements (not more than 25% off)
+    const unsigned long ref = static_cast<unsigned long>(median()) << MEASUREMENT_SHIFT;
+    const unsigned long diff = ref >> 2;
+    if (measurement < ref - diff) {
+      // spurious signal, ignore it, so the next measurement spans whole rotation
+      skipped_ = true;
+      if (++rejected_ < MAX_REJECTED)
+        return;
+      reset(state);  // signals persistently too fast, restart measurement
+      state.last_time = timer;
       return;
     }
-    auto high_bound = last_ + diff;
-    if (measurement > high_bound) {
-      last_ = high_bound;
-      return;
+    if (measurement > ref + diff) {
+      if (measurement > (ref << 1) - diff && measurement < (ref << 1) + diff) {
+        measurement >>= 1;  // one signal missing
+        periods = 2;
+      } else {
+        if (++rejected_ < MAX_REJECTED) {
+          // dropped, but its periods still count for the average speed (rounded by the average
+          // interval, which is less noisy than the median)
+          const unsigned long scaled = measurement * state.count * 2;
+          const unsigned long total = state.sum << MEASUREMENT_SHIFT;
+          state.average_time += measurement;
+          ++state.average_periods;
+          for (unsigned long limit = total * 3; scaled > limit; limit += total * 2)
+            ++state.average_periods;
+          skipped_ = false;
+          state.last_time = timer;
+          return;
+        }
+        reset(state);  // signals persistently too slow, restart measurement
+        state.last_time = timer;
+        return;
+      }
     }
   }
+  // a measurement spanning an ignored signal doesn't end the series of rejections,
+  // else a measurement stuck at half the speed (each real signal looks spurious) never restarts
+  if (!skipped_)
+    rejected_ = 0;
+  skipped_ = false;
+  state.average_time += timer - state.last_time;
+  state.average_periods += periods;
+  state.last_time = timer;
 
-  // measurement OK, enter it in the list
-  unsigned long old = measurements_[index_];
-  measurements_[index_] = measurement;
-  sum_ = sum_ + measurement - old;
+  // measurement OK, enter it in the list, carry over the rounding remainder
+  measurement += remainder_;
+  remainder_ = static_cast<unsigned char>(measurement & ((1 << MEASUREMENT_SHIFT) - 1));
+  const auto value = static_cast<unsigned short>(measurement >> MEASUREMENT_SHIFT);
+  const unsigned short old = measurements_[index_];
+  const unsigned short old_recent = measurements_[(index_ - RECENT_MEASUREMENTS) & (MAX_MEASUREMENTS - 1)];
+  measurements_[index_] = value;
+  state.sum = state.sum + value - old;
+  state.recent_sum = state.recent_sum + value - old_recent;
   index_ = (index_ + 1) & (MAX_MEASUREMENTS - 1);
-  valid_ = true;
-  last_ = measurement;
+  if (state.count < MAX_MEASUREMENTS)
+    ++state.count;
+  state.valid = true;
 }
 
-int FanRPM::getSpeed() noexcept
+unsigned FanRPM::median() const noexcept
 {
-  auto valid = valid_;
-  auto sum = sum_;
-  auto last_time = last_time_;
-  for (;;) {
-    // Now re-read all data and check for change, if changed, re-read again.
-    // This prevents the need to disable interrupts for reading data.
-    const auto new_valid = valid_;
-    const auto new_sum = sum_;
-    const auto new_last_time = last_time_;
-    if (valid == new_valid && sum == new_sum && last_time == new_last_time)
-      break;  // data read consistently
-    // interrupt in-between changed state, re-read
-    valid = new_valid;
-    sum = new_sum;
-    last_time = new_last_time;
+  unsigned a = measurements_[(index_ - 1) & (MAX_MEASUREMENTS - 1)];
+  unsigned b = measurements_[(index_ - 2) & (MAX_MEASUREMENTS - 1)];
+  const unsigned c = measurements_[(index_ - 3) & (MAX_MEASUREMENTS - 1)];
+  if (a > b) {
+    const auto tmp = a;
+    a = b;
+    b = tmp;
   }
+  if (c <= a)
+    return a;
+  if (c >= b)
+    return b;
+  return c;
+}
 
-  if (!valid)
+void FanRPM::reset(State& state) noexcept
+{
+  memset(measurements_, 0, sizeof(measurements_));
+  state.last_time = 0;
+  state.sum = 0;
+  state.recent_sum = 0;
+  index_ = 0;
+  state.count = 0;
+  rejected_ = 0;
+  skipped_ = false;
+  remainder_ = 0;
+  state.valid = false;
+}
+
+int FanRPM::speed(bool recent) noexcept
+{
+  // consistent copy without disabling interrupts
+  const State state = state_.read();
+  if (!state.valid)
     return 0;
 
   // Create pseudo-measurement to check whether fan has stopped
   // w/o detection in the interrupt routine.
-  const unsigned long measurement = micros() - last_time;
+  const unsigned long measurement = time_source_() - state.last_time;
   if (measurement > ((60000000UL / MIN_RPM / RPM_MULTIPLIER_BASE) * multiplier_)) {
     // assume fan stopped - it is too slow (more than 1s between signals)
     // NOTE: the precision of the calculation is +/-0.01%. Pay attention
     // when changing the code in the future.
     noInterrupts();
-    last_time_ = 0;
-    last_ = 0;
-    valid_ = false;
+    {
+      SeqLock<State>::Writer writer(state_);
+      reset(writer.data());
+    }
     interrupts();
     return 0;
   }
 
-  // Captured value is effectively sum of MAX_MEASUREMENT measurements, return average.
+  // Captured value is effectively sum of count measurements in units of 64us, return average.
+  unsigned long sum = state.sum;
+  unsigned count = state.count;
+  if (recent) {
+    sum = state.recent_sum;
+    if (count > RECENT_MEASUREMENTS)
+      count = RECENT_MEASUREMENTS;
+  }
   if (sum)
-    return int(((60000000UL * MAX_MEASUREMENTS / RPM_MULTIPLIER_BASE) * multiplier_) / sum);
+    return int(((60000000UL >> MEASUREMENT_SHIFT) / RPM_MULTIPLIER_BASE * multiplier_ * count) / sum);
   else
     return 0;
 }
 
+void FanRPM::startAverage() noexcept
+{
+  noInterrupts();
+  {
+    SeqLock<State>::Writer writer(state_);
+    writer.data().average_time = 0;
+    writer.data().average_periods = 0;
+  }
+  interrupts();
+}
+
+int FanRPM::getAverageSpeed() noexcept
+{
+  const State state = state_.read();
+  const unsigned long time = state.average_time >> MEASUREMENT_SHIFT;
+  if (!time)
+    return 0;
+  return int(((60000000UL >> MEASUREMENT_SHIFT) / RPM_MULTIPLIER_BASE * multiplier_ * state.average_periods) / time);
+}
+
 void FanRPM::dump(Print& out) noexcept {
-  if (!valid_)
+  const auto& state = state_.peek();
+  if (!state.valid)
     out.print(F("INVALID: "));
-  out.print(F("Last: "));
-  out.print(last_);
-  out.print('@');
-  out.print(last_time_);
+  out.print(F("Count: "));
+  out.print(state.count);
+  out.print(F(", rejected "));
+  out.print(rejected_);
+  out.print(F(", last @"));
+  out.print(state.last_time);
   out.print(F(", index "));
   out.print(index_);
   out.print(F(": "));
@@ -134,5 +225,5 @@ void FanRPM::dump(Print& out) noexcept {
     out.print(measurements_[i]);
     out.print(';');
   }
-  out.println(sum_);
+  out.println(state.sum);
 }
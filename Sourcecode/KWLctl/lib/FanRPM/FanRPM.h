@@ -24,6 +24,8 @@
 
 #pragma once
 
+#include <SeqLock.h>
+
 class Print;
 
 /*!
@@ -33,9 +35,30 @@ class Print;
  * by sending a signal once per rotation (by default; other signal frequencies
  * are possible, see multiplier()). The signal is captured from a pin
  * using an associated interrupt. Interrupt's handling routine must call
- * interrupt() routine.
+ * interrupt() routine. Alternatively, the time of the signal can be captured
+ * by hardware (see TachoCapture), which then calls edge() with the captured
+ * time.
+ *
+ * Signal intervals are filtered before they are stored. An interval much
+ * shorter than the running median of the last three stored intervals is
+ * considered to be a spurious signal (e.g., a doubled pulse) and the signal
+ * is ignored, so the next interval spans the whole rotation. An interval of
+ * about twice the median is considered to be a missing pulse and half of it
+ * is stored. Other intervals off by more than 25% are dropped. If intervals
+ * are rejected repeatedly, the speed really changed and the measurement is
+ * restarted.
  *
- * To read the measurement, call get_speed() routine.
+ * Intervals are stored in units of 64us as 16-bit values. The rounding
+ * remainder is carried over to the next interval, so the sum (and thus
+ * the average speed) doesn't accumulate the rounding error.
+ *
+ * To read the measurement, call getSpeed() routine. It averages the whole
+ * buffer of 32 intervals, which is several seconds at low speed. For fast
+ * control loops, getRecentSpeed() averages only the last few intervals. For
+ * precise measurements over a longer time (e.g., fan calibration), start
+ * averaging by startAverage() and read the result by getAverageSpeed(). The
+ * state needed to compute the speed is shared with the interrupt routine via
+ * SeqLock, so reading it doesn't disable interrupts.
  *
  * You can dump the internal state to serial console using dump() method,
  * but this method is not synchronized (i.e., it may report erratic data).
@@ -84,13 +107,60 @@ public:
    */
   multiplier_t& multiplier() noexcept { return multiplier_; }
 
+  /// Type of the function returning current time in microseconds.
+  using time_source_t = unsigned long (*)();
+
   /// Call this method in the interrupt function for the RPM measurement pin.
   void interrupt() noexcept;
 
+  /*!
+   * @brief Record a tacho signal captured at given time.
+   *
+   * This method is called from the interrupt routine, if the time of the
+   * signal was captured by hardware. It feeds the same measurement buffer
+   * and outlier filter as interrupt().
+   *
+   * @param time time of the signal in microseconds, in the time base of the
+   *    time source (see setTimeSource()).
+   */
+  void edge(unsigned long time) noexcept;
+
+  /*!
+   * @brief Set the time source used to detect a stopped fan.
+   *
+   * By default, micros() is used. If the signal times are passed via edge()
+   * in a different time base, set the function returning current time in
+   * this time base.
+   */
+  void setTimeSource(time_source_t source) noexcept { time_source_ = source; }
+
   /*!
    * @brief Get the current speed measurement in rpm.
    */
-  int getSpeed() noexcept;
+  int getSpeed() noexcept { return speed(false); }
+
+  /*!
+   * @brief Get the speed measurement in rpm averaged over the last RECENT_MEASUREMENTS intervals.
+   *
+   * This follows speed changes with less lag than getSpeed(), but is more
+   * sensitive to noise of the tacho signal.
+   */
+  int getRecentSpeed() noexcept { return speed(true); }
+
+  /// Start averaging the speed for getAverageSpeed().
+  void startAverage() noexcept;
+
+  /*!
+   * @brief Get the speed in rpm averaged since the last call to startAverage().
+   *
+   * The speed is computed from the count of signal periods and their total
+   * time. Unlike getSpeed(), intervals dropped by the outlier filter count as
+   * well, so jitter of the tacho signal doesn't bias the result. Intervals
+   * spanning a restart of the measurement are not counted.
+   *
+   * @return average speed or 0, if no interval was measured yet.
+   */
+  int getAverageSpeed() noexcept;
 
   /// Dump the internal state to the serial console (unsynchronized read).
   void dump(Print& out) noexcept;
@@ -99,20 +169,58 @@ private:
   enum {
     /// Maximum # of measurements to store. Must be power of 2.
     MAX_MEASUREMENTS = 1<<5,
+    /// Count of last measurements averaged by getRecentSpeed().
+    RECENT_MEASUREMENTS = 4,
+    /// Count of measurements to compute median for outlier detection.
+    MEDIAN_MEASUREMENTS = 3,
+    /// Count of consecutive rejected measurements after which to restart.
+    MAX_REJECTED = 4,
+    /// Shift to convert microseconds to stored measurement units (64us).
+    MEASUREMENT_SHIFT = 6
+  };
+
+  /// State read by getSpeed().
+  struct State
+  {
+    /// Last measurement time.
+    unsigned long last_time;
+    /// Current sum of all measurements in units of 64us.
+    unsigned long sum;
+    /// Current sum of last RECENT_MEASUREMENTS measurements in units of 64us.
+    unsigned long recent_sum;
+    /// Time of signal periods since startAverage() in microseconds.
+    unsigned long average_time;
+    /// Count of signal periods since startAverage().
+    unsigned average_periods;
+    /// Count of valid measurements in the buffer.
+    unsigned char count;
+    /// Set to true, if a valid measurement was found.
+    bool valid;
   };
 
-  /// Last measurement time.
-  unsigned long last_time_ = 0;
-  /// Measurements buffer.
-  unsigned long measurements_[MAX_MEASUREMENTS];
+  /// Compute speed from all or only recent measurements.
+  int speed(bool recent) noexcept;
+
+  /// Median of last MEDIAN_MEASUREMENTS measurements in stored units.
+  unsigned median() const noexcept;
+
+  /// Forget all measurements (fan stopped or changed speed).
+  void reset(State& state) noexcept;
+
+  /// State shared with getSpeed().
+  SeqLock<State> state_;
+  /// Measurements buffer in units of 64us.
+  unsigned short measurements_[MAX_MEASUREMENTS];
   /// Current measurement index. Wraps around the buffer.
   unsigned char index_ = 0;
-  /// Set to true, if a valid measurement was found.
-  volatile bool valid_ = false;
-  /// Last measurement. Used to filter out outliers.
-  unsigned long last_ = 0;
-  /// Current sum of all measurements.
-  volatile unsigned long sum_ = 0;
+  /// Count of consecutive rejected measurements.
+  unsigned char rejected_ = 0;
+  /// Set, if the last signal was ignored as spurious.
+  bool skipped_ = false;
+  /// Rounding remainder of the last measurement in microseconds.
+  unsigned char remainder_ = 0;
   /// Multiplier in 1/256 units to convert to real RPM.
   multiplier_t multiplier_ = RPM_MULTIPLIER_BASE;
+  /// Time source for stop detection.
+  time_source_t time_source_;
 };
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "TachoCapture.h"
+#include "FanRPM.h"
+
+#include <InterruptStats.h>
+
+#include <Arduino.h>
+#include <util/atomic.h>
+
+/// Timer 4 period in microseconds (full 16 bits at 0.5us).
+static constexpr unsigned long PERIOD4_US = 0x10000UL / 2;
+/// Timer 5 period in microseconds (8 bits at 4us).
+static constexpr unsigned long PERIOD5_US = 0x100UL * 4;
+
+FanRPM* TachoCapture::s_rpm4_ = nullptr;
+FanRPM* TachoCapture::s_rpm5_ = nullptr;
+Scheduler::InterruptStats* TachoCapture::s_stats4_ = nullptr;
+Scheduler::InterruptStats* TachoCapture::s_stats5_ = nullptr;
+volatile unsigned long TachoCapture::s_base4_ = 0;
+volatile unsigned long TachoCapture::s_base5_ = 0;
+
+bool TachoCapture::begin(uint8_t pin, FanRPM& rpm, bool rising, Scheduler::InterruptStats* stats) noexcept
+{
+  const uint8_t edge = rising ? _BV(ICES4) : 0;
+  if (pin == PIN_ICP4) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      s_rpm4_ = &rpm;
+      s_stats4_ = stats;
+      rpm.setTimeSource(timeICP4);
+      // normal mode, prescaler 8
+      TCCR4A = 0;
+      TCCR4B = uint8_t(_BV(ICNC4) | edge | _BV(CS41));
+      TCNT4 = 0;
+      s_base4_ = 0;
+      TIFR4 = _BV(ICF4) | _BV(TOV4);
+      TIMSK4 = _BV(ICIE4) | _BV(TOIE4);
+    }
+    return true;
+  }
+  if (pin == PIN_ICP5) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      s_rpm5_ = &rpm;
+      s_stats5_ = stats;
+      rpm.setTimeSource(timeICP5);
+      // fast PWM 8-bit (keep output compare settings), prescaler 64
+      TCCR5A = uint8_t((TCCR5A & ~_BV(WGM51)) | _BV(WGM50));
+      TCCR5B = uint8_t(_BV(ICNC5) | edge | _BV(WGM52) | _BV(CS51) | _BV(CS50));
+      s_base5_ = 0;
+      TIFR5 = _BV(ICF5) | _BV(TOV5);
+      TIMSK5 = _BV(ICIE5) | _BV(TOIE5);
+    }
+    return true;
+  }
+  return false;
+}
+
+unsigned long TachoCapture::timeICP4() noexcept
+{
+  uint16_t count;
+  unsigned long base;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    count = TCNT4;
+    base = s_base4_;
+    if (bit_is_set(TIFR4, TOV4) && count < 0x8000)
+      base += PERIOD4_US; // overflow pending, counter already wrapped
+  }
+  return base + (count >> 1);
+}
+
+unsigned long TachoCapture::timeICP5() noexcept
+{
+  uint8_t count;
+  unsigned long base;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    count = uint8_t(TCNT5);
+    base = s_base5_;
+    if (bit_is_set(TIFR5, TOV5) && count < 0x80)
+      base += PERIOD5_US; // overflow pending, counter already wrapped
+  }
+  return base + (unsigned(count) << 2);
+}
+
+void TachoCapture::captureICP4() noexcept
+{
+  Scheduler::InterruptStats::Measure measure(s_stats4_);
+  // capture interrupt has higher priority than overflow interrupt, so check
+  // whether a pending overflow happened before the capture (the counter
+  // then has already counted past the captured value since wrapping)
+  uint16_t count = ICR4;
+  unsigned long base = s_base4_;
+  if (bit_is_set(TIFR4, TOV4) && count <= TCNT4)
+    base += PERIOD4_US;
+  s_rpm4_->edge(base + (count >> 1));
+}
+
+void TachoCapture::overflowICP4() noexcept
+{
+  Scheduler::InterruptStats::Measure measure(s_stats4_);
+  s_base4_ = s_base4_ + PERIOD4_US;
+}
+
+void TachoCapture::captureICP5() noexcept
+{
+  Scheduler::InterruptStats::Measure measure(s_stats5_);
+  uint8_t count = uint8_t(ICR5);
+  unsigned long base = s_base5_;
+  if (bit_is_set(TIFR5, TOV5) && count <= uint8_t(TCNT5))
+    base += PERIOD5_US;
+  s_rpm5_->edge(base + (unsigned(count) << 2));
+}
+
+void TachoCapture::overflowICP5() noexcept
+{
+  Scheduler::InterruptStats::Measure measure(s_stats5_);
+  s_base5_ = s_base5_ + PERIOD5_US;
+}
+
+ISR(TIMER4_CAPT_vect)
+{
+  TachoCapture::captureICP4();
+}
+
+ISR(TIMER4_OVF_vect)
+{
+  TachoCapture::overflowICP4();
+}
+
+ISR(TIMER5_CAPT_vect)
+{
+  TachoCapture::captureICP5();
+}
+
+ISR(TIMER5_OVF_vect)
+{
+  TachoCapture::overflowICP5();
+}
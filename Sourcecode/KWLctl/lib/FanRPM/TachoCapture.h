@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+/*!
+ * @file
+ * @brief Fan tacho signal capture using timer input capture units.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+class FanRPM;
+
+namespace Scheduler
+{
+  class InterruptStats;
+}
+
+/*!
+ * @brief Capture tacho signal times using input capture units of Timer 4 and 5.
+ *
+ * Instead of reading micros() in an external interrupt, the time of the
+ * signal edge is latched by the timer hardware on the ICP pin. The interrupt
+ * routine only extends the captured 16-bit value to 32 bits and passes it to
+ * FanRPM::edge(). The measurement is thus free of jitter caused by interrupt
+ * latency (other interrupts running, interrupts disabled for a while) and
+ * the interrupt routine is shorter.
+ *
+ * Only the Arduino Mega has input capture pins available:
+ *   - pin 49 (ICP4): Timer 4 is switched to normal mode with prescaler 8,
+ *     i.e., 0.5us resolution and overflow every 32.768ms. PWM outputs of
+ *     Timer 4 (pins 6, 7, 8) cannot be used anymore.
+ *   - pin 48 (ICP5): Timer 5 drives PWM outputs for fans and preheater, so it
+ *     is switched from phase-correct to fast PWM mode with 8 bits and
+ *     prescaler 64 (976Hz), which keeps analogWrite() working. The resolution
+ *     is 4us, same as micros(), and overflow is every 1.024ms.
+ *
+ * A pending overflow is accounted for correctly, as long as interrupts are not
+ * disabled for longer than one timer period. Timer 5 thus loses time during
+ * longer blocking operations (e.g., reading DHT sensors), just like micros()
+ * does, so the fan measurement on Timer 4 is more robust.
+ *
+ * The noise canceler of the input capture unit is turned on, so the signal
+ * must be stable for 4 CPU cycles to be captured.
+ */
+class TachoCapture
+{
+public:
+  /// Pin of input capture unit of Timer 4.
+  static constexpr uint8_t PIN_ICP4 = 49;
+  /// Pin of input capture unit of Timer 5.
+  static constexpr uint8_t PIN_ICP5 = 48;
+
+  /*!
+   * @brief Start capturing tacho signal on given pin.
+   *
+   * The time source of the measurement is set to the timer of the capture
+   * unit.
+   *
+   * @param pin pin to capture on (PIN_ICP4 or PIN_ICP5).
+   * @param rpm fan speed measurement to feed.
+   * @param rising if set, capture on rising edge, otherwise on falling edge.
+   * @param stats statistics to record load of capture and overflow
+   *    interrupts of the timer (optional).
+   * @return @c true, if capture started, @c false if the pin has no input
+   *    capture unit.
+   */
+  static bool begin(uint8_t pin, FanRPM& rpm, bool rising, Scheduler::InterruptStats* stats = nullptr) noexcept;
+
+  /// Get current time in microseconds in time base of Timer 4 capture.
+  static unsigned long timeICP4() noexcept;
+
+  /// Get current time in microseconds in time base of Timer 5 capture.
+  static unsigned long timeICP5() noexcept;
+
+  /// Handle input capture interrupt of Timer 4 (internal).
+  static void captureICP4() noexcept;
+
+  /// Handle overflow interrupt of Timer 4 (internal).
+  static void overflowICP4() noexcept;
+
+  /// Handle input capture interrupt of Timer 5 (internal).
+  static void captureICP5() noexcept;
+
+  /// Handle overflow interrupt of Timer 5 (internal).
+  static void overflowICP5() noexcept;
+
+private:
+  static FanRPM* s_rpm4_;               ///< Measurement fed by Timer 4.
+  static FanRPM* s_rpm5_;               ///< Measurement fed by Timer 5.
+  static Scheduler::InterruptStats* s_stats4_;  ///< Interrupt statistics of Timer 4 (optional).
+  static Scheduler::InterruptStats* s_stats5_;  ///< Interrupt statistics of Timer 5 (optional).
+  static volatile unsigned long s_base4_;  ///< Time of last Timer 4 overflow in microseconds.
+  static volatile unsigned long s_base5_;  ///< Time of last Timer 5 overflow in microseconds.
+};
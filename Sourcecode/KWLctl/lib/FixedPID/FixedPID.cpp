@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "FixedPID.h"
+
+#include <Arduino.h>
+
+FixedPID::FixedPID(const Tunings& tunings, unsigned long sample_time_ms, value_t out_min, value_t out_max) noexcept :
+  tunings_(tunings),
+  sample_time_(sample_time_ms),
+  last_time_(millis() - sample_time_ms),
+  out_min_(out_min),
+  out_max_(out_max)
+{}
+
+void FixedPID::setOutputLimits(value_t out_min, value_t out_max) noexcept
+{
+  if (out_min >= out_max)
+    return;
+  out_min_ = out_min;
+  out_max_ = out_max;
+  sum_ = clamp(sum_);
+}
+
+void FixedPID::start(input_t input, value_t output) noexcept
+{
+  if (running_)
+    return;
+  sum_ = clamp(output);
+  last_input_ = input;
+  running_ = true;
+}
+
+bool FixedPID::compute(input_t input, input_t setpoint, value_t& output) noexcept
+{
+  if (!running_)
+    return false;
+  const auto now = millis();
+  if (now - last_time_ < sample_time_ - (sample_time_ >> 4))
+    return false;
+
+  const int16_t error = diff(setpoint, input);
+  const int16_t d_input = diff(input, last_input_);
+
+  // integral and proportional on measurement go to the sum, clamped to
+  // output limits to prevent windup (the difference of two products of
+  // 16-bit values fits 32 bits)
+  sum_ = clamp(add(sum_, mul(tunings_.ki, error) - mul(tunings_.kp, d_input)));
+
+  // derivative on measurement
+  output = clamp(add(sum_, -mul(tunings_.kd, d_input)));
+
+  last_input_ = input;
+  last_time_ = now;
+  return true;
+}
+
+int16_t FixedPID::diff(input_t a, input_t b) noexcept
+{
+  const int32_t d = int32_t(a) - b;
+  if (d > INT16_MAX)
+    return INT16_MAX;
+  if (d < -INT16_MAX)
+    return -INT16_MAX;
+  return int16_t(d);
+}
+
+FixedPID::value_t FixedPID::add(value_t v, value_t term) noexcept
+{
+  if (term > 0 && v > INT32_MAX - term)
+    return INT32_MAX;
+  if (term < 0 && v < INT32_MIN - term)
+    return INT32_MIN;
+  return v + term;
+}
+
+FixedPID::value_t FixedPID::clamp(value_t v) const noexcept
+{
+  if (v > out_max_)
+    return out_max_;
+  if (v < out_min_)
+    return out_min_;
+  return v;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+/*!
+ * @file
+ * @brief PID controller using fixed-point arithmetic.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*!
+ * @brief PID controller using fixed-point arithmetic.
+ *
+ * The controller works the same way as PID_v1 library with proportional on
+ * measurement (P_ON_M) in direct mode, but computes with integers instead
+ * of software-emulated floating point:
+ *   - the proportional term and the integral term are accumulated into
+ *     the output sum, so changing tunings doesn't cause output jumps;
+ *   - the derivative term is computed on measurement, so setpoint changes
+ *     don't cause derivative kicks;
+ *   - the output sum is clamped to output limits (anti-windup).
+ *
+ * Inputs are 16-bit integers in units chosen by the caller (e.g., rpm or
+ * 1/16 degrees Celsius), gains are 16-bit values with 12 fractional bits
+ * (Q3.12, output units per input unit) and the output has 12 fractional
+ * bits as well. So each term is a 16x16->32 bit multiplication and all sums
+ * are 32 bit with saturation, which is cheap on AVR (no 64-bit arithmetic).
+ * Choose the input unit so that gains are in range 0.0002 to 7.9 for
+ * reasonable precision.
+ *
+ * Tunings are specified per second like for PID_v1 and converted for
+ * the sample time at compile time using tunings().
+ */
+class FixedPID
+{
+public:
+  /// Measured value (input and setpoint) in units chosen by the caller.
+  using input_t = int16_t;
+
+  /// Gain with 12 fractional bits (Q3.12).
+  using gain_t = int16_t;
+
+  /// Output value with 12 fractional bits (Q19.12).
+  using value_t = int32_t;
+
+  /// Count of fractional bits of gains and output values.
+  static constexpr uint8_t FRACTION_BITS = 12;
+
+  /// Output value representing 1.
+  static constexpr value_t ONE = value_t(1) << FRACTION_BITS;
+
+  /// Tunings of the controller converted for a given sample time.
+  struct Tunings
+  {
+    gain_t kp;    ///< Proportional gain.
+    gain_t ki;    ///< Integral gain per sample.
+    gain_t kd;    ///< Derivative gain per sample.
+  };
+
+  /// Convert floating-point value to fixed-point output value (intended for constants).
+  static constexpr value_t fromDouble(double v) noexcept {
+    return value_t(v * ONE + (v < 0 ? -0.5 : 0.5));
+  }
+
+  /// Convert floating-point value to a gain, saturated to the range of gains (intended for constants).
+  static constexpr gain_t toGain(double v) noexcept {
+    return (v * ONE >= INT16_MAX) ? gain_t(INT16_MAX) :
+      (v * ONE <= -INT16_MAX) ? gain_t(-INT16_MAX) :
+      gain_t(v * ONE + (v < 0 ? -0.5 : 0.5));
+  }
+
+  /// Convert integer to fixed-point output value.
+  static constexpr value_t fromInt(int v) noexcept { return value_t(v) * ONE; }
+
+  /// Convert fixed-point output value to integer (rounded down).
+  static constexpr int toInt(value_t v) noexcept { return int(v >> FRACTION_BITS); }
+
+  /// Convert fixed-point output value to floating-point (for debugging output).
+  static constexpr double toDouble(value_t v) noexcept { return double(v) / ONE; }
+
+  /*!
+   * @brief Compute tunings for given sample time.
+   *
+   * @param kp proportional gain.
+   * @param ki integral gain per second.
+   * @param kd derivative gain per second.
+   * @param sample_time_ms sample time in milliseconds.
+   */
+  static constexpr Tunings tunings(double kp, double ki, double kd, unsigned long sample_time_ms) noexcept {
+    return Tunings{toGain(kp), toGain(ki * sample_time_ms / 1000), toGain(kd * 1000 / sample_time_ms)};
+  }
+
+  /*!
+   * @brief Construct the controller.
+   *
+   * The controller is initially stopped.
+   *
+   * @param tunings initial tunings, computed for the sample time.
+   * @param sample_time_ms sample time in milliseconds.
+   * @param out_min minimum output value.
+   * @param out_max maximum output value.
+   */
+  FixedPID(const Tunings& tunings, unsigned long sample_time_ms, value_t out_min, value_t out_max) noexcept;
+
+  /// Set new tunings, computed for the sample time of the controller.
+  void setTunings(const Tunings& tunings) noexcept { tunings_ = tunings; }
+
+  /*!
+   * @brief Set new sample time.
+   *
+   * The tunings must be set for the new sample time as well.
+   *
+   * @param sample_time_ms sample time in milliseconds.
+   */
+  void setSampleTime(unsigned long sample_time_ms) noexcept { sample_time_ = sample_time_ms; }
+
+  /// Set output limits.
+  void setOutputLimits(value_t out_min, value_t out_max) noexcept;
+
+  /*!
+   * @brief Start the controller (automatic mode).
+   *
+   * If the controller is already started, nothing happens. Otherwise, it
+   * starts from current input and output, so there is no bump.
+   *
+   * @param input current input (measurement).
+   * @param output current output.
+   */
+  void start(input_t input, value_t output) noexcept;
+
+  /// Stop the controller (manual mode).
+  void stop() noexcept { running_ = false; }
+
+  /// Check whether the controller is started.
+  bool isRunning() const noexcept { return running_; }
+
+  /*!
+   * @brief Compute new output, if the sample time elapsed.
+   *
+   * To tolerate jitter of the caller running at the sample time, 15/16 of
+   * the sample time is sufficient.
+   *
+   * @param input current input (measurement).
+   * @param setpoint desired input.
+   * @param output set to new output, if computed.
+   * @return @c true, if a new output was computed, @c false if the sample
+   *    time didn't elapse yet or the controller is stopped.
+   */
+  bool compute(input_t input, input_t setpoint, value_t& output) noexcept;
+
+private:
+  /// Compute difference of inputs saturated to 16 bits.
+  static int16_t diff(input_t a, input_t b) noexcept;
+
+  /// Multiply gain by a difference of inputs (16x16->32 bit, cannot overflow).
+  static value_t mul(gain_t gain, int16_t v) noexcept { return value_t(gain) * v; }
+
+  /// Add a term to a value in output limits with saturation.
+  static value_t add(value_t v, value_t term) noexcept;
+
+  /// Clamp the value to output limits.
+  value_t clamp(value_t v) const noexcept;
+
+  Tunings tunings_;             ///< Current tunings.
+  unsigned long sample_time_;   ///< Sample time in milliseconds.
+  unsigned long last_time_;     ///< Time of the last computation.
+  value_t out_min_;             ///< Minimum output.
+  value_t out_max_;             ///< Maximum output.
+  value_t sum_ = 0;             ///< Output sum (integral and proportional terms).
+  input_t last_input_ = 0;      ///< Input at last computation.
+  bool running_ = false;        ///< Set, if the controller is started.
+};
@@ -97,6 +97,15 @@ public:
   /// Get length of the string (without terminating NUL).
   constexpr size_t length() const noexcept { return len - 1; }
 
+  /*!
+   * @brief Get pointer to the string data in Flash memory.
+   *
+   * In contrast to the conversion to <tt>const __FlashStringHelper*</tt>,
+   * this is a constant expression, so it can be used to initialize tables
+   * residing in Flash memory.
+   */
+  constexpr const char* data_P() const noexcept { return data_; }
+
   /*!
    * @brief Load the string into memory and return it.
    *
@@ -22,14 +22,24 @@
 
 #include <Arduino.h>
 #include <stdlib.h>
+#include <string.h>
 
 PublishTask* PublishTask::s_first_task_ = nullptr;
 bool PublishTask::s_has_tasks_ = false;
 
 MessageHandler* MessageHandler::s_first_handler = nullptr;
 MessageHandler::publish_callback MessageHandler::s_cb_ = nullptr;
+MessageHandler::begin_stream_callback MessageHandler::s_begin_stream_cb_ = nullptr;
+MessageHandler::end_stream_callback MessageHandler::s_end_stream_cb_ = nullptr;
 void *MessageHandler::s_cb_arg_ = nullptr;
 bool MessageHandler::s_debug_ = false;
+const char* MessageHandler::s_command_ = nullptr;
+bool MessageHandler::s_malformed_ = false;
+bool MessageHandler::s_validating_ = false;
+uint8_t MessageHandler::s_command_count_ = 0;
+MessageHandler::CommandStats MessageHandler::s_command_stats_[MESSAGE_HANDLER_COMMAND_STATS];
+unsigned long MessageHandler::s_unhandled_count_ = 0;
+unsigned long MessageHandler::s_command_overflow_count_ = 0;
 
 PublishTask::PublishTask() :
   next_(s_first_task_)
@@ -54,6 +64,38 @@ bool PublishTask::loop()
   return retval;
 }
 
+void MessageStats::add(unsigned long time, bool malformed) noexcept
+{
+  ++count_;
+  if (malformed)
+    ++malformed_;
+  if (time > max_time_)
+    max_time_ = time;
+  total_time_ms_ += time / 1000;
+  total_time_us_ += unsigned(time % 1000);
+  if (total_time_us_ >= 1000) {
+    total_time_us_ -= 1000;
+    ++total_time_ms_;
+  }
+}
+
+void MessageStats::printTo(Print& out) const
+{
+  out.print(F("cnt "));
+  out.print(count_);
+  out.print(F(" bad "));
+  out.print(malformed_);
+  out.print(F(" max "));
+  out.print(max_time_);
+  out.print(F(" tot "));
+  out.print(total_time_ms_);
+}
+
+void MessageStats::reset() noexcept
+{
+  *this = MessageStats();
+}
+
 MessageHandler::MessageHandler(const __FlashStringHelper* name) :
   next_(s_first_handler),
   name_(name)
@@ -70,6 +112,12 @@ void MessageHandler::begin(publish_callback cb, void *cb_arg, bool debug)
   s_debug_ = debug;
 }
 
+void MessageHandler::setStreamCallbacks(begin_stream_callback begin_cb, end_stream_callback end_cb)
+{
+  s_begin_stream_cb_ = begin_cb;
+  s_end_stream_cb_ = end_cb;
+}
+
 bool MessageHandler::publish(const char* topic, const char* payload, bool retained)
 {
   bool sent = s_cb_(s_cb_arg_, topic, payload, retained);
@@ -115,6 +163,70 @@ bool MessageHandler::publish(const char* topic, double payload, unsigned char pr
   return publish(topic, buffer, retained);
 }
 
+bool MessageHandler::StreamWriter::begin(const char* topic, bool retained)
+{
+  if (!s_begin_stream_cb_)
+    return false;
+  out_ = s_begin_stream_cb_(s_cb_arg_, topic, remaining_, retained);
+  return out_ != nullptr;
+}
+
+bool MessageHandler::StreamWriter::end()
+{
+  flushChunk();
+  // a short or long payload or a failed write can't be fixed up, since the receiver
+  // counts payload bytes, so let the transport abort the connection
+  bool complete = !remaining_ && !overflow_ && !getWriteError();
+  bool sent = s_end_stream_cb_(s_cb_arg_, complete);
+  return sent && complete;
+}
+
+size_t MessageHandler::StreamWriter::write(const uint8_t* buffer, size_t size)
+{
+  if (size > remaining_) {
+    overflow_ = true;   // the writer wrote more than announced
+    size = remaining_;
+  }
+  remaining_ -= size;
+  auto rem = size;
+  while (rem) {
+    if (fill_ == STREAM_CHUNK_SIZE)
+      flushChunk();
+    size_t count = STREAM_CHUNK_SIZE - fill_;
+    if (count > rem)
+      count = rem;
+    memcpy(chunk_ + fill_, buffer, count);
+    fill_ = uint8_t(fill_ + count);
+    buffer += count;
+    rem -= count;
+  }
+  return size;
+}
+
+void MessageHandler::StreamWriter::flushChunk()
+{
+  // after a failed write, the rest of the payload is dropped
+  if (fill_ && !getWriteError() && out_->write(chunk_, fill_) != fill_)
+    setWriteError();
+  fill_ = 0;
+}
+
+Print& MessageHandler::debugStreamBegin(const char* topic)
+{
+  Serial.print(F("MQTT send "));
+  Serial.print(topic);
+  Serial.print(':');
+  Serial.print(' ');
+  return Serial;
+}
+
+void MessageHandler::debugStreamEnd(bool retained)
+{
+  if (retained)
+    Serial.print(F(" [retained]"));
+  Serial.println();
+}
+
 void MessageHandler::mqttMessageReceived(char* topic, uint8_t* payload, unsigned int length)
 {
   payload[length] = 0;  // ensure NUL termination
@@ -134,7 +246,13 @@ void MessageHandler::mqttMessageReceived(char* topic, uint8_t* payload, unsigned
       Serial.print(F("- trying MQTT handler: "));
       Serial.println(handler->name_);
     }
+    s_command_ = nullptr;
+    s_malformed_ = false;
+    auto start = micros();
     if (handler->mqttReceiveMsg(topicStr, s)) {
+      auto time = micros() - start;
+      handler->stats_.add(time, s_malformed_);
+      addCommandStats(s_command_, time, s_malformed_);
       if (s_debug_) {
         Serial.print(F("MQTT message handled by: "));
         Serial.println(handler->name_);
@@ -144,7 +262,65 @@ void MessageHandler::mqttMessageReceived(char* topic, uint8_t* payload, unsigned
     handler = handler->next_;
   }
 
+  ++s_unhandled_count_;
   if (s_debug_) {
     Serial.println(F("Unexpected MQTT message received, no handler found"));
   }
 }
+
+bool MessageHandler::dispatch(const StringView& topic, const StringView& payload)
+{
+  auto command = s_command_;
+  auto malformed = s_malformed_;
+  s_malformed_ = false;
+  bool handled = false;
+  auto start = micros();
+  for (auto handler = s_first_handler; handler && !handled; handler = handler->next_) {
+    s_command_ = nullptr;
+    handled = handler->mqttReceiveMsg(topic, payload);
+  }
+  if (handled && !s_validating_)
+    addCommandStats(s_command_, micros() - start, s_malformed_);
+  bool accepted = handled && !s_malformed_;
+  s_command_ = command;
+  s_malformed_ = malformed;
+  return accepted;
+}
+
+bool MessageHandler::validate(const StringView& topic, const StringView& payload)
+{
+  s_validating_ = true;
+  auto accepted = dispatch(topic, payload);
+  s_validating_ = false;
+  return accepted;
+}
+
+void MessageHandler::addCommandStats(const char* pattern, unsigned long time, bool malformed) noexcept
+{
+  if (!pattern)
+    return; // counted for the handler only
+  // patterns are unique in Flash memory, so the pointer identifies the command
+  uint8_t i = 0;
+  while (i < s_command_count_ && s_command_stats_[i].name != pattern)
+    ++i;
+  if (i == s_command_count_) {
+    if (i == MESSAGE_HANDLER_COMMAND_STATS) {
+      ++s_command_overflow_count_;  // no more space for new commands
+      return;
+    }
+    s_command_stats_[i].name = pattern;
+    s_command_stats_[i].stats.reset();
+    ++s_command_count_;
+  }
+  s_command_stats_[i].stats.add(time, malformed);
+}
+
+void MessageHandler::resetStats() noexcept
+{
+  for (auto handler = s_first_handler; handler; handler = handler->next_)
+    handler->stats_.reset();
+  // free command slots, so commands seen after reset get statistics
+  s_command_count_ = 0;
+  s_command_overflow_count_ = 0;
+  s_unhandled_count_ = 0;
+}
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <StringView.h>
+#include <Print.h>
 #include <avr/pgmspace.h>
 
 /*
@@ -38,8 +39,24 @@
  */
 //#define MESSAGE_HANDLER_SYNC_PUBLISH
 
-/// In-place new operator.
+/*
+ * NOTE: Statistics are collected per command. A command is identified by
+ * the pattern in Flash memory set via MessageHandler::setCommand() (e.g.,
+ * by TopicRouter), messages of handlers without command pattern are only
+ * counted for the handler. This macro defines the maximum number of distinct
+ * commands for which statistics are kept, messages of further commands are
+ * counted as overflow.
+ */
+#ifndef MESSAGE_HANDLER_COMMAND_STATS
+  #define MESSAGE_HANDLER_COMMAND_STATS 8
+#endif
+
+#ifdef __AVR__
+/// In-place new operator (not provided by the AVR core).
 inline void* operator new(size_t, void* ptr) { return ptr; }
+#else
+#include <new>
+#endif
 
 /*!
  * @brief Task used to publish MQTT messages asynchronously.
@@ -106,6 +123,9 @@ public:
   /// Cancel pending send.
   void cancel() noexcept { invoker_ = nullptr; }
 
+  /// Check if the message of this task was not sent yet.
+  bool isPending() const noexcept { return invoker_ != nullptr; }
+
   /// Check if any tasks are pending.
   static bool hasTasks() noexcept { return s_has_tasks_; }
 
@@ -122,7 +142,7 @@ public:
   static bool loop();
 
 private:
-  char closure_space_[12];            ///< Space for the closure of the writer.
+  alignas(void*) char closure_space_[6 * sizeof(void*)];  ///< Space for the closure of the writer.
   bool (*invoker_)(void*) = nullptr;  ///< Invoker of the writer, if active.
   PublishTask* next_;                 ///< Next registered publish task.
 
@@ -130,6 +150,46 @@ private:
   static PublishTask* s_first_task_;  ///< First registered task.
 };
 
+/*!
+ * @brief Statistics of handled messages.
+ */
+class MessageStats
+{
+public:
+  /*!
+   * @brief Add one handled message.
+   *
+   * @param time handling time in microseconds.
+   * @param malformed if set, the message was rejected as malformed.
+   */
+  void add(unsigned long time, bool malformed) noexcept;
+
+  /// Get count of handled messages.
+  unsigned long getCount() const noexcept { return count_; }
+
+  /// Get count of messages rejected as malformed.
+  unsigned getMalformedCount() const noexcept { return malformed_; }
+
+  /// Get maximum handling time in microseconds.
+  unsigned long getMaxTime() const noexcept { return max_time_; }
+
+  /// Get total handling time in milliseconds.
+  unsigned long getTotalTime() const noexcept { return total_time_ms_; }
+
+  /// Print statistics to a stream.
+  void printTo(Print& out) const;
+
+  /// Reset statistics.
+  void reset() noexcept;
+
+private:
+  unsigned long count_ = 0;           ///< Count of handled messages.
+  unsigned long max_time_ = 0;        ///< Maximum handling time in microseconds.
+  unsigned long total_time_ms_ = 0;   ///< Total handling time in milliseconds.
+  unsigned total_time_us_ = 0;        ///< Total handling time remainder in microseconds.
+  unsigned malformed_ = 0;            ///< Count of malformed messages.
+};
+
 /*!
  * @brief Handler for incoming MQTT messages and publising outgoing messages.
  *
@@ -158,6 +218,49 @@ public:
    */
   using publish_callback = bool (*)(void* instance, const char* topic, const char* payload, bool retained);
 
+  /*!
+   * @brief Signature of a method starting to publish a streamed message.
+   *
+   * @param instance instance pointer as specified in begin().
+   * @param topic message topic.
+   * @param length exact length of the payload, which will be written to returned stream.
+   * @param retained if set, retain the message on the server.
+   * @return stream to write the payload to or @c nullptr, if the message cannot be sent.
+   */
+  using begin_stream_callback = Print* (*)(void* instance, const char* topic, unsigned length, bool retained);
+
+  /*!
+   * @brief Signature of a method finishing to publish a streamed message.
+   *
+   * If the payload is not complete (write to the stream failed or the writer
+   * didn't produce the announced length), the message cannot be finished and
+   * the receiver would misinterpret following data. The connection must be
+   * aborted in this case.
+   *
+   * @param instance instance pointer as specified in begin().
+   * @param complete if set, the payload was written completely.
+   * @return @c true, if the message was sent, @c false, if not.
+   */
+  using end_stream_callback = bool (*)(void* instance, bool complete);
+
+  /// Iterator over registered handlers.
+  class iterator
+  {
+  public:
+    MessageHandler& operator*() noexcept { return *cur_; }
+    MessageHandler* operator->() noexcept { return cur_; }
+
+    /// Move to the next handler.
+    iterator& operator++() noexcept { cur_ = cur_->next_; return *this; }
+
+  private:
+    friend class MessageHandler;
+    explicit iterator(MessageHandler* ptr) noexcept : cur_(ptr) {}
+    friend bool operator==(const iterator& l, const iterator& r) noexcept { return l.cur_ == r.cur_; }
+    friend bool operator!=(const iterator& l, const iterator& r) noexcept { return l.cur_ != r.cur_; }
+    MessageHandler* cur_;
+  };
+
   MessageHandler(const MessageHandler&) = delete;
   MessageHandler& operator=(const MessageHandler&) = delete;
 
@@ -170,11 +273,19 @@ public:
    * @brief Start sending and receiving messages.
    *
    * @param cb callback for sending messages.
-   * @param cb_arg callback argument (instance of PubSubClient).
+   * @param cb_arg callback argument (e.g., instance of the network client).
    * @param debug if set, print debugging messages to Serial output.
    */
   static void begin(publish_callback cb, void *cb_arg, bool debug = false);
 
+  /*!
+   * @brief Set callbacks for publishing streamed messages.
+   *
+   * @param begin_cb callback to start sending a message.
+   * @param end_cb callback to finish sending a message.
+   */
+  static void setStreamCallbacks(begin_stream_callback begin_cb, end_stream_callback end_cb);
+
   /*!
    * @brief Publish a message.
    *
@@ -267,6 +378,56 @@ public:
     return publish(buffer, payload, args...);
   }
 
+  /*!
+   * @brief Publish a message with payload streamed directly to the network.
+   *
+   * The payload is not materialized in memory. Instead, the writer is called
+   * first to compute payload length and then to write the payload to the
+   * network in small chunks. This allows sending messages larger than MQTT
+   * client buffer without a matching buffer in RAM.
+   *
+   * @param topic message topic.
+   * @param writer function called with a Print reference to write the payload.
+   *    It must produce the same output each time it's called. Otherwise, the
+   *    message is not sent and the connection is aborted.
+   * @param retained if set, retain the message on the server for quick read upon client connect.
+   * @return @c true, if published successfully, @c false otherwise.
+   */
+  template<typename Func>
+  static bool publishStream(const char* topic, Func&& writer, bool retained = false) {
+    StreamSizer sizer;
+    writer(static_cast<Print&>(sizer));
+    StreamWriter out(sizer.size());
+    if (!out.begin(topic, retained))
+      return false;
+    writer(static_cast<Print&>(out));
+    if (!out.end())
+      return false;
+    if (s_debug_) {
+      writer(debugStreamBegin(topic));
+      debugStreamEnd(retained);
+    }
+    return true;
+  }
+
+  /*!
+   * @brief Publish a message with payload streamed directly to the network.
+   *
+   * @param topic message topic stored in Flash memory.
+   * @param writer function called with a Print reference to write the payload.
+   *    It must produce the same output each time it's called.
+   * @param retained if set, retain the message on the server for quick read upon client connect.
+   * @return @c true, if published successfully, @c false otherwise.
+   */
+  template<typename Func>
+  static bool publishStream(const __FlashStringHelper* topic, Func&& writer, bool retained = false) {
+    auto ctopic = reinterpret_cast<const char*>(topic);
+    auto topic_len = strlen_P(ctopic) + 1;
+    char buffer[topic_len];
+    memcpy_P(buffer, ctopic, topic_len);
+    return publishStream(buffer, writer, retained);
+  }
+
   /*!
    * @brief Publish a message conditionally.
    *
@@ -304,7 +465,123 @@ public:
    */
   static void mqttMessageReceived(char* topic, uint8_t* payload, unsigned int length);
 
+  /*!
+   * @brief Dispatch a message to registered handlers from within a handler.
+   *
+   * This is used to implement composite commands, which consist of several
+   * single commands. Statistics are only recorded for the composite command.
+   *
+   * @param topic MQTT topic (without prefix).
+   * @param payload payload of the message (must be NUL-terminated after length).
+   * @return @c true, if the message was handled and accepted, @c false otherwise.
+   */
+  static bool dispatch(const StringView& topic, const StringView& payload);
+
+  /*!
+   * @brief Check a message with registered handlers without applying it.
+   *
+   * Handlers check the payload as usual, but return before changing any
+   * state, if isValidating() is set. This is used to apply several commands
+   * completely or not at all (bulk configuration, Modbus). Only commands,
+   * whose handlers respect isValidating(), may be validated.
+   *
+   * @param topic topic (without prefix).
+   * @param payload message payload.
+   * @return @c true, if the message was accepted, @c false if not handled or malformed.
+   */
+  static bool validate(const StringView& topic, const StringView& payload);
+
+  /// Check whether the current message is only validated (see validate()).
+  static bool isValidating() noexcept { return s_validating_; }
+
+  /// Get handler name.
+  const __FlashStringHelper* getName() const noexcept { return name_; }
+
+  /// Get statistics of messages handled by this handler.
+  const MessageStats& getStats() const noexcept { return stats_; }
+
+  /// Get iterator to the first handler.
+  static iterator beginHandlers() noexcept { return iterator(s_first_handler); }
+
+  /// Get iterator past the last handler.
+  static iterator endHandlers() noexcept { return iterator(nullptr); }
+
+  /*!
+   * @brief Identify the command being handled for per-command statistics.
+   *
+   * Call from within a message handler. If not called, the message is only
+   * counted in statistics of the handler.
+   *
+   * @param name command name in Flash memory (typically topic or topic pattern),
+   *    the same pointer must be used for each message of the command.
+   */
+  static void setCommand(const char* name) noexcept { s_command_ = name; }
+
+  /// Report that the message being handled is malformed and was rejected.
+  static void reportMalformed() noexcept { s_malformed_ = true; }
+
+  /// Get count of commands with statistics.
+  static uint8_t getCommandCount() noexcept { return s_command_count_; }
+
+  /// Get name of a command with statistics (topic pattern or topic in Flash memory).
+  static const char* getCommandName(uint8_t index) noexcept { return s_command_stats_[index].name; }
+
+  /// Get statistics of a command.
+  static const MessageStats& getCommandStats(uint8_t index) noexcept { return s_command_stats_[index].stats; }
+
+  /// Get count of messages which were not handled by any handler.
+  static unsigned long getUnhandledCount() noexcept { return s_unhandled_count_; }
+
+  /// Get count of messages of commands, for which no statistics slot was free.
+  static unsigned long getCommandOverflowCount() noexcept { return s_command_overflow_count_; }
+
+  /// Reset statistics of all handlers and commands.
+  static void resetStats() noexcept;
+
 private:
+  /// Size of a chunk written at once to the network for streamed messages.
+  static constexpr uint8_t STREAM_CHUNK_SIZE = 32;
+
+  /// Helper stream to compute streamed payload size.
+  class StreamSizer : public Print
+  {
+  public:
+    virtual size_t write(uint8_t) override { ++size_; return 1; }
+    virtual size_t write(const uint8_t*, size_t size) override { size_ += size; return size; }
+    /// Get size of the payload written so far.
+    unsigned size() const noexcept { return size_; }
+  private:
+    unsigned size_ = 0;
+  };
+
+  /// Helper stream to write streamed payload in chunks.
+  class StreamWriter : public Print
+  {
+  public:
+    explicit StreamWriter(unsigned length) noexcept : remaining_(length) {}
+    /// Start sending the message.
+    bool begin(const char* topic, bool retained);
+    /// Finish sending the message, abort it, if the payload didn't match announced length.
+    bool end();
+    virtual size_t write(uint8_t c) override { return write(&c, 1); }
+    virtual size_t write(const uint8_t* buffer, size_t size) override;
+  private:
+    /// Write buffered chunk to the network.
+    void flushChunk();
+
+    Print* out_ = nullptr;              ///< Network stream.
+    unsigned remaining_;                ///< Remaining payload bytes.
+    bool overflow_ = false;             ///< Set, if the writer wrote more than announced.
+    uint8_t fill_ = 0;                  ///< Bytes filled in chunk buffer.
+    uint8_t chunk_[STREAM_CHUNK_SIZE];  ///< Chunk buffer.
+  };
+
+  /// Print debugging info for streamed message and return the stream for payload.
+  static Print& debugStreamBegin(const char* topic);
+
+  /// Finish debugging info for streamed message.
+  static void debugStreamEnd(bool retained);
+
   /*!
    * @brief Try to handle received message.
    *
@@ -314,10 +591,36 @@ private:
    */
   virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) = 0;
 
+  /// Statistics for one command.
+  struct CommandStats
+  {
+    const char* name;     ///< Command name in Flash memory.
+    MessageStats stats;   ///< Statistics.
+  };
+
+  /*!
+   * @brief Record statistics for a command.
+   *
+   * @param pattern command pattern in Flash memory set via setCommand() or @c nullptr.
+   * @param time handling time in microseconds.
+   * @param malformed if set, the message was rejected as malformed.
+   */
+  static void addCommandStats(const char* pattern, unsigned long time, bool malformed) noexcept;
+
   MessageHandler* next_;
   const __FlashStringHelper* name_;
+  MessageStats stats_;
   static MessageHandler* s_first_handler;
+  static const char* s_command_;
+  static bool s_malformed_;
+  static bool s_validating_;
+  static uint8_t s_command_count_;
+  static CommandStats s_command_stats_[MESSAGE_HANDLER_COMMAND_STATS];
+  static unsigned long s_unhandled_count_;
+  static unsigned long s_command_overflow_count_;
   static publish_callback s_cb_;
+  static begin_stream_callback s_begin_stream_cb_;
+  static end_stream_callback s_end_stream_cb_;
   static void *s_cb_arg_;
   static bool s_debug_;
 };
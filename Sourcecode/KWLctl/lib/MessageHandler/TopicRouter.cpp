@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "TopicRouter.h"
+
+/// Placeholder types.
+enum class PlaceholderType : uint8_t
+{
+  INVALID,
+  U8,
+  U16,
+  STRING
+};
+
+/// Parse placeholder type at the pattern position after '{' and move past '}'.
+static PlaceholderType parsePlaceholder(const char*& pattern) noexcept
+{
+  char type[4];
+  uint8_t len = 0;
+  for (;;) {
+    char c = char(pgm_read_byte(pattern++));
+    if (c == '}')
+      break;
+    if (c == 0 || len == sizeof(type) - 1)
+      return PlaceholderType::INVALID;
+    type[len++] = c;
+  }
+  type[len] = 0;
+  if (strcmp_P(type, PSTR("u8")) == 0)
+    return PlaceholderType::U8;
+  if (strcmp_P(type, PSTR("u16")) == 0)
+    return PlaceholderType::U16;
+  if (strcmp_P(type, PSTR("s")) == 0)
+    return PlaceholderType::STRING;
+  return PlaceholderType::INVALID;
+}
+
+bool TopicRouter::match(const char* pattern, const StringView& topic, TopicParams& params) noexcept
+{
+  const char* t = topic.c_str();
+  const char* const end = t + topic.length();
+  params.count_ = 0;
+  for (;;) {
+    char c = char(pgm_read_byte(pattern++));
+    if (c == 0)
+      return t == end;
+    if (c != '{') {
+      if (t == end || *t != c)
+        return false;
+      ++t;
+      continue;
+    }
+
+    // placeholder
+    auto type = parsePlaceholder(pattern);
+    if (type == PlaceholderType::INVALID || params.count_ == TopicParams::MAX_PARAMS)
+      return false;
+    auto& param = params.params_[params.count_++];
+    param.str = t;
+    param.value = 0;
+    if (type == PlaceholderType::STRING) {
+      while (t != end && *t != '/')
+        ++t;
+    } else {
+      const unsigned long limit = (type == PlaceholderType::U8) ? 0xffUL : 0xffffUL;
+      unsigned long value = 0;
+      while (t != end && *t >= '0' && *t <= '9') {
+        value = value * 10 + unsigned(*t++ - '0');
+        if (value > limit)
+          return false;
+      }
+      param.value = unsigned(value);
+    }
+    if (t == param.str || t - param.str > 255)
+      return false; // empty or too long parameter
+    param.len = uint8_t(t - param.str);
+  }
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Declarative router for parametric MQTT command topics.
+ *
+ * Command families addressed by an index or a name (e.g., `program/05/data`)
+ * are described by topic patterns stored in Flash memory. A pattern is
+ * a literal topic containing placeholders, which are parsed while matching:
+ *
+ * - `{u8}` - decimal number 0-255,
+ * - `{u16}` - decimal number 0-65535,
+ * - `{s}` - non-empty string up to the next `/` or the end of the topic.
+ *
+ * Patterns and their handlers are collected in a routing table in Flash
+ * memory, for example:
+ * @code
+ * static const TopicRoute<MyHandler> s_routes[] PROGMEM = {
+ *   { MQTTTopic::CmdFooAll.data_P(), &MyHandler::handleFooAll },
+ *   { MQTTTopic::CmdFoo.data_P(), &MyHandler::handleFoo },     // "foo/{u8}/bar"
+ * };
+ *
+ * bool MyHandler::mqttReceiveMsg(const StringView& topic, const StringView& s) {
+ *   return routeTopic(*this, s_routes, topic, s);
+ * }
+ * @endcode
+ *
+ * Routes are tried in table order, so more specific routes (like `foo/all/bar`)
+ * have to precede more generic ones. The pattern of the matching route is used
+ * as command name for MessageHandler statistics.
+ */
+#pragma once
+
+#include "MessageHandler.h"
+
+/*!
+ * @brief Parameters parsed from topic placeholders.
+ */
+class TopicParams
+{
+public:
+  /// Maximum number of placeholders in one pattern.
+  static constexpr uint8_t MAX_PARAMS = 4;
+
+  /// Get count of parsed parameters.
+  uint8_t size() const noexcept { return count_; }
+
+  /// Get numeric value of a parameter (0 for string parameters).
+  unsigned getNumber(uint8_t index) const noexcept {
+    return index < count_ ? params_[index].value : 0;
+  }
+
+  /// Get textual value of a parameter as found in the topic.
+  StringView getString(uint8_t index) const noexcept {
+    if (index >= count_)
+      return StringView();
+    return StringView(params_[index].str, params_[index].len);
+  }
+
+private:
+  friend class TopicRouter;
+
+  /// One parsed parameter.
+  struct Param
+  {
+    const char* str;  ///< Start of the parameter in the topic.
+    uint8_t len;      ///< Length of the parameter in the topic.
+    unsigned value;   ///< Numeric value of the parameter.
+  };
+
+  Param params_[MAX_PARAMS];  ///< Parsed parameters.
+  uint8_t count_ = 0;         ///< Count of parsed parameters.
+};
+
+/*!
+ * @brief One route of a routing table.
+ *
+ * @tparam T handler class.
+ */
+template<class T>
+struct TopicRoute
+{
+  /// Signature of a handler method. Return @c false to continue with next route.
+  using handler_type = bool (T::*)(const TopicParams& params, const StringView& payload);
+
+  const char* pattern;    ///< Topic pattern in Flash memory.
+  handler_type handler;   ///< Handler method to call for matching topic.
+};
+
+/*!
+ * @brief Matcher for topic patterns.
+ */
+class TopicRouter
+{
+public:
+  /*!
+   * @brief Match a topic against a pattern.
+   *
+   * The topic is matched in a single pass, placeholders are parsed on the fly.
+   *
+   * @param pattern topic pattern in Flash memory.
+   * @param topic topic to match.
+   * @param params parameters parsed from placeholders.
+   * @return @c true, if the topic matches the pattern, @c false otherwise.
+   */
+  static bool match(const char* pattern, const StringView& topic, TopicParams& params) noexcept;
+};
+
+/*!
+ * @brief Route a message to the handler of the first matching route.
+ *
+ * @param instance instance on which to call the handler.
+ * @param routes routing table in Flash memory.
+ * @param topic message topic.
+ * @param payload message payload.
+ * @return @c true, if the message was handled, @c false otherwise.
+ */
+template<class T, unsigned N>
+bool routeTopic(T& instance, const TopicRoute<T> (&routes)[N], const StringView& topic, const StringView& payload)
+{
+  TopicParams params;
+  for (auto& entry : routes) {
+    TopicRoute<T> route;
+    memcpy_P(&route, &entry, sizeof(route));
+    if (TopicRouter::match(route.pattern, topic, params)) {
+      MessageHandler::setCommand(route.pattern);
+      if ((instance.*route.handler)(params, payload))
+        return true;
+    }
+  }
+  return false;
+}
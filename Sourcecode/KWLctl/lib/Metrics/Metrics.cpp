@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "Metrics.h"
+
+#include <Arduino.h>
+
+Metric* Metric::s_first_metric_ = nullptr;
+
+Metric::Metric(const __FlashStringHelper* name, const __FlashStringHelper* help, Type type, Sampler sampler, void* arg) noexcept :
+  name_(name),
+  help_(help),
+  sampler_(sampler),
+  arg_(arg),
+  type_(type),
+  next_(s_first_metric_)
+{
+  s_first_metric_ = this;
+}
+
+void Metric::printTo(Print& out) const
+{
+  out.print(F("# HELP "));
+  out.print(name_);
+  out.print(' ');
+  out.print(help_);
+  out.print(F("\n# TYPE "));
+  out.print(name_);
+  out.print(type_ == Type::Counter ? F(" counter\n") : F(" gauge\n"));
+  Writer writer(out, *this);
+  sampler_(writer, arg_);
+}
+
+void Metric::printAll(Print& out)
+{
+  for (auto i = begin(); i != end(); ++i)
+    i->printTo(out);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Registry of named metrics exposed in Prometheus text format.
+ */
+#pragma once
+
+#include <Print.h>
+
+/*!
+ * @brief A named metric (counter or gauge) registered in the global metrics registry.
+ *
+ * Metrics don't store values. Each metric has a sampler function, which
+ * reads live values (e.g., from module state) and writes them as one or
+ * more samples, optionally labeled, when the registry is printed. Name and
+ * help text reside in Flash, so a metric takes only a few bytes of RAM.
+ *
+ * Like Scheduler::TaskTimingStats, metrics register themselves in a global
+ * intrusive list upon construction, so typically they are declared as
+ * members of the module providing the values:
+ * @code
+ * Metric rpm_metric_{F("kwl_fan_rpm"), F("Fan speed"), Metric::Type::Gauge,
+ *   [](Metric::Writer& out, void* arg) {
+ *     out.sample(F("fan"), F("1"), static_cast<MyModule*>(arg)->getSpeed());
+ *   }, this};
+ * @endcode
+ */
+class Metric
+{
+public:
+  Metric(const Metric&) = delete;
+  Metric& operator=(const Metric&) = delete;
+
+  /// Metric type.
+  enum class Type : uint8_t
+  {
+    Counter,  ///< Monotonically increasing value.
+    Gauge     ///< Value which can go up and down.
+  };
+
+  /// Writer of samples of one metric in Prometheus text format.
+  class Writer
+  {
+  public:
+    /// Write an unlabeled sample.
+    template<typename T>
+    void sample(T value)
+    {
+      out_.print(metric_.name_);
+      out_.print(' ');
+      value_(value);
+    }
+
+    /// Write a sample with one label.
+    template<typename L, typename T>
+    void sample(const __FlashStringHelper* label, L label_value, T value)
+    {
+      out_.print(metric_.name_);
+      out_.print('{');
+      out_.print(label);
+      out_.print(F("=\""));
+      out_.print(label_value);
+      out_.print(F("\"} "));
+      value_(value);
+    }
+
+  private:
+    friend class Metric;
+    Writer(Print& out, const Metric& metric) noexcept : out_(out), metric_(metric) {}
+
+    template<typename T>
+    void value_(T value) { out_.print(value); out_.print('\n'); }
+    void value_(double value) { out_.print(value, 2); out_.print('\n'); }
+
+    Print& out_;            ///< Output stream.
+    const Metric& metric_;  ///< Metric being written.
+  };
+
+  /// Function writing samples of a metric.
+  using Sampler = void (*)(Writer& out, void* arg);
+
+  /// Iterator over metrics.
+  class iterator
+  {
+  public:
+    Metric& operator*() noexcept { return *cur_; }
+    Metric* operator->() noexcept { return cur_; }
+
+    /// Move to the next metric.
+    iterator& operator++() noexcept { cur_ = cur_->next_; return *this; }
+
+  private:
+    friend class Metric;
+    explicit iterator(Metric* ptr) noexcept : cur_(ptr) {}
+    friend bool operator==(const iterator& l, const iterator& r) noexcept { return l.cur_ == r.cur_; }
+    friend bool operator!=(const iterator& l, const iterator& r) noexcept { return l.cur_ != r.cur_; }
+    Metric* cur_;
+  };
+
+  /*!
+   * @brief Construct and register a metric.
+   *
+   * @param name metric name (in Flash), e.g., @c kwl_fan_rpm.
+   * @param help help text (in Flash).
+   * @param type metric type.
+   * @param sampler function writing samples.
+   * @param arg argument to pass to the sampler.
+   */
+  Metric(const __FlashStringHelper* name, const __FlashStringHelper* help, Type type, Sampler sampler, void* arg = nullptr) noexcept;
+
+  /// Get metric name.
+  const __FlashStringHelper* getName() const noexcept { return name_; }
+
+  /// Print the metric (help, type and all samples) in Prometheus text format.
+  void printTo(Print& out) const;
+
+  /// Print all registered metrics in Prometheus text format.
+  static void printAll(Print& out);
+
+  /// Get iterator to the first metric.
+  static iterator begin() noexcept { return iterator(s_first_metric_); }
+
+  /// Get iterator past the last metric.
+  static iterator end() noexcept { return iterator(nullptr); }
+
+private:
+  const __FlashStringHelper* name_;   ///< Metric name.
+  const __FlashStringHelper* help_;   ///< Help text.
+  Sampler sampler_;                   ///< Function writing samples.
+  void* arg_;                         ///< Argument for the sampler.
+  Type type_;                         ///< Metric type.
+  Metric* next_;                      ///< Next metric in the list.
+
+  /// First metric.
+  static Metric* s_first_metric_;
+};
@@ -34,6 +34,8 @@ static constexpr uint32_t NTP_FRACTION_DIVIDER = 4294968UL;
 static constexpr uint32_t NTP_INITIAL_QUERY_INTERVAL = 5UL*1000;
 /// Re-query time every 5 minutes.
 static constexpr uint32_t NTP_QUERY_INTERVAL = 5UL*60*1000;
+/// Stop waiting for a reply after 2 seconds.
+static constexpr uint32_t NTP_REPLY_TIMEOUT = 2000;
 /// Expire NTP information after 14 days of no new time.
 static constexpr uint32_t NTP_INVALID_INTERVAL = 14UL*24*60*60*1000;
 
@@ -99,13 +101,20 @@ void MicroNTP::begin(IPAddress server_ip)
     Serial.println(F("ERROR: Cannot start NTP client, out of sockets"));
 }
 
-void MicroNTP::loop()
+bool MicroNTP::loop()
 {
   auto ms = millis();
-  if (parseReply(ms))
-    return;
-
   auto delta = ms - sent_time_ms_;
+  if (request_outstanding_) {
+    if (parseReply(ms))
+      return true;
+    if (delta < NTP_REPLY_TIMEOUT)
+      return true;
+    if (DEBUG)
+      Serial.println(F("NTP: no reply received"));
+    request_outstanding_ = false;
+  }
+
   if (delta >= NTP_INVALID_INTERVAL && current_ntp_time_) {
     if (DEBUG)
       Serial.println(F("NTP: time expired, no NTP reply since long time (2 weeks default)"));
@@ -115,11 +124,14 @@ void MicroNTP::loop()
     if (DEBUG)
       Serial.println(F("NTP: query interval reached"));
     sendRequest(ms);
+    return true;
   } else if (!current_ntp_time_ && delta > NTP_INITIAL_QUERY_INTERVAL) {
     if (DEBUG)
       Serial.println(F("NTP: no time yet and initial query interval reached"));
     sendRequest(ms);
+    return true;
   }
+  return false;
 }
 
 void MicroNTP::forceQuery()
@@ -127,6 +139,7 @@ void MicroNTP::forceQuery()
   if (DEBUG)
     Serial.println(F("NTP: forcing query"));
   sent_time_ms_ = millis() - NTP_QUERY_INTERVAL;
+  request_outstanding_ = false;
 }
 
 unsigned long MicroNTP::currentTime() const
@@ -177,6 +190,7 @@ bool MicroNTP::sendRequest(uint32_t ms)
     Serial.println(ms);
   }
   sent_time_ms_ = ms;
+  request_outstanding_ = res;
   return res;
 }
 
@@ -201,6 +215,7 @@ bool MicroNTP::parseReply(uint32_t ms)
       return false;
     }
     // assume NTP packet
+    request_outstanding_ = false;
     auto expected_time = currentTime();
     ntp_packet tmp;
     udp_.read(reinterpret_cast<uint8_t*>(&tmp), sizeof(ntp_packet));
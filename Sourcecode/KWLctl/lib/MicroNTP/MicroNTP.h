@@ -53,8 +53,20 @@ public:
    */
   void begin(IPAddress server_ip);
 
-  /// Call in loop to update time.
-  void loop();
+  /// Change NTP server, new server is used for the next query.
+  void setServer(IPAddress server_ip) { ip_ = server_ip; }
+
+  /*!
+   * @brief Call in loop to update time.
+   *
+   * The UDP backend is only polled for a reply while a request is outstanding.
+   *
+   * @return true, if the UDP backend was accessed.
+   */
+  bool loop();
+
+  /// Check if a request was sent and the reply is still expected.
+  bool isRequestOutstanding() const { return request_outstanding_; }
 
   /// Force sending query on next loop() call.
   void forceQuery();
@@ -129,4 +141,5 @@ private:
   unsigned long receive_time_ms_ = 0;   ///< Millis() timer at the time packet came in.
   unsigned long current_ntp_time_ = 0;  ///< NTP time from NTP packet.
   unsigned int ntp_time_millis_fract_;  ///< NTP time fraction in milliseconds.
+  bool request_outstanding_ = false;    ///< Set while waiting for a reply.
 };
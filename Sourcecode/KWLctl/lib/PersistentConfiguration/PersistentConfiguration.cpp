@@ -28,6 +28,11 @@ static constexpr int EEPROM_MIN_ADDR = 0;
 /// Address past addressable EEPROM contents.
 static constexpr int EEPROM_MAX_ADDR = 1024;
 
+bool PersistentConfigurationBase::s_tx_active_ = false;
+int PersistentConfigurationBase::s_tx_begin_ = EEPROM_MAX_ADDR;
+int PersistentConfigurationBase::s_tx_end_ = EEPROM_MIN_ADDR;
+unsigned long PersistentConfigurationBase::s_write_count_ = 0;
+
 void PersistentConfigurationBase::begin(Print& out, unsigned int size, unsigned int version, LoadFnc load_defaults, LoadFnc migrate, bool reset)
 {
   out.println(F("Reading EEPROM contents..."));
@@ -88,6 +93,16 @@ void PersistentConfigurationBase::factoryReset(unsigned size)
   updateRange(this, size);
 }
 
+void PersistentConfigurationBase::reload(unsigned size)
+{
+  uint8_t* data = reinterpret_cast<uint8_t*>(this);
+  int limit = int(EEPROM_MIN_ADDR + size);
+  if (limit > EEPROM_MAX_ADDR)
+    limit = EEPROM_MAX_ADDR;
+  for (int i = EEPROM_MIN_ADDR; i < limit; ++i)
+    *data++ = EEPROM.read(i);
+}
+
 bool PersistentConfigurationBase::updateRange(const void* ptr, unsigned int size) const {
   const uint8_t* data = reinterpret_cast<const uint8_t*>(ptr);
   int addr = data - reinterpret_cast<const uint8_t*>(this);
@@ -96,11 +111,46 @@ bool PersistentConfigurationBase::updateRange(const void* ptr, unsigned int size
     return false;
   if (limit > EEPROM_MAX_ADDR)
     return false;
-  while (addr < limit)
-    EEPROM.update(addr++, *data++);
+  if (s_tx_active_) {
+    // only record modified range, will be written on commit
+    if (addr < s_tx_begin_)
+      s_tx_begin_ = addr;
+    if (limit > s_tx_end_)
+      s_tx_end_ = limit;
+    return true;
+  }
+  return writeRange(addr, limit);
+}
+
+bool PersistentConfigurationBase::writeRange(int addr, int limit) const {
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(this) + addr;
+  for (; addr < limit; ++addr, ++data) {
+    // like EEPROM.update(), but count real writes to monitor EEPROM wear
+    if (EEPROM.read(addr) != *data) {
+      EEPROM.write(addr, *data);
+      ++s_write_count_;
+    }
+  }
   return true;
 }
 
+void PersistentConfigurationBase::beginTransaction() noexcept
+{
+  s_tx_active_ = true;
+  s_tx_begin_ = EEPROM_MAX_ADDR;
+  s_tx_end_ = EEPROM_MIN_ADDR;
+}
+
+bool PersistentConfigurationBase::commitTransaction() const
+{
+  if (!s_tx_active_)
+    return false;
+  s_tx_active_ = false;
+  if (s_tx_begin_ >= s_tx_end_)
+    return true;  // nothing modified
+  return writeRange(s_tx_begin_, s_tx_end_);
+}
+
 void PersistentConfigurationBase::dumpRaw(Print& out, unsigned bytes_per_row)
 {
   unsigned j = 0;
@@ -33,6 +33,35 @@ class Print;
 class PersistentConfigurationBase
 {
 public:
+  /*!
+   * @brief Start a configuration transaction.
+   *
+   * Until commitTransaction() is called, updates of configuration members
+   * are only done in memory and the range of modified bytes is recorded.
+   * This allows changing several settings at once with a single pass over
+   * the EEPROM.
+   */
+  static void beginTransaction() noexcept;
+
+  /*!
+   * @brief Commit the configuration transaction.
+   *
+   * Write all bytes modified since beginTransaction() to EEPROM in one
+   * coalesced update.
+   *
+   * @return @c true, if data updated, @c false if out of range.
+   */
+  bool commitTransaction() const;
+
+  /// Check whether a configuration transaction is active.
+  static bool inTransaction() noexcept { return s_tx_active_; }
+
+  /// Get configuration version stored in the configuration.
+  unsigned int getVersion() const noexcept { return version_; }
+
+  /// Get count of bytes actually written to EEPROM since start (unchanged bytes are not written).
+  static unsigned long getWriteCount() noexcept { return s_write_count_; }
+
 protected:
   /// Function to load defaults.
   using LoadFnc = void (PersistentConfigurationBase::*)();
@@ -65,6 +94,9 @@ protected:
   /*!
    * @brief Update arbitrary section of the configuration.
    *
+   * If a transaction is active, the section is only recorded as modified and
+   * written to EEPROM upon commitTransaction().
+   *
    * @param ptr pointer to part of the configuration.
    * @param size size to update.
    * @return @c true, if data updated, @c false if out of range.
@@ -88,11 +120,26 @@ protected:
    */
   void factoryReset(unsigned size);
 
+  /*!
+   * @brief Discard changes in memory by reading the configuration from EEPROM again.
+   *
+   * @param size real size of the config.
+   */
+  void reload(unsigned size);
+
 private:
+  /// Write a section of the configuration to EEPROM.
+  bool writeRange(int addr, int limit) const;
+
   /// Version counter.
   unsigned int version_;
 
   // NOTE: no data members allowed here (except version)!
+
+  static bool s_tx_active_;   ///< Set, if a transaction is active.
+  static int s_tx_begin_;     ///< Start of the range modified in the transaction.
+  static int s_tx_end_;       ///< End of the range modified in the transaction.
+  static unsigned long s_write_count_;  ///< Count of bytes written to EEPROM.
 };
 
 /*!
@@ -154,6 +201,14 @@ public:
    */
   void factoryReset() { PersistentConfigurationBase::factoryReset(sizeof(T)); }
 
+  /*!
+   * @brief Discard changes in memory by reading the configuration from EEPROM again.
+   *
+   * Use this after the raw image in memory was overwritten, but the new
+   * contents turned out to be invalid.
+   */
+  void reload() { PersistentConfigurationBase::reload(sizeof(T)); }
+
 protected:
   /// Default migrate is empty.
   void migrate() {}
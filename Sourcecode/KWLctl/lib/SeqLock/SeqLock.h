@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+/*!
+ * @file
+ * @brief Sequence lock for data shared with interrupt routines.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*!
+ * @brief Sequence lock for data shared with interrupt routines.
+ *
+ * The writer (typically an interrupt routine) increments the sequence
+ * counter before and after changing the data, so the counter is odd while
+ * the data is being changed. The reader copies the data and checks that the
+ * counter was even and didn't change in the meantime, otherwise it copies
+ * the data again. Thus, the reader gets a consistent copy without disabling
+ * interrupts and the writer never waits.
+ *
+ * Writers must not run concurrently. If there is a writer outside of the
+ * interrupt routine (e.g., resetting the data), it must disable interrupts.
+ *
+ * The sequence counter is 8 bits by default, which suffices, as long as
+ * the writer can't run 128 times during a single read. On AVR, the reader
+ * is interrupted by complete writes only, so a read is retried at most once
+ * per interrupt.
+ *
+ * Example:
+ * @code
+ * SeqLock<Data> data_;
+ *
+ * void interrupt() {
+ *   SeqLock<Data>::Writer w(data_);
+ *   w.data().value += 1;
+ * }
+ *
+ * void loop() {
+ *   Data copy = data_.read();
+ *   ...
+ * }
+ * @endcode
+ *
+ * @tparam T type of the data (must be trivially copyable).
+ * @tparam Seq type of the sequence counter (unsigned integer).
+ */
+template<typename T, typename Seq = uint8_t>
+class SeqLock
+{
+public:
+  /// Writer guard, changes the data during its lifetime.
+  class Writer
+  {
+  public:
+    /// Start writing.
+    explicit Writer(SeqLock& lock) noexcept : lock_(lock)
+    {
+      lock_.seq_ = Seq(lock_.seq_ + 1);
+      barrier();
+    }
+
+    /// Finish writing.
+    ~Writer() noexcept
+    {
+      barrier();
+      lock_.seq_ = Seq(lock_.seq_ + 1);
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    /// Get the data to change.
+    T& data() noexcept { return lock_.data_; }
+
+  private:
+    SeqLock& lock_;
+  };
+
+  /// Get a consistent copy of the data.
+  T read() const noexcept
+  {
+    for (;;) {
+      const Seq seq = seq_;
+      barrier();
+      const T copy = data_;
+      barrier();
+      if (!(seq & 1) && seq == seq_)
+        return copy;
+    }
+  }
+
+  /// Get the data without synchronization (writer context or debugging output only).
+  const T& peek() const noexcept { return data_; }
+
+private:
+  /// Prevent the compiler (and on other platforms, the CPU) from moving memory accesses across.
+  static void barrier() noexcept
+  {
+#ifdef __AVR__
+    __asm__ __volatile__ ("" ::: "memory");
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+  }
+
+  /// Sequence counter, odd while writing.
+  volatile Seq seq_ = 0;
+  /// Protected data.
+  T data_ = T();
+};
@@ -70,6 +70,26 @@ public:
   long toInt() const noexcept {
     return atol(data_);
   }
+
+  /*!
+   * @brief Parse the whole string as decimal integer.
+   *
+   * @param value set to the parsed value.
+   * @return @c true, if the string is a valid integer, @c false otherwise.
+   */
+  bool parseInt(long& value) const noexcept {
+    size_t i = (length_ > 0 && (data_[0] == '-' || data_[0] == '+')) ? 1 : 0;
+    if (i == length_ || length_ - i > 9)
+      return false;
+    long v = 0;
+    for (size_t j = i; j < length_; ++j) {
+      if (data_[j] < '0' || data_[j] > '9')
+        return false;
+      v = v * 10 + (data_[j] - '0');
+    }
+    value = (data_[0] == '-') ? -v : v;
+    return true;
+  }
   float toFloat() const noexcept {
     return float(atof(data_));
   }
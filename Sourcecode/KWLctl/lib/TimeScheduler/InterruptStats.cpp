@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "InterruptStats.h"
+
+#include <Arduino.h>
+
+using namespace Scheduler;
+
+InterruptStats* InterruptStats::s_first_stat_ = nullptr;
+
+InterruptStats::InterruptStats(const __FlashStringHelper* name) noexcept :
+  name_(name),
+  next_(s_first_stat_)
+{
+  s_first_stat_ = this;
+}
+
+#ifndef __AVR__
+uint8_t InterruptStats::ticks() noexcept
+{
+  return uint8_t(micros() * (F_CPU / 1000000UL) / CYCLES_PER_TICK);
+}
+#endif
+
+unsigned long InterruptStats::getCount() const noexcept
+{
+  noInterrupts();
+  auto count = count_;
+  interrupts();
+  return count;
+}
+
+void InterruptStats::update() noexcept
+{
+  noInterrupts();
+  const auto count = count_;
+  const auto ticks = ticks_;
+  interrupts();
+  const auto now = micros();
+  const unsigned long elapsed = now - last_time_;
+  const unsigned long dcount = count - last_count_;
+  const unsigned long dticks = ticks - last_ticks_;
+  last_count_ = count;
+  last_ticks_ = ticks;
+  last_time_ = now;
+  if (elapsed < 1000)
+    return;
+
+  // time spent in interrupts in microseconds
+  const unsigned long busy = dticks * CYCLES_PER_TICK / (F_CPU / 1000000UL);
+  rate_ = unsigned(dcount * 1000 / (elapsed / 1000));
+  load_ = unsigned(busy * 1000 / elapsed);
+  avg_cycles_ = dcount ? unsigned(dticks * CYCLES_PER_TICK / dcount) : 0;
+  if (rate_ > max_rate_)
+    max_rate_ = rate_;
+  if (load_ > max_load_)
+    max_load_ = load_;
+}
+
+void InterruptStats::printTo(Print& out) const
+{
+  out.print(F("ips "));
+  out.print(rate_);
+  out.print(F(" mips "));
+  out.print(max_rate_);
+  out.print(F(" load "));
+  out.print(load_);
+  out.print(F(" mload "));
+  out.print(max_load_);
+  out.print(F(" cyc "));
+  out.print(avg_cycles_);
+  out.print(F(" mcyc "));
+  out.print(getMaxCycles());
+}
+
+void InterruptStats::resetMaximum() noexcept
+{
+  max_rate_ = 0;
+  max_load_ = 0;
+  max_ticks_ = 0;
+}
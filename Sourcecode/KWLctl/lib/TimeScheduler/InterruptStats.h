@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+/*!
+ * @file
+ * @brief Load statistics for interrupt routines.
+ */
+#pragma once
+
+#include <stdint.h>
+#ifdef __AVR__
+#include <avr/io.h>
+#endif
+
+class __FlashStringHelper;
+class Print;
+
+namespace Scheduler
+{
+  /*!
+   * @brief Statistics for interrupt routine load.
+   *
+   * Interrupt routines to measure construct a Measure object at their start.
+   * It counts the interrupt and accumulates the time spent in the routine.
+   * The time is read from Timer 0, which the Arduino core runs at F_CPU/64
+   * for millis(). This costs only two register reads, but a single
+   * measurement has a resolution of 64 cycles (4us). Since interrupts come
+   * at random phase of the timer, the average over many interrupts is exact.
+   * Entry and exit of the interrupt (saving and restoring registers) are
+   * not included. Off AVR, the ticks are derived from micros().
+   *
+   * The main loop calls update() once per second to compute interrupt rate
+   * and CPU load in the last interval.
+   */
+  class InterruptStats
+  {
+  public:
+    /// Iterator over statistics.
+    class iterator
+    {
+    public:
+      InterruptStats& operator*() noexcept { return *cur_; }
+      InterruptStats* operator->() noexcept { return cur_; }
+
+      /// Move to the next interrupt.
+      iterator& operator++() noexcept { cur_ = cur_->next_; return *this; }
+
+    private:
+      friend class InterruptStats;
+      explicit iterator(InterruptStats* ptr) noexcept : cur_(ptr) {}
+      friend bool operator==(const iterator& l, const iterator& r) noexcept { return l.cur_ == r.cur_; }
+      friend bool operator!=(const iterator& l, const iterator& r) noexcept { return l.cur_ != r.cur_; }
+      InterruptStats* cur_;
+    };
+
+    /// Measurement of one interrupt, construct at the start of the interrupt routine.
+    class Measure
+    {
+    public:
+      /// Start measurement (no-op for @c nullptr statistics).
+      explicit Measure(InterruptStats* stats) noexcept : stats_(stats), start_(stats ? ticks() : 0) {}
+
+      ~Measure() noexcept { if (stats_) stats_->add(uint8_t(ticks() - start_)); }
+
+      Measure(const Measure&) = delete;
+      Measure& operator=(const Measure&) = delete;
+
+    private:
+      InterruptStats* stats_;
+      uint8_t start_;
+    };
+
+    /// CPU cycles per tick of Timer 0.
+    static constexpr unsigned CYCLES_PER_TICK = 64;
+
+    /// Construct stats for a given interrupt name.
+    explicit InterruptStats(const __FlashStringHelper* name) noexcept;
+
+    /// Get statistics name.
+    const __FlashStringHelper* getName() const noexcept { return name_; }
+
+    /// Compute rate and load since last call (call about once per second).
+    void update() noexcept;
+
+    /// Get count of interrupts since start.
+    unsigned long getCount() const noexcept;
+
+    /// Get interrupts per second in the last interval.
+    unsigned getRate() const noexcept { return rate_; }
+
+    /// Get maximum interrupts per second.
+    unsigned getMaxRate() const noexcept { return max_rate_; }
+
+    /// Get CPU load in the last interval in per mille.
+    unsigned getLoad() const noexcept { return load_; }
+
+    /// Get maximum CPU load in per mille.
+    unsigned getMaxLoad() const noexcept { return max_load_; }
+
+    /// Get average cycles per interrupt in the last interval.
+    unsigned getAvgCycles() const noexcept { return avg_cycles_; }
+
+    /// Get maximum cycles of one interrupt (resolution CYCLES_PER_TICK).
+    unsigned getMaxCycles() const noexcept { return max_ticks_ * CYCLES_PER_TICK; }
+
+    /// Print statistics to a stream.
+    void printTo(Print& out) const;
+
+    /// Reset maximum.
+    void resetMaximum() noexcept;
+
+    /// Get iterator to the first interrupt.
+    static iterator begin() noexcept { return iterator(s_first_stat_); }
+
+    /// Get iterator past the last interrupt.
+    static iterator end() noexcept { return iterator(nullptr); }
+
+  private:
+    /// Get current time in Timer 0 ticks (wraps around).
+#ifdef __AVR__
+    static uint8_t ticks() noexcept { return TCNT0; }
+#else
+    static uint8_t ticks() noexcept;
+#endif
+
+    /// Record one interrupt (called from the interrupt routine).
+    void add(uint8_t ticks) noexcept
+    {
+      count_ = count_ + 1;
+      ticks_ = ticks_ + ticks;
+      if (ticks > max_ticks_)
+        max_ticks_ = ticks;
+    }
+
+    /// Interrupt name.
+    const __FlashStringHelper* name_;
+    /// Count of interrupts.
+    volatile unsigned long count_ = 0;
+    /// Sum of Timer 0 ticks spent in interrupts.
+    volatile unsigned long ticks_ = 0;
+    /// Maximum Timer 0 ticks spent in one interrupt.
+    volatile uint8_t max_ticks_ = 0;
+    /// Count at the last update.
+    unsigned long last_count_ = 0;
+    /// Ticks at the last update.
+    unsigned long last_ticks_ = 0;
+    /// Time of the last update in microseconds.
+    unsigned long last_time_ = 0;
+    /// Interrupts per second in the last interval.
+    unsigned rate_ = 0;
+    /// Maximum interrupts per second.
+    unsigned max_rate_ = 0;
+    /// CPU load in per mille in the last interval.
+    unsigned load_ = 0;
+    /// Maximum CPU load in per mille.
+    unsigned max_load_ = 0;
+    /// Average cycles per interrupt in the last interval.
+    unsigned avg_cycles_ = 0;
+    /// Next interrupt statistics in the list.
+    InterruptStats* next_;
+    /// First statistics.
+    static InterruptStats* s_first_stat_;
+  };
+}
@@ -19,8 +19,7 @@
 
 #include "TaskTimingStats.h"
 
-#include <avr/pgmspace.h>
-#include <stdio.h>
+#include <Print.h>
 
 using namespace Scheduler;
 
@@ -62,12 +61,18 @@ unsigned long TaskTimingStats::getMaxRuntimeSinceStart() const noexcept
   return max_runtime_ > max_runtime_since_start_ ? max_runtime_ : max_runtime_since_start_;
 }
 
-void TaskTimingStats::toString(char* buffer, unsigned size) const noexcept
+void TaskTimingStats::printTo(Print& out) const
 {
-  auto FORMAT = PSTR("max %lu smax %lu avg %lu cnt %lu adj %lu");
-  snprintf_P(buffer, size, FORMAT,
-    max_runtime_, getMaxRuntimeSinceStart(), getAvgRuntime(),
-    count_runtime_, adjust_count_runtime_);
+  out.print(F("max "));
+  out.print(max_runtime_);
+  out.print(F(" smax "));
+  out.print(getMaxRuntimeSinceStart());
+  out.print(F(" avg "));
+  out.print(getAvgRuntime());
+  out.print(F(" cnt "));
+  out.print(count_runtime_);
+  out.print(F(" adj "));
+  out.print(adjust_count_runtime_);
 }
 
 void TaskTimingStats::resetMaximum() noexcept
@@ -114,11 +119,14 @@ unsigned long TaskPollingStats::getMaxPolltimeSinceStart() const noexcept
   return max_polltime_ > max_polltime_since_start_ ? max_polltime_ : max_polltime_since_start_;
 }
 
-void TaskPollingStats::toString(char* buffer, unsigned size) const noexcept
+void TaskPollingStats::printTo(Print& out) const
 {
-  auto FORMAT = PSTR("pmax %lu spmax %lu pavg %lu");
-  snprintf_P(buffer, size, FORMAT,
-    max_polltime_, getMaxPolltimeSinceStart(), getAvgPolltime());
+  out.print(F("pmax "));
+  out.print(max_polltime_);
+  out.print(F(" spmax "));
+  out.print(getMaxPolltimeSinceStart());
+  out.print(F(" pavg "));
+  out.print(getAvgPolltime());
 }
 
 void TaskPollingStats::resetMaximum() noexcept
@@ -24,6 +24,7 @@
 #pragma once
 
 class __FlashStringHelper;
+class Print;
 
 namespace Scheduler
 {
@@ -82,12 +83,8 @@ namespace Scheduler
     /// Get number of measurements consolidated in order not to overflow long counters.
     unsigned long getConsolidatedMeasurementCount() const noexcept { return adjust_count_runtime_; }
 
-    /*!
-     * @brief Serialize statistics to a buffer.
-     *
-     * @param buffer,size buffer where to materialize the string (should be >=140B).
-     */
-    void toString(char* buffer, unsigned size) const noexcept;
+    /// Print statistics to a stream.
+    void printTo(Print& out) const;
 
     /// Reset maximum.
     void resetMaximum() noexcept;
@@ -166,12 +163,8 @@ namespace Scheduler
     /// Get average poll time.
     unsigned long getAvgPolltime() const noexcept;
 
-    /*!
-     * @brief Serialize statistics to a buffer.
-     *
-     * @param buffer,size buffer where to materialize the string (should be >=140B).
-     */
-    void toString(char* buffer, unsigned size) const noexcept;
+    /// Print statistics to a stream.
+    void printTo(Print& out) const;
 
     /// Reset maximum.
     void resetMaximum() noexcept;
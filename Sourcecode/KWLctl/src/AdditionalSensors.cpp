@@ -35,19 +35,6 @@ static constexpr unsigned long INTERVAL_MHZ14_READ            = 10000000;
 /// Time between VOC sensor readings (1s).
 static constexpr unsigned long INTERVAL_TGS2600_READ          =  1000000;
 
-/// Minimum time between communicating DHT values.
-static constexpr unsigned long INTERVAL_MQTT_DHT              =  5000000;
-/// Maximum time between communicating DHT values.
-static constexpr unsigned long INTERVAL_MQTT_DHT_FORCE        = 300000000; // 5 * 60 * 1000; 5 Minuten
-/// Minimum time between communicating CO2 values.
-static constexpr unsigned long INTERVAL_MQTT_MHZ14            = 60000000;
-/// Maximum time between communicating CO2 values.
-static constexpr unsigned long INTERVAL_MQTT_MHZ14_FORCE      = 300000000; // 5 * 60 * 1000; 5 Minuten
-/// Minimum time between communicating VOC values.
-static constexpr unsigned long INTERVAL_MQTT_TGS2600          =  5000000;
-/// Maximum time between communicating VOC values.
-static constexpr unsigned long INTERVAL_MQTT_TGS2600_FORCE    = 30000000;
-
 // DHT Sensoren
 static DHT_Unified dht1(KWLConfig::PinDHTSensor1, DHT22);
 static DHT_Unified dht2(KWLConfig::PinDHTSensor2, DHT22);
@@ -124,7 +111,8 @@ static int calcSensor_VOC(int valr)
 // ----------------------------- TGS2600 END --------------------------------
 
 
-AdditionalSensors::AdditionalSensors() :
+AdditionalSensors::AdditionalSensors(const KWLPersistentConfig& config) :
+  config_(config),
   stats_(F("AdditionalSensors")),
   dht1_read_(stats_, &AdditionalSensors::readDHT1, *this),
   dht2_read_(stats_, &AdditionalSensors::readDHT2, *this),
@@ -301,22 +289,22 @@ void AdditionalSensors::begin(Print& initTracer)
     dht2_read_.runRepeated(INTERVAL_DHT_READ);
   }
   if (DHT1_available_ || DHT2_available_) {
-    dht_send_task_.runRepeated(INTERVAL_DHT_READ + 1000000, INTERVAL_MQTT_DHT);
-    dht_send_oversample_task_.runRepeated(INTERVAL_DHT_READ + 1000000, INTERVAL_MQTT_DHT_FORCE);
+    dht_send_task_.runRepeated(INTERVAL_DHT_READ + 1000000, getInterval(ReportingParam::DHTMinInterval));
+    dht_send_oversample_task_.runRepeated(INTERVAL_DHT_READ + 1000000, getInterval(ReportingParam::DHTMaxInterval));
   }
 
   // MH-Z14 CO2 Sensor
   if (setupMHZ14()) {
     initTracer.print(F(" CO2"));
-    co2_send_task_.runRepeated(INTERVAL_MHZ14_READ + 1000000, INTERVAL_MQTT_MHZ14);
-    co2_send_oversample_task_.runRepeated(INTERVAL_MHZ14_READ + 1000000, INTERVAL_MQTT_MHZ14_FORCE);
+    co2_send_task_.runRepeated(INTERVAL_MHZ14_READ + 1000000, getInterval(ReportingParam::CO2MinInterval));
+    co2_send_oversample_task_.runRepeated(INTERVAL_MHZ14_READ + 1000000, getInterval(ReportingParam::CO2MaxInterval));
   }
 
   // TGS2600 VOC Sensor
   if (setupTGS2600()) {
     initTracer.print(F(" VOC"));
-    voc_send_task_.runRepeated(INTERVAL_MQTT_TGS2600 + 1000000, INTERVAL_MQTT_TGS2600);
-    voc_send_oversample_task_.runRepeated(INTERVAL_MQTT_TGS2600 + 1000000, INTERVAL_MQTT_TGS2600_FORCE);
+    voc_send_task_.runRepeated(getInterval(ReportingParam::VOCMinInterval) + 1000000, getInterval(ReportingParam::VOCMinInterval));
+    voc_send_oversample_task_.runRepeated(getInterval(ReportingParam::VOCMinInterval) + 1000000, getInterval(ReportingParam::VOCMaxInterval));
   }
 
   if (!DHT1_available_ && !DHT2_available_ && !MHZ14_available_ && !TGS2600_available_) {
@@ -336,11 +324,34 @@ void AdditionalSensors::forceSend() noexcept
     sendVOC(true);
 }
 
+void AdditionalSensors::reschedule() noexcept
+{
+  if (DHT1_available_ || DHT2_available_) {
+    dht_send_task_.runRepeated(getInterval(ReportingParam::DHTMinInterval));
+    dht_send_oversample_task_.runRepeated(getInterval(ReportingParam::DHTMaxInterval));
+  }
+  if (MHZ14_available_) {
+    co2_send_task_.runRepeated(getInterval(ReportingParam::CO2MinInterval));
+    co2_send_oversample_task_.runRepeated(getInterval(ReportingParam::CO2MaxInterval));
+  }
+  if (TGS2600_available_) {
+    voc_send_task_.runRepeated(getInterval(ReportingParam::VOCMinInterval));
+    voc_send_oversample_task_.runRepeated(getInterval(ReportingParam::VOCMaxInterval));
+  }
+}
+
+unsigned long AdditionalSensors::getInterval(ReportingParam param) const noexcept
+{
+  return config_.getMeasurementInterval(param) * 1000000UL;
+}
+
 void AdditionalSensors::sendDHT(bool force) noexcept
 {
+  auto min_diff_temp = config_.getReporting(ReportingParam::DHTMinDiffTemp) * 0.01f;
+  auto min_diff_hum = float(config_.getReporting(ReportingParam::DHTMinDiffHum));
   if (!force
-      && (abs(dht1_temp_ - dht1_last_sent_temp_) < 0.1f) && (abs(dht2_temp_ - dht2_last_sent_temp_) < 0.1f)
-      && (abs(dht1_hum_ - dht2_last_sent_hum_) < 1) && (abs(dht2_hum_ - dht2_last_sent_hum_) < 1)) {
+      && (abs(dht1_temp_ - dht1_last_sent_temp_) < min_diff_temp) && (abs(dht2_temp_ - dht2_last_sent_temp_) < min_diff_temp)
+      && (abs(dht1_hum_ - dht1_last_sent_hum_) < min_diff_hum) && (abs(dht2_hum_ - dht2_last_sent_hum_) < min_diff_hum)) {
     // not enough change, no point to send
     return;
   }
@@ -369,31 +380,33 @@ void AdditionalSensors::sendDHT(bool force) noexcept
     }
     return true;  // all sent
   });
-  dht_send_task_.runRepeated(INTERVAL_MQTT_DHT);
-  dht_send_oversample_task_.runRepeated(INTERVAL_MQTT_DHT_FORCE);
+  dht_send_task_.runRepeated(getInterval(ReportingParam::DHTMinInterval));
+  dht_send_oversample_task_.runRepeated(getInterval(ReportingParam::DHTMaxInterval));
 }
 
 void AdditionalSensors::sendCO2(bool force) noexcept
 {
-  if (!force && (abs(co2_ppm_ - co2_last_sent_ppm_) < 20)) {
+  if (!force && (abs(co2_ppm_ - co2_last_sent_ppm_) < int(config_.getReporting(ReportingParam::CO2MinDiff)))) {
     // not enough change
     return;
   }
+  co2_last_sent_ppm_ = co2_ppm_;
   if (co2_ppm_ >= 0)
     publish_co2_.publish(MQTTTopic::KwlCO2Abluft, co2_ppm_, KWLConfig::RetainAdditionalSensors);
   else if (KWLConfig::SendErroneousMeasurement)
     publish_co2_.publish(MQTTTopic::KwlCO2Abluft, -1, KWLConfig::RetainAdditionalSensors);
-  co2_send_task_.runRepeated(INTERVAL_MQTT_MHZ14);
-  co2_send_oversample_task_.runRepeated(INTERVAL_MQTT_MHZ14_FORCE);
+  co2_send_task_.runRepeated(getInterval(ReportingParam::CO2MinInterval));
+  co2_send_oversample_task_.runRepeated(getInterval(ReportingParam::CO2MaxInterval));
 }
 
 void AdditionalSensors::sendVOC(bool force) noexcept
 {
-  if (!force && (abs(voc_ - voc_last_sent_) < 20)) {
+  if (!force && (abs(voc_ - voc_last_sent_) < int(config_.getReporting(ReportingParam::VOCMinDiff)))) {
     // not enough change
     return;
   }
+  voc_last_sent_ = voc_;
   publish_voc_.publish(MQTTTopic::KwlVOCAbluft, voc_, 1, KWLConfig::RetainAdditionalSensors);
-  voc_send_task_.runRepeated(INTERVAL_MQTT_TGS2600);
-  voc_send_oversample_task_.runRepeated(INTERVAL_MQTT_TGS2600_FORCE);
+  voc_send_task_.runRepeated(getInterval(ReportingParam::VOCMinInterval));
+  voc_send_oversample_task_.runRepeated(getInterval(ReportingParam::VOCMaxInterval));
 }
@@ -26,10 +26,12 @@
 
 #include "TimeScheduler.h"
 #include "MessageHandler.h"
+#include "ReportingParam.h"
 
 #include <math.h>
 
 class Print;
+class KWLPersistentConfig;
 
 /*!
  * @brief Additional sensors of the ventilation system (optional).
@@ -40,7 +42,8 @@ class Print;
 class AdditionalSensors
 {
 public:
-  AdditionalSensors();
+  /// Construct sensors, reporting parameters are read from given configuration.
+  explicit AdditionalSensors(const KWLPersistentConfig& config);
 
   /// Initialize sensors.
   void begin(Print& initTracer);
@@ -48,6 +51,9 @@ public:
   /// Force sending values via MQTT on the next MQTT run.
   void forceSend() noexcept;
 
+  /// Reschedule sending values after reporting parameters changed.
+  void reschedule() noexcept;
+
   /// Check if DHT1 sensor is present.
   bool hasDHT1() const noexcept { return DHT1_available_; }
 
@@ -93,6 +99,9 @@ private:
   /// Read value of air quality sensor.
   void readVOC();
 
+  /// Get reporting interval in microseconds.
+  unsigned long getInterval(ReportingParam param) const noexcept;
+
   /// Schedule sending DHT values now.
   void sendDHT(bool force) noexcept;
   /// Schedule sending CO2 values now.
@@ -100,6 +109,9 @@ private:
   /// Schedule sending CO2 values now.
   void sendVOC(bool force) noexcept;
 
+  /// Configuration with reporting parameters.
+  const KWLPersistentConfig& config_;
+
   // sensor availability
   bool DHT1_available_ = false;
   bool DHT2_available_ = false;
@@ -23,9 +23,9 @@
 #include "StringView.h"
 #include "TempSensors.h"
 #include "FanControl.h"
+#include "DacOutput.h"
 #include "MQTTTopic.hpp"
 
-#include <Wire.h>
 
 /// Run the check every minute.
 static constexpr unsigned long INTERVAL_ANTIFREEZE_CHECK = 60000000;
@@ -44,15 +44,35 @@ static constexpr double EXHAUST_ANTIFREEZE_TEMP_THRESHOLD = 1.5;     // Nach kal
 static constexpr long MAX_TEMP_HYSTERESIS = 10;
 
 // PID REGLER
-static constexpr double heaterKp = 50, heaterKi = 0.1, heaterKd = 0.025;
+/// Sample time of the PID regulator (2s). SetFan ruft Preheater auf, deswegen ein Vielfaches
+/// des schnellen und gleich dem langsamen Regelintervall der Lüfter.
+static constexpr unsigned long HEATER_SAMPLE_TIME_MS = 2000;
+/// PID input unit is 1/16 degrees Celsius (resolution of temperature sensors).
+static constexpr int PID_TEMP_SCALE = 16;
+/// Tunings per degree Celsius converted to PID input unit.
+static constexpr FixedPID::Tunings heaterTunings =
+  FixedPID::tunings(50.0 / PID_TEMP_SCALE, 0.1 / PID_TEMP_SCALE, 0.025 / PID_TEMP_SCALE, HEATER_SAMPLE_TIME_MS);
+
+/// Convert temperature to PID input.
+static FixedPID::input_t pidTemp(double t)
+{
+  return FixedPID::input_t(t * PID_TEMP_SCALE + (t < 0 ? -0.5 : 0.5));
+}
+
+/// Temperature threshold plus hysteresis as PID setpoint.
+static FixedPID::input_t upperLimit(unsigned hysteresis)
+{
+  return pidTemp(EXHAUST_ANTIFREEZE_TEMP_THRESHOLD + hysteresis);
+}
 
-Antifreeze::Antifreeze(FanControl& fan, TempSensors& temp, KWLPersistentConfig& config) :
+Antifreeze::Antifreeze(FanControl& fan, TempSensors& temp, KWLPersistentConfig& config, DacOutput& dac) :
   MessageHandler(F("Antifreeze")),
   fan_(fan),
   temp_(temp),
   config_(config),
+  dac_(dac),
   hysteresis_temp_delta_(KWLConfig::StandardAntifreezeHystereseTemp),
-  pid_preheater_(&temp_.get_t4_exhaust(), &tech_setpoint_preheater_, &antifreeze_temp_upper_limit_, heaterKp, heaterKi, heaterKd, P_ON_M, DIRECT),
+  pid_preheater_(heaterTunings, HEATER_SAMPLE_TIME_MS, FixedPID::fromInt(100), FixedPID::fromInt(1000)),
   heating_app_comb_use_(KWLConfig::StandardHeatingAppCombUse != 0),
   stats_(F("Antifreeze")),
   timer_task_(stats_, &Antifreeze::run, *this)
@@ -62,11 +82,7 @@ void Antifreeze::begin(Print& /*initTracer*/)
 {
   // antifreeze
   hysteresis_temp_delta_ = config_.getAntifreezeHystereseTemp(); // TODO variable name is wrong
-  antifreeze_temp_upper_limit_ = EXHAUST_ANTIFREEZE_TEMP_THRESHOLD + hysteresis_temp_delta_;
-
-  pid_preheater_.SetOutputLimits(100, 1000);
-  pid_preheater_.SetMode(MANUAL);
-  pid_preheater_.SetSampleTime(1000 /* TODO use constant intervalSetFan */);  // SetFan ruft Preheater auf, deswegen hier intervalSetFan
+  antifreeze_temp_upper_limit_ = upperLimit(hysteresis_temp_delta_);
 
   heating_app_comb_use_ = config_.getHeatingAppCombUse();
 
@@ -120,8 +136,8 @@ void Antifreeze::run()
         send_mqtt = true;
 
         // Vorheizer einschalten
-        antifreeze_temp_upper_limit_  = EXHAUST_ANTIFREEZE_TEMP_THRESHOLD + hysteresis_temp_delta_;
-        pid_preheater_.SetMode(AUTOMATIC);  // Pid einschalten
+        antifreeze_temp_upper_limit_ = upperLimit(hysteresis_temp_delta_);
+        pid_preheater_.start(pidTemp(temp_.get_t4_exhaust()), FixedPID::fromInt(int(tech_setpoint_preheater_)));  // Pid einschalten
         preheater_start_time_ms_ = millis();
 
         if (KWLConfig::serialDebugAntifreeze)
@@ -135,7 +151,7 @@ void Antifreeze::run()
         // Neuer Status: AntifreezeState::OFF
         antifreeze_state_ = AntifreezeState::OFF;
         send_mqtt = true;
-        pid_preheater_.SetMode(MANUAL);
+        pid_preheater_.stop();
         if (KWLConfig::serialDebugAntifreeze)
           Serial.println(F("Antifreeze: threshold reached; state = OFF"));
       } else if ((millis() - preheater_start_time_ms_ > INTERVAL_ANTIFREEZE_ALARM_CHECK)
@@ -148,7 +164,7 @@ void Antifreeze::run()
           // Neuer Status: AntifreezeState::FIREPLACE
           antifreeze_state_ =  AntifreezeState::FIREPLACE;
           send_mqtt = true;
-          pid_preheater_.SetMode(MANUAL);
+          pid_preheater_.stop();
           // Zeit speichern
           heating_app_comb_use_antifreeze_start_time_ms_ = millis();
           if (KWLConfig::serialDebugAntifreeze)
@@ -157,7 +173,7 @@ void Antifreeze::run()
           // Neuer Status: AntifreezeState::FAN_OFF
           antifreeze_state_ = AntifreezeState::FAN_OFF;
           send_mqtt = true;
-          pid_preheater_.SetMode(MANUAL);
+          pid_preheater_.stop();
           if (KWLConfig::serialDebugAntifreeze)
             Serial.println(F("Antifreeze: preheater timeout; state = FAN_OFF"));
         }
@@ -169,7 +185,7 @@ void Antifreeze::run()
           // Neuer Status: AntifreezeState::OFF
           antifreeze_state_ = AntifreezeState::OFF;
           send_mqtt = true;
-          pid_preheater_.SetMode(MANUAL);
+          pid_preheater_.stop();
         }
         break;
 
@@ -179,7 +195,7 @@ void Antifreeze::run()
           // Neuer Status: AntifreezeState::OFF
           antifreeze_state_ = AntifreezeState::OFF;
           send_mqtt = true;
-          pid_preheater_.SetMode(MANUAL);
+          pid_preheater_.stop();
         }
         break;
       }
@@ -216,7 +232,7 @@ void Antifreeze::setPreheater()
     Serial.print(F("Preheater - M: "));
     Serial.print(millis());
     Serial.print(F(", Gap: "));
-    Serial.print(abs(antifreeze_temp_upper_limit_ - temp_.get_t4_exhaust()));
+    Serial.print(abs(double(antifreeze_temp_upper_limit_) / PID_TEMP_SCALE - temp_.get_t4_exhaust()));
     Serial.print(F(", tech_setpoint_preheater_: "));
     Serial.println(tech_setpoint_preheater_);
     // TODO based on what to send via MQTT?
@@ -224,18 +240,11 @@ void Antifreeze::setPreheater()
   }
 
   // Setzen per PWM
-  unsigned tech_setpoint = unsigned(tech_setpoint_preheater_);
+  unsigned tech_setpoint = tech_setpoint_preheater_;
   analogWrite(KWLConfig::PinPreheaterPWM, tech_setpoint / 4);
 
-  // Setzen der Werte per DAC
-  byte HBy = byte(tech_setpoint >> 8);
-  byte LBy = tech_setpoint & 0xff;
-
-  Wire.beginTransmission(KWLConfig::DacI2COutAddr); // Start Übertragung zur ANALOG-OUT Karte
-  Wire.write(KWLConfig::DacChannelPreheater);        // PREHEATER schreiben
-  Wire.write(LBy);                          // LOW-Byte schreiben
-  Wire.write(HBy);                          // HIGH-Byte schreiben
-  Wire.endTransmission();                   // Ende
+  // Setzen der Werte per DAC (asynchron, nur bei Änderung)
+  dac_.set(KWLConfig::DacChannelPreheater, tech_setpoint);
 }
 
 void Antifreeze::sendMQTT()
@@ -260,7 +269,11 @@ void Antifreeze::doActionAntiFreezeState()
   switch (antifreeze_state_)
   {
     case AntifreezeState::PREHEATER:
-      pid_preheater_.Compute();
+      {
+        FixedPID::value_t output;
+        if (pid_preheater_.compute(pidTemp(temp_.get_t4_exhaust()), antifreeze_temp_upper_limit_, output))
+          tech_setpoint_preheater_ = unsigned(FixedPID::toInt(output));
+      }
       break;
 
     case AntifreezeState::FAN_OFF:
@@ -293,20 +306,21 @@ void Antifreeze::doActionAntiFreezeState()
 
 bool Antifreeze::mqttReceiveMsg(const StringView& topic, const StringView& s)
 {
+  // commands are validated first by bulk configuration, see MessageHandler::validate()
   if (topic == MQTTTopic::CmdAntiFreezeHyst) {
-    auto i = s.toInt();
-    if (i < 0)
-      i = 0;
-    if (i > MAX_TEMP_HYSTERESIS)
-      i = MAX_TEMP_HYSTERESIS;
-    hysteresis_temp_delta_ = unsigned(i);
-    antifreeze_temp_upper_limit_ = EXHAUST_ANTIFREEZE_TEMP_THRESHOLD + hysteresis_temp_delta_;
-    config_.setAntifreezeHystereseTemp(hysteresis_temp_delta_);
+    long i;
+    if (!s.parseInt(i) || i < 0 || i > MAX_TEMP_HYSTERESIS) {
+      reportMalformed();
+    } else if (!isValidating()) {
+      hysteresis_temp_delta_ = unsigned(i);
+      antifreeze_temp_upper_limit_ = upperLimit(hysteresis_temp_delta_);
+      config_.setAntifreezeHystereseTemp(hysteresis_temp_delta_);
+    }
   } else if (topic == MQTTTopic::CmdHeatingAppCombUse) {
-    if (s == F("YES"))
-      setHeatingAppCombUse(true);
-    else if (s == F("NO"))
-      setHeatingAppCombUse(false);
+    if (s != F("YES") && s != F("NO"))
+      reportMalformed();
+    else if (!isValidating())
+      setHeatingAppCombUse(s == F("YES"));
   } else {
     return false;
   }
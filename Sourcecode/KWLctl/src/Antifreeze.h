@@ -27,11 +27,12 @@
 #include "TimeScheduler.h"
 #include "MessageHandler.h"
 
-#include <PID_v1.h>
+#include <FixedPID.h>
 
 class KWLPersistentConfig;
 class FanControl;
 class TempSensors;
+class DacOutput;
 class Print;
 
 /// State of antifreeze control.
@@ -58,8 +59,9 @@ public:
    * @param fan fan control.
    * @param temp temperature sensor array.
    * @param config configuration to read/write.
+   * @param dac DAC output for preheater.
    */
-  explicit Antifreeze(FanControl& fan, TempSensors& temp, KWLPersistentConfig& config);
+  Antifreeze(FanControl& fan, TempSensors& temp, KWLPersistentConfig& config, DacOutput& dac);
 
   /// Start the handler.
   void begin(Print& initTracer);
@@ -68,7 +70,7 @@ public:
   AntifreezeState getState() const { return antifreeze_state_; }
 
   /// Get preheater settings (in %).
-  double getPreheaterState() const { return tech_setpoint_preheater_ / 10; }
+  unsigned getPreheaterState() const { return tech_setpoint_preheater_ / 10; }
 
   /// Callback for fan control to set fan speed to 0, if needed.
   void doActionAntiFreezeState();
@@ -95,13 +97,14 @@ private:
   FanControl& fan_;
   TempSensors& temp_;
   KWLPersistentConfig& config_;
+  DacOutput& dac_;
   AntifreezeState antifreeze_state_ = AntifreezeState::OFF;
   unsigned hysteresis_temp_delta_;
-  double antifreeze_temp_upper_limit_;
-  double tech_setpoint_preheater_   = 0.0;      // Analogsignal 0..1000 für Vorheizer
+  FixedPID::input_t antifreeze_temp_upper_limit_;  ///< PID setpoint in 1/16 degrees Celsius.
+  unsigned tech_setpoint_preheater_ = 0;        // Analogsignal 0..1000 für Vorheizer
   unsigned long preheater_start_time_ms_ = 0;      // Beginn der Vorheizung
   unsigned long heating_app_comb_use_antifreeze_start_time_ms_ = 0;
-  PID pid_preheater_;
+  FixedPID pid_preheater_;
   bool heating_app_comb_use_; ///< Flag whether we are using the ventilation system combined with heating appliance.
   PublishTask mqtt_publish_;
   Scheduler::TaskTimingStats stats_;
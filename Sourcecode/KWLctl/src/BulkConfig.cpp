@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "BulkConfig.h"
+#include "KWLConfig.h"
+#include "MQTTTopic.hpp"
+#include "StringView.h"
+
+namespace
+{
+  /// Maximum length of a value.
+  static constexpr unsigned MAX_VALUE_LEN = 15;
+
+  /*!
+   * @brief All keys accepted in bulk configuration.
+   *
+   * Values are checked by the handlers of the single commands (see
+   * MessageHandler::validate()), so they must support validation.
+   */
+  const char* const KEYS[] PROGMEM = {
+    MQTTTopic::CmdFan1Speed.data_P(),
+    MQTTTopic::CmdFan2Speed.data_P(),
+    MQTTTopic::CmdBypassTempAbluftMin.data_P(),
+    MQTTTopic::CmdBypassTempAussenluftMin.data_P(),
+    MQTTTopic::CmdBypassHystereseMinutes.data_P(),
+    MQTTTopic::CmdBypassHyst.data_P(),
+    MQTTTopic::CmdBypassManualFlap.data_P(),
+    MQTTTopic::CmdBypassMode.data_P(),
+    MQTTTopic::CmdAntiFreezeHyst.data_P(),
+    MQTTTopic::CmdHeatingAppCombUse.data_P(),
+    MQTTTopic::CmdTimezone.data_P(),
+    MQTTTopic::CmdDST.data_P(),
+    MQTTTopic::CmdNTPServer.data_P(),
+  };
+
+  /// Check for pair separator.
+  inline bool isSeparator(char c) { return c == ' ' || c == ';' || c == '\t' || c == '\r' || c == '\n'; }
+
+  /*!
+   * @brief Find next key=value pair in the payload.
+   *
+   * @param p,end current position and end of the payload, position is advanced.
+   * @param key,key_len set to the key found.
+   * @param value,value_len set to the value found (value is @c nullptr, if '=' is missing).
+   * @return @c true, if a pair was found, @c false at the end of payload.
+   */
+  bool nextPair(const char*& p, const char* end, const char*& key, unsigned& key_len, const char*& value, unsigned& value_len)
+  {
+    while (p < end && isSeparator(*p))
+      ++p;
+    if (p == end)
+      return false;
+    key = p;
+    value = nullptr;
+    while (p < end && !isSeparator(*p) && *p != '=')
+      ++p;
+    key_len = unsigned(p - key);
+    if (p < end && *p == '=') {
+      value = ++p;
+      while (p < end && !isSeparator(*p))
+        ++p;
+      value_len = unsigned(p - value);
+    }
+    return true;
+  }
+
+  /// Check whether a key is accepted in bulk configuration.
+  bool isKey(const char* key, unsigned key_len)
+  {
+    for (auto& k : KEYS) {
+      auto desc = reinterpret_cast<const char*>(pgm_read_ptr(&k));
+      if (strlen_P(desc) == key_len && memcmp_P(key, desc, key_len) == 0)
+        return true;
+    }
+    return false;
+  }
+}
+
+BulkConfig::BulkConfig(KWLPersistentConfig& config) :
+  MessageHandler(F("BulkConfig")),
+  config_(config)
+{
+  ack_[0] = 0;
+}
+
+bool BulkConfig::mqttReceiveMsg(const StringView& topic, const StringView& s)
+{
+  if (topic != MQTTTopic::CmdConfigBulk)
+    return false;
+
+  if (publisher_.isPending()) {
+    // acknowledgment of the previous bulk configuration not sent yet, don't overwrite it
+    if (KWLConfig::serialDebug)
+      Serial.println(F("Bulk configuration: busy, ignored"));
+    reportMalformed();
+    return true;
+  }
+
+  auto count = validate(s);
+  if (count < 0) {
+    reportMalformed();
+  } else {
+    // apply all values in memory, then write the configuration at once
+    config_.beginTransaction();
+    bool ok = apply(s);
+    config_.commitTransaction();
+    if (ok)
+      snprintf_P(ack_, sizeof(ack_), PSTR("OK %d"), count);
+    else
+      reportMalformed();
+  }
+  if (KWLConfig::serialDebug) {
+    Serial.print(F("Bulk configuration: "));
+    Serial.println(ack_);
+  }
+  publishAck();
+  return true;
+}
+
+int BulkConfig::validate(const StringView& s)
+{
+  auto p = s.c_str();
+  auto end = p + s.length();
+  const char* key;
+  const char* value;
+  unsigned key_len, value_len;
+  int count = 0;
+  while (nextPair(p, end, key, key_len, value, value_len)) {
+    if (!isKey(key, key_len)) {
+      setError(F("ERROR key "), key, key_len);
+      return -1;
+    }
+    if (!value || value_len > MAX_VALUE_LEN) {
+      setError(F("ERROR value "), key, key_len);
+      return -1;
+    }
+    char buffer[MAX_VALUE_LEN + 1];
+    memcpy(buffer, value, value_len);
+    buffer[value_len] = 0;
+    if (!MessageHandler::validate(StringView(key, key_len), StringView(buffer, value_len))) {
+      setError(F("ERROR value "), key, key_len);
+      return -1;
+    }
+    ++count;
+  }
+  if (!count) {
+    strcpy_P(ack_, PSTR("ERROR empty"));
+    return -1;
+  }
+  return count;
+}
+
+bool BulkConfig::apply(const StringView& s)
+{
+  auto p = s.c_str();
+  auto end = p + s.length();
+  const char* key;
+  const char* value;
+  unsigned key_len, value_len;
+  bool ok = true;
+  while (nextPair(p, end, key, key_len, value, value_len)) {
+    char buffer[MAX_VALUE_LEN + 1];
+    memcpy(buffer, value, value_len);
+    buffer[value_len] = 0;
+    if (!dispatch(StringView(key, key_len), StringView(buffer, value_len)) && ok) {
+      // cannot happen for validated values, keep the state of handlers and
+      // stored configuration consistent by storing already applied values
+      setError(F("ERROR apply "), key, key_len);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+void BulkConfig::setError(const __FlashStringHelper* reason, const char* key, unsigned key_len)
+{
+  strlcpy_P(ack_, reinterpret_cast<const char*>(reason), sizeof(ack_));
+  auto len = strlen(ack_);
+  if (key_len > sizeof(ack_) - len - 1)
+    key_len = sizeof(ack_) - len - 1;
+  memcpy(ack_ + len, key, key_len);
+  ack_[len + key_len] = 0;
+}
+
+void BulkConfig::publishAck()
+{
+  // try to send right away, the task only handles a busy connection
+  if (!publish(MQTTTopic::KwlConfigBulk, ack_)) {
+    publisher_.publish([this]() {
+      return publish(MQTTTopic::KwlConfigBulk, ack_);
+    });
+  }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+/*!
+ * @file
+ * @brief Bulk configuration transaction over MQTT.
+ */
+#pragma once
+
+#include "MessageHandler.h"
+
+class KWLPersistentConfig;
+
+/*!
+ * @brief Bulk configuration transaction over MQTT.
+ *
+ * Handles a command with many <tt>key=value</tt> pairs in the payload, where
+ * keys are topics of single configuration commands (e.g.,
+ * <tt>fan1/standardspeed=1300</tt>). Pairs are separated by whitespace or
+ * semicolons. First, all pairs are validated by the handlers of single
+ * commands without applying them (see MessageHandler::validate()). Only if
+ * all of them are valid, they are applied by dispatching them to the same
+ * handlers and the modified configuration is written to EEPROM at once.
+ *
+ * A bulk configuration received before the acknowledgment of the previous
+ * one was sent is ignored.
+ *
+ * The result is acknowledged with a single message containing either
+ * <tt>OK n</tt> with the count of applied settings or <tt>ERROR key</tt>
+ * with the key which was rejected.
+ */
+class BulkConfig : private MessageHandler
+{
+public:
+  BulkConfig(const BulkConfig&) = delete;
+  BulkConfig& operator=(const BulkConfig&) = delete;
+
+  explicit BulkConfig(KWLPersistentConfig& config);
+
+private:
+  virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override;
+
+  /*!
+   * @brief Validate all pairs in the payload.
+   *
+   * @param s payload.
+   * @return count of valid pairs or -1 on error (acknowledgment is prepared).
+   */
+  int validate(const StringView& s);
+
+  /*!
+   * @brief Apply all pairs in the payload.
+   *
+   * @param s payload (validated).
+   * @return @c true, if all pairs were applied, @c false otherwise (acknowledgment is prepared).
+   */
+  bool apply(const StringView& s);
+
+  /// Prepare error acknowledgment for a given key.
+  void setError(const __FlashStringHelper* reason, const char* key, unsigned key_len);
+
+  /// Publish prepared acknowledgment (now or as soon as possible).
+  void publishAck();
+
+  KWLPersistentConfig& config_; ///< Persistent configuration.
+  PublishTask publisher_;       ///< Task to publish acknowledgment.
+  char ack_[40];                ///< Acknowledgment to send.
+};
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "DacOutput.h"
+#include "KWLConfig.h"
+
+static_assert(1 + 2 * DacOutput::CHANNELS <= AsyncTWI::MAX_DATA, "Transaction too small for all DAC channels");
+
+DacOutput::DacOutput() :
+  stats_(F("DacOutput")),
+  poll_task_(stats_, &DacOutput::poll, *this)
+{
+  for (uint8_t i = 0; i < CHANNELS; ++i)
+    value_[i] = UNKNOWN;
+}
+
+void DacOutput::begin(Print& initTracer)
+{
+  if (KWLConfig::ControlFansDAC) {
+    // TODO Also if using Preheater DAC, but no Fan DAC
+    AsyncTWI::begin();          // I2C-Pins definieren
+    enabled_ = true;
+    initTracer.println(F("Initialisierung DAC"));
+  }
+}
+
+void DacOutput::set(uint8_t channel, unsigned value)
+{
+  if (!enabled_ || channel >= CHANNELS)
+    return;
+  if (value_[channel] == value) {
+    // already sent or about to be sent
+    ++skipped_count_;
+    return;
+  }
+  value_[channel] = uint16_t(value);
+  dirty_ |= uint8_t(1 << channel);
+}
+
+void DacOutput::poll()
+{
+  AsyncTWI::poll();
+  if (!dirty_ || pending_)
+    return;
+  if (failed_) {
+    if (millis() - fail_ms_ < RETRY_DELAY_MS)
+      return;
+    failed_ = false;
+  }
+
+  if (KWLConfig::DacSequentialWrite) {
+    uint8_t first = 0;
+    while (!(dirty_ & (1 << first)))
+      ++first;
+    uint8_t last = CHANNELS - 1;
+    while (!(dirty_ & (1 << last)))
+      --last;
+    send(first, last);
+  } else {
+    for (uint8_t i = 0; i < CHANNELS; ++i)
+      if (dirty_ & (1 << i))
+        send(i, i);
+  }
+}
+
+void DacOutput::send(uint8_t first, uint8_t last)
+{
+  uint8_t data[1 + 2 * CHANNELS];
+  uint8_t length = 0;
+  data[length++] = first;                   // Kanal
+  for (uint8_t i = first; i <= last; ++i) {
+    data[length++] = uint8_t(value_[i] & 255);  // LOW-Byte
+    data[length++] = uint8_t(value_[i] >> 8);   // HIGH-Byte
+    dirty_ &= uint8_t(~(1 << i));
+  }
+  if (AsyncTWI::write(KWLConfig::DacI2COutAddr, data, length, &DacOutput::done, this)) {
+    ++pending_;
+  } else {
+    // queue full, try again on next poll
+    for (uint8_t i = first; i <= last; ++i)
+      dirty_ |= uint8_t(1 << i);
+  }
+}
+
+void DacOutput::done(void* arg, AsyncTWI::Status status, const uint8_t* data, uint8_t length)
+{
+  auto& self = *static_cast<DacOutput*>(arg);
+  --self.pending_;
+  if (status == AsyncTWI::Status::Ok)
+    return;
+
+  if (KWLConfig::serialDebug) {
+    Serial.print(F("DAC: I2C error "));
+    Serial.println(int(status));
+  }
+  const uint8_t first = data[0];
+  const uint8_t count = uint8_t((length - 1) / 2);
+  for (uint8_t i = first; i < first + count; ++i)
+    self.dirty_ |= uint8_t(1 << i);
+  self.failed_ = true;
+  self.fail_ms_ = millis();
+}
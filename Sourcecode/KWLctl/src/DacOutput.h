@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+/*!
+ * @file
+ * @brief Analog outputs via Horter I2C DAC.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <AsyncTWI.h>
+
+#include "TimeScheduler.h"
+
+/*!
+ * @brief Analog outputs via Horter I2C DAC.
+ *
+ * Output values are only remembered by set() and sent to the DAC
+ * asynchronously by a poll task using AsyncTWI, so setting an output
+ * never waits for the I2C bus. Values which didn't change since the last
+ * successful transmission are not sent again.
+ *
+ * The DAC accepts several consecutive channels in one transaction
+ * (channel number followed by low and high byte for each channel).
+ * If KWLConfig::DacSequentialWrite is set, all changed channels are sent
+ * in one transaction, otherwise in one transaction per channel.
+ *
+ * Channels of a failed transaction are sent again after RETRY_DELAY_MS.
+ */
+class DacOutput
+{
+public:
+  DacOutput(const DacOutput&) = delete;
+  DacOutput& operator=(const DacOutput&) = delete;
+
+  /// Count of DAC channels.
+  static constexpr uint8_t CHANNELS = 4;
+
+  DacOutput();
+
+  /// Start the I2C bus.
+  void begin(Print& initTracer);
+
+  /*!
+   * @brief Set output value.
+   *
+   * @param channel DAC channel (0-3).
+   * @param value output value (0-1023, 10V == 1000).
+   */
+  void set(uint8_t channel, unsigned value);
+
+  /// Get count of set() calls, which didn't need to send anything.
+  unsigned long getSkippedCount() const { return skipped_count_; }
+
+private:
+  /// Delay before sending channels of a failed transaction again.
+  static constexpr unsigned long RETRY_DELAY_MS = 1000;
+  /// Value for not yet sent channel.
+  static constexpr uint16_t UNKNOWN = 0xffff;
+
+  /// Send changed channels.
+  void poll();
+
+  /// Send channels first..last in one transaction.
+  void send(uint8_t first, uint8_t last);
+
+  /// Completion callback of AsyncTWI.
+  static void done(void* arg, AsyncTWI::Status status, const uint8_t* data, uint8_t length);
+
+  /// Values to output.
+  uint16_t value_[CHANNELS];
+  /// Bitmask of channels to send.
+  uint8_t dirty_ = 0;
+  /// Count of transactions in flight.
+  uint8_t pending_ = 0;
+  /// Set, if the bus is started.
+  bool enabled_ = false;
+  /// Set, if the last transaction failed.
+  bool failed_ = false;
+  /// Time of the last failure.
+  unsigned long fail_ms_ = 0;
+  /// Count of set() calls without change.
+  unsigned long skipped_count_ = 0;
+  /// Task polling statistics.
+  Scheduler::TaskPollingStats stats_;
+  /// Poll task sending values.
+  Scheduler::PollTask<DacOutput> poll_task_;
+};
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "EspTransport.h"
+
+#ifdef WIFI_SUPPORT
+
+#include "UserConfig.WifiData.h"
+/*
+#define WIFI_AP "MyAP"
+#define WIFI_PASSWORD "MyPassword"
+*/
+
+/// Interval for joining WiFi network explicitly, if ESP module doesn't reconnect by itself (5 minutes).
+static constexpr unsigned long LAN_REJOIN_INTERVAL = 300000000;
+
+void EspTransport::begin(Print& initTracer)
+{
+  initTracer.println(F("Initialize serial for ESP module"));
+  uart_.begin(115200);
+  esp_.begin(uart_);
+  // module initialization is asynchronous, give it a chance to finish before joining
+  esp_.waitUntil([this]() { return esp_.isReady(); }, 2000);
+}
+
+bool EspTransport::join(const Settings&)
+{
+  Serial.print(F("Joining WiFi network "));
+  Serial.println(WIFI_AP);
+  // joining is asynchronous, link state is checked by the network client
+  return esp_.join(WIFI_AP, WIFI_PASSWORD);
+}
+
+int8_t EspTransport::listen(uint16_t port)
+{
+  // AT firmware supports only a single server
+  if (listening_)
+    return -1;
+  esp_.listen(port);
+  listening_ = true;
+  return 0;
+}
+
+Client* EspTransport::accept(uint8_t)
+{
+  auto link = esp_.accept();
+  if (link < 0)
+    return nullptr;
+  server_client_.attach(uint8_t(link));
+  return &server_client_;
+}
+
+unsigned long EspTransport::getRejoinInterval() const
+{
+  // ESP module reconnects by itself, join explicitly only if it doesn't succeed
+  return LAN_REJOIN_INTERVAL;
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Network transport over ESP8266 WiFi module.
+ */
+#pragma once
+
+#include "NetworkTransport.h"
+
+#ifdef WIFI_SUPPORT
+
+#include <EspAT.h>
+#include <EspClient.h>
+#include <EspUDP.h>
+#include <EspUart.h>
+
+/*!
+ * @brief Network transport over ESP8266 WiFi module.
+ *
+ * This is written for a WEMOS MEGA + WIFI, the ESP module is connected to
+ * Serial3 in "special mode" (DIP 1-4 on, others off). The module keeps
+ * the network configuration itself, so only access point and password
+ * are used to join.
+ */
+class EspTransport : public NetworkTransport
+{
+public:
+  EspTransport() noexcept : client_(esp_), aux_client_(esp_), server_client_(esp_), udp_(esp_) {}
+
+  virtual void begin(Print& initTracer) override;
+  virtual bool join(const Settings& settings) override;
+  virtual bool isJoining() override { return esp_.isJoining(); }
+  virtual unsigned long getRejoinInterval() const override;
+  virtual void loop() override { esp_.loop(); }
+  virtual bool isLinkUp() override { return esp_.isLinkUp(); }
+  virtual IPAddress localIP() override { return esp_.localIP(); }
+  virtual bool connect(IPAddress ip, uint16_t port) override { return client_.connectAsync(ip, port); }
+  virtual bool isConnecting() override { return client_.isConnecting(); }
+  virtual Client& getClient() override { return client_; }
+  virtual bool canWrite(size_t size) override { return size_t(client_.availableForWrite()) >= size; }
+  virtual Client& getAuxClient() override { return aux_client_; }
+  virtual UDP& getUDP() override { return udp_; }
+  virtual int8_t listen(uint16_t port) override;
+  virtual Client* accept(uint8_t server) override;
+
+private:
+  EspUart uart_;          ///< Serial port connected to the ESP8266 module.
+  EspAT esp_;             ///< ESP8266 module driver.
+  EspClient client_;      ///< Client for MQTT connection.
+  EspClient aux_client_;  ///< Client for one-off connections.
+  EspClient server_client_; ///< Client for accepted incoming connection.
+  EspUDP udp_;            ///< UDP endpoint.
+  bool listening_ = false;  ///< Set, if the server was started (module supports only one).
+};
+
+#endif
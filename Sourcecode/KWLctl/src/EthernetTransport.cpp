@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "EthernetTransport.h"
+
+#if !defined(WIFI_SUPPORT) && !defined(LOOPBACK_TRANSPORT)
+
+/// Timeout for opening TCP connection to the broker, in milliseconds.
+static constexpr uint16_t TCP_CONNECT_TIMEOUT = 2000;
+
+void EthernetTransport::begin(Print&)
+{
+  client_.setConnectionTimeout(TCP_CONNECT_TIMEOUT);
+  aux_client_.setConnectionTimeout(TCP_CONNECT_TIMEOUT);
+}
+
+bool EthernetTransport::join(const Settings& settings)
+{
+  Ethernet.begin(const_cast<uint8_t*>(settings.mac), settings.ip, settings.dns, settings.gateway, settings.subnet);
+  return true;
+}
+
+bool EthernetTransport::isLinkUp()
+{
+  Ethernet.maintain();
+  return Ethernet.localIP()[0] != 0;
+}
+
+int8_t EthernetTransport::listen(uint16_t port)
+{
+  if (server_count_ == MAX_SERVERS)
+    return -1;
+  auto& server = server_[server_count_];
+  server = EthernetServer(port);
+  server.begin();
+  return int8_t(server_count_++);
+}
+
+Client* EthernetTransport::accept(uint8_t server)
+{
+  // returns each new connection only once
+  auto client = server_[server].accept();
+  if (!client)
+    return nullptr;
+  server_client_[server].stop();
+  server_client_[server] = client;
+  return &server_client_[server];
+}
+
+bool EthernetTransport::connect(IPAddress ip, uint16_t port)
+{
+  // bounded by connection timeout of the client
+  return client_.connect(ip, port) == 1;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Network transport over W5100 Ethernet shield.
+ */
+#pragma once
+
+#include "NetworkTransport.h"
+
+#if !defined(WIFI_SUPPORT) && !defined(LOOPBACK_TRANSPORT)
+
+#include <Ethernet.h>
+#include <EthernetUdp.h>
+
+/*!
+ * @brief Network transport over W5100 Ethernet shield.
+ *
+ * Connecting is synchronous, bounded by the connection timeout of the client.
+ */
+class EthernetTransport : public NetworkTransport
+{
+public:
+  EthernetTransport() = default;
+
+  virtual void begin(Print& initTracer) override;
+  virtual bool join(const Settings& settings) override;
+  virtual bool isLinkUp() override;
+  virtual IPAddress localIP() override { return Ethernet.localIP(); }
+  virtual bool connect(IPAddress ip, uint16_t port) override;
+  virtual Client& getClient() override { return client_; }
+  virtual Client& getAuxClient() override { return aux_client_; }
+  virtual UDP& getUDP() override { return udp_; }
+  virtual int8_t listen(uint16_t port) override;
+  virtual Client* accept(uint8_t server) override;
+
+private:
+  EthernetClient client_;     ///< Client for MQTT connection.
+  EthernetClient aux_client_; ///< Client for one-off connections.
+  EthernetUDP udp_;           ///< UDP endpoint.
+  /// Servers for incoming connections (port set by listen()).
+  EthernetServer server_[MAX_SERVERS] = { EthernetServer(0), EthernetServer(0) };
+  EthernetClient server_client_[MAX_SERVERS]; ///< Clients for accepted incoming connections.
+  uint8_t server_count_ = 0;  ///< Count of started servers.
+};
+
+#endif
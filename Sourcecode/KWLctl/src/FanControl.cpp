@@ -19,37 +19,71 @@
  */
 
 #include "FanControl.h"
+#include "DacOutput.h"
 #include "MQTTTopic.hpp"
 #include "KWLConfig.h"
 
 #include <StringView.h>
+#include <TachoCapture.h>
+#include <TopicRouter.h>
 
 #include <Arduino.h>
-#include <Wire.h>
 
 /// Global instance used by interrupt routines.
 static FanControl* instance_ = nullptr;
 
 // MQTT timing:
 
-/// Interval for scheduling fan regulation (1s)
+/// Interval for fan regulation during calibration and base interval for reporting (1s)
 static constexpr unsigned long FAN_INTERVAL = 1000000;
-/// Interval for sending fan information (5s), if speed changed.
-static constexpr unsigned long FAN_MQTT_INTERVAL = 5000000;
-/// Interval for sending fan information unconditionally (2min).
-static constexpr unsigned long FAN_MQTT_INTERVAL_OVERSAMPLING = 120000000;
-/// Interval for sending mode information unconditionally (5min).
-static constexpr unsigned long MODE_MQTT_INTERVAL = 300000000;
-/// Only send fan speed if changed by at least 50rpm.
-static constexpr int MIN_SPEED_DIFF = 50;
+/// Interval for fan regulation while fan speed settles after a change (200ms).
+static constexpr unsigned long FAN_FAST_INTERVAL = 200000;
+/// Interval for fan regulation while fan speed is stable (2s).
+static constexpr unsigned long FAN_SLOW_INTERVAL = 2000000;
+/// Count of fast regulation runs with stable speed before slowing down (2s).
+static constexpr uint8_t FAN_STABLE_RUNS = 10;
+/// Maximum difference from setpoint in percent, which is considered stable.
+static constexpr int FAN_STABLE_PERCENT = 3;
+/// Minimum difference from setpoint in RPM, which is considered stable.
+static constexpr int FAN_STABLE_MIN_GAP = 30;
+/// Interval to check progress of the fan speed ramp after feed-forward (1s).
+static constexpr unsigned long FAN_RAMP_CHECK_MS = 1000;
+
+// Learned fan curve:
+
+/// Learning rate of the fan curve as power of two (1/16 of the error per stable run).
+static constexpr uint8_t FAN_CURVE_LEARN_SHIFT = 4;
+/// Interval for checking learned fan curves and storing moved ones in EEPROM in seconds (1 hour).
+static constexpr int FAN_CURVE_STORE_INTERVAL = 3600;
+
+/// Convert reporting interval in seconds to count of reporting ticks.
+static int toRunIntervals(uint16_t seconds) { return int(seconds * 1000000UL / FAN_INTERVAL); }
+
+// Reporting intervals and minimum speed difference are configured via
+// reporting parameters Fan* in persistent configuration.
+
+/// Get airflow of a ventilation mode in per mille of standard speed.
+static int modeAirflow(unsigned mode) { return int(KWLConfig::StandardKwlModeFactor[mode] * 1000 + 0.5); }
+
+/// Count of usable ventilation modes.
+static constexpr unsigned MODE_COUNT = (KWLConfig::StandardModeCnt < MAX_FAN_MODE_CNT) ? KWLConfig::StandardModeCnt : MAX_FAN_MODE_CNT;
 
 // Calibration timing:
 
 /// Timeout for the entire calibration (10 minutes). If the calibration doesn't
 /// succeed in time, it will be cancelled.
 static constexpr unsigned long TIMEOUT_CALIBRATION = 600000000;
-/// Timeout for the calibration of one PWM step (5 minutes).
-static constexpr unsigned long TIMEOUT_PWM_CALIBRATION = 300000000;
+
+/// Maximum deviation of fan speed during calibration.
+static int calibrationGap(int speed)
+{
+  return int(speed * KWLConfig::StandardKwlFanPrecisionPercent / 100) + 1;
+}
+
+/// Tacho input of fan 1, input capture of Timer 4 is fixed to pin 49.
+static constexpr uint8_t FAN1_TACHO_PIN = KWLConfig::TachoInputCapture ? TachoCapture::PIN_ICP4 : KWLConfig::PinFan1Tacho;
+/// Tacho input of fan 2, input capture of Timer 5 is fixed to pin 48.
+static constexpr uint8_t FAN2_TACHO_PIN = KWLConfig::TachoInputCapture ? TachoCapture::PIN_ICP5 : KWLConfig::PinFan2Tacho;
 
 // Define the aggressive and conservative Tuning Parameters
 // Nenndrehzahl Lüfter 3200, Stellwert 0..1000 entspricht 0-10V
@@ -59,11 +93,14 @@ static constexpr double consKp = 0.05, consKi = 0.1, consKd = 0.001;
 
 Fan::Fan(uint8_t id, uint8_t powerPin, uint8_t pwmPin, uint8_t tachoPin, float ipr) :
   rpm_(static_cast<FanRPM::multiplier_t>(FanRPM::RPM_MULTIPLIER_BASE / ipr)),
+  isr_stats_(id == 1 ? F("TachoFan1") : F("TachoFan2")),
   power_(powerPin),
   pwm_pin_(pwmPin),
   tacho_pin_(tachoPin),
   fan_id_(id),
-  pid_(&current_speed_, &tech_setpoint_, &speed_setpoint_, consKp, consKi, consKd, P_ON_M, DIRECT)
+  cons_tunings_(FixedPID::tunings(consKp, consKi, consKd, FAN_INTERVAL / 1000)),
+  agg_tunings_(FixedPID::tunings(aggKp, aggKi, aggKd, FAN_INTERVAL / 1000)),
+  pid_(cons_tunings_, FAN_INTERVAL / 1000, 0, FixedPID::fromInt(1000))
 {}
 
 void Fan::begin(void (*countUp)(), unsigned standardSpeed, float ipr)
@@ -71,9 +108,7 @@ void Fan::begin(void (*countUp)(), unsigned standardSpeed, float ipr)
   standard_speed_ = standardSpeed;
   rpm_.multiplier() = static_cast<FanRPM::multiplier_t>(FanRPM::RPM_MULTIPLIER_BASE / ipr);
 
-  pid_.SetOutputLimits(0, 1000);
-  pid_.SetMode(AUTOMATIC);
-  pid_.SetSampleTime(1000); // TODO use constant slightly less than in fan interval?
+  pid_.start(FixedPID::input_t(current_speed_), FixedPID::fromInt(tech_setpoint_));
 
   // Lüfter Speed
   pinMode(pwm_pin_, OUTPUT);
@@ -81,15 +116,24 @@ void Fan::begin(void (*countUp)(), unsigned standardSpeed, float ipr)
 
   // Lüfter Tacho Interrupt
   pinMode(tacho_pin_, INPUT_PULLUP);
+  bool capture = KWLConfig::TachoInputCapture &&
+      TachoCapture::begin(tacho_pin_, rpm_, KWLConfig::TachoSamplingMode == RISING,
+                          KWLConfig::InterruptStatistics ? &isr_stats_ : nullptr);
   auto intr = uint8_t(digitalPinToInterrupt(tacho_pin_));
-  attachInterrupt(intr, countUp, KWLConfig::TachoSamplingMode);
+  if (KWLConfig::TachoInputCapture && !capture)
+    Serial.println(F("Fan tacho pin has no input capture unit"));
+  else if (!capture)
+    attachInterrupt(intr, countUp, KWLConfig::TachoSamplingMode);
 
   Serial.print(F("Fan pins(tacho/PWM), interrupt, std speed, ipr:\t"));
   Serial.print(tacho_pin_);
   Serial.print('\t');
   Serial.print(pwm_pin_);
   Serial.print('\t');
-  Serial.print(intr);
+  if (capture)
+    Serial.print(F("ICP"));
+  else
+    Serial.print(intr);
   Serial.print('\t');
   Serial.print(standardSpeed);
   Serial.print('\t');
@@ -99,28 +143,27 @@ void Fan::begin(void (*countUp)(), unsigned standardSpeed, float ipr)
   power_.on();
 }
 
-void Fan::computeSpeed(int ventMode, FanCalculateSpeedMode calcMode)
+void Fan::computeSpeed(unsigned airflow, FanCalculateSpeedMode calcMode)
 {
-  speed_setpoint_ = standard_speed_ * KWLConfig::StandardKwlModeFactor[ventMode];
+  const int last_speed_setpoint = speed_setpoint_;
+  speed_setpoint_ = int(long(standard_speed_) * airflow / 1000);
 
-  if (ventMode == 0) {
+  if (airflow == 0) {
     tech_setpoint_ = 0 ;  // Lüfungsstufe 0 alles ausschalten
     return;
   }
 
-  double gap = abs(speed_setpoint_ - current_speed_); //distance away from setpoint
+  unsigned gap = unsigned(abs(speed_setpoint_ - current_speed_)); //distance away from setpoint
 
   // Das PWM-Signal kann entweder per PID-Regler oder unten per Dreisatz berechnen werden.
   // TODO above comment seems invalid now
   if (calcMode == FanCalculateSpeedMode::PID) {
-    if (gap < 1000) {
-      pid_.SetTunings(consKp, consKi, consKd);
-    } else {
-      pid_.SetTunings(aggKp, aggKi, aggKd);
-    }
-    pid_.Compute();
+    if (speed_setpoint_ != last_speed_setpoint || tech_setpoint_ == 0)
+      feedForward(gap);
+    else if (!rampInProgress(gap))
+      computePID(gap);
   } else if (calcMode == FanCalculateSpeedMode::PROP) {
-    tech_setpoint_ = pwm_setpoint_[ventMode];
+    tech_setpoint_ = getPropPWM(airflow);
   }
 
   // Grenzwertbehandlung: Max- / Min-Werte
@@ -130,7 +173,96 @@ void Fan::computeSpeed(int ventMode, FanCalculateSpeedMode calcMode)
     tech_setpoint_ = 1000;
 }
 
-void Fan::setSpeed(int id, uint8_t pwmPin, uint8_t dacChannel)
+int Fan::getPropPWM(unsigned airflow) const
+{
+  // zwischen den kalibrierten Stufen linear interpolieren, exakt auf den Stufen
+  unsigned low_airflow = 0;
+  int low_pwm = 0;
+  for (unsigned i = 1; i < MODE_COUNT; ++i) {
+    const auto high_airflow = unsigned(modeAirflow(i));
+    if (airflow <= high_airflow) {
+      if (high_airflow == low_airflow)
+        return pwm_setpoint_[i];
+      return low_pwm + int(long(pwm_setpoint_[i] - low_pwm) * long(airflow - low_airflow) / long(high_airflow - low_airflow));
+    }
+    low_airflow = high_airflow;
+    low_pwm = pwm_setpoint_[i];
+  }
+  return low_pwm;  // above highest mode
+}
+
+void Fan::computePID(unsigned gap)
+{
+  if (gap < 1000)
+    pid_.setTunings(cons_tunings_);
+  else
+    pid_.setTunings(agg_tunings_);
+  FixedPID::value_t output;
+  if (pid_.compute(FixedPID::input_t(current_speed_), FixedPID::input_t(speed_setpoint_), output))
+    tech_setpoint_ = FixedPID::toInt(output);
+}
+
+void Fan::feedForward(unsigned gap)
+{
+  tech_setpoint_ = curve_.getPWM(speed_setpoint_);
+  ramping_ = true;
+  ramp_gap_ = gap;
+  ramp_check_ms_ = millis();
+}
+
+bool Fan::rampInProgress(unsigned gap)
+{
+  if (!ramping_)
+    return false;
+  // PID erst wieder rechnen, wenn sich die Drehzahl dem Sollwert nicht mehr nähert
+  const unsigned stable_gap = unsigned(getStableGap());
+  if (gap > stable_gap) {
+    const auto now = millis();
+    if (now - ramp_check_ms_ < FAN_RAMP_CHECK_MS)
+      return true;
+    if (gap + stable_gap / 2 < ramp_gap_) {
+      ramp_gap_ = gap;
+      ramp_check_ms_ = now;
+      return true;
+    }
+  }
+  // PID stoßfrei mit dem aktuellen PWM Wert übernehmen lassen
+  ramping_ = false;
+  pid_.stop();
+  pid_.start(FixedPID::input_t(current_speed_), FixedPID::fromInt(tech_setpoint_));
+  return false;
+}
+
+void Fan::learnCurve()
+{
+  if (tech_setpoint_ == 0 || ramping_ || !isStable())
+    return;
+  curve_.learn(tech_setpoint_, current_speed_, FAN_CURVE_LEARN_SHIFT);
+}
+
+int Fan::getStableGap() const
+{
+  int max_gap = speed_setpoint_ * FAN_STABLE_PERCENT / 100;
+  if (max_gap < FAN_STABLE_MIN_GAP)
+    max_gap = FAN_STABLE_MIN_GAP;
+  return max_gap;
+}
+
+void Fan::setSampleTime(unsigned long sampleTimeMs)
+{
+  cons_tunings_ = FixedPID::tunings(consKp, consKi, consKd, sampleTimeMs);
+  agg_tunings_ = FixedPID::tunings(aggKp, aggKi, aggKd, sampleTimeMs);
+  pid_.setSampleTime(sampleTimeMs);
+}
+
+bool Fan::isStable() const
+{
+  if (tech_setpoint_ == 0)
+    return true;  // fan off, nothing to regulate
+  return abs(speed_setpoint_ - current_speed_) <= getStableGap();
+}
+
+void Fan::setSpeed(int id, uint8_t pwmPin, DacOutput& dac, uint8_t dacChannel)
 {
   if (KWLConfig::serialDebugFan) {
     Serial.print(F("Fan "));
@@ -150,22 +282,12 @@ void Fan::setSpeed(int id, uint8_t pwmPin, uint8_t dacChannel)
   // Ausgabewert für Lüftersteuerung darf zwischen 0-10V liegen, dies entspricht 0..1023, vereinfacht 0..1000
   // 0..1000 muss umgerechnet werden auf 0..255 also durch 4 geteilt werden
   // max. Lüfterdrehzahl bei Papstlüfter 3200 U/min
-  int tech = int(tech_setpoint_);
+  int tech = tech_setpoint_;
   analogWrite(pwmPin, tech / 4);
 
-  // Setzen der Werte per DAC
-  if (KWLConfig::ControlFansDAC) {
-    byte HBy;
-    byte LBy;
-
-    HBy = byte(tech >> 8);   //HIGH-Byte berechnen
-    LBy = byte(tech & 255);  //LOW-Byte berechnen
-    Wire.beginTransmission(KWLConfig::DacI2COutAddr); // Start Übertragung zur ANALOG-OUT Karte
-    Wire.write(dacChannel);                   // Fan channel schreiben
-    Wire.write(LBy);                          // LOW-Byte schreiben
-    Wire.write(HBy);                          // HIGH-Byte schreiben
-    Wire.endTransmission();                   // Ende
-  }
+  // Setzen der Werte per DAC (asynchron, nur bei Änderung)
+  if (KWLConfig::ControlFansDAC)
+    dac.set(dacChannel, unsigned(tech));
 }
 
 void Fan::debugSet(int ventMode, int techSetpoint) {
@@ -176,49 +298,201 @@ void Fan::debugSet(int ventMode, int techSetpoint) {
   pwm_setpoint_[ventMode] = techSetpoint;
 }
 
-bool Fan::speedCalibrationStep(int mode)
+void Fan::prepareCalibration()
 {
-  if (abs(KWLConfig::StandardKwlModeFactor[mode]) < 0.01) {
-    // Faktor Null ist einfach
-    calibration_pwm_setpoint_[mode] = 0;
+  calibration_phase_ = CalibrationPhase::Sweep;
+  calibration_step_ = 0;
+  setCalibrationPWM(sweepPWM(0));
+}
+
+bool Fan::speedCalibrationStep()
+{
+  if (calibration_phase_ != CalibrationPhase::Done && calibration_phase_ != CalibrationPhase::Failed &&
+      settle_count_ >= CALIBRATION_STEP_RUNS) {
+    // Drehzahl wird bei dieser PWM nicht stabil, Kalibrierung abbrechen
+    calibration_phase_ = CalibrationPhase::Failed;
     return true;
-  } else {
-    // Faktor ungleich 0
-    speed_setpoint_ = standard_speed_ * KWLConfig::StandardKwlModeFactor[mode];
-
-    int maxGap = (speed_setpoint_ / 100 * KWLConfig::StandardKwlFanPrecisionPercent) + 1 ;  // max. StandardKwlFanPrecisionPercent % Abweichung 
-    double gap = abs(speed_setpoint_ - current_speed_); //distance away from setpoint
-    if ((gap < maxGap) && (good_pwm_setpoint_count_ < REQUIRED_GOOD_PWM_COUNT)) {
-      // einen PWM Wert gefunden
-      good_pwm_setpoint_[good_pwm_setpoint_count_] = int(tech_setpoint_);
-      good_pwm_setpoint_count_++;
-    }
-    if (good_pwm_setpoint_count_ >= REQUIRED_GOOD_PWM_COUNT) {
-      // fertig, genug Werte gefunden, jetzt Durchschnitt bilden
-      long sum_pwm = 0;
-      for (unsigned i = 0; i < REQUIRED_GOOD_PWM_COUNT; i++) {
-        sum_pwm += good_pwm_setpoint_[i];
+  }
+  int speed;
+  switch (calibration_phase_) {
+    case CalibrationPhase::Sweep:
+      {
+        if (!calibrationSettled(speed))
+          return false;
+        // Kennlinie muss monoton steigend sein
+        if (calibration_step_ > 0 && speed < sweep_speed_[calibration_step_ - 1])
+          speed = sweep_speed_[calibration_step_ - 1];
+        sweep_speed_[calibration_step_++] = speed;
+
+        // weiter messen, bis die Drehzahl der höchsten Stufe erreicht ist
+        int max_speed = 0;
+        for (unsigned i = 0; (i < KWLConfig::StandardModeCnt) && (i < MAX_FAN_MODE_CNT); ++i) {
+          int mode_speed = int(standard_speed_ * KWLConfig::StandardKwlModeFactor[i]);
+          if (mode_speed > max_speed)
+            max_speed = mode_speed;
+        }
+        if (calibration_step_ < CALIBRATION_SWEEP_POINTS && speed < max_speed) {
+          setCalibrationPWM(sweepPWM(calibration_step_));
+          return false;
+        }
+        sweep_count_ = calibration_step_;
+        calibration_phase_ = CalibrationPhase::Refine;
+        return calibrateMode(int(min(KWLConfig::StandardModeCnt, MAX_FAN_MODE_CNT)) - 1);
       }
-      calibration_pwm_setpoint_[mode] = int(sum_pwm / REQUIRED_GOOD_PWM_COUNT);
+
+    case CalibrationPhase::Refine:
+      if (!calibrationSettled(speed))
+        return false;
+      if (abs(speed - speed_setpoint_) >= calibrationGap(speed_setpoint_)) {
+        if (speed < speed_setpoint_) {
+          bracket_low_pwm_ = tech_setpoint_;
+          bracket_low_speed_ = speed;
+        } else {
+          bracket_high_pwm_ = tech_setpoint_;
+          bracket_high_speed_ = speed;
+        }
+        if (bracket_high_pwm_ - bracket_low_pwm_ > 1) {
+          // Intervall verkleinern, Teilungspunkt interpolieren
+          setCalibrationPWM(constrain(bracket_low_pwm_ + interpolatePWM(speed_setpoint_ - bracket_low_speed_),
+                                      bracket_low_pwm_ + 1, bracket_high_pwm_ - 1));
+          return false;
+        }
+      }
+      // PWM Wert gefunden, Drehzahl für die Restkorrektur über längere Zeit mitteln (unruhiges Tachosignal)
+      calibration_phase_ = CalibrationPhase::Average;
+      average_rounds_ = 0;
+      settle_count_ = CALIBRATION_SETTLE_HISTORY;
+      rpm_.startAverage();
+      return false;
+
+    case CalibrationPhase::Average:
+      {
+        // nach einer Korrektur zuerst einschwingen lassen, danach mitteln
+        if (++settle_count_ == CALIBRATION_SETTLE_HISTORY)
+          rpm_.startAverage();
+        if (settle_count_ < CALIBRATION_SETTLE_HISTORY + CALIBRATION_AVERAGE_RUNS)
+          return false;
+        speed = rpm_.getAverageSpeed();
+        if (!speed)
+          speed = current_speed_;
+        // Restabweichung anhand der Steigung zwischen den Stützpunkten des Durchlaufs korrigieren, die Steigung
+        // im bereits kleinen Intervall ist durch Messfehler zu ungenau
+        const int pwm = constrain(tech_setpoint_ + int(long(speed_setpoint_ - speed) * segment_pwm_ / segment_speed_), 0, 1000);
+        if (abs(speed - speed_setpoint_) >= calibrationGap(speed_setpoint_) && pwm != tech_setpoint_) {
+          if (++average_rounds_ >= CALIBRATION_AVERAGE_ROUNDS) {
+            // Mittelwert springt, Drehzahl wird nicht stabil, Kalibrierung abbrechen
+            calibration_phase_ = CalibrationPhase::Failed;
+            return true;
+          }
+          // zu weit weg, korrigierte PWM nochmals messen
+          setCalibrationPWM(pwm);
+          return false;
+        }
+        calibration_pwm_setpoint_[calibration_step_] = pwm;
+        calibration_phase_ = CalibrationPhase::Refine;
+        return calibrateMode(int(calibration_step_) - 1);
+      }
+
+    default:
       return true;
+  }
+}
+
+int Fan::interpolatePWM(int speed_delta) const
+{
+  // Steigung der Kennlinie zwischen den Intervallgrenzen, high_speed > low_speed ist garantiert
+  return int(long(speed_delta) * (bracket_high_pwm_ - bracket_low_pwm_) / (bracket_high_speed_ - bracket_low_speed_));
+}
+
+void Fan::setCalibrationPWM(int pwm)
+{
+  tech_setpoint_ = pwm;
+  settle_count_ = 0;  // next measurement restarts settling detection
+}
+
+bool Fan::calibrationSettled(int& speed)
+{
+  // Drehzahl gilt als eingeschwungen, wenn sich der Mittelwert der letzten Messungen gegenüber dem
+  // der Messungen davor kaum ändert. Einzelne Messungen dürfen streuen (unruhiges Tachosignal).
+  settle_speed_[settle_count_ % CALIBRATION_SETTLE_HISTORY] = current_speed_;
+  if (++settle_count_ < CALIBRATION_SETTLE_HISTORY)
+    return false;
+  long recent = 0, previous = 0;
+  for (uint8_t i = 0; i < CALIBRATION_SETTLE_RUNS; ++i) {
+    recent += settle_speed_[(settle_count_ - 1 - i) % CALIBRATION_SETTLE_HISTORY];
+    previous += settle_speed_[(settle_count_ - 1 - CALIBRATION_SETTLE_RUNS - i) % CALIBRATION_SETTLE_HISTORY];
+  }
+  speed = int(recent / CALIBRATION_SETTLE_RUNS);
+  return abs(recent - previous) <= long(calibrationGap(speed)) * CALIBRATION_SETTLE_RUNS / 2;
+}
+
+bool Fan::calibrateMode(int mode)
+{
+  // von oben nach unten, die Kennlinienmessung endet bei der höchsten Drehzahl
+  for (; mode >= 0; --mode) {
+    speed_setpoint_ = int(standard_speed_ * KWLConfig::StandardKwlModeFactor[mode]);
+    if (speed_setpoint_ <= 0) {
+      // Faktor Null ist einfach
+      calibration_pwm_setpoint_[mode] = 0;
+      continue;
     }
 
-    // Noch nicht genug Werte, PID Regler muss nachregeln
-    if (gap < 1000)
-      pid_.SetTunings(consKp, consKi, consKd);
-    else
-      pid_.SetTunings(aggKp, aggKi, aggKd);
-    pid_.Compute();
+    // Stützpunkte der Kennlinie um die Solldrehzahl suchen
+    int low_pwm = 0, low_speed = 0;
+    uint8_t i = 0;
+    while (i < sweep_count_ && sweep_speed_[i] < speed_setpoint_) {
+      low_pwm = sweepPWM(i);
+      low_speed = sweep_speed_[i];
+      ++i;
+    }
+    if (i == sweep_count_) {
+      // Solldrehzahl auch mit maximaler PWM nicht erreichbar
+      calibration_phase_ = CalibrationPhase::Failed;
+      return true;
+    }
+    const int high_pwm = sweepPWM(i);
+    const int high_speed = sweep_speed_[i];
 
-    // !Kein PreHeating und keine Sicherheitsabfrage Temperatur
+    // Startwert linear interpolieren, danach Intervall verkleinern
+    bracket_low_pwm_ = low_pwm;
+    bracket_low_speed_ = low_speed;
+    bracket_high_pwm_ = high_pwm;
+    bracket_high_speed_ = high_speed;
+    segment_pwm_ = high_pwm - low_pwm;
+    segment_speed_ = high_speed - low_speed;
+    setCalibrationPWM(constrain(low_pwm + interpolatePWM(speed_setpoint_ - low_speed), low_pwm + 1, high_pwm));
+    calibration_step_ = uint8_t(mode);
     return false;
   }
+  calibration_phase_ = CalibrationPhase::Done;
+  return true;
 }
 
 void Fan::finishCalibration()
 {
   for (unsigned i = 0; (i < KWLConfig::StandardModeCnt) && (i < MAX_FAN_MODE_CNT); ++i)
     pwm_setpoint_[i] = calibration_pwm_setpoint_[i];
+
+  // Kennlinie aus den Messpunkten des Durchlaufs neu aufbauen (ohne PWM ist die Drehzahl 0)
+  int low_pwm = 0, low_speed = 0;
+  uint8_t s = 0;
+  for (uint8_t k = 0; k < FanCurve::POINTS && s < sweep_count_; ++k) {
+    const int pwm = k * FanCurve::PWM_STEP;
+    while (s < sweep_count_ && sweepPWM(s) < pwm) {
+      low_pwm = sweepPWM(s);
+      low_speed = sweep_speed_[s];
+      ++s;
+    }
+    if (s == sweep_count_)
+      break;  // oberhalb des Durchlaufs bleibt die bisherige Kennlinie
+    const int high_pwm = sweepPWM(s);
+    curve_.setKnot(k, low_speed + int(long(sweep_speed_[s] - low_speed) * (pwm - low_pwm) / (high_pwm - low_pwm)));
+  }
+  // genau kalibrierte Stufen übernehmen
+  for (unsigned i = 0; (i < KWLConfig::StandardModeCnt) && (i < MAX_FAN_MODE_CNT); ++i) {
+    if (pwm_setpoint_[i] > 0)
+      curve_.learn(pwm_setpoint_[i], int(standard_speed_ * KWLConfig::StandardKwlModeFactor[i]), 0);
+  }
 }
 
 void Fan::sendMQTTDebug(int id, unsigned long ts, MessageHandler& h)
@@ -226,20 +500,28 @@ void Fan::sendMQTTDebug(int id, unsigned long ts, MessageHandler& h)
   if (!mqtt_send_debug_)
     return;
 
-  char buffer[100];
-  static constexpr auto FORMAT = makeFlashStringLiteral("Fan%d - M: %lu, gap: %ld, tsf: %ld, ssf: %ld, rpm: %ld");
-  snprintf(buffer, sizeof(buffer), FORMAT.load(),
-           id, ts,
-           long(current_speed_ - speed_setpoint_),
-           long(tech_setpoint_), long(speed_setpoint_), long(current_speed_));
-  h.publish((id == 1) ? MQTTTopic::KwlDebugstateFan1 : MQTTTopic::KwlDebugstateFan2, buffer, false);
+  h.publishStream((id == 1) ? MQTTTopic::KwlDebugstateFan1 : MQTTTopic::KwlDebugstateFan2, [this, id, ts](Print& out) {
+    out.print(F("Fan"));
+    out.print(id);
+    out.print(F(" - M: "));
+    out.print(ts);
+    out.print(F(", gap: "));
+    out.print(current_speed_ - speed_setpoint_);
+    out.print(F(", tsf: "));
+    out.print(tech_setpoint_);
+    out.print(F(", ssf: "));
+    out.print(speed_setpoint_);
+    out.print(F(", rpm: "));
+    out.print(current_speed_);
+  });
 }
 
 
-FanControl::FanControl(KWLPersistentConfig& config, SetSpeedCallback *speedCallback) :
+FanControl::FanControl(KWLPersistentConfig& config, DacOutput& dac, SetSpeedCallback *speedCallback) :
   MessageHandler(F("FanControl")),
-  fan1_(1, KWLConfig::PinFan1Power, KWLConfig::PinFan1PWM, KWLConfig::PinFan1Tacho, KWLConfig::StandardFan1ImpulsesPerRotation),
-  fan2_(2, KWLConfig::PinFan2Power, KWLConfig::PinFan2PWM, KWLConfig::PinFan2Tacho, KWLConfig::StandardFan2ImpulsesPerRotation),
+  fan1_(1, KWLConfig::PinFan1Power, KWLConfig::PinFan1PWM, FAN1_TACHO_PIN, KWLConfig::StandardFan1ImpulsesPerRotation),
+  fan2_(2, KWLConfig::PinFan2Power, KWLConfig::PinFan2PWM, FAN2_TACHO_PIN, KWLConfig::StandardFan2ImpulsesPerRotation),
+  dac_(dac),
   speed_callback_(speedCallback),
   ventilation_mode_(KWLConfig::StandardKwlMode),
   persistent_config_(config),
@@ -256,17 +538,150 @@ void FanControl::begin(Print& initTrace)
     fan1_.initPWM(i, persistent_config_.getFanPWMSetpoint(0, i));
     fan2_.initPWM(i, persistent_config_.getFanPWMSetpoint(1, i));
   }
+  fan1_.curve_.load(persistent_config_.getFanCurve(0), KWLConfig::StandardNenndrehzahlFan);
+  fan2_.curve_.load(persistent_config_.getFanCurve(1), KWLConfig::StandardNenndrehzahlFan);
+  store_curve_countdown_ = FAN_CURVE_STORE_INTERVAL;
   fan1_.begin(countUpFan1, persistent_config_.getSpeedSetpointFan1(), persistent_config_.getFan1ImpulsesPerRotation());
   fan2_.begin(countUpFan2, persistent_config_.getSpeedSetpointFan2(), persistent_config_.getFan2ImpulsesPerRotation());
 
+  // delay first sending by per-device phase to not send in lockstep with other devices
+  send_mode_countdown_ = 1 + int(persistent_config_.getPhaseOffset(
+    unsigned(toRunIntervals(persistent_config_.getReporting(ReportingParam::FanModeInterval)))));
+  send_fan_oversampling_countdown_ = 1 + int(persistent_config_.getPhaseOffset(
+    unsigned(toRunIntervals(persistent_config_.getMeasurementInterval(ReportingParam::FanMaxInterval)))));
+  send_fan_countdown_ = send_fan_oversampling_countdown_;
+
   timer_task_.runRepeated(FAN_INTERVAL);
+  last_run_time_ = timer_task_.getScheduleTime() - FAN_INTERVAL;
 }
 
 void FanControl::setVentilationMode(int mode)
 {
+  airflow_target_ = -1;
   ventilation_mode_ = constrain(mode, 0, int(KWLConfig::StandardModeCnt - 1));
   speedUpdate();
   forceSendMode();
+  if (calc_speed_mode_ == FanCalculateSpeedMode::PID)
+    regulateFast();
+}
+
+void FanControl::stepVentilationMode(int direction)
+{
+  if (!isStepless()) {
+    setVentilationMode(ventilation_mode_ + ((direction > 0) ? 1 : -1));
+    return;
+  }
+  // aus dem stufenlosen Betrieb zur nächsten Stufe in der gewünschten Richtung
+  int mode = (direction > 0) ? int(MODE_COUNT) - 1 : 0;
+  for (unsigned i = 0; i < MODE_COUNT; ++i) {
+    const int airflow = modeAirflow(i);
+    if (direction > 0 && airflow > airflow_target_) {
+      mode = int(i);
+      break;
+    }
+    if (direction <= 0 && airflow < airflow_target_)
+      mode = int(i);
+  }
+  setVentilationMode(mode);
+}
+
+int FanControl::getAirflow()
+{
+  return ((isStepless() ? airflow_target_ : modeAirflow(unsigned(ventilation_mode_))) + 5) / 10;
+}
+
+int FanControl::getCurrentAirflow()
+{
+  return ((isStepless() ? airflow_ : modeAirflow(unsigned(ventilation_mode_))) + 5) / 10;
+}
+
+int FanControl::getMaxAirflow()
+{
+  return (modeAirflow(MODE_COUNT - 1) + 5) / 10;
+}
+
+void FanControl::setAirflow(int percent)
+{
+  int airflow = 0;
+  if (percent > 0)
+    airflow = constrain(percent, int(KWLConfig::StandardSteplessMinPercent), getMaxAirflow()) * 10;
+  if (!isStepless())
+    airflow_ = modeAirflow(unsigned(ventilation_mode_));  // ramp from current mode
+  // aus sofort und von "aus" direkt beim Minimum starten, nicht durch den Bereich unterhalb des Minimums rampen
+  const int min_airflow = int(KWLConfig::StandardSteplessMinPercent) * 10;
+  const bool switch_now = (airflow == 0) || (airflow_ < min_airflow);
+  if (switch_now)
+    airflow_ = (airflow == 0) ? 0 : min_airflow;
+  airflow_target_ = airflow;
+
+  // nächstgelegene Stufe melden, Stufe 0 nur wenn aus
+  ventilation_mode_ = 0;
+  if (airflow > 0) {
+    int best_diff = INT16_MAX;
+    for (unsigned i = 1; i < MODE_COUNT; ++i) {
+      const int diff = abs(modeAirflow(i) - airflow);
+      if (diff < best_diff) {
+        best_diff = diff;
+        ventilation_mode_ = int(i);
+      }
+    }
+  }
+  if (switch_now)
+    speedUpdate();
+  forceSendMode();
+  regulateFast();
+}
+
+void FanControl::rampAirflow(unsigned long elapsed)
+{
+  if (!isStepless() || airflow_ == airflow_target_)
+    return;
+  // per mille per elapsed time, at least one step to always make progress; no credit
+  // for the time before the target was set, the run after it is regulation_interval_ away
+  if (elapsed > regulation_interval_)
+    elapsed = regulation_interval_;
+  int step = int(KWLConfig::StandardSteplessRampPercent * 10 * (elapsed / 1000) / 1000);
+  if (step < 1)
+    step = 1;
+  if (airflow_ < airflow_target_)
+    airflow_ = min(airflow_ + step, airflow_target_);
+  else
+    airflow_ = max(airflow_ - step, airflow_target_);
+}
+
+void FanControl::regulateFast()
+{
+  if (mode_ != FanMode::Normal)
+    return;
+  stable_runs_ = 0;
+  if (regulation_interval_ != FAN_FAST_INTERVAL) {
+    setRegulationInterval(FAN_FAST_INTERVAL);
+    timer_task_.runRepeated(FAN_FAST_INTERVAL);
+  }
+}
+
+void FanControl::setRegulationInterval(unsigned long interval)
+{
+  if (interval == regulation_interval_)
+    return;
+  regulation_interval_ = interval;
+  fan1_.setSampleTime(interval / 1000);
+  fan2_.setSampleTime(interval / 1000);
+  timer_task_.setInterval(interval);
+}
+
+void FanControl::adaptRegulationInterval()
+{
+  if (mode_ != FanMode::Normal) {
+    setRegulationInterval(FAN_INTERVAL);
+    return;
+  }
+  if ((calc_speed_mode_ == FanCalculateSpeedMode::PID && (!fan1_.isStable() || !fan2_.isStable())) ||
+      (isStepless() && airflow_ != airflow_target_))
+    stable_runs_ = 0;
+  else if (stable_runs_ < FAN_STABLE_RUNS)
+    ++stable_runs_;
+  setRegulationInterval((stable_runs_ < FAN_STABLE_RUNS) ? FAN_FAST_INTERVAL : FAN_SLOW_INTERVAL);
 }
 
 void FanControl::countUpFan1() { instance_->fan1_.interrupt(); }
@@ -278,8 +693,14 @@ void FanControl::run()
   // Die Geschwindigkeit der beiden Lüfter wird bestimmt. Die eigentliche Zählung der Tachoimpulse
   // geschieht per Interrupt in countUpFan1 und countUpFan2
 
-  fan1_.updateSpeed();
-  fan2_.updateSpeed();
+  // average of the whole tacho buffer lags up to several seconds, too much for fast regulation
+  const bool recent = regulation_interval_ == FAN_FAST_INTERVAL;
+  fan1_.updateSpeed(recent);
+  fan2_.updateSpeed(recent);
+
+  const auto now = timer_task_.getScheduleTime();
+  const auto elapsed = now - last_run_time_;
+  last_run_time_ = now;
 
   if (KWLConfig::serialDebugFan) {
     Serial.print(F("Speed fan1: "));
@@ -292,32 +713,52 @@ void FanControl::run()
   }
 
   if (mode_ == FanMode::Normal) {
+    rampAirflow(elapsed);
     speedUpdate();
   } else if (mode_ == FanMode::Calibration) {
     speedCalibrationStep();
   }
+  adaptRegulationInterval();
+  if (mode_ == FanMode::Normal && calc_speed_mode_ == FanCalculateSpeedMode::PID && stable_runs_ >= FAN_STABLE_RUNS) {
+    // im eingeschwungenen Zustand Kennlinie nachführen
+    fan1_.learnCurve();
+    fan2_.learnCurve();
+  }
+
+  // reporting counts in FAN_INTERVAL units independent of regulation interval
+  report_time_ += elapsed;
+  if (report_time_ < FAN_INTERVAL)
+    return;
+  const auto ticks = int(report_time_ / FAN_INTERVAL);
+  report_time_ -= ticks * FAN_INTERVAL;
+
+  if ((store_curve_countdown_ -= ticks) <= 0) {
+    store_curve_countdown_ = FAN_CURVE_STORE_INTERVAL;
+    storeFanCurvesToEEPROM(false);
+  }
 
   // publish any measurements, if necessary
   bool send_mqtt = false;
-  if (--send_mode_countdown_ <= 0) {
-    send_mode_countdown_ = int(MODE_MQTT_INTERVAL / FAN_INTERVAL);
-    mqtt_send_flags_ |= MQTT_SEND_MODE;
+  if ((send_mode_countdown_ -= ticks) <= 0) {
+    send_mode_countdown_ = toRunIntervals(persistent_config_.getReporting(ReportingParam::FanModeInterval));
+    mqtt_send_flags_ |= MQTT_SEND_MODE | MQTT_SEND_AIRFLOW;
     send_mqtt = true;
   }
-  if (--send_fan_oversampling_countdown_ <= 0) {
-    send_fan_oversampling_countdown_ = int(FAN_MQTT_INTERVAL_OVERSAMPLING / FAN_INTERVAL);
-    send_fan_countdown_ = int(FAN_MQTT_INTERVAL / FAN_INTERVAL);
+  if ((send_fan_oversampling_countdown_ -= ticks) <= 0) {
+    send_fan_oversampling_countdown_ = toRunIntervals(persistent_config_.getMeasurementInterval(ReportingParam::FanMaxInterval));
+    send_fan_countdown_ = toRunIntervals(persistent_config_.getMeasurementInterval(ReportingParam::FanMinInterval));
     mqtt_send_flags_ |= MQTT_SEND_FAN1 | MQTT_SEND_FAN2;
     send_mqtt = true;
   }
-  if (--send_fan_countdown_ <= 0) {
+  if ((send_fan_countdown_ -= ticks) <= 0) {
     int fan1 = int(fan1_.getSpeed());
     int fan2 = int(fan2_.getSpeed());
+    int min_diff = int(persistent_config_.getReporting(ReportingParam::FanMinDiff));
     // check whether we need to send data
-    if (abs(fan1 - last_sent_fan1_speed_) >= MIN_SPEED_DIFF ||
-        abs(fan2 - last_sent_fan2_speed_) >= MIN_SPEED_DIFF) {
-      send_fan_oversampling_countdown_ = int(FAN_MQTT_INTERVAL_OVERSAMPLING / FAN_INTERVAL);
-      send_fan_countdown_ = int(FAN_MQTT_INTERVAL / FAN_INTERVAL);
+    if (abs(fan1 - last_sent_fan1_speed_) >= min_diff ||
+        abs(fan2 - last_sent_fan2_speed_) >= min_diff) {
+      send_fan_oversampling_countdown_ = toRunIntervals(persistent_config_.getMeasurementInterval(ReportingParam::FanMaxInterval));
+      send_fan_countdown_ = toRunIntervals(persistent_config_.getMeasurementInterval(ReportingParam::FanMinInterval));
       mqtt_send_flags_ |= MQTT_SEND_FAN1 | MQTT_SEND_FAN2;
       send_mqtt = true;
     }
@@ -329,8 +770,9 @@ void FanControl::run()
 
 void FanControl::speedUpdate()
 {
-  fan1_.computeSpeed(ventilation_mode_, calc_speed_mode_);
-  fan2_.computeSpeed(ventilation_mode_, calc_speed_mode_);
+  const auto airflow = unsigned(isStepless() ? airflow_ : modeAirflow(unsigned(ventilation_mode_)));
+  fan1_.computeSpeed(airflow, calc_speed_mode_);
+  fan2_.computeSpeed(airflow, calc_speed_mode_);
 
   if (speed_callback_)
     speed_callback_->fanSpeedSet();
@@ -347,78 +789,62 @@ void FanControl::setSpeed()
     Serial.print(F("Timestamp: "));
     Serial.println(timer_task_.getScheduleTime());
   }
-  fan1_.setSpeed(1, KWLConfig::PinFan1PWM, KWLConfig::DacChannelFan1);
-  fan2_.setSpeed(2, KWLConfig::PinFan2PWM, KWLConfig::DacChannelFan2);
+  fan1_.setSpeed(1, KWLConfig::PinFan1PWM, dac_, KWLConfig::DacChannelFan1);
+  fan2_.setSpeed(2, KWLConfig::PinFan2PWM, dac_, KWLConfig::DacChannelFan2);
 }
 
 void FanControl::speedCalibrationStart() {
   Serial.println(F("Kalibrierung der Lüfter wird gestartet"));
-  calibration_pwm_in_progress_ = false;
   calibration_in_progress_ = false;
   mode_ = FanMode::Calibration;
 }
 
 void FanControl::speedCalibrationStep()
 {
-  Serial.println(F("SpeedCalibrationPwm startet"));
   if (!calibration_in_progress_) {
     // Erster Durchlauf der Kalibrierung
-    Serial.println(F("Erster Durchlauf"));
+    Serial.println(F("Kalibrierung: Kennlinie der Lüfter messen"));
     calibration_in_progress_ = true;
     calibration_start_time_us_ = timer_task_.getScheduleTime();
     current_calibration_mode_ = 0;
     calc_speed_mode_ = FanCalculateSpeedMode::PROP;
-  }
-  if (calibration_in_progress_ && (timer_task_.getScheduleTime() - calibration_start_time_us_ >= TIMEOUT_CALIBRATION)) {
+    fan1_.prepareCalibration();
+    fan2_.prepareCalibration();
+  } else if (timer_task_.getScheduleTime() - calibration_start_time_us_ >= TIMEOUT_CALIBRATION) {
     // Timeout, Kalibrierung abbrechen
     stopCalibration(true);
-  } else {
-    if (!calibration_pwm_in_progress_) {
-      // Erster Durchlauf der Kalibrierung
-      Serial.println(F("Erster Durchlauf für Stufe, calibration_pwm_in_progress_"));
-      calibration_pwm_in_progress_ = true;
-      calibration_pwm_start_time_us_ = timer_task_.getScheduleTime();
-      fan1_.prepareCalibration();
-      fan2_.prepareCalibration();
-    }
-    if (calibration_pwm_in_progress_ && (timer_task_.getScheduleTime() - calibration_pwm_start_time_us_ <= TIMEOUT_PWM_CALIBRATION)) {
-      // Einzelne Stufen kalibrieren
-      if (speedCalibrationPWMStep()) {
-        // true = Kalibrierung der Lüftungsstufe beendet
-        if (current_calibration_mode_ == KWLConfig::StandardModeCnt - 1) {
-          // fertig mit allen Stufen!!!
-          // Speichern in EEProm und Variablen
-          fan1_.finishCalibration();
-          fan2_.finishCalibration();
-          storePWMSettingsToEEPROM();
-          for (unsigned i = 0; ((i < KWLConfig::StandardModeCnt) && (i < 10)); i++) {
-            Serial.print(F("Stufe: "));
-            Serial.print(i);
-            Serial.print(F("  PWM Fan 1: "));
-            Serial.print(fan1_.getPWM(i));
-            Serial.print(F("  PWM Fan 2: "));
-            Serial.println(fan2_.getPWM(i));
-          }
-          stopCalibration(false);
-        } else {
-          // nächste Stufe
-          calibration_pwm_in_progress_ = false;
-          current_calibration_mode_++;
-        }
-      }
-    } else {
-      // one PWM step timed out
-      stopCalibration(true);
-    }
+    return;
   }
-}
 
-bool FanControl::speedCalibrationPWMStep()
-{
-  bool r1 = fan1_.speedCalibrationStep(current_calibration_mode_);
-  bool r2 = fan2_.speedCalibrationStep(current_calibration_mode_);
+  // Beide Lüfter werden gleichzeitig kalibriert
+  bool r1 = fan1_.speedCalibrationStep();
+  bool r2 = fan2_.speedCalibrationStep();
   setSpeed();
-  return r1 && r2;
+  current_calibration_mode_ = int(r1 ? fan2_.getCalibrationMode() : fan1_.getCalibrationMode());
+  if (!r1 || !r2)
+    return;
+
+  if (fan1_.calibrationFailed() || fan2_.calibrationFailed()) {
+    // Solldrehzahl nicht erreichbar
+    stopCalibration(true);
+    return;
+  }
+
+  // fertig mit allen Stufen!!!
+  // Speichern in EEProm und Variablen
+  fan1_.finishCalibration();
+  fan2_.finishCalibration();
+  storePWMSettingsToEEPROM();
+  storeFanCurvesToEEPROM(true);
+  for (unsigned i = 0; ((i < KWLConfig::StandardModeCnt) && (i < 10)); i++) {
+    Serial.print(F("Stufe: "));
+    Serial.print(i);
+    Serial.print(F("  PWM Fan 1: "));
+    Serial.print(fan1_.getPWM(i));
+    Serial.print(F("  PWM Fan 2: "));
+    Serial.println(fan2_.getPWM(i));
+  }
+  stopCalibration(false);
 }
 
 void FanControl::stopCalibration(bool timeout)
@@ -441,66 +867,161 @@ void FanControl::storePWMSettingsToEEPROM()
   }
 }
 
+void FanControl::storeFanCurvesToEEPROM(bool force)
+{
+  // Kennlinie pendelt im eingeschwungenen Zustand um eine Einheit, EEPROM schonen
+  uint8_t curve[FanCurve::POINTS];
+  if (force || fan1_.curve_.movedFrom(persistent_config_.getFanCurve(0))) {
+    fan1_.curve_.save(curve);
+    persistent_config_.setFanCurve(0, curve);
+  }
+  if (force || fan2_.curve_.movedFrom(persistent_config_.getFanCurve(1))) {
+    fan2_.curve_.save(curve);
+    persistent_config_.setFanCurve(1, curve);
+  }
+}
+
 bool FanControl::mqttReceiveMsg(const StringView& topic, const StringView& s)
 {
-  if (topic == MQTTTopic::CmdFan1Speed) {
-    // Drehzahl Lüfter 1
-    unsigned i = unsigned(s.toInt());
-    getFan1().setStandardSpeed(i);
-    persistent_config_.setSpeedSetpointFan1(i);
-  } else if (topic == MQTTTopic::CmdFan2Speed) {
-    // Drehzahl Lüfter 2
-    unsigned i = unsigned(s.toInt());
-    getFan2().setStandardSpeed(i);
-    persistent_config_.setSpeedSetpointFan2(i);
-  } else if (topic == MQTTTopic::CmdMode) {
-    // KWL Stufe
-    setVentilationMode(int(s.toInt()));
-  } else if (topic == MQTTTopic::CmdFansCalculateSpeedMode) {
-    if (s == F("PROP"))
-      setCalculateSpeedMode(FanCalculateSpeedMode::PROP);
-    else if (s == F("PID"))
-      setCalculateSpeedMode(FanCalculateSpeedMode::PID);
-  } else if (topic == MQTTTopic::CmdCalibrateFans) {
-    if (s == F("YES"))
-      speedCalibrationStart();
-  } else if (topic == MQTTTopic::CmdGetSpeed) {
-    forceSend();
+  static const TopicRoute<FanControl> ROUTES[] PROGMEM = {
+    { MQTTTopic::CmdFanSpeed.data_P(), &FanControl::mqttSetStandardSpeed },
+    { MQTTTopic::CmdMode.data_P(), &FanControl::mqttSetMode },
+    { MQTTTopic::CmdAirflow.data_P(), &FanControl::mqttSetAirflow },
+    { MQTTTopic::CmdFansCalculateSpeedMode.data_P(), &FanControl::mqttSetCalculateSpeedMode },
+    { MQTTTopic::CmdCalibrateFans.data_P(), &FanControl::mqttCalibrateFans },
+    { MQTTTopic::CmdGetSpeed.data_P(), &FanControl::mqttGetSpeed },
 #ifdef DEBUG
-  } else if (topic == MQTTTopic::KwlDebugsetFan1Getvalues) {
-    if (s == F("on"))
-      fan1_.debug(true);
-    else if (s == F("off"))
-      fan1_.debug(false);
-  } else if (topic == MQTTTopic::KwlDebugsetFan2Getvalues) {
-    if (s == F("on"))
-      fan2_.debug(true);
-    else if (s == F("off"))
-      fan2_.debug(false);
-  } else if (topic == MQTTTopic::KwlDebugsetFan1PWM) {
-    // update PWM value for the current state
-    if (ventilation_mode_ != 0) {
-      int value = int(s.toInt());
-      fan1_.debugSet(ventilation_mode_, value);
-      speedUpdate();
-    }
-  } else if (topic == MQTTTopic::KwlDebugsetFan2PWM) {
-    // update PWM value for the current state
-    if (ventilation_mode_ != 0) {
-      int value = int(s.toInt());
-      fan2_.debugSet(ventilation_mode_, value);
-      speedUpdate();
-    }
-  } else if (topic == MQTTTopic::KwlDebugsetFanPWMStore) {
-    // store calibration data in EEPROM
-    storePWMSettingsToEEPROM();
+    { MQTTTopic::KwlDebugsetFanGetvalues.data_P(), &FanControl::mqttDebugFan },
+    { MQTTTopic::KwlDebugsetFanPWM.data_P(), &FanControl::mqttDebugSetPWM },
+    { MQTTTopic::KwlDebugsetFanPWMStore.data_P(), &FanControl::mqttDebugStorePWM },
 #endif
-  } else {
+  };
+  return routeTopic(*this, ROUTES, topic, s);
+}
+
+Fan* FanControl::getFan(unsigned index)
+{
+  switch (index) {
+    case 1: return &fan1_;
+    case 2: return &fan2_;
+    default: return nullptr;
+  }
+}
+
+bool FanControl::mqttSetStandardSpeed(const TopicParams& params, const StringView& s)
+{
+  // Drehzahl Lüfter 1 oder 2 (auch in Bulk-Konfiguration und Modbus, daher erst prüfen, siehe MessageHandler::validate())
+  auto index = params.getNumber(0);
+  auto fan = getFan(index);
+  if (!fan)
     return false;
+  long i;
+  if (!s.parseInt(i) || i < FanRPM::MIN_RPM || i > FanRPM::MAX_RPM) {
+    reportMalformed();
+  } else if (!isValidating()) {
+    fan->setStandardSpeed(unsigned(i));
+    if (index == 1)
+      persistent_config_.setSpeedSetpointFan1(unsigned(i));
+    else
+      persistent_config_.setSpeedSetpointFan2(unsigned(i));
+  }
+  return true;
+}
+
+bool FanControl::mqttSetMode(const TopicParams&, const StringView& s)
+{
+  // KWL Stufe (auch über Modbus, daher erst prüfen)
+  long i;
+  if (!s.parseInt(i) || i < 0 || i >= long(KWLConfig::StandardModeCnt))
+    reportMalformed();
+  else if (!isValidating())
+    setVentilationMode(int(i));
+  return true;
+}
+
+bool FanControl::mqttSetAirflow(const TopicParams&, const StringView& s)
+{
+  // stufenlose Luftmenge in Prozent ("85%") oder als Drehzahl Lüfter 1 ("1300"), 0 = aus
+  const bool percent = s.length() > 0 && s.c_str()[s.length() - 1] == '%';
+  long value;
+  if (!s.substr(0, s.length() - (percent ? 1 : 0)).parseInt(value) || value < 0) {
+    reportMalformed();
+    return true;
+  }
+  if (!percent) {
+    const long standard = long(fan1_.getStandardSpeed());
+    if (standard <= 0) {
+      reportMalformed();
+      return true;
+    }
+    // nur eine echte 0 schaltet aus
+    value = (value == 0) ? 0 : max(1L, (value * 100 + standard / 2) / standard);
   }
+  if (value > getMaxAirflow())
+    reportMalformed();
+  else if (!isValidating())
+    setAirflow(int(value));
+  return true;
+}
+
+bool FanControl::mqttSetCalculateSpeedMode(const TopicParams&, const StringView& s)
+{
+  if (s == F("PROP"))
+    setCalculateSpeedMode(FanCalculateSpeedMode::PROP);
+  else if (s == F("PID"))
+    setCalculateSpeedMode(FanCalculateSpeedMode::PID);
+  else
+    reportMalformed();
   return true;
 }
 
+bool FanControl::mqttCalibrateFans(const TopicParams&, const StringView& s)
+{
+  if (s == F("YES"))
+    speedCalibrationStart();
+  return true;
+}
+
+bool FanControl::mqttGetSpeed(const TopicParams&, const StringView&)
+{
+  forceSend();
+  return true;
+}
+
+#ifdef DEBUG
+bool FanControl::mqttDebugFan(const TopicParams& params, const StringView& s)
+{
+  auto fan = getFan(params.getNumber(0));
+  if (!fan)
+    return false;
+  if (s == F("on"))
+    fan->debug(true);
+  else if (s == F("off"))
+    fan->debug(false);
+  return true;
+}
+
+bool FanControl::mqttDebugSetPWM(const TopicParams& params, const StringView& s)
+{
+  auto fan = getFan(params.getNumber(0));
+  if (!fan)
+    return false;
+  // update PWM value for the current state
+  if (ventilation_mode_ != 0) {
+    fan->debugSet(ventilation_mode_, int(s.toInt()));
+    speedUpdate();
+  }
+  return true;
+}
+
+bool FanControl::mqttDebugStorePWM(const TopicParams&, const StringView&)
+{
+  // store calibration data in EEPROM
+  storePWMSettingsToEEPROM();
+  return true;
+}
+#endif
+
 void FanControl::sendMQTT()
 {
   int fan1 = int(fan1_.getSpeed());
@@ -508,9 +1029,12 @@ void FanControl::sendMQTT()
   last_sent_fan1_speed_ = fan1;
   last_sent_fan2_speed_ = fan2;
   auto mode = ventilation_mode_;
-  mqtt_publish_.publish([this, fan1, fan2, mode]() {
+  auto airflow = getAirflow();
+  mqtt_publish_.publish([this, fan1, fan2, mode, airflow]() {
     if (!publish_if(mqtt_send_flags_, MQTT_SEND_MODE, MQTTTopic::StateKwlMode, mode, KWLConfig::RetainFanMode))
       return false;
+    if (!publish_if(mqtt_send_flags_, MQTT_SEND_AIRFLOW, MQTTTopic::StateKwlAirflow, airflow, KWLConfig::RetainFanMode))
+      return false;
     if (!publish_if(mqtt_send_flags_, MQTT_SEND_FAN1, MQTTTopic::Fan1Speed, fan1, KWLConfig::RetainFanSpeed))
       return false;
     if (!publish_if(mqtt_send_flags_, MQTT_SEND_FAN2, MQTTTopic::Fan2Speed, fan2, KWLConfig::RetainFanSpeed))
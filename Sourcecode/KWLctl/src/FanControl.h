@@ -29,12 +29,16 @@
 
 #include <FanRPM.h>
 #include <TimeScheduler.h>
+#include <InterruptStats.h>
 #include <MessageHandler.h>
 
-#include <PID_v1.h>
+#include <FanCurve.h>
+#include <FixedPID.h>
 
 class Print;
+class TopicParams;
 class KWLPersistentConfig;
+class DacOutput;
 
 class MessageHandler;
 
@@ -87,7 +91,7 @@ public:
   inline void setStandardSpeed(unsigned speed) { standard_speed_ = speed; }
 
   /// Check whether the fan is set off.
-  inline bool isOff() const { return abs(tech_setpoint_) < 0.1; }
+  inline bool isOff() const { return tech_setpoint_ == 0; }
 
   /// Set the fan to off (until next computation).
   inline void off() { tech_setpoint_ = 0; }
@@ -95,6 +99,9 @@ public:
   /// Get PWM signal strength for given ventilation mode.
   inline int getPWM(unsigned mode) const { return pwm_setpoint_[mode]; }
 
+  /// Get learned PWM to RPM curve of this fan.
+  inline const FanCurve& getCurve() const { return curve_; }
+
   /// Set PWM signal strength for given ventilation mode at initialization time.
   inline void initPWM(unsigned mode, int pwm) { pwm_setpoint_[mode] = pwm; }
 
@@ -106,25 +113,88 @@ private:
   friend class FanControl;
 
   /// Called by the interrupt routine for this fan.
-  inline void interrupt() { rpm_.interrupt(); }
+  inline void interrupt() {
+    Scheduler::InterruptStats::Measure measure(KWLConfig::InterruptStatistics ? &isr_stats_ : nullptr);
+    rpm_.interrupt();
+  }
+
+  /// Called by the fan control to update speed from RPM measurement (of the last few signals, if recent is set).
+  inline void updateSpeed(bool recent) { current_speed_ = recent ? rpm_.getRecentSpeed() : rpm_.getSpeed(); }
+
+  /*!
+   * @brief Update fan speed based on airflow and calculation mode.
+   *
+   * @param airflow airflow in per mille of standard speed (0=off).
+   * @param calcMode mode of fan speed calculation.
+   */
+  void computeSpeed(unsigned airflow, FanCalculateSpeedMode calcMode);
+
+  /// Get PWM signal for airflow in per mille by interpolating calibrated ventilation modes.
+  int getPropPWM(unsigned airflow) const;
+
+  /// Compute PWM signal using PID controller, with tunings based on distance from setpoint.
+  void computePID(unsigned gap);
+
+  /// Set PWM signal from learned curve after setpoint change, PID takes over after the speed ramp.
+  void feedForward(unsigned gap);
+
+  /// Check whether the fan speed is still ramping to the setpoint after feed-forward.
+  bool rampInProgress(unsigned gap);
+
+  /// Refine learned curve by current steady-state PWM signal and speed.
+  void learnCurve();
 
-  /// Called by the fan control to update speed from RPM measurement.
-  inline void updateSpeed() { current_speed_ = rpm_.getSpeed(); }
+  /// Get maximum difference from setpoint, which is considered stable.
+  int getStableGap() const;
 
-  /// Update fan speed based on modes.
-  void computeSpeed(int ventMode, FanCalculateSpeedMode calcMode);
+  /// Set PID sample time to match regulation interval.
+  void setSampleTime(unsigned long sampleTimeMs);
+
+  /// Check whether the fan runs close enough to the setpoint.
+  bool isStable() const;
 
   /// Set computed fan speed via PWM pin and/or DAC.
-  void setSpeed(int id, uint8_t pwmPin, uint8_t dacChannel);
+  void setSpeed(int id, uint8_t pwmPin, DacOutput& dac, uint8_t dacChannel);
 
   /// Debug: set PWM signal explicitly for debugging purposes.
   void debugSet(int ventMode, int techSetpoint);
 
-  /// Prepare for calibration.
-  void prepareCalibration() { good_pwm_setpoint_count_ = 0; }
+  /// Prepare for calibration, start measuring fan characteristic.
+  void prepareCalibration();
+
+  /*!
+   * @brief Perform one speed calibration step.
+   *
+   * The fan speed is first measured at increasing PWM points, until the
+   * speed of the fastest ventilation mode is reached. The measured points
+   * form a monotonic piecewise-linear PWM to RPM model, which provides
+   * the initial PWM estimate for each ventilation mode. If the fan speed
+   * at this PWM isn't precise enough, the PWM is refined by bisection
+   * between neighboring measured points.
+   *
+   * @return true, if the calibration of this fan is finished (successfully or not).
+   */
+  bool speedCalibrationStep();
+
+  /// Check whether the calibration failed (some mode speed is out of reach of the fan).
+  bool calibrationFailed() const { return calibration_phase_ == CalibrationPhase::Failed; }
+
+  /// Get ventilation mode being calibrated (0 while measuring fan characteristic).
+  unsigned getCalibrationMode() const {
+    return (calibration_phase_ == CalibrationPhase::Refine || calibration_phase_ == CalibrationPhase::Average) ? calibration_step_ : 0;
+  }
+
+  /// Get PWM difference for a speed difference using the slope between calibration bounds.
+  int interpolatePWM(int speed_delta) const;
+
+  /// Set PWM signal during calibration and restart waiting for stable speed.
+  void setCalibrationPWM(int pwm);
+
+  /// Check whether the speed is stable during calibration and return the average stable speed.
+  bool calibrationSettled(int& speed);
 
-  /// Perform one speed calibration step for given mode.
-  bool speedCalibrationStep(int mode);
+  /// Start calibration of the given or next lower ventilation mode, return true if all modes are calibrated.
+  bool calibrateMode(int mode);
 
   /// Finish calibration and copy temp PWM values to real PWM values.
   void finishCalibration();
@@ -135,25 +205,66 @@ private:
   /// Send MQTT debugging message, if on.
   void sendMQTTDebug(int id, unsigned long ts, MessageHandler& h);
 
-  /// How many "good" measurements do we need to consider the calibration good.
-  static constexpr unsigned REQUIRED_GOOD_PWM_COUNT = 30;
+  /// Calibration phases.
+  enum class CalibrationPhase : uint8_t
+  {
+    Sweep,    ///< Measuring fan speed at increasing PWM points.
+    Refine,   ///< Refining PWM for ventilation modes.
+    Average,  ///< Averaging fan speed at the refined PWM for the final correction.
+    Done,     ///< Calibration finished.
+    Failed    ///< Calibration failed.
+  };
+
+  /// Maximum count of PWM points to measure fan characteristic.
+  static constexpr uint8_t CALIBRATION_SWEEP_POINTS = 5;
+  /// Count of measurements averaged to compare fan speed with the preceding measurements.
+  static constexpr uint8_t CALIBRATION_SETTLE_RUNS = 4;
+  /// Count of measurements needed to decide whether the fan speed settled.
+  static constexpr uint8_t CALIBRATION_SETTLE_HISTORY = 2 * CALIBRATION_SETTLE_RUNS;
+  /// Count of fan control runs to average the speed at the refined PWM of a ventilation mode.
+  static constexpr uint8_t CALIBRATION_AVERAGE_RUNS = 8;
+  /// Maximum count of averaging rounds at one ventilation mode before calibration fails.
+  static constexpr uint8_t CALIBRATION_AVERAGE_ROUNDS = 4;
+  /// Maximum count of measurements at one PWM point before calibration fails (1 minute).
+  static constexpr uint8_t CALIBRATION_STEP_RUNS = 60;
+
+  /// Get PWM signal of the given sweep point.
+  static constexpr int sweepPWM(uint8_t point) { return (point + 1) * 1000 / CALIBRATION_SWEEP_POINTS; }
 
   FanRPM rpm_;  ///< Speed measurement and setting.
+  Scheduler::InterruptStats isr_stats_; ///< Load of tacho interrupts.
   Relay power_; ///< Power relay.
 
-  double current_speed_ = 0;            ///< Current speed of the fan in RPM.
-  double speed_setpoint_ = 0;           ///< Desired speed of the fan in RPM.
-  double tech_setpoint_ = 0;            ///< Needed PWM signal to set this fan speed.
+  int current_speed_ = 0;               ///< Current speed of the fan in RPM.
+  int speed_setpoint_ = 0;              ///< Desired speed of the fan in RPM.
+  int tech_setpoint_ = 0;               ///< Needed PWM signal to set this fan speed.
   unsigned standard_speed_ = 0;         ///< Standard speed of this fan (configuration for default ventilation mode).
   int pwm_setpoint_[MAX_FAN_MODE_CNT];  ///< Current set of PWM output for ventilation modes.
   int calibration_pwm_setpoint_[MAX_FAN_MODE_CNT];  ///< Temporary PWM values during calibration.
-  int good_pwm_setpoint_[REQUIRED_GOOD_PWM_COUNT];  ///< PWM signal strength considered "good" during calibration.
-  unsigned good_pwm_setpoint_count_ = 0;            ///< # of "good" PWM signal strengths we already know.
+  int sweep_speed_[CALIBRATION_SWEEP_POINTS];       ///< Speed measured at sweep PWM points during calibration.
+  int bracket_low_pwm_ = 0;             ///< Lower PWM bound for ventilation mode being calibrated.
+  int bracket_high_pwm_ = 0;            ///< Upper PWM bound for ventilation mode being calibrated.
+  int bracket_low_speed_ = 0;           ///< Speed at lower PWM bound.
+  int bracket_high_speed_ = 0;          ///< Speed at upper PWM bound.
+  int segment_pwm_ = 0;                 ///< PWM difference of sweep points around speed being calibrated.
+  int segment_speed_ = 0;               ///< Speed difference of sweep points around speed being calibrated.
+  int settle_speed_[CALIBRATION_SETTLE_HISTORY]; ///< Last speed measurements during calibration.
+  uint8_t settle_count_ = 0;            ///< Count of speed measurements since last PWM change during calibration.
+  uint8_t average_rounds_ = 0;          ///< Count of averaging rounds at ventilation mode being calibrated.
+  uint8_t sweep_count_ = 0;             ///< Count of measured sweep points.
+  uint8_t calibration_step_ = 0;        ///< Sweep point or ventilation mode being calibrated.
+  CalibrationPhase calibration_phase_ = CalibrationPhase::Done; ///< Current calibration phase.
   bool mqtt_send_debug_ = false;        ///< Send debugging info for this fan per MQTT.
   uint8_t pwm_pin_;                     ///< Pin to send PWM signa to.
   uint8_t tacho_pin_;                   ///< Pin to read tacho signal from.
   uint8_t fan_id_;                      ///< Fan ID (1 or 2).
-  PID pid_;                             ///< PID regulator for this fan.
+  FixedPID::Tunings cons_tunings_;      ///< Conservative PID tunings for current sample time.
+  FixedPID::Tunings agg_tunings_;       ///< Aggressive PID tunings for current sample time.
+  FixedPID pid_;                        ///< PID regulator for this fan.
+  FanCurve curve_;                      ///< Learned PWM to RPM curve.
+  bool ramping_ = false;                ///< Set while the speed ramps to new setpoint after feed-forward.
+  unsigned ramp_gap_ = 0;               ///< Distance from setpoint at last ramp progress check.
+  unsigned long ramp_check_ms_ = 0;     ///< Time of last ramp progress check.
 };
 
 /*!
@@ -177,11 +288,12 @@ public:
    * @brief Construct fan control object.
    *
    * @param config configuration to read/write.
+   * @param dac DAC outputs for fans.
    * @param speedCallback callback to call after computing PWM signal for fans, but before
    *        setting it. Typically used for antifreeze/preheater regulation and to turn off
    *        fans if no preheater installed.
    */
-  explicit FanControl(KWLPersistentConfig& config, SetSpeedCallback *speedCallback);
+  FanControl(KWLPersistentConfig& config, DacOutput& dac, SetSpeedCallback *speedCallback);
 
   /*!
    * @brief Start fans.
@@ -196,9 +308,35 @@ public:
   /// Get current mode (0=off, others the current ventilation mode).
   inline int getVentilationMode() { return ventilation_mode_; }
 
-  /// Set current mode (0=off).
+  /// Set current mode (0=off), this ends stepless operation.
   void setVentilationMode(int mode);
 
+  /// Switch to next higher (direction > 0) or lower ventilation mode, also from stepless operation.
+  void stepVentilationMode(int direction);
+
+  /// Check whether the airflow is set steplessly instead of by ventilation mode.
+  inline bool isStepless() { return airflow_target_ >= 0; }
+
+  /// Get target airflow in percent of standard speed (also in ventilation modes).
+  int getAirflow();
+
+  /// Get current airflow in percent of standard speed, while ramping to the stepless target.
+  int getCurrentAirflow();
+
+  /// Get maximum stepless airflow in percent of standard speed (airflow of the highest mode).
+  static int getMaxAirflow();
+
+  /*!
+   * @brief Set airflow steplessly.
+   *
+   * The airflow ramps to the new value at KWLConfig::StandardSteplessRampPercent
+   * per second. Ventilation mode reports the nearest mode in the meantime.
+   *
+   * @param percent airflow in percent of standard speed (0=off), limited
+   *    to KWLConfig::StandardSteplessMinPercent and the highest mode.
+   */
+  void setAirflow(int percent);
+
   /// Get mode of fan speed calculation.
   FanCalculateSpeedMode getCalculateSpeedMode() { return calc_speed_mode_; }
 
@@ -212,10 +350,10 @@ public:
   inline Fan& getFan2() { return fan2_; }
 
   /// Force sending mode message via MQTT independent of timing.
-  inline void forceSendMode() { mqtt_send_flags_ |= MQTT_SEND_MODE; sendMQTT(); }
+  inline void forceSendMode() { mqtt_send_flags_ |= MQTT_SEND_MODE | MQTT_SEND_AIRFLOW; sendMQTT(); }
 
   /// Force sending speed message via MQTT independent of timing.
-  inline void forceSend() { mqtt_send_flags_ |= MQTT_SEND_MODE | MQTT_SEND_FAN1 | MQTT_SEND_FAN2; sendMQTT(); }
+  inline void forceSend() { mqtt_send_flags_ |= MQTT_SEND_MODE | MQTT_SEND_AIRFLOW | MQTT_SEND_FAN1 | MQTT_SEND_FAN2; sendMQTT(); }
 
   /// Starts speed calibration.
   void speedCalibrationStart();
@@ -232,48 +370,88 @@ private:
   /// Sets fan speed based on ventilation mode.
   void speedUpdate();
 
+  /// Move current airflow towards stepless target by the ramp rate for the elapsed time.
+  void rampAirflow(unsigned long elapsed);
+
+  /// Regulate fast until the fans reach new speed.
+  void regulateFast();
+
+  /// Set regulation interval and PID sample time of fans.
+  void setRegulationInterval(unsigned long interval);
+
+  /// Regulate fast while fan speed settles, slow when stable.
+  void adaptRegulationInterval();
+
   /// Sets fan speed based currently-set PWM signal strength.
   void setSpeed();
 
   /// Called to process the next calibration step.
   void speedCalibrationStep();
 
-  /// Called to process the next calibration step for one PWM step.
-  bool speedCalibrationPWMStep();
-
   /// Called to end/cancel calibration.
   void stopCalibration(bool timeout);
 
   /// Save current PWM settings to EEPROM.
   void storePWMSettingsToEEPROM();
 
+  /*!
+   * @brief Save learned fan curves to EEPROM (only changed knots are written).
+   *
+   * @param force store also curves, which moved by at most one unit since the last store.
+   */
+  void storeFanCurvesToEEPROM(bool force);
+
   virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override;
 
+  /// Get fan by index as used in MQTT topics (1 or 2) or @c nullptr for invalid index.
+  Fan* getFan(unsigned index);
+
+  // MQTT command handlers, see mqttReceiveMsg() for topics.
+  bool mqttSetStandardSpeed(const TopicParams& params, const StringView& s);
+  bool mqttSetMode(const TopicParams& params, const StringView& s);
+  bool mqttSetAirflow(const TopicParams& params, const StringView& s);
+  bool mqttSetCalculateSpeedMode(const TopicParams& params, const StringView& s);
+  bool mqttCalibrateFans(const TopicParams& params, const StringView& s);
+  bool mqttGetSpeed(const TopicParams& params, const StringView& s);
+#ifdef DEBUG
+  bool mqttDebugFan(const TopicParams& params, const StringView& s);
+  bool mqttDebugSetPWM(const TopicParams& params, const StringView& s);
+  bool mqttDebugStorePWM(const TopicParams& params, const StringView& s);
+#endif
+
   /// Send requested messages, if any.
   void sendMQTT();
 
   Fan fan1_;   ///< Control for fan 1 (intake).
   Fan fan2_;   ///< Control for fan 2 (exhaust).
 
+  DacOutput& dac_;                  ///< DAC outputs for fans.
   SetSpeedCallback *speed_callback_;///< Callback to call when new tech points for fans computed.
-  int ventilation_mode_;            ///< Current ventilation mode (0-n).
+  int ventilation_mode_;            ///< Current ventilation mode (0-n), nearest mode in stepless operation.
+  int airflow_target_ = -1;         ///< Stepless target airflow in per mille of standard speed (-1=use ventilation mode).
+  int airflow_ = 0;                 ///< Current ramped stepless airflow in per mille of standard speed.
   FanMode mode_ = FanMode::Normal;  ///< Current operation mode.
   FanCalculateSpeedMode calc_speed_mode_ = FanCalculateSpeedMode::PROP;
 
   bool calibration_in_progress_ = false;        ///< Flag set during calibration.
-  bool calibration_pwm_in_progress_ = false;    ///< Flag set during calibration of one PWM mode.
   int current_calibration_mode_ = 0;            ///< Current mode being calibrated.
   unsigned long calibration_start_time_us_ = 0; ///< Start of calibration.
-  unsigned long calibration_pwm_start_time_us_ = 0; ///< Start of one PWM mode calibration.
 
   KWLPersistentConfig& persistent_config_;      ///< Configuration.
 
   static constexpr uint8_t MQTT_SEND_MODE = 1;
   static constexpr uint8_t MQTT_SEND_FAN1 = 2;
   static constexpr uint8_t MQTT_SEND_FAN2 = 4;
+  static constexpr uint8_t MQTT_SEND_AIRFLOW = 8;
+
+  unsigned long regulation_interval_ = 1000000; ///< Current regulation interval in microseconds.
+  uint8_t stable_runs_ = 0;         ///< Count of consecutive regulation runs with stable speed.
+  unsigned long last_run_time_ = 0; ///< Schedule time of last run.
+  unsigned long report_time_ = 0;   ///< Time accumulated since last reporting tick.
 
-  int send_mode_countdown_ = 0;     ///< Countdown until sending mode (in run intervals).
-  int send_fan_countdown_ = 0;      ///< Countdown until sending fan state (in run intervals).
+  int store_curve_countdown_ = 0;   ///< Countdown until storing learned fan curves (in seconds).
+  int send_mode_countdown_ = 0;     ///< Countdown until sending mode (in seconds).
+  int send_fan_countdown_ = 0;      ///< Countdown until sending fan state (in seconds).
   int send_fan_oversampling_countdown_ = 0; ///< Countdown until sending fan state unconditionally.
   int last_sent_fan1_speed_ = 0;    ///< Last reported fan 1 speed.
   int last_sent_fan2_speed_ = 0;    ///< Last reported fan 2 speed.
@@ -32,7 +32,10 @@ IPAddressLiteral::operator IPAddress() const noexcept
 
 #define KWL_COPY(name) name##_ = KWLConfig::Standard##name
 
-static_assert(sizeof(KWLPersistentConfig) == 298, "Persistent config size changed, ensure compatibility or increment version");
+#ifdef __AVR__
+// layout differs in host builds (int size, alignment), there's no EEPROM to stay compatible with
+static_assert(sizeof(KWLPersistentConfig) == 360, "Persistent config size changed, ensure compatibility or increment version");
+#endif
 static constexpr auto PrefixMQTT = KWLConfig::PrefixMQTT;
 
 void KWLPersistentConfig::loadDefaults()
@@ -67,7 +70,9 @@ void KWLPersistentConfig::loadDefaults()
   strcpy(mqtt_prefix_, PrefixMQTT.load());
 
   loadNetworkDefaults();
+  loadReportingDefaults();
   touch_.reset();
+  memset(FanCurve_, FanCurve::UNKNOWN, sizeof(FanCurve_));  // not learned yet
 }
 
 void KWLPersistentConfig::loadNetworkDefaults()
@@ -89,6 +94,31 @@ void KWLPersistentConfig::loadNetworkDefaults()
   mac_ = mac;
 }
 
+void KWLPersistentConfig::loadReportingDefaults()
+{
+  auto set = [this](ReportingParam param, uint16_t value) { reporting_[unsigned(param)] = value; };
+  set(ReportingParam::TempMinInterval, KWLConfig::MinIntervalMqttTemp);
+  set(ReportingParam::TempMaxInterval, KWLConfig::MaxIntervalMqttTemp);
+  set(ReportingParam::TempMinDiff, uint16_t(KWLConfig::MinDiffMqttTemp * 100 + 0.5));
+  set(ReportingParam::DHTMinInterval, KWLConfig::MinIntervalMqttDHT);
+  set(ReportingParam::DHTMaxInterval, KWLConfig::MaxIntervalMqttDHT);
+  set(ReportingParam::DHTMinDiffTemp, uint16_t(KWLConfig::MinDiffMqttDHTTemp * 100 + 0.5));
+  set(ReportingParam::DHTMinDiffHum, KWLConfig::MinDiffMqttDHTHum);
+  set(ReportingParam::CO2MinInterval, KWLConfig::MinIntervalMqttCO2);
+  set(ReportingParam::CO2MaxInterval, KWLConfig::MaxIntervalMqttCO2);
+  set(ReportingParam::CO2MinDiff, KWLConfig::MinDiffMqttCO2);
+  set(ReportingParam::VOCMinInterval, KWLConfig::MinIntervalMqttVOC);
+  set(ReportingParam::VOCMaxInterval, KWLConfig::MaxIntervalMqttVOC);
+  set(ReportingParam::VOCMinDiff, KWLConfig::MinDiffMqttVOC);
+  set(ReportingParam::FanMinInterval, KWLConfig::MinIntervalMqttFan);
+  set(ReportingParam::FanMaxInterval, KWLConfig::MaxIntervalMqttFan);
+  set(ReportingParam::FanMinDiff, KWLConfig::MinDiffMqttFan);
+  set(ReportingParam::FanModeInterval, KWLConfig::IntervalMqttFanMode);
+  set(ReportingParam::BypassInterval, KWLConfig::IntervalMqttBypass);
+  set(ReportingParam::SummaryWindow, KWLConfig::SummaryWindowMqtt);
+  set(ReportingParam::RawSlowdown, KWLConfig::RawSlowdownMqtt);
+}
+
 void KWLPersistentConfig::migrate()
 {
   // "upgrade" existing config, if possible (all initialized to -1/0xff)
@@ -148,6 +178,16 @@ void KWLPersistentConfig::migrate()
     update(Fan1ImpulsesPerRotation_);
     update(Fan2ImpulsesPerRotation_);
   }
+  if (reporting_[0] == 0xffff) {
+    Serial.println(F("Config migration: setting reporting parameters"));
+    loadReportingDefaults();
+    update(reporting_);
+  }
+  if (reporting_[unsigned(ReportingParam::SummaryWindow)] == 0xffff) {
+    Serial.println(F("Config migration: setting summary parameters"));
+    setReporting(ReportingParam::SummaryWindow, KWLConfig::SummaryWindowMqtt);
+    setReporting(ReportingParam::RawSlowdown, KWLConfig::RawSlowdownMqtt);
+  }
 }
 
 bool KWLPersistentConfig::hasCrash() const
@@ -191,6 +231,38 @@ void KWLPersistentConfig::resetCrashes()
   update(crashes_);
 }
 
+uint16_t KWLPersistentConfig::getMeasurementInterval(ReportingParam param) const
+{
+  auto interval = getReporting(param);
+  if (!getReporting(ReportingParam::SummaryWindow))
+    return interval;
+  auto slow = uint32_t(interval) * getReporting(ReportingParam::RawSlowdown);
+  if (slow > REPORTING_MAX_INTERVAL)
+    return REPORTING_MAX_INTERVAL;
+  return uint16_t(slow);
+}
+
+unsigned long KWLPersistentConfig::getPhaseOffset(unsigned long period) const
+{
+  if (!period)
+    return 0;
+  // FNV-1a hash over device identity and period
+  uint32_t hash = 2166136261UL;
+  auto add = [&hash](const void* data, size_t size) {
+    auto p = reinterpret_cast<const uint8_t*>(data);
+    while (size--) {
+      hash ^= *p++;
+      hash *= 16777619UL;
+    }
+  };
+  add(&mac_, sizeof(mac_));
+  add(&ip_, sizeof(ip_));
+  add(mqtt_prefix_, strnlen(mqtt_prefix_, sizeof(mqtt_prefix_)));
+  // different periods get independent offsets, so tasks of one device don't run in lockstep
+  add(&period, sizeof(period));
+  return hash % period;
+}
+
 bool KWLPersistentConfig::setMQTTPrefix(const char* prefix)
 {
   auto len = strlen(prefix);
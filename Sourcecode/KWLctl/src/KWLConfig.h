@@ -51,7 +51,9 @@
 #pragma once
 
 #include "ProgramData.h"
+#include "ReportingParam.h"
 
+#include <FanCurve.h>
 #include <FlashStringLiteral.h>
 #include <PersistentConfiguration.h>
 #include <Arduino.h>
@@ -168,6 +170,19 @@ public:
   /// Passwort für den MQTT Broker.
   static constexpr const char* NetworkMQTTPassword = nullptr;
 
+  /// How often to refresh cached network link state, in milliseconds.
+  static constexpr uint16_t NetworkLinkCheckPeriod = 1000;
+
+  /// How often to poll MQTT client for incoming messages when idle, in milliseconds.
+  static constexpr uint16_t NetworkMQTTPollPeriod = 50;
+
+  /// TCP port for Prometheus metrics scraping via HTTP (0 to disable).
+  static constexpr uint16_t MetricsPort = 9100;
+
+  /// TCP port for Modbus TCP server (0 to disable, standard port is 502).
+  /// WiFi module supports only one server, set MetricsPort to 0 to use Modbus over WiFi.
+  static constexpr uint16_t ModbusPort = 0;
+
   /// Prefix for all messages to and from the controller.
   static constexpr auto PrefixMQTT = makeFlashStringLiteral("d15");
 
@@ -207,6 +222,10 @@ public:
 // static constexpr double StandardKwlModeFactor[MAX_FAN_MODE_CNT] = {0, 0.5, 0.6, 0.7, 1, 1.3};
   /// Standardlüftungsstufe beim Anschalten.
   static constexpr int StandardKwlMode = 2;
+  /// Minimale Luftmenge im stufenlosen Betrieb in Prozent der Standarddrehzahl.
+  static constexpr unsigned StandardSteplessMinPercent = 50;
+  /// Maximale Änderung der Luftmenge im stufenlosen Betrieb in Prozent pro Sekunde.
+  static constexpr unsigned StandardSteplessRampPercent = 2;
   /// Drehzahl für Standardlüftungsstufe Zuluft.
   static constexpr unsigned StandardSpeedSetpointFan1       = 1550;              // sju: 1450
   /// Drehzahl für Standardlüftungsstufe Abluft.
@@ -291,6 +310,15 @@ public:
   static constexpr uint8_t PinFan2Tacho       = 19;
   /// Sampling für Tachoimpulse beim FALLING oder RISING.
   static constexpr int8_t TachoSamplingMode   = RISING;
+  /// Tachosignal per Input Capture von Timer 4 und 5 messen statt per Interrupt mit micros().
+  /// Die Tachoeingänge müssen dann an Pin 49 (ICP4, Lüfter 1) und 48 (ICP5, Lüfter 2) angeschlossen
+  /// werden, PinFan1Tacho und PinFan2Tacho werden ignoriert, siehe TachoCapture.
+  /// Achtung: Timer 5 wird dabei von 490 Hz Phase-Correct-PWM auf 976 Hz Fast-PWM umgestellt,
+  /// das betrifft die PWM-Ausgänge 44, 45 und 46 (Lüfter und Vorheizregister). Die PWM-Pins der
+  /// Lüfter bzw. das Vorheizregister müssen mit 976 Hz zurechtkommen.
+  static constexpr bool TachoInputCapture     = false;
+  /// Anzahl und Rechenzeit der Tacho-Interrupts messen (siehe Scheduler-Statistik, kostet ca. 20 Takte pro Interrupt).
+  static constexpr bool InterruptStatistics   = false;
 
   // Alternative zu PWM, Ansteuerung per DAC. I2C nutzt beim Arduino Mega Pin 20 u 21.
   /// I2C-OUTPUT-Addresse für Horter DAC als 7 Bit, wird verwendet als Alternative zur PWM Ansteuerung der Lüfter und für Vorheizregister.
@@ -303,6 +331,8 @@ public:
   static constexpr uint8_t DacChannelPreheater = 2;
   /// Zusätzliche Ansteuerung durch DAC über SDA und SLC (und PWM)
   static constexpr bool ControlFansDAC = true;
+  /// Geänderte DAC-Kanäle in einer I2C-Übertragung senden (Horter DAC schreibt aufeinanderfolgende Kanäle).
+  static constexpr bool DacSequentialWrite = true;
 
   /// Pin vom 1. DHT Sensor.
   static constexpr uint8_t PinDHTSensor1       = 28;
@@ -355,6 +385,44 @@ public:
   /// Minimum change in temperature to report per MQTT.
   static constexpr double MinDiffMqttTemp = 0.1;
 
+  /// At most how often to send DHT sensor messages via MQTT, in seconds.
+  static constexpr uint16_t MinIntervalMqttDHT = 5;
+  /// At least how often to send DHT sensor messages via MQTT, in seconds.
+  static constexpr uint16_t MaxIntervalMqttDHT = 300;
+  /// Minimum change in DHT temperature to report per MQTT.
+  static constexpr double MinDiffMqttDHTTemp = 0.1;
+  /// Minimum change in DHT humidity to report per MQTT, in %.
+  static constexpr uint16_t MinDiffMqttDHTHum = 1;
+  /// At most how often to send CO2 sensor messages via MQTT, in seconds.
+  static constexpr uint16_t MinIntervalMqttCO2 = 60;
+  /// At least how often to send CO2 sensor messages via MQTT, in seconds.
+  static constexpr uint16_t MaxIntervalMqttCO2 = 300;
+  /// Minimum change in CO2 concentration to report per MQTT, in ppm.
+  static constexpr uint16_t MinDiffMqttCO2 = 20;
+  /// At most how often to send VOC sensor messages via MQTT, in seconds.
+  static constexpr uint16_t MinIntervalMqttVOC = 5;
+  /// At least how often to send VOC sensor messages via MQTT, in seconds.
+  static constexpr uint16_t MaxIntervalMqttVOC = 30;
+  /// Minimum change in VOC concentration to report per MQTT, in ppm.
+  static constexpr uint16_t MinDiffMqttVOC = 20;
+  /// At most how often to send fan speed messages via MQTT, in seconds.
+  static constexpr uint16_t MinIntervalMqttFan = 5;
+  /// At least how often to send fan speed messages via MQTT, in seconds.
+  static constexpr uint16_t MaxIntervalMqttFan = 120;
+  /// Minimum change in fan speed to report per MQTT, in rpm.
+  static constexpr uint16_t MinDiffMqttFan = 50;
+  /// How often to send ventilation mode via MQTT, in seconds.
+  static constexpr uint16_t IntervalMqttFanMode = 300;
+  /// How often to send summer bypass state via MQTT, in seconds.
+  static constexpr uint16_t IntervalMqttBypass = 900;
+  /// Window for summaries (min/max/avg) of measurements sent via MQTT, in seconds. Set to 0 to not send summaries.
+  static constexpr uint16_t SummaryWindowMqtt = 0;
+  /// Factor to slow down sending of measurements via MQTT while summaries are sent.
+  static constexpr uint16_t RawSlowdownMqtt = 10;
+
+  // NOTE: The reporting values above are only defaults. They are stored in
+  // the persistent configuration and can be changed at runtime via MQTT.
+
   /// Default for retain last measurements reading in the MQTT broker.
   static constexpr bool RetainMeasurements = true;
 
@@ -582,7 +650,13 @@ private:
   // Fan RPM adjustment configuration
   float Fan1ImpulsesPerRotation_;              // 290
   float Fan2ImpulsesPerRotation_;              // 294
-  // 298
+
+  // Reporting configuration
+  uint16_t reporting_[unsigned(ReportingParam::Count)]; // 298..338
+
+  // Learned fan characteristics
+  uint8_t FanCurve_[2][FanCurve::POINTS];      // 338..360
+  // 360
 
   /// Initialize with defaults, if version doesn't fit.
   void loadDefaults();
@@ -590,6 +664,9 @@ private:
   /// Initialize network default values.
   void loadNetworkDefaults();
 
+  /// Initialize reporting default values.
+  void loadReportingDefaults();
+
   /// Migrate configuration.
   void migrate();
 
@@ -622,6 +699,12 @@ public:
   int getFanPWMSetpoint(unsigned fan, unsigned idx) { return FanPWMSetpoint_[idx][fan]; }
   void setFanPWMSetpoint(unsigned fan, unsigned idx, int pwm) { FanPWMSetpoint_[idx][fan] = pwm; update(FanPWMSetpoint_[idx][fan]); }
 
+  /// Get learned PWM to RPM curve of a fan (FanCurve::POINTS bytes).
+  const uint8_t* getFanCurve(unsigned fan) const { return FanCurve_[fan]; }
+
+  /// Set learned PWM to RPM curve of a fan (FanCurve::POINTS bytes).
+  void setFanCurve(unsigned fan, const uint8_t* curve) { memcpy(FanCurve_[fan], curve, sizeof(FanCurve_[fan])); update(FanCurve_[fan]); }
+
   /// Get program data from the given slot.
   const ProgramData& getProgram(unsigned index) const { return programs_[index]; }
 
@@ -655,6 +738,37 @@ public:
   /// Set prefix for all MQTT messages.
   bool setMQTTPrefix(const char* prefix);
 
+  /// Get reporting parameter.
+  uint16_t getReporting(ReportingParam param) const { return reporting_[unsigned(param)]; }
+
+  /// Set reporting parameter.
+  void setReporting(ReportingParam param, uint16_t value) { reporting_[unsigned(param)] = value; update(reporting_[unsigned(param)]); }
+
+  /*!
+   * @brief Get reporting interval for measurements.
+   *
+   * While summaries are active, measurements are reported less often, so
+   * the interval is multiplied by RawSlowdown (limited to maximum interval).
+   *
+   * @param param interval parameter.
+   * @return interval in seconds.
+   */
+  uint16_t getMeasurementInterval(ReportingParam param) const;
+
+  /*!
+   * @brief Get per-device phase offset for periodic tasks.
+   *
+   * The offset is derived from MAC address, IP address and MQTT prefix. So
+   * devices sharing a broker get different offsets and don't send messages
+   * in lockstep after a common restart (e.g., power outage), while each device
+   * keeps the same offset across restarts. Tasks with different periods get
+   * independent offsets.
+   *
+   * @param period period of the task (in any unit).
+   * @return offset in range [0, period).
+   */
+  unsigned long getPhaseOffset(unsigned long period) const;
+
   /// Get TFT calibration.
   const TouchCalibration& getTouchCalibration() const { return touch_; }
 
@@ -23,36 +23,130 @@
 #include "MQTTTopic.hpp"
 #include "ScreenshotService.h"
 
-#ifdef WIFI_SUPPORT
-  #include <WiFiEspUdp.h>
-#else
-  #include <EthernetUdp.h>
-#endif
-
-#include <Wire.h>
+#include <AsyncTWI.h>
+#include <TopicRouter.h>
 #include <DeadlockWatchdog.h>
 #include <avr/wdt.h>
 
 KWLControl::KWLControl() :
   MessageHandler(F("KWLControl")),
-  ntp_(udp_),
-  network_client_(persistent_config_, ntp_),
-  fan_control_(persistent_config_, this),
+  ntp_(transport_.getUDP()),
+  network_client_(persistent_config_, ntp_, transport_),
+  temp_sensors_(persistent_config_),
+  add_sensors_(persistent_config_),
+  fan_control_(persistent_config_, dac_, this),
   bypass_(persistent_config_, temp_sensors_),
-  antifreeze_(fan_control_, temp_sensors_, persistent_config_),
+  antifreeze_(fan_control_, temp_sensors_, persistent_config_, dac_),
   program_manager_(persistent_config_, fan_control_, ntp_),
+  bulk_config_(persistent_config_),
+  reporting_(persistent_config_, add_sensors_),
+  summary_(persistent_config_, temp_sensors_, fan_control_, add_sensors_),
+  serial_console_(persistent_config_),
+  modbus_server_(transport_, persistent_config_),
   control_stats_(F("KWLControl")),
-  control_timer_(control_stats_, &KWLControl::run, *this)
+  control_timer_(control_stats_, &KWLControl::run, *this),
+  uptime_metric_(F("kwl_uptime_seconds"), F("Time since controller start."), Metric::Type::Counter,
+    [](Metric::Writer& out, void*) {
+      out.sample(millis() / 1000);
+    }),
+  errors_metric_(F("kwl_errors"), F("Set of error bits."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void* arg) {
+      out.sample(static_cast<KWLControl*>(arg)->errors_);
+    }, this),
+  temperature_metric_(F("kwl_temperature_celsius"), F("Measured air temperature."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void* arg) {
+      const auto& t = static_cast<const KWLControl*>(arg)->temp_sensors_;
+      if (t.get_t1_outside() != TempSensors::INVALID)
+        out.sample(F("sensor"), F("outside"), t.get_t1_outside());
+      if (t.get_t2_inlet() != TempSensors::INVALID)
+        out.sample(F("sensor"), F("inlet"), t.get_t2_inlet());
+      if (t.get_t3_outlet() != TempSensors::INVALID)
+        out.sample(F("sensor"), F("outlet"), t.get_t3_outlet());
+      if (t.get_t4_exhaust() != TempSensors::INVALID)
+        out.sample(F("sensor"), F("exhaust"), t.get_t4_exhaust());
+    }, this),
+  efficiency_metric_(F("kwl_efficiency_percent"), F("Efficiency of the heat exchanger."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void* arg) {
+      out.sample(static_cast<KWLControl*>(arg)->temp_sensors_.getEfficiency());
+    }, this),
+  fan_rpm_metric_(F("kwl_fan_rpm"), F("Measured fan speed."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void* arg) {
+      auto& fc = static_cast<KWLControl*>(arg)->fan_control_;
+      out.sample(F("fan"), 1, fc.getFan1().getSpeed());
+      out.sample(F("fan"), 2, fc.getFan2().getSpeed());
+    }, this),
+  mode_metric_(F("kwl_ventilation_mode"), F("Current ventilation mode (0 = off)."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void* arg) {
+      out.sample(static_cast<KWLControl*>(arg)->fan_control_.getVentilationMode());
+    }, this),
+  task_max_metric_(F("kwl_task_runtime_max_microseconds"), F("Maximum run time of a task since reset."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void*) {
+      for (auto i = Scheduler::TaskTimingStats::begin(); i != Scheduler::TaskTimingStats::end(); ++i)
+        out.sample(F("task"), i->getName(), i->getMaxRuntime());
+    }),
+  task_avg_metric_(F("kwl_task_runtime_avg_microseconds"), F("Average run time of a task."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void*) {
+      for (auto i = Scheduler::TaskTimingStats::begin(); i != Scheduler::TaskTimingStats::end(); ++i)
+        out.sample(F("task"), i->getName(), i->getAvgRuntime());
+    }),
+  task_runs_metric_(F("kwl_task_runs_total"), F("Count of task runs."), Metric::Type::Counter,
+    [](Metric::Writer& out, void*) {
+      for (auto i = Scheduler::TaskTimingStats::begin(); i != Scheduler::TaskTimingStats::end(); ++i)
+        out.sample(F("task"), i->getName(), i->getMeasurementCount() + i->getConsolidatedMeasurementCount());
+    }),
+  poll_max_metric_(F("kwl_poll_time_max_microseconds"), F("Maximum poll time of a poll task since reset."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void*) {
+      for (auto i = Scheduler::TaskPollingStats::begin(); i != Scheduler::TaskPollingStats::end(); ++i)
+        out.sample(F("task"), i->getName(), i->getMaxPolltime());
+    }),
+  poll_avg_metric_(F("kwl_poll_time_avg_microseconds"), F("Average poll time of a poll task."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void*) {
+      for (auto i = Scheduler::TaskPollingStats::begin(); i != Scheduler::TaskPollingStats::end(); ++i)
+        out.sample(F("task"), i->getName(), i->getAvgPolltime());
+    }),
+  eeprom_writes_metric_(F("kwl_eeprom_writes_total"), F("Count of bytes written to EEPROM since start."), Metric::Type::Counter,
+    [](Metric::Writer& out, void*) {
+      out.sample(PersistentConfigurationBase::getWriteCount());
+    }),
+  i2c_transactions_metric_(F("kwl_i2c_transactions_total"), F("Count of finished I2C transactions."), Metric::Type::Counter,
+    [](Metric::Writer& out, void*) {
+      const auto errors = AsyncTWI::getErrorCount();
+      const auto timeouts = AsyncTWI::getTimeoutCount();
+      out.sample(F("result"), F("ok"), AsyncTWI::getOkCount());
+      out.sample(F("result"), F("error"), errors - timeouts);
+      out.sample(F("result"), F("timeout"), timeouts);
+    }),
+  i2c_retries_metric_(F("kwl_i2c_retries_total"), F("Count of retried I2C transactions."), Metric::Type::Counter,
+    [](Metric::Writer& out, void*) {
+      out.sample(AsyncTWI::getRetryCount());
+    }),
+  dac_skipped_metric_(F("kwl_dac_writes_skipped_total"), F("Count of DAC writes skipped due to unchanged value."), Metric::Type::Counter,
+    [](Metric::Writer& out, void* arg) {
+      out.sample(static_cast<KWLControl*>(arg)->dac_.getSkippedCount());
+    }, this),
+  isr_rate_metric_(F("kwl_isr_rate_per_second"), F("Interrupts per second in the last second."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void*) {
+      for (auto i = Scheduler::InterruptStats::begin(); i != Scheduler::InterruptStats::end(); ++i)
+        if (i->getCount())
+          out.sample(F("isr"), i->getName(), i->getRate());
+    }),
+  isr_load_metric_(F("kwl_isr_load_permille"), F("CPU load of interrupts in the last second."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void*) {
+      for (auto i = Scheduler::InterruptStats::begin(); i != Scheduler::InterruptStats::end(); ++i)
+        if (i->getCount())
+          out.sample(F("isr"), i->getName(), i->getLoad());
+    }),
+  isr_cycles_metric_(F("kwl_isr_cycles_avg"), F("Average CPU cycles per interrupt in the last second."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void*) {
+      for (auto i = Scheduler::InterruptStats::begin(); i != Scheduler::InterruptStats::end(); ++i)
+        if (i->getCount())
+          out.sample(F("isr"), i->getName(), i->getAvgCycles());
+    })
 {}
 
 void KWLControl::begin(Print& initTracer)
 {
-  if (KWLConfig::ControlFansDAC) {
-    // TODO Also if using Preheater DAC, but no Fan DAC
-    Wire.begin();               // I2C-Pins definieren
-    initTracer.println(F("Initialisierung DAC"));
-  }
-
+  dac_.begin(initTracer);
   persistent_config_.begin(initTracer, KWLConfig::FACTORY_RESET_EEPROM);
   network_client_.begin(initTracer);
   temp_sensors_.begin(initTracer);
@@ -60,6 +154,8 @@ void KWLControl::begin(Print& initTracer)
   bypass_.begin(initTracer);
   antifreeze_.begin(initTracer);
   add_sensors_.begin(initTracer);
+  modbus_server_.begin(initTracer, *this, KWLConfig::ModbusPort);
+  summary_.begin();
   ntp_.begin(persistent_config_.getNetworkNTPServer());
   program_manager_.begin();
 
@@ -95,10 +191,7 @@ void KWLControl::begin(Print& initTracer)
 
   tft_.begin(initTracer, *this);
 
-#ifndef WIFI_SUPPORT
-  // wifi causes watchdog issues
   DeadlockWatchdog::begin(&deadlockDetected, this);
-#endif  
 }
 
 void KWLControl::errorsToString(char* buffer, size_t size)
@@ -173,177 +266,366 @@ void KWLControl::fanSpeedSet()
   antifreeze_.doActionAntiFreezeState();
 }
 
+uint16_t KWLControl::modbusReadInput(uint16_t addr)
+{
+  // signed 1/100 degrees
+  auto centiDegrees = [](double t) { return uint16_t(int16_t(t * 100 + (t < 0 ? -0.5 : 0.5))); };
+  switch (addr) {
+    case 0: return uint16_t(errors_);
+    case 1: return uint16_t(info_);
+    case 2: return centiDegrees(temp_sensors_.get_t1_outside());
+    case 3: return centiDegrees(temp_sensors_.get_t2_inlet());
+    case 4: return centiDegrees(temp_sensors_.get_t3_outlet());
+    case 5: return centiDegrees(temp_sensors_.get_t4_exhaust());
+    case 6: return uint16_t(temp_sensors_.getEfficiency());
+    case 7: return uint16_t(fan_control_.getFan1().getSpeed());
+    case 8: return uint16_t(fan_control_.getFan2().getSpeed());
+    case 9: return uint16_t(fan_control_.getMode());
+    case 10: return uint16_t(antifreeze_.getState());
+    case 11: return uint16_t(antifreeze_.getPreheaterState());
+    case 12: return uint16_t(bypass_.getState());
+    case 13: return bypass_.isRunning() ? 1 : 0;
+    default: return 0;
+  }
+}
+
+uint16_t KWLControl::modbusReadHolding(uint16_t addr)
+{
+  switch (addr) {
+    case 0: return uint16_t(fan_control_.getVentilationMode());
+    case 1: return uint16_t(fan_control_.getFan1().getStandardSpeed());
+    case 2: return uint16_t(fan_control_.getFan2().getStandardSpeed());
+    case 3: return uint16_t(persistent_config_.getBypassMode());
+    case 4: return uint16_t(persistent_config_.getBypassManualSetpoint());
+    default: return 0;
+  }
+}
+
 bool KWLControl::mqttReceiveMsg(const StringView& topic, const StringView& s)
 {
-  // Set Values
-  if (topic == MQTTTopic::CmdResetAll) {
-    if (s == F("YES"))   {
-      Serial.println(F("Speicherbereich wird gelöscht"));
-      getPersistentConfig().factoryReset();
-      // Reboot
-      Serial.println(F("Reboot"));
-      Serial.flush();
-      delay(100);
-      wdt_disable();
-      asm volatile ("jmp 0");
+  static const TopicRoute<KWLControl> ROUTES[] PROGMEM = {
+    { MQTTTopic::CmdResetAll.data_P(), &KWLControl::mqttResetAll },
+    { MQTTTopic::CmdRestart.data_P(), &KWLControl::mqttRestart },
+    { MQTTTopic::CmdTimezone.data_P(), &KWLControl::mqttSetTimezone },
+    { MQTTTopic::CmdDST.data_P(), &KWLControl::mqttSetDST },
+    { MQTTTopic::CmdNTPServer.data_P(), &KWLControl::mqttSetNTPServer },
+    { MQTTTopic::KwlDebugsetSchedulerResetvalues.data_P(), &KWLControl::mqttResetSchedulerStats },
+    { MQTTTopic::CmdGetvalues.data_P(), &KWLControl::mqttGetValues },
+    { MQTTTopic::KwlDebugsetSchedulerGetvalues.data_P(), &KWLControl::mqttGetSchedulerStats },
+    { MQTTTopic::KwlDebugsetMqttResetvalues.data_P(), &KWLControl::mqttResetMessageStats },
+    { MQTTTopic::KwlDebugsetMqttGetvalues.data_P(), &KWLControl::mqttGetMessageStats },
+    { MQTTTopic::KwlDebugsetNTPTime.data_P(), &KWLControl::mqttDebugSetNTPTime },
+    { MQTTTopic::KwlDebugsetCrashGetvalues.data_P(), &KWLControl::mqttGetCrashes },
+    { MQTTTopic::KwlDebugsetCrashResetvalues.data_P(), &KWLControl::mqttResetCrashes },
+    { MQTTTopic::KwlDebugsetCrashProvoke.data_P(), &KWLControl::mqttProvokeCrash },
+    { MQTTTopic::CmdScreenshot.data_P(), &KWLControl::mqttScreenshot },
+    { MQTTTopic::CmdScreen.data_P(), &KWLControl::mqttGotoScreen },
+    { MQTTTopic::CmdTouch.data_P(), &KWLControl::mqttTouch },
+  };
+  return routeTopic(*this, ROUTES, topic, s);
+}
+
+bool KWLControl::mqttResetAll(const TopicParams&, const StringView& s)
+{
+  if (s == F("YES"))   {
+    Serial.println(F("Speicherbereich wird gelöscht"));
+    getPersistentConfig().factoryReset();
+    // Reboot
+    Serial.println(F("Reboot"));
+    Serial.flush();
+    delay(100);
+    wdt_disable();
+    asm volatile ("jmp 0");
+  }
+  return true;
+}
+
+bool KWLControl::mqttRestart(const TopicParams&, const StringView& s)
+{
+  if (s == F("YES"))   {
+    // Reboot
+    Serial.println(F("Reboot"));
+    Serial.flush();
+    delay(100);
+    wdt_disable();
+    asm volatile ("jmp 0");
+  }
+  return true;
+}
+
+bool KWLControl::mqttSetTimezone(const TopicParams&, const StringView& s)
+{
+  // Zeitzone in Minuten (auch in Bulk-Konfiguration, daher erst prüfen, siehe MessageHandler::validate())
+  long i;
+  if (!s.parseInt(i) || i < -24 * 60 || i > 24 * 60)
+    reportMalformed();
+  else if (!isValidating())
+    persistent_config_.setTimezoneMin(int16_t(i));
+  return true;
+}
+
+bool KWLControl::mqttSetDST(const TopicParams&, const StringView& s)
+{
+  // Sommerzeit
+  if (s != F("YES") && s != F("NO"))
+    reportMalformed();
+  else if (!isValidating())
+    persistent_config_.setDST(s == F("YES"));
+  return true;
+}
+
+bool KWLControl::mqttSetNTPServer(const TopicParams&, const StringView& s)
+{
+  // NTP Server, wird ab der nächsten Abfrage benutzt
+  IPAddress ip;
+  if (!ip.fromString(s.c_str())) {
+    reportMalformed();
+  } else if (!isValidating()) {
+    persistent_config_.setNetworkNTPServer(ip);
+    ntp_.setServer(ip);
+  }
+  return true;
+}
+
+bool KWLControl::mqttResetSchedulerStats(const TopicParams&, const StringView&)
+{
+  // reset maximum runtimes for all tasks
+  for (auto i = Scheduler::TaskTimingStats::begin(); i != Scheduler::TaskTimingStats::end(); ++i)
+    i->resetMaximum();
+  for (auto i = Scheduler::TaskPollingStats::begin(); i != Scheduler::TaskPollingStats::end(); ++i)
+    i->resetMaximum();
+  for (auto i = Scheduler::InterruptStats::begin(); i != Scheduler::InterruptStats::end(); ++i)
+    i->resetMaximum();
+  return true;
+}
+
+bool KWLControl::mqttGetValues(const TopicParams&, const StringView&)
+{
+  // Alle Values
+  getTempSensors().forceSend();
+  getAntifreeze().forceSend();
+  getFanControl().forceSend();
+  getBypass().forceSend();
+  getAdditionalSensors().forceSend();
+  return true;
+}
+
+bool KWLControl::mqttGetSchedulerStats(const TopicParams&, const StringView&)
+{
+  // send statistics for scheduler
+  auto i1 = Scheduler::TaskPollingStats::begin();
+  auto i2 = Scheduler::TaskTimingStats::begin();
+  auto i3 = Scheduler::InterruptStats::begin();
+  scheduler_publish_.publish([i1, i2, i3]() mutable {
+    char tbuffer[40];
+    MQTTTopic::KwlDebugstateScheduler.store(tbuffer);
+    char* p = tbuffer + MQTTTopic::KwlDebugstateScheduler.length();
+    static constexpr size_t rsize = sizeof(tbuffer) - MQTTTopic::KwlDebugstateScheduler.length() - 1;
+    while (i1 != Scheduler::TaskPollingStats::end()) {
+      strncpy_P(p, reinterpret_cast<const char*>(i1->getName()), rsize);
+      p[rsize] = 0;
+      auto& stats = *i1;
+      if (publishStream(tbuffer, [&stats](Print& out) { stats.printTo(out); }))
+        ++i1;
+      return false;
     }
-  } else if (topic == MQTTTopic::CmdRestart) {
-    if (s == F("YES"))   {
-      // Reboot
-      Serial.println(F("Reboot"));
-      Serial.flush();
-      delay(100);
-      wdt_disable();
-      asm volatile ("jmp 0");
+    while (i2 != Scheduler::TaskTimingStats::end()) {
+      strncpy_P(p, reinterpret_cast<const char*>(i2->getName()), rsize);
+      p[rsize] = 0;
+      auto& stats = *i2;
+      if (publishStream(tbuffer, [&stats](Print& out) { stats.printTo(out); }))
+        ++i2;
+      return false;
     }
-  } else if (topic == MQTTTopic::KwlDebugsetSchedulerResetvalues) {
-    // reset maximum runtimes for all tasks
-    for (auto i = Scheduler::TaskTimingStats::begin(); i != Scheduler::TaskTimingStats::end(); ++i)
-      i->resetMaximum();
-    for (auto i = Scheduler::TaskPollingStats::begin(); i != Scheduler::TaskPollingStats::end(); ++i)
-      i->resetMaximum();
-  // Get Commands
-  } else if (topic == MQTTTopic::CmdGetvalues) {
-    // Alle Values
-    getTempSensors().forceSend();
-    getAntifreeze().forceSend();
-    getFanControl().forceSend();
-    getBypass().forceSend();
-    getAdditionalSensors().forceSend();
-  } else if (topic == MQTTTopic::KwlDebugsetSchedulerGetvalues) {
-    // send statistics for scheduler
-    auto i1 = Scheduler::TaskPollingStats::begin();
-    auto i2 = Scheduler::TaskTimingStats::begin();
-    scheduler_publish_.publish([i1, i2]() mutable {
-      char buffer[80];
-      char tbuffer[40];
-      MQTTTopic::KwlDebugstateScheduler.store(tbuffer);
-      char* p = tbuffer + MQTTTopic::KwlDebugstateScheduler.length();
-      static constexpr size_t rsize = sizeof(tbuffer) - MQTTTopic::KwlDebugstateScheduler.length() - 1;
-      while (i1 != Scheduler::TaskPollingStats::end()) {
-        strncpy_P(p, reinterpret_cast<const char*>(i1->getName()), rsize);
-        p[rsize] = 0;
-        i1->toString(buffer, sizeof(buffer));
-        if (publish(tbuffer, buffer, false))
-          ++i1;
-        return false;
+    while (i3 != Scheduler::InterruptStats::end()) {
+      if (!i3->getCount()) {
+        ++i3;   // not measured
+        continue;
       }
-      while (i2 != Scheduler::TaskTimingStats::end()) {
-        strncpy_P(p, reinterpret_cast<const char*>(i2->getName()), rsize);
-        p[rsize] = 0;
-        i2->toString(buffer, sizeof(buffer));
-        if (publish(tbuffer, buffer, false))
-          ++i2;
+      strncpy_P(p, reinterpret_cast<const char*>(i3->getName()), rsize);
+      p[rsize] = 0;
+      auto& stats = *i3;
+      if (publishStream(tbuffer, [&stats](Print& out) { stats.printTo(out); }))
+        ++i3;
+      return false;
+    }
+    return true;
+  });
+  return true;
+}
+
+bool KWLControl::mqttResetMessageStats(const TopicParams&, const StringView&)
+{
+  // reset statistics for all MQTT message handlers
+  MessageHandler::resetStats();
+  return true;
+}
+
+bool KWLControl::mqttGetMessageStats(const TopicParams&, const StringView&)
+{
+  // send statistics for MQTT message handlers and commands
+  auto handler = MessageHandler::beginHandlers();
+  uint8_t command = 0;
+  bool unhandled_sent = false;
+  scheduler_publish_.publish([handler, command, unhandled_sent]() mutable {
+    char tbuffer[48];
+    while (handler != MessageHandler::endHandlers()) {
+      MQTTTopic::KwlDebugstateMqtt.store(tbuffer);
+      char* p = tbuffer + MQTTTopic::KwlDebugstateMqtt.length();
+      static constexpr size_t rsize = sizeof(tbuffer) - MQTTTopic::KwlDebugstateMqtt.length() - 1;
+      strncpy_P(p, reinterpret_cast<const char*>(handler->getName()), rsize);
+      p[rsize] = 0;
+      auto& stats = handler->getStats();
+      if (publishStream(tbuffer, [&stats](Print& out) { stats.printTo(out); }))
+        ++handler;
+      return false;
+    }
+    while (command < MessageHandler::getCommandCount()) {
+      MQTTTopic::KwlDebugstateMqttCommand.store(tbuffer);
+      char* p = tbuffer + MQTTTopic::KwlDebugstateMqttCommand.length();
+      static constexpr size_t rsize = sizeof(tbuffer) - MQTTTopic::KwlDebugstateMqttCommand.length() - 1;
+      strncpy_P(p, MessageHandler::getCommandName(command), rsize);
+      p[rsize] = 0;
+      auto& stats = MessageHandler::getCommandStats(command);
+      if (publishStream(tbuffer, [&stats](Print& out) { stats.printTo(out); }))
+        ++command;
+      return false;
+    }
+    if (!unhandled_sent) {
+      if (!publish(MQTTTopic::KwlDebugstateMqttUnhandled, MessageHandler::getUnhandledCount()))
         return false;
-      }
-      return true;
-    });
-  } else if (topic == MQTTTopic::KwlDebugsetNTPTime) {
-    // set NTP time
-    unsigned long time = static_cast<unsigned long>(s.toInt());
-    ntp_.debugSetTime(time);
-    if (KWLConfig::serialDebug) {
-      Serial.print(F("Setting NTP time to "));
-      Serial.print(time);
-      Serial.print(F(", "));
-      Serial.println(PrintableHMS(ntp_.currentTimeHMS(persistent_config_.getTimezoneMin() * 60, persistent_config_.getDST())));
+      unhandled_sent = true;
     }
-  } else if (topic == MQTTTopic::KwlDebugsetCrashGetvalues) {
-    // get crash information
-    unsigned index = 0;
-    scheduler_publish_.publish([this, index]() mutable {
-      while (index < KWLConfig::MaxCrashReportCount) {
-        auto& c = persistent_config_.getCrash(index);
-        if (c.crash_addr) {
-          char buffer[48], topic[MQTTTopic::KwlDebugstateCrash.length() + 3];
-          MQTTTopic::KwlDebugstateCrash.store(topic);
-          char* p = topic + MQTTTopic::KwlDebugstateCrash.length();
-          *p++ = char(index / 10) + '0';
-          *p++ = (index % 10) + '0';
-          *p = 0;
-          snprintf_P(buffer, sizeof(buffer), PSTR("ip %06lx sp %03lx ntp %lu ms %lu"),
-                   c.crash_addr * 2, c.crash_sp, c.real_time, c.millis);
-          if (MessageHandler::publish(topic, buffer))
-            ++index;
-          return false;
-        }
-        ++index;
+    return publish(MQTTTopic::KwlDebugstateMqttOverflow, MessageHandler::getCommandOverflowCount());
+  });
+  return true;
+}
+
+bool KWLControl::mqttDebugSetNTPTime(const TopicParams&, const StringView& s)
+{
+  // set NTP time
+  unsigned long time = static_cast<unsigned long>(s.toInt());
+  ntp_.debugSetTime(time);
+  if (KWLConfig::serialDebug) {
+    Serial.print(F("Setting NTP time to "));
+    Serial.print(time);
+    Serial.print(F(", "));
+    Serial.println(PrintableHMS(ntp_.currentTimeHMS(persistent_config_.getTimezoneMin() * 60, persistent_config_.getDST())));
+  }
+  return true;
+}
+
+bool KWLControl::mqttGetCrashes(const TopicParams&, const StringView&)
+{
+  // get crash information
+  unsigned index = 0;
+  scheduler_publish_.publish([this, index]() mutable {
+    while (index < KWLConfig::MaxCrashReportCount) {
+      auto& c = persistent_config_.getCrash(index);
+      if (c.crash_addr) {
+        char buffer[48], topic[MQTTTopic::KwlDebugstateCrash.length() + 3];
+        MQTTTopic::KwlDebugstateCrash.store(topic);
+        char* p = topic + MQTTTopic::KwlDebugstateCrash.length();
+        *p++ = char(index / 10) + '0';
+        *p++ = (index % 10) + '0';
+        *p = 0;
+        snprintf_P(buffer, sizeof(buffer), PSTR("ip %06lx sp %03lx ntp %lu ms %lu"),
+                 c.crash_addr * 2, c.crash_sp, c.real_time, c.millis);
+        if (MessageHandler::publish(topic, buffer))
+          ++index;
+        return false;
       }
-      return true;
-    });
-  } else if (topic == MQTTTopic::KwlDebugsetCrashResetvalues) {
-    // reset crash information
-    persistent_config_.resetCrashes();
-    errors_ &= ~ERROR_BIT_CRASH;
-    mqttSendStatus();
-  } else if (topic == MQTTTopic::KwlDebugsetCrashProvoke) {
-    if (s == F("YES"))   {
-      // provoke a crash by making a deadlock
-      Serial.println(F("CRASH: Deadlock provoked"));
-      Serial.flush();
-      while (true) {}
+      ++index;
     }
-  } else if (topic == MQTTTopic::CmdScreenshot) {
-    IPAddress ip;
-    uint16_t port = 4444;
-    {
-      auto ip_str = s.c_str();
-      auto port_str = strchr(ip_str, ':');
-      if (port_str) {
-        *const_cast<char*>(port_str++) = 0;
-        port = uint16_t(atoi(port_str));
-      }
-      if (!ip.fromString(ip_str)) {
-        Serial.println(F("Screenshot: invalid IP address"));
-        return true;
-      }
-      if (!port) {
-        Serial.println(F("Screenshot: invalid port specified"));
-        return true;
-      }
+    return true;
+  });
+  return true;
+}
+
+bool KWLControl::mqttResetCrashes(const TopicParams&, const StringView&)
+{
+  // reset crash information
+  persistent_config_.resetCrashes();
+  errors_ &= ~ERROR_BIT_CRASH;
+  mqttSendStatus();
+  return true;
+}
+
+bool KWLControl::mqttProvokeCrash(const TopicParams&, const StringView& s)
+{
+  if (s == F("YES"))   {
+    // provoke a crash by making a deadlock
+    Serial.println(F("CRASH: Deadlock provoked"));
+    Serial.flush();
+    while (true) {}
+  }
+  return true;
+}
+
+bool KWLControl::mqttScreenshot(const TopicParams&, const StringView& s)
+{
+  IPAddress ip;
+  uint16_t port = 4444;
+  {
+    auto ip_str = s.c_str();
+    auto port_str = strchr(ip_str, ':');
+    if (port_str) {
+      *const_cast<char*>(port_str++) = 0;
+      port = uint16_t(atoi(port_str));
     }
-    if (KWLConfig::serialDebug) {
-      Serial.print(F("Screenshot: trigger for "));
-      Serial.print(ip);
-      Serial.print(':');
-      Serial.print(port);
-      Serial.print(F(" received at "));
-      Serial.println(millis());
+    if (!ip.fromString(ip_str)) {
+      Serial.println(F("Screenshot: invalid IP address"));
+      reportMalformed();
+      return true;
     }
-    tft_.prepareForScreenshot();
-
-#ifdef WIFI_SUPPORT
-    WiFiEspClient client;
-#else    
-    EthernetClient client;
-#endif
-
-    if (!client.connect(ip, port)) {
-      if (KWLConfig::serialDebug) {
-        Serial.println(F("Screenshot: cannot connect"));
-        return true;
-      }
+    if (!port) {
+      Serial.println(F("Screenshot: invalid port specified"));
+      reportMalformed();
+      return true;
     }
-    if (KWLConfig::serialDebug)
-      Serial.println(F("Screenshot: connected"));
-    ScreenshotService::make(tft_.getTFT(), client);
-    client.flush();
-    client.stop();
+  }
+  if (KWLConfig::serialDebug) {
+    Serial.print(F("Screenshot: trigger for "));
+    Serial.print(ip);
+    Serial.print(':');
+    Serial.print(port);
+    Serial.print(F(" received at "));
+    Serial.println(millis());
+  }
+  tft_.prepareForScreenshot();
+
+  auto& client = transport_.getAuxClient();
+  if (!client.connect(ip, port)) {
     if (KWLConfig::serialDebug) {
-      Serial.print(F("Screenshot: done at "));
-      Serial.println(millis());
+      Serial.println(F("Screenshot: cannot connect"));
+      return true;
     }
-  } else if (topic == MQTTTopic::CmdScreen) {
-    // switch to given screen by ID
-    tft_.gotoScreen(s.toInt());
-  } else if (topic == MQTTTopic::CmdTouch) {
-    // simulate touch at x,y
-    int x, y;
-    if (sscanf_P(s.c_str(), PSTR("%d,%d"), &x, &y) == 2)
-      tft_.makeTouch(x, y);
-  } else {
-    return false;
   }
+  if (KWLConfig::serialDebug)
+    Serial.println(F("Screenshot: connected"));
+  ScreenshotService::make(tft_.getTFT(), client);
+  client.flush();
+  client.stop();
+  if (KWLConfig::serialDebug) {
+    Serial.print(F("Screenshot: done at "));
+    Serial.println(millis());
+  }
+  return true;
+}
+
+bool KWLControl::mqttGotoScreen(const TopicParams&, const StringView& s)
+{
+  // switch to given screen by ID
+  tft_.gotoScreen(s.toInt());
+  return true;
+}
+
+bool KWLControl::mqttTouch(const TopicParams&, const StringView& s)
+{
+  // simulate touch at x,y
+  int x, y;
+  if (sscanf_P(s.c_str(), PSTR("%d,%d"), &x, &y) == 2)
+    tft_.makeTouch(x, y);
   return true;
 }
 
@@ -352,6 +634,12 @@ void KWLControl::run()
   // In dieser Funktion wird auf verschiedene Fehler getestet und Felherbitmap gesets.
   // Fehlertext wird auf das Display geschrieben.
 
+  if (KWLConfig::InterruptStatistics) {
+    // Interruptlast der letzten Sekunde berechnen
+    for (auto i = Scheduler::InterruptStats::begin(); i != Scheduler::InterruptStats::end(); ++i)
+      i->update();
+  }
+
   unsigned local_err = errors_ & ERROR_BIT_CRASH;
   if (KWLConfig::StandardKwlModeFactor[fan_control_.getVentilationMode()] > 0.01) {
     if (fan_control_.getFan1().getSpeed() < 10 && antifreeze_.getState() == AntifreezeState::OFF)
@@ -26,15 +26,23 @@
 
 #include <Arduino.h>
 
-#define WIFI_SUPPORT
-
 #include <MicroNTP.h>
+#include <Metrics.h>
 
 #include "NetworkClient.h"
+#include "EspTransport.h"
+#include "EthernetTransport.h"
+#include "LoopbackTransport.h"
 #include "TempSensors.h"
+#include "DacOutput.h"
 #include "FanControl.h"
 #include "Antifreeze.h"
 #include "ProgramManager.h"
+#include "BulkConfig.h"
+#include "Reporting.h"
+#include "Summary.h"
+#include "SerialConsole.h"
+#include "ModbusServer.h"
 #include "SummerBypass.h"
 #include "AdditionalSensors.h"
 #include "TFT.h"
@@ -44,7 +52,7 @@
  *
  * This class comprises all modules for the control of the ventilation system.
  */
-class KWLControl : private FanControl::SetSpeedCallback, private MessageHandler
+class KWLControl : private FanControl::SetSpeedCallback, private ModbusServer::Registers, private MessageHandler
 {
 public:
   /// Fan 1 is not working.
@@ -138,8 +146,31 @@ public:
 private:
   virtual void fanSpeedSet() override;
 
+  virtual uint16_t modbusReadInput(uint16_t addr) override;
+
+  virtual uint16_t modbusReadHolding(uint16_t addr) override;
+
   virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override;
 
+  // MQTT command handlers, see mqttReceiveMsg() for topics.
+  bool mqttResetAll(const TopicParams& params, const StringView& s);
+  bool mqttRestart(const TopicParams& params, const StringView& s);
+  bool mqttSetTimezone(const TopicParams& params, const StringView& s);
+  bool mqttSetDST(const TopicParams& params, const StringView& s);
+  bool mqttSetNTPServer(const TopicParams& params, const StringView& s);
+  bool mqttResetSchedulerStats(const TopicParams& params, const StringView& s);
+  bool mqttGetValues(const TopicParams& params, const StringView& s);
+  bool mqttGetSchedulerStats(const TopicParams& params, const StringView& s);
+  bool mqttResetMessageStats(const TopicParams& params, const StringView& s);
+  bool mqttGetMessageStats(const TopicParams& params, const StringView& s);
+  bool mqttDebugSetNTPTime(const TopicParams& params, const StringView& s);
+  bool mqttGetCrashes(const TopicParams& params, const StringView& s);
+  bool mqttResetCrashes(const TopicParams& params, const StringView& s);
+  bool mqttProvokeCrash(const TopicParams& params, const StringView& s);
+  bool mqttScreenshot(const TopicParams& params, const StringView& s);
+  bool mqttGotoScreen(const TopicParams& params, const StringView& s);
+  bool mqttTouch(const TopicParams& params, const StringView& s);
+
   void run();
 
   /// Send status bits.
@@ -152,11 +183,13 @@ private:
   Scheduler::PollingScheduler scheduler_;
   /// Persistent configuration.
   KWLPersistentConfig persistent_config_;
-#ifdef WIFI_SUPPORT
-  WiFiEspUDP udp_;
-#else  
-  /// UDP handler for NTP.
-  EthernetUDP udp_;
+  /// Network transport selected in NetworkTransport.h.
+#if defined(LOOPBACK_TRANSPORT)
+  LoopbackTransport transport_;
+#elif defined(WIFI_SUPPORT)
+  EspTransport transport_;
+#else
+  EthernetTransport transport_;
 #endif
   /// NTP protocol.
   MicroNTP ntp_;
@@ -166,6 +199,8 @@ private:
   TempSensors temp_sensors_;
   /// Additional sensors (humidity, CO2, VOC).
   AdditionalSensors add_sensors_;
+  /// DAC outputs for fans and preheater.
+  DacOutput dac_;
   /// Fan control.
   FanControl fan_control_;
   /// Summer bypass object.
@@ -174,6 +209,16 @@ private:
   Antifreeze antifreeze_;
   /// Program manager to set daily/weekly programs.
   ProgramManager program_manager_;
+  /// Bulk configuration handler.
+  BulkConfig bulk_config_;
+  /// Reporting parameter handler.
+  Reporting reporting_;
+  /// Summaries of measurements.
+  Summary summary_;
+  /// Commands and provisioning over serial port.
+  SerialConsole serial_console_;
+  /// Modbus TCP server for building automation.
+  ModbusServer modbus_server_;
   /// Display control.
   TFT tft_;
   /// Task to send all scheduler infos reliably.
@@ -188,4 +233,40 @@ private:
   Scheduler::TaskTimingStats control_stats_;
   /// Timer firing checks.
   Scheduler::TimedTask<KWLControl> control_timer_;
+  /// Metric: uptime.
+  Metric uptime_metric_;
+  /// Metric: error bits.
+  Metric errors_metric_;
+  /// Metric: temperatures.
+  Metric temperature_metric_;
+  /// Metric: heat exchanger efficiency.
+  Metric efficiency_metric_;
+  /// Metric: fan speeds.
+  Metric fan_rpm_metric_;
+  /// Metric: ventilation mode.
+  Metric mode_metric_;
+  /// Metric: maximum task run time.
+  Metric task_max_metric_;
+  /// Metric: average task run time.
+  Metric task_avg_metric_;
+  /// Metric: count of task runs.
+  Metric task_runs_metric_;
+  /// Metric: maximum poll time (loop load).
+  Metric poll_max_metric_;
+  /// Metric: average poll time (loop load).
+  Metric poll_avg_metric_;
+  /// Metric: EEPROM writes.
+  Metric eeprom_writes_metric_;
+  /// Metric: I2C transactions.
+  Metric i2c_transactions_metric_;
+  /// Metric: I2C retries.
+  Metric i2c_retries_metric_;
+  /// Metric: DAC writes skipped due to unchanged value.
+  Metric dac_skipped_metric_;
+  /// Metric: interrupt rate.
+  Metric isr_rate_metric_;
+  /// Metric: interrupt load.
+  Metric isr_load_metric_;
+  /// Metric: average interrupt duration.
+  Metric isr_cycles_metric_;
 };
@@ -0,0 +1,534 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "LoopbackTransport.h"
+
+#ifdef LOOPBACK_TRANSPORT
+
+#include <Arduino.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+  #define LOOPBACK_SOCKETS
+  #include <arpa/inet.h>
+  #include <fcntl.h>
+  #include <netinet/in.h>
+  #include <sys/ioctl.h>
+  #include <sys/socket.h>
+  #include <sys/time.h>
+  #include <unistd.h>
+#endif
+
+/// MQTT packet types (upper nibble of the fixed header).
+namespace MqttPacket
+{
+  static constexpr uint8_t CONNECT     = 1;
+  static constexpr uint8_t CONNACK     = 2;
+  static constexpr uint8_t PUBLISH     = 3;
+  static constexpr uint8_t PUBACK      = 4;
+  static constexpr uint8_t SUBSCRIBE   = 8;
+  static constexpr uint8_t SUBACK      = 9;
+  static constexpr uint8_t UNSUBSCRIBE = 10;
+  static constexpr uint8_t UNSUBACK    = 11;
+  static constexpr uint8_t PINGREQ     = 12;
+  static constexpr uint8_t PINGRESP    = 13;
+  static constexpr uint8_t DISCONNECT  = 14;
+}
+
+void LoopbackBroker::accept() noexcept
+{
+  state_ = State::Header;
+  in_fill_ = 0;
+  out_head_ = out_tail_ = out_size_ = 0;
+  probe_active_ = false;
+  for (auto& f : filters_)
+    f[0] = 0;
+  connected_ = true;
+  if (!stats_start_)
+    stats_start_ = millis();
+}
+
+size_t LoopbackBroker::write(const uint8_t* data, size_t size) noexcept
+{
+  if (!connected_)
+    return 0;
+  for (size_t i = 0; i < size; ++i) {
+    auto c = data[i];
+    switch (state_) {
+      case State::Header:
+        in_header_ = c;
+        in_remaining_ = 0;
+        in_length_shift_ = 0;
+        in_fill_ = 0;
+        state_ = State::Length;
+        break;
+
+      case State::Length:
+        in_remaining_ |= uint32_t(c & 0x7f) << in_length_shift_;
+        in_length_shift_ = uint8_t(in_length_shift_ + 7);
+        if (c & 0x80)
+          break;
+        state_ = State::Body;
+        if (in_remaining_ == 0) {
+          handlePacket();
+          state_ = State::Header;
+        }
+        break;
+
+      case State::Body:
+        if (in_fill_ < IN_SIZE)
+          in_[in_fill_] = c;
+        ++in_fill_;   // counts also bytes of too large packets
+        if (--in_remaining_ == 0) {
+          if (in_fill_ <= IN_SIZE)
+            handlePacket();
+          else
+            ++dropped_;
+          state_ = State::Header;
+        }
+        break;
+    }
+    if (!connected_)
+      break;  // disconnected by the packet
+  }
+  return size;
+}
+
+int LoopbackBroker::read() noexcept
+{
+  if (!out_size_)
+    return -1;
+  auto c = out_[out_tail_];
+  out_tail_ = uint16_t((out_tail_ + 1) % OUT_SIZE);
+  --out_size_;
+  ++read_total_;
+  if (probe_active_ && long(read_total_ - probe_end_) >= 0) {
+    // injected message was read completely
+    probe_active_ = false;
+    auto latency = micros() - probe_start_;
+    if (!latency_count_ || latency < latency_min_)
+      latency_min_ = latency;
+    if (latency > latency_max_)
+      latency_max_ = latency;
+    latency_sum_ += latency;
+    ++latency_count_;
+  }
+  return c;
+}
+
+bool LoopbackBroker::inject(const char* topic, const char* payload) noexcept
+{
+  if (!connected_)
+    return false;
+  auto start = micros();
+  if (!deliver(topic, uint16_t(strlen(topic)), reinterpret_cast<const uint8_t*>(payload), uint16_t(strlen(payload))))
+    return false;
+  if (!probe_active_) {
+    // measure latency of one message at a time
+    probe_active_ = true;
+    probe_start_ = start;
+    probe_end_ = queued_total_;
+  }
+  return true;
+}
+
+void LoopbackBroker::resetStats() noexcept
+{
+  stats_start_ = millis();
+  published_ = published_bytes_ = delivered_ = dropped_ = 0;
+  latency_count_ = latency_min_ = latency_max_ = latency_sum_ = 0;
+}
+
+void LoopbackBroker::printTo(Print& out) const
+{
+  out.print(F("pub "));
+  out.print(published_);
+  out.print(F(" bytes "));
+  out.print(published_bytes_);
+  out.print(F(" dlv "));
+  out.print(delivered_);
+  out.print(F(" drop "));
+  out.print(dropped_);
+  out.print(F(" time "));
+  out.print(millis() - stats_start_);
+  out.print(F(" lat min "));
+  out.print(latency_min_);
+  out.print(F(" max "));
+  out.print(latency_max_);
+  out.print(F(" avg "));
+  out.print(latency_count_ ? latency_sum_ / latency_count_ : 0);
+}
+
+void LoopbackBroker::handlePacket() noexcept
+{
+  switch (in_header_ >> 4) {
+    case MqttPacket::CONNECT:
+    {
+      static const uint8_t CONNACK[] = { MqttPacket::CONNACK << 4, 2, 0, 0 };
+      queue(CONNACK, sizeof(CONNACK));
+      break;
+    }
+
+    case MqttPacket::PUBLISH:
+      handlePublish();
+      break;
+
+    case MqttPacket::SUBSCRIBE:
+      handleSubscribe(true);
+      break;
+
+    case MqttPacket::UNSUBSCRIBE:
+      handleSubscribe(false);
+      break;
+
+    case MqttPacket::PINGREQ:
+    {
+      static const uint8_t PINGRESP[] = { MqttPacket::PINGRESP << 4, 0 };
+      queue(PINGRESP, sizeof(PINGRESP));
+      break;
+    }
+
+    case MqttPacket::DISCONNECT:
+      connected_ = false;
+      break;
+
+    default:
+      break;  // ignore
+  }
+}
+
+void LoopbackBroker::handlePublish() noexcept
+{
+  if (in_fill_ < 2)
+    return;
+  uint16_t topic_len = uint16_t((in_[0] << 8) | in_[1]);
+  uint16_t pos = uint16_t(2 + topic_len);
+  uint8_t qos = (in_header_ >> 1) & 3;
+  uint16_t id = 0;
+  if (qos) {
+    if (pos + 2 > in_fill_)
+      return;
+    id = uint16_t((in_[pos] << 8) | in_[pos + 1]);
+    pos = uint16_t(pos + 2);
+  }
+  if (pos > in_fill_)
+    return;
+  ++published_;
+  published_bytes_ += in_fill_ - pos;
+  deliver(reinterpret_cast<const char*>(in_ + 2), topic_len, in_ + pos, uint16_t(in_fill_ - pos));
+  if (qos) {
+    const uint8_t puback[] = { MqttPacket::PUBACK << 4, 2, uint8_t(id >> 8), uint8_t(id) };
+    queue(puback, sizeof(puback));
+  }
+}
+
+void LoopbackBroker::handleSubscribe(bool subscribe) noexcept
+{
+  if (in_fill_ < 2)
+    return;
+  uint8_t ack[4 + MAX_SUBSCRIPTIONS] = {
+    uint8_t((subscribe ? MqttPacket::SUBACK : MqttPacket::UNSUBACK) << 4), 2, in_[0], in_[1]
+  };
+  uint16_t pos = 2;
+  while (pos + 2 <= in_fill_) {
+    uint16_t len = uint16_t((in_[pos] << 8) | in_[pos + 1]);
+    pos = uint16_t(pos + 2);
+    if (pos + len > in_fill_)
+      break;
+    char filter[MAX_FILTER_LEN + 1];
+    bool fits = len <= MAX_FILTER_LEN;
+    if (fits) {
+      memcpy(filter, in_ + pos, len);
+      filter[len] = 0;
+    }
+    pos = uint16_t(pos + len);
+    uint8_t result = 0x80;  // failure
+    if (subscribe) {
+      ++pos;  // requested QoS
+      for (auto& f : filters_) {
+        if (fits && (!f[0] || strcmp(f, filter) == 0)) {
+          strcpy(f, filter);
+          result = 0; // granted QoS 0
+          break;
+        }
+      }
+      if (ack[1] < 2 + MAX_SUBSCRIPTIONS)
+        ack[2 + ack[1]++] = result;
+    } else {
+      for (auto& f : filters_)
+        if (fits && strcmp(f, filter) == 0)
+          f[0] = 0;
+    }
+  }
+  queue(ack, uint16_t(2 + ack[1]));
+}
+
+bool LoopbackBroker::deliver(const char* topic, uint16_t topic_len, const uint8_t* payload, uint16_t payload_len) noexcept
+{
+  bool match = false;
+  for (auto& f : filters_) {
+    if (f[0] && matches(f, topic, topic_len)) {
+      match = true;
+      break;
+    }
+  }
+  if (!match)
+    return false;
+
+  // fixed header with remaining length, topic length
+  uint8_t header[8];
+  uint8_t hlen = 0;
+  header[hlen++] = MqttPacket::PUBLISH << 4;
+  uint32_t remaining = 2UL + topic_len + payload_len;
+  do {
+    uint8_t c = remaining & 0x7f;
+    remaining >>= 7;
+    header[hlen++] = remaining ? (c | 0x80) : c;
+  } while (remaining);
+  header[hlen++] = uint8_t(topic_len >> 8);
+  header[hlen++] = uint8_t(topic_len);
+  if (hlen + topic_len + payload_len > OUT_SIZE - out_size_) {
+    ++dropped_;
+    return false;
+  }
+  queue(header, hlen);
+  queue(reinterpret_cast<const uint8_t*>(topic), topic_len);
+  queue(payload, payload_len);
+  ++delivered_;
+  return true;
+}
+
+bool LoopbackBroker::queue(const uint8_t* data, uint16_t size) noexcept
+{
+  if (size > OUT_SIZE - out_size_) {
+    ++dropped_;
+    return false;
+  }
+  for (uint16_t i = 0; i < size; ++i) {
+    out_[out_head_] = data[i];
+    out_head_ = uint16_t((out_head_ + 1) % OUT_SIZE);
+  }
+  out_size_ = uint16_t(out_size_ + size);
+  queued_total_ += size;
+  return true;
+}
+
+bool LoopbackBroker::matches(const char* filter, const char* topic, uint16_t topic_len) noexcept
+{
+  uint16_t i = 0;
+  while (*filter) {
+    if (*filter == '#')
+      return true;  // matches rest of the topic
+    if (*filter == '+') {
+      // matches one level
+      while (i < topic_len && topic[i] != '/')
+        ++i;
+      ++filter;
+      continue;
+    }
+    if (i >= topic_len || topic[i] != *filter)
+      return false;
+    ++i;
+    ++filter;
+  }
+  return i == topic_len;
+}
+
+int LoopbackClient::connect(IPAddress, uint16_t)
+{
+  if (!broker_)
+    return 0;
+  broker_->accept();
+  return 1;
+}
+
+int LoopbackClient::connect(const char*, uint16_t)
+{
+  return connect(IPAddress(), 0);
+}
+
+size_t LoopbackClient::write(const uint8_t* buf, size_t size)
+{
+  return connected() ? broker_->write(buf, size) : 0;
+}
+
+int LoopbackClient::available()
+{
+  return broker_ ? broker_->available() : 0;
+}
+
+int LoopbackClient::read()
+{
+  return broker_ ? broker_->read() : -1;
+}
+
+int LoopbackClient::read(uint8_t* buf, size_t size)
+{
+  size_t count = 0;
+  while (count < size) {
+    auto c = read();
+    if (c < 0)
+      break;
+    buf[count++] = uint8_t(c);
+  }
+  return int(count);
+}
+
+int LoopbackClient::peek()
+{
+  return broker_ ? broker_->peek() : -1;
+}
+
+void LoopbackClient::stop()
+{
+  if (broker_)
+    broker_->close();
+}
+
+uint8_t LoopbackClient::connected()
+{
+  return broker_ && broker_->isConnected();
+}
+
+#ifdef LOOPBACK_SOCKETS
+
+void LoopbackSocketClient::attach(int fd) noexcept
+{
+  stop();
+  // writes are blocking, but bounded
+  struct timeval tv = { 1, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  fd_ = fd;
+}
+
+size_t LoopbackSocketClient::write(const uint8_t* buf, size_t size)
+{
+  if (fd_ < 0)
+    return 0;
+  auto res = ::send(fd_, buf, size, MSG_NOSIGNAL);
+  return res > 0 ? size_t(res) : 0;
+}
+
+int LoopbackSocketClient::available()
+{
+  int count = 0;
+  if (fd_ < 0 || ioctl(fd_, FIONREAD, &count) < 0)
+    return 0;
+  return count;
+}
+
+int LoopbackSocketClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int LoopbackSocketClient::read(uint8_t* buf, size_t size)
+{
+  if (fd_ < 0)
+    return -1;
+  auto res = ::recv(fd_, buf, size, MSG_DONTWAIT);
+  return res > 0 ? int(res) : -1;
+}
+
+int LoopbackSocketClient::peek()
+{
+  uint8_t c;
+  if (fd_ < 0 || ::recv(fd_, &c, 1, MSG_DONTWAIT | MSG_PEEK) != 1)
+    return -1;
+  return c;
+}
+
+void LoopbackSocketClient::stop()
+{
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+uint8_t LoopbackSocketClient::connected()
+{
+  if (fd_ < 0)
+    return 0;
+  // orderly shutdown by the peer is reported as readable socket without data
+  uint8_t c;
+  auto res = ::recv(fd_, &c, 1, MSG_DONTWAIT | MSG_PEEK);
+  return res != 0;
+}
+
+int8_t LoopbackTransport::listen(uint16_t port)
+{
+  if (server_count_ == MAX_SERVERS)
+    return -1;
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      ::listen(fd, 1) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  listen_fd_[server_count_] = fd;
+  return int8_t(server_count_++);
+}
+
+Client* LoopbackTransport::accept(uint8_t server)
+{
+  int fd = ::accept(listen_fd_[server], nullptr, nullptr);
+  if (fd < 0)
+    return nullptr;
+  server_client_[server].attach(fd);
+  return &server_client_[server];
+}
+
+#else
+
+void LoopbackSocketClient::attach(int) noexcept {}
+size_t LoopbackSocketClient::write(const uint8_t*, size_t) { return 0; }
+int LoopbackSocketClient::available() { return 0; }
+int LoopbackSocketClient::read() { return -1; }
+int LoopbackSocketClient::read(uint8_t*, size_t) { return -1; }
+int LoopbackSocketClient::peek() { return -1; }
+void LoopbackSocketClient::stop() {}
+uint8_t LoopbackSocketClient::connected() { return 0; }
+int8_t LoopbackTransport::listen(uint16_t) { return -1; }
+Client* LoopbackTransport::accept(uint8_t) { return nullptr; }
+
+#endif
+
+void LoopbackTransport::begin(Print& initTracer)
+{
+  initTracer.println(F("Initialize loopback transport"));
+}
+
+bool LoopbackTransport::join(const Settings& settings)
+{
+  ip_ = settings.ip;
+  return true;
+}
+
+#endif
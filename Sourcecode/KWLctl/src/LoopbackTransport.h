@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief In-process loopback network transport with MQTT broker stand-in.
+ */
+#pragma once
+
+#include "NetworkTransport.h"
+
+#ifdef LOOPBACK_TRANSPORT
+
+/*!
+ * @brief Minimal in-process MQTT broker stand-in.
+ *
+ * The broker serves a single client connection. It understands MQTT 3.1.1
+ * packets sent by PubSubClient (CONNECT, PUBLISH with QoS 0/1, SUBSCRIBE,
+ * UNSUBSCRIBE, PINGREQ, DISCONNECT). Published messages are delivered back
+ * to the client, if they match one of its subscriptions, and messages from
+ * an external publisher can be simulated using inject().
+ *
+ * For benchmarking, the broker counts published, delivered and dropped
+ * messages and measures latency of injected messages from inject() until
+ * the client read the whole message.
+ */
+class LoopbackBroker
+{
+public:
+  LoopbackBroker(const LoopbackBroker&) = delete;
+  LoopbackBroker& operator=(const LoopbackBroker&) = delete;
+
+  LoopbackBroker() = default;
+
+  /// Accept client connection, dropping any previous state.
+  void accept() noexcept;
+
+  /// Close client connection.
+  void close() noexcept { connected_ = false; }
+
+  /// Check whether the client is connected.
+  bool isConnected() const noexcept { return connected_; }
+
+  /// Process bytes written by the client.
+  size_t write(const uint8_t* data, size_t size) noexcept;
+
+  /// Get count of bytes ready to be read by the client.
+  int available() const noexcept { return int(out_size_); }
+
+  /// Read one byte for the client or return -1, if none available.
+  int read() noexcept;
+
+  /// Peek next byte for the client or return -1, if none available.
+  int peek() const noexcept { return out_size_ ? out_[out_tail_] : -1; }
+
+  /*!
+   * @brief Simulate a message from an external publisher.
+   *
+   * @param topic message topic.
+   * @param payload message payload.
+   * @return @c true, if the message matched a subscription and was queued.
+   */
+  bool inject(const char* topic, const char* payload) noexcept;
+
+  /// Reset statistics.
+  void resetStats() noexcept;
+
+  /// Get count of messages published by the client since statistics reset.
+  unsigned long getPublishedCount() const noexcept { return published_; }
+
+  /// Get count of messages delivered to the client since statistics reset.
+  unsigned long getDeliveredCount() const noexcept { return delivered_; }
+
+  /// Get count of messages dropped since statistics reset.
+  unsigned long getDroppedCount() const noexcept { return dropped_; }
+
+  /// Print statistics.
+  void printTo(Print& out) const;
+
+private:
+  /// Maximum size of a packet from the client (larger packets are dropped).
+  static constexpr uint16_t IN_SIZE = 1024;
+  /// Size of the queue of data for the client.
+  static constexpr uint16_t OUT_SIZE = 2048;
+  /// Maximum count of subscriptions.
+  static constexpr uint8_t MAX_SUBSCRIPTIONS = 4;
+  /// Maximum length of a subscription filter.
+  static constexpr uint8_t MAX_FILTER_LEN = 48;
+
+  /// State of packet parser.
+  enum class State : uint8_t
+  {
+    Header,   ///< Expecting fixed header.
+    Length,   ///< Expecting remaining length.
+    Body      ///< Receiving packet body.
+  };
+
+  /// Handle complete packet from the client.
+  void handlePacket() noexcept;
+
+  /// Handle PUBLISH packet.
+  void handlePublish() noexcept;
+
+  /// Handle SUBSCRIBE or UNSUBSCRIBE packet.
+  void handleSubscribe(bool subscribe) noexcept;
+
+  /// Deliver a message to the client, if it matches a subscription.
+  bool deliver(const char* topic, uint16_t topic_len, const uint8_t* payload, uint16_t payload_len) noexcept;
+
+  /// Queue packet data for the client (all or nothing).
+  bool queue(const uint8_t* data, uint16_t size) noexcept;
+
+  /// Check whether a topic matches a subscription filter.
+  static bool matches(const char* filter, const char* topic, uint16_t topic_len) noexcept;
+
+  uint8_t in_[IN_SIZE];                   ///< Packet from the client.
+  uint16_t in_fill_ = 0;                  ///< Bytes received of packet body.
+  uint32_t in_remaining_ = 0;             ///< Bytes remaining of packet body.
+  uint8_t in_header_ = 0;                 ///< Fixed header byte of the current packet.
+  uint8_t in_length_shift_ = 0;           ///< Shift for next byte of remaining length.
+  State state_ = State::Header;           ///< Parser state.
+  bool connected_ = false;                ///< Client connected.
+
+  uint8_t out_[OUT_SIZE];                 ///< Queue of data for the client.
+  uint16_t out_head_ = 0;                 ///< Write position in the queue.
+  uint16_t out_tail_ = 0;                 ///< Read position in the queue.
+  uint16_t out_size_ = 0;                 ///< Bytes in the queue.
+
+  char filters_[MAX_SUBSCRIPTIONS][MAX_FILTER_LEN + 1] = {};  ///< Subscription filters.
+
+  unsigned long queued_total_ = 0;        ///< Total bytes queued for the client.
+  unsigned long read_total_ = 0;          ///< Total bytes read by the client.
+  unsigned long probe_end_ = 0;           ///< Value of read_total_ at which the probe is consumed.
+  unsigned long probe_start_ = 0;         ///< Time when the probe was injected (micros).
+  bool probe_active_ = false;             ///< Latency probe is in flight.
+
+  unsigned long stats_start_ = 0;         ///< Start of statistics (millis).
+  unsigned long published_ = 0;           ///< Messages published by the client.
+  unsigned long published_bytes_ = 0;     ///< Payload bytes published by the client.
+  unsigned long delivered_ = 0;           ///< Messages delivered to the client.
+  unsigned long dropped_ = 0;             ///< Messages dropped (too large or queue full).
+  unsigned long latency_count_ = 0;       ///< Count of latency samples.
+  unsigned long latency_min_ = 0;         ///< Minimum latency in microseconds.
+  unsigned long latency_max_ = 0;         ///< Maximum latency in microseconds.
+  unsigned long latency_sum_ = 0;         ///< Sum of latencies in microseconds.
+};
+
+/// TCP client connected to the loopback broker.
+class LoopbackClient : public Client
+{
+public:
+  LoopbackClient(const LoopbackClient&) = delete;
+  LoopbackClient& operator=(const LoopbackClient&) = delete;
+
+  /// Construct client connecting to a broker or a client which can't connect (broker == nullptr).
+  explicit LoopbackClient(LoopbackBroker* broker) noexcept : broker_(broker) {}
+
+  virtual int connect(IPAddress ip, uint16_t port) override;
+  virtual int connect(const char* host, uint16_t port) override;
+  virtual size_t write(uint8_t c) override { return write(&c, 1); }
+  virtual size_t write(const uint8_t* buf, size_t size) override;
+  virtual int available() override;
+  virtual int read() override;
+  virtual int read(uint8_t* buf, size_t size) override;
+  virtual int peek() override;
+  virtual void flush() override {}
+  virtual void stop() override;
+  virtual uint8_t connected() override;
+  virtual operator bool() override { return connected(); }
+
+private:
+  LoopbackBroker* broker_;  ///< Broker or nullptr.
+};
+
+/*!
+ * @brief TCP client for an incoming connection on a host socket.
+ *
+ * On Unix-like hosts, the loopback transport listens on a real socket bound
+ * to 127.0.0.1, so servers of the controller (e.g., metrics) can be tested
+ * with standard tools. On other platforms, no connection is ever accepted.
+ */
+class LoopbackSocketClient : public Client
+{
+public:
+  LoopbackSocketClient(const LoopbackSocketClient&) = delete;
+  LoopbackSocketClient& operator=(const LoopbackSocketClient&) = delete;
+
+  LoopbackSocketClient() = default;
+  virtual ~LoopbackSocketClient() { stop(); }
+
+  /// Take over an accepted socket.
+  void attach(int fd) noexcept;
+
+  /// Outgoing connections are not supported, always fails.
+  virtual int connect(IPAddress, uint16_t) override { return 0; }
+  /// Outgoing connections are not supported, always fails.
+  virtual int connect(const char*, uint16_t) override { return 0; }
+  virtual size_t write(uint8_t c) override { return write(&c, 1); }
+  virtual size_t write(const uint8_t* buf, size_t size) override;
+  virtual int available() override;
+  virtual int read() override;
+  virtual int read(uint8_t* buf, size_t size) override;
+  virtual int peek() override;
+  virtual void flush() override {}
+  virtual void stop() override;
+  virtual uint8_t connected() override;
+  virtual operator bool() override { return fd_ >= 0; }
+
+private:
+  int fd_ = -1;   ///< Socket or -1, if not connected.
+};
+
+/// UDP endpoint discarding all datagrams (no NTP server is simulated).
+class LoopbackUDP : public UDP
+{
+public:
+  virtual uint8_t begin(uint16_t) override { return 1; }
+  virtual void stop() override {}
+  virtual int beginPacket(IPAddress, uint16_t) override { return 1; }
+  virtual int beginPacket(const char*, uint16_t) override { return 1; }
+  virtual int endPacket() override { return 1; }
+  virtual size_t write(uint8_t) override { return 1; }
+  virtual size_t write(const uint8_t*, size_t size) override { return size; }
+  virtual int parsePacket() override { return 0; }
+  virtual int available() override { return 0; }
+  virtual int read() override { return -1; }
+  virtual int read(unsigned char*, size_t) override { return 0; }
+  virtual int read(char*, size_t) override { return 0; }
+  virtual int peek() override { return -1; }
+  virtual void flush() override {}
+  virtual IPAddress remoteIP() override { return IPAddress(); }
+  virtual uint16_t remotePort() override { return 0; }
+};
+
+/*!
+ * @brief In-process loopback network transport.
+ *
+ * The link is always up and the MQTT client is connected to an in-process
+ * broker stand-in, so the network client can be tested and benchmarked
+ * without any hardware or real network (e.g., in host builds on Linux).
+ */
+class LoopbackTransport : public NetworkTransport
+{
+public:
+  LoopbackTransport() noexcept : client_(&broker_), aux_client_(nullptr) {}
+
+  virtual void begin(Print& initTracer) override;
+  virtual bool join(const Settings& settings) override;
+  virtual bool isLinkUp() override { return true; }
+  virtual IPAddress localIP() override { return ip_; }
+  virtual bool connect(IPAddress ip, uint16_t port) override { return client_.connect(ip, port) == 1; }
+  virtual Client& getClient() override { return client_; }
+  virtual Client& getAuxClient() override { return aux_client_; }
+  virtual UDP& getUDP() override { return udp_; }
+  virtual int8_t listen(uint16_t port) override;
+  virtual Client* accept(uint8_t server) override;
+
+  /// Get the broker stand-in, e.g., to inject messages.
+  LoopbackBroker& getBroker() { return broker_; }
+
+private:
+  LoopbackBroker broker_;       ///< Broker stand-in.
+  LoopbackClient client_;       ///< Client for MQTT connection.
+  LoopbackClient aux_client_;   ///< Client for one-off connections (can't connect).
+  LoopbackUDP udp_;             ///< UDP endpoint.
+  LoopbackSocketClient server_client_[MAX_SERVERS];  ///< Clients for accepted incoming connections.
+  int listen_fd_[MAX_SERVERS] = { -1, -1 };  ///< Listening host sockets.
+  uint8_t server_count_ = 0;    ///< Count of started servers.
+  IPAddress ip_;                ///< Local IP address set by join().
+};
+
+#endif
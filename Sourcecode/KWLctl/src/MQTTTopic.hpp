@@ -56,10 +56,12 @@ namespace MQTTTopic
   constexpr auto CmdFansCalculateSpeedMode  = makeFlashStringLiteral("fans/calculatespeed");
   constexpr auto CmdFan1Speed               = makeFlashStringLiteral("fan1/standardspeed");
   constexpr auto CmdFan2Speed               = makeFlashStringLiteral("fan2/standardspeed");
+  constexpr auto CmdFanSpeed                = makeFlashStringLiteral("fan{u8}/standardspeed");
   constexpr auto CmdGetSpeed                = makeFlashStringLiteral("fans/getspeed");
   constexpr auto CmdGetTemp                 = makeFlashStringLiteral("temperatur/gettemp");
   constexpr auto CmdGetvalues               = makeFlashStringLiteral("getvalues");
   constexpr auto CmdMode                    = makeFlashStringLiteral("lueftungsstufe");
+  constexpr auto CmdAirflow                 = makeFlashStringLiteral("luftmenge");
   constexpr auto CmdAntiFreezeHyst          = makeFlashStringLiteral("antifreeze/hysterese");
   constexpr auto CmdBypassGetValues         = makeFlashStringLiteral("summerbypass/getvalues");
   constexpr auto CmdBypassManualFlap        = makeFlashStringLiteral("summerbypass/flap");
@@ -69,11 +71,21 @@ namespace MQTTTopic
   constexpr auto CmdBypassTempAbluftMin     = makeFlashStringLiteral("summerbypass/TempAbluftMin");
   constexpr auto CmdBypassTempAussenluftMin = makeFlashStringLiteral("summerbypass/TempAussenluftMin");
   constexpr auto CmdHeatingAppCombUse       = makeFlashStringLiteral("heatingapp/combinedUse");
-  constexpr auto CmdSetProgram              = makeFlashStringLiteral("program/");
   constexpr auto CmdSetProgramSet           = makeFlashStringLiteral("program/set");
+  constexpr auto CmdProgramGetAll           = makeFlashStringLiteral("program/all/get");
+  constexpr auto CmdProgramGet              = makeFlashStringLiteral("program/{u8}/get");
+  constexpr auto CmdProgramData             = makeFlashStringLiteral("program/{u8}/data");
+  constexpr auto CmdProgramEnable           = makeFlashStringLiteral("program/{u8}/enable");
+  constexpr auto CmdProgramInvalid          = makeFlashStringLiteral("program/{s}/{s}");
   constexpr auto SubtopicProgramData        = makeFlashStringLiteral("data");
   constexpr auto SubtopicProgramEnable      = makeFlashStringLiteral("enable");
   constexpr auto SubtopicProgramGet         = makeFlashStringLiteral("get");
+  constexpr auto CmdTimezone                = makeFlashStringLiteral("ntp/timezone");
+  constexpr auto CmdDST                     = makeFlashStringLiteral("ntp/dst");
+  constexpr auto CmdNTPServer               = makeFlashStringLiteral("ntp/server");
+  constexpr auto CmdConfigBulk              = makeFlashStringLiteral("config/bulk");
+  constexpr auto CmdReportingGet            = makeFlashStringLiteral("reporting/get");
+  constexpr auto CmdReporting               = makeFlashStringLiteral("reporting/{s}");
   constexpr auto CmdScreenshot              = makeFlashStringLiteral("screenshot");
   constexpr auto CmdScreen                  = makeFlashStringLiteral("screen");
   constexpr auto CmdTouch                   = makeFlashStringLiteral("touch");
@@ -83,6 +95,7 @@ namespace MQTTTopic
   constexpr auto Fan1Speed                  = makeFlashStringLiteral("fan1/speed");
   constexpr auto Fan2Speed                  = makeFlashStringLiteral("fan2/speed");
   constexpr auto StateKwlMode               = makeFlashStringLiteral("lueftungsstufe");
+  constexpr auto StateKwlAirflow            = makeFlashStringLiteral("luftmenge");
   constexpr auto KwlTemperaturAussenluft    = makeFlashStringLiteral("aussenluft/temperatur");
   constexpr auto KwlTemperaturZuluft        = makeFlashStringLiteral("zuluft/temperatur");
   constexpr auto KwlTemperaturAbluft        = makeFlashStringLiteral("abluft/temperatur");
@@ -99,6 +112,10 @@ namespace MQTTTopic
   constexpr auto KwlProgramIndex            = makeFlashStringLiteral("program/index");
   constexpr auto KwlProgramSet              = makeFlashStringLiteral("program/set");
   constexpr auto KwlProgramData             = makeFlashStringLiteral("program/");
+  constexpr auto KwlConfigBulk              = makeFlashStringLiteral("config/bulk");
+  constexpr auto KwlReporting               = makeFlashStringLiteral("reporting/");
+  constexpr auto KwlSummary                 = makeFlashStringLiteral("summary/");
+  constexpr auto KwlNetworkStats            = makeFlashStringLiteral("network/stats");
 
   constexpr auto KwlDHT1Temperatur          = makeFlashStringLiteral("dht1/temperatur");
   constexpr auto KwlDHT2Temperatur          = makeFlashStringLiteral("dht2/temperatur");
@@ -109,8 +126,7 @@ namespace MQTTTopic
 
 
   // Die folgenden Topics sind nur für die SW-Entwicklung, und schalten Debugausgaben per mqtt ein und aus
-  constexpr auto KwlDebugsetFan1Getvalues   = makeFlashStringLiteral("/fan1/getvalues");
-  constexpr auto KwlDebugsetFan2Getvalues   = makeFlashStringLiteral("/fan2/getvalues");
+  constexpr auto KwlDebugsetFanGetvalues    = makeFlashStringLiteral("/fan{u8}/getvalues");
   constexpr auto KwlDebugstateFan1          = makeFlashStringLiteral("/fan1");
   constexpr auto KwlDebugstateFan2          = makeFlashStringLiteral("/fan2");
   constexpr auto KwlDebugstatePreheater     = makeFlashStringLiteral("/preheater");
@@ -126,6 +142,19 @@ namespace MQTTTopic
   constexpr auto KwlDebugsetSchedulerResetvalues = makeFlashStringLiteral("/scheduler/resetvalues");
   constexpr auto KwlDebugstateScheduler    = makeFlashStringLiteral("/scheduler/");
 
+  // Die folgenden Topics sind nur für die SW-Entwicklung, um MQTT-Statistiken auszulesen
+  constexpr auto KwlDebugsetMqttGetvalues   = makeFlashStringLiteral("/mqtt/getvalues");
+  constexpr auto KwlDebugsetMqttResetvalues = makeFlashStringLiteral("/mqtt/resetvalues");
+  constexpr auto KwlDebugstateMqtt          = makeFlashStringLiteral("/mqtt/");
+  constexpr auto KwlDebugstateMqttCommand   = makeFlashStringLiteral("/mqtt/cmd/");
+  constexpr auto KwlDebugstateMqttUnhandled = makeFlashStringLiteral("/mqtt/unhandled");
+  constexpr auto KwlDebugstateMqttOverflow  = makeFlashStringLiteral("/mqtt/overflow");
+
+  // Die folgenden Topics sind nur für die SW-Entwicklung, um die Kosten der Netzwerk-Abfragen auszulesen
+  constexpr auto KwlDebugsetNetworkGetvalues   = makeFlashStringLiteral("/network/getvalues");
+  constexpr auto KwlDebugsetNetworkResetvalues = makeFlashStringLiteral("/network/resetvalues");
+  constexpr auto KwlDebugstateNetworkPollCost  = makeFlashStringLiteral("/network/pollcost");
+
   // Die folgenden Topics sind nur für die SW-Entwicklung, um Crash info auszulesen
   constexpr auto KwlDebugsetCrashGetvalues = makeFlashStringLiteral("/crash/getvalues");
   constexpr auto KwlDebugsetCrashResetvalues = makeFlashStringLiteral("/crash/resetvalues");
@@ -136,7 +165,6 @@ namespace MQTTTopic
   constexpr auto KwlDebugsetNTPTime        = makeFlashStringLiteral("/ntp/time");
 
   // Die folgenden Topics sind nur für die SW-Entwicklung, um Kalibrierung explizit zu setzen
-  constexpr auto KwlDebugsetFan1PWM         = makeFlashStringLiteral("/fan1/pwm");
-  constexpr auto KwlDebugsetFan2PWM         = makeFlashStringLiteral("/fan2/pwm");
+  constexpr auto KwlDebugsetFanPWM          = makeFlashStringLiteral("/fan{u8}/pwm");
   constexpr auto KwlDebugsetFanPWMStore     = makeFlashStringLiteral("/fan/pwm/store_IKNOWWHATIMDOING");
 }
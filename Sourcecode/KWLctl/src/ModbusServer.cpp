@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "ModbusServer.h"
+#include "KWLConfig.h"
+#include "MQTTTopic.hpp"
+#include "NetworkTransport.h"
+#include "MessageHandler.h"
+#include "StringView.h"
+
+/// Interval for checking incoming connection or polling the client for requests (50ms).
+static constexpr unsigned long MODBUS_POLL_INTERVAL = 50000;
+
+/// Idle connection is closed if no request is received within this time (60 seconds).
+static constexpr unsigned long MODBUS_IDLE_TIMEOUT = 60000000;
+
+/// Size of Modbus application protocol header (transaction, protocol, length, unit).
+static constexpr uint8_t MBAP_SIZE = 7;
+
+/// Maximum length of a command topic of a holding register.
+static constexpr unsigned MAX_TOPIC_LEN = 31;
+
+namespace
+{
+  /// Function code to read holding registers.
+  static constexpr uint8_t FC_READ_HOLDING = 3;
+  /// Function code to read input registers.
+  static constexpr uint8_t FC_READ_INPUT = 4;
+  /// Function code to write single holding register.
+  static constexpr uint8_t FC_WRITE_SINGLE = 6;
+  /// Function code to write multiple holding registers.
+  static constexpr uint8_t FC_WRITE_MULTIPLE = 16;
+
+  /*!
+   * @brief Description of a holding register, which is written via MQTT command.
+   *
+   * Values are checked by the command handlers, so they must support
+   * validation (see MessageHandler::validate()).
+   */
+  struct HoldingRegister
+  {
+    const char* topic;    ///< Command topic in Flash.
+    const char* choices;  ///< Payloads for values first.. separated by '|' in Flash or nullptr for a number.
+    uint16_t first;       ///< Value of the first choice.
+  };
+
+  const char CHOICES_BYPASS_MODE[] PROGMEM = "auto|manual";
+  const char CHOICES_FLAP[] PROGMEM = "close|open";
+
+  /// All holding registers, indexed by address.
+  const HoldingRegister HOLDING[] PROGMEM = {
+    { MQTTTopic::CmdMode.data_P(), nullptr, 0 },
+    { MQTTTopic::CmdFan1Speed.data_P(), nullptr, 0 },
+    { MQTTTopic::CmdFan2Speed.data_P(), nullptr, 0 },
+    { MQTTTopic::CmdBypassMode.data_P(), CHOICES_BYPASS_MODE, 0 },
+    { MQTTTopic::CmdBypassManualFlap.data_P(), CHOICES_FLAP, 1 },
+  };
+
+  /// Count of input registers.
+  static constexpr uint16_t INPUT_REGISTER_COUNT = 14;
+
+  /// Count of holding registers.
+  static constexpr uint16_t HOLDING_REGISTER_COUNT = sizeof(HOLDING) / sizeof(HOLDING[0]);
+
+  /// Get big-endian 16-bit value.
+  inline uint16_t get16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+
+  /// Store big-endian 16-bit value.
+  inline void put16(uint8_t* p, uint16_t value) { p[0] = uint8_t(value >> 8); p[1] = uint8_t(value); }
+
+  /// Copy n-th of the choices separated by '|' to a buffer, return @c false if there is no such choice.
+  bool copyChoice(const char* choices, unsigned n, char* buffer, size_t size)
+  {
+    while (n--) {
+      choices = strchr_P(choices, '|');
+      if (!choices)
+        return false;
+      ++choices;
+    }
+    auto sep = strchr_P(choices, '|');
+    size_t len = sep ? size_t(sep - choices) : strlen_P(choices);
+    if (len > size - 1)
+      len = size - 1;
+    memcpy_P(buffer, choices, len);
+    buffer[len] = 0;
+    return true;
+  }
+
+  /// Command of a holding register write.
+  struct HoldingCommand
+  {
+    char topic[MAX_TOPIC_LEN + 1];  ///< Command topic.
+    char payload[8];                ///< Command payload.
+
+    /// Build command for a register value, return @c false if the value has no payload.
+    bool set(uint16_t addr, uint16_t value)
+    {
+      HoldingRegister desc;
+      memcpy_P(&desc, &HOLDING[addr], sizeof(desc));
+      strlcpy_P(topic, desc.topic, sizeof(topic));
+      if (!desc.choices) {
+        utoa(value, payload, 10);
+        return true;
+      }
+      return value >= desc.first && copyChoice(desc.choices, value - desc.first, payload, sizeof(payload));
+    }
+  };
+}
+
+// WiFi module can only listen on one port
+#ifdef WIFI_SUPPORT
+static_assert(!KWLConfig::MetricsPort || !KWLConfig::ModbusPort,
+  "WiFi module supports only one server, set MetricsPort or ModbusPort to 0");
+#endif
+
+ModbusServer::ModbusServer(NetworkTransport& transport, KWLPersistentConfig& config) :
+  transport_(transport),
+  config_(config),
+  stats_(F("ModbusServer")),
+  poll_task_(stats_, &ModbusServer::loop, *this)
+{}
+
+void ModbusServer::begin(Print& initTracer, Registers& registers, uint16_t port)
+{
+  registers_ = &registers;
+  if (!port)
+    return;
+  server_ = transport_.listen(port);
+  if (server_ < 0) {
+    initTracer.println(F("Modbus server not available"));
+    return;
+  }
+  initTracer.print(F("Initialisierung Modbus TCP, port "));
+  initTracer.println(port);
+}
+
+void ModbusServer::loop()
+{
+  auto current_time = micros();
+  if (current_time - last_poll_time_ < MODBUS_POLL_INTERVAL)
+    return; // not due yet
+  last_poll_time_ = current_time;
+
+  if (!client_) {
+    if (server_ < 0)
+      return;
+    client_ = transport_.accept(uint8_t(server_));
+    fill_ = 0;
+    last_request_time_ = current_time;
+    return;
+  }
+
+  // read the header first, then the rest of the frame as announced in the header
+  if (fill_ < MBAP_SIZE && !receive(MBAP_SIZE, current_time))
+    return;
+  auto length = get16(frame_ + 4);
+  if (get16(frame_ + 2) != 0 || length < 2 || length > FRAME_SIZE - MBAP_SIZE + 1) {
+    // not Modbus or too long request, cannot resynchronize
+    if (KWLConfig::serialDebug)
+      Serial.println(F("Modbus: invalid frame, closing connection"));
+    close();
+    return;
+  }
+  if (!receive(uint8_t(MBAP_SIZE - 1 + length), current_time))
+    return;
+
+  auto pdu_len = handleRequest();
+  put16(frame_ + 4, uint16_t(pdu_len + 1));
+  client_->write(frame_, MBAP_SIZE + pdu_len);
+  fill_ = 0;
+  last_request_time_ = current_time;
+}
+
+bool ModbusServer::receive(uint8_t size, unsigned long current_time)
+{
+  auto count = client_->read(frame_ + fill_, size - fill_);
+  if (count > 0) {
+    fill_ = uint8_t(fill_ + count);
+    return fill_ == size;
+  }
+  if (!client_->connected() || current_time - last_request_time_ >= MODBUS_IDLE_TIMEOUT)
+    close();
+  return false;
+}
+
+void ModbusServer::close()
+{
+  client_->stop();
+  client_ = nullptr;
+  fill_ = 0;
+}
+
+uint8_t ModbusServer::handleRequest()
+{
+  auto pdu = frame_ + MBAP_SIZE;
+  auto pdu_len = uint8_t(fill_ - MBAP_SIZE);
+  auto fc = pdu[0];
+  auto addr = get16(pdu + 1);
+  auto count = get16(pdu + 3);
+  auto rc = ExceptionCode::IllegalFunction;
+  uint8_t len = 5;  // responses to writes echo function code, address and count or value
+  switch (fc) {
+    case FC_READ_HOLDING:
+    case FC_READ_INPUT:
+      if (pdu_len != 5) {
+        rc = ExceptionCode::IllegalValue;
+      } else {
+        rc = readRegisters(fc == FC_READ_INPUT, addr, count, pdu + 2);
+        pdu[1] = uint8_t(count * 2);
+        len = uint8_t(2 + count * 2);
+      }
+      break;
+    case FC_WRITE_SINGLE:
+      rc = (pdu_len != 5) ? ExceptionCode::IllegalValue : writeHolding(addr, 1, pdu + 3);
+      break;
+    case FC_WRITE_MULTIPLE:
+      if (pdu_len < 6 || pdu[5] != count * 2 || pdu_len != 6 + pdu[5])
+        rc = ExceptionCode::IllegalValue;
+      else
+        rc = writeHolding(addr, count, pdu + 6);
+      break;
+  }
+  if (rc != ExceptionCode::None) {
+    if (KWLConfig::serialDebug) {
+      Serial.print(F("Modbus: exception "));
+      Serial.print(uint8_t(rc));
+      Serial.print(F(" for function "));
+      Serial.print(fc);
+      Serial.print(F(", address "));
+      Serial.println(addr);
+    }
+    pdu[0] = uint8_t(fc | 0x80);
+    pdu[1] = uint8_t(rc);
+    return 2;
+  }
+  return len;
+}
+
+ModbusServer::ExceptionCode ModbusServer::readRegisters(bool input, uint16_t addr, uint16_t count, uint8_t* out)
+{
+  if (count < 1 || count > MAX_REGISTERS)
+    return ExceptionCode::IllegalValue;
+  auto limit = input ? INPUT_REGISTER_COUNT : HOLDING_REGISTER_COUNT;
+  if (addr >= limit || count > limit - addr)
+    return ExceptionCode::IllegalAddress;
+  // values are taken from the live state directly into the response
+  for (; count; --count, ++addr, out += 2)
+    put16(out, input ? registers_->modbusReadInput(addr) : registers_->modbusReadHolding(addr));
+  return ExceptionCode::None;
+}
+
+ModbusServer::ExceptionCode ModbusServer::writeHolding(uint16_t addr, uint16_t count, const uint8_t* values)
+{
+  if (count < 1 || count > MAX_REGISTERS)
+    return ExceptionCode::IllegalValue;
+  if (addr >= HOLDING_REGISTER_COUNT || count > HOLDING_REGISTER_COUNT - addr)
+    return ExceptionCode::IllegalAddress;
+
+  // validate all values first, so the request is applied completely or not at all
+  HoldingCommand cmd;
+  for (uint16_t i = 0; i < count; ++i) {
+    if (!cmd.set(uint16_t(addr + i), get16(values + i * 2)) ||
+        !MessageHandler::validate(StringView(cmd.topic), StringView(cmd.payload)))
+      return ExceptionCode::IllegalValue;
+  }
+
+  // apply values via MQTT command handlers, then write the configuration at once
+  config_.beginTransaction();
+  bool ok = true;
+  for (uint16_t i = 0; i < count; ++i) {
+    cmd.set(uint16_t(addr + i), get16(values + i * 2));
+    if (!MessageHandler::dispatch(StringView(cmd.topic), StringView(cmd.payload)))
+      ok = false; // cannot happen for validated values, store already applied ones
+  }
+  config_.commitTransaction();
+  return ok ? ExceptionCode::None : ExceptionCode::DeviceFailure;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Modbus TCP server for building automation.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include "TimeScheduler.h"
+
+class KWLPersistentConfig;
+class NetworkTransport;
+class Client;
+
+/*!
+ * @brief Modbus TCP server mapping registers onto the state of the controller.
+ *
+ * The server accepts one connection at a time and keeps it open as long as
+ * the client sends requests (building management systems typically poll over
+ * a persistent connection). Supported function codes are 3 (read holding
+ * registers), 4 (read input registers), 6 (write single register) and 16
+ * (write multiple registers), at most MAX_REGISTERS registers per request.
+ * The unit identifier is ignored.
+ *
+ * Register values are read directly from the live state of the modules when
+ * the response is built (see Registers), there is no register image. Writes
+ * are dispatched as MQTT commands, so they go through the same validation
+ * and setters as commands received via MQTT. A write of multiple registers
+ * is validated as a whole by the command handlers first (see
+ * MessageHandler::validate()) and stored in EEPROM at once.
+ *
+ * Input registers (read-only):
+ *  - 0 - error bits (high word of @c statusbits),
+ *  - 1 - info bits (low word of @c statusbits),
+ *  - 2..5 - temperatures T1..T4 in 1/100 degrees Celsius (signed, -12700 if invalid),
+ *  - 6 - efficiency of the heat exchanger in %,
+ *  - 7, 8 - speed of fan 1 and 2 in RPM,
+ *  - 9 - fan mode (0 normal, 1 calibration),
+ *  - 10 - antifreeze state (0 off, 1 preheater, 2 fan off, 3 fireplace),
+ *  - 11 - preheater power in %,
+ *  - 12 - bypass flap state (0 unknown, 1 closed, 2 open),
+ *  - 13 - bypass motor running (0/1).
+ *
+ * Holding registers (read/write):
+ *  - 0 - ventilation mode,
+ *  - 1, 2 - standard speed of fan 1 and 2 in RPM (60..10000),
+ *  - 3 - bypass mode (0 auto, 1 manual),
+ *  - 4 - bypass flap setpoint in manual mode (1 closed, 2 open).
+ */
+class ModbusServer
+{
+public:
+  ModbusServer(const ModbusServer&) = delete;
+  ModbusServer& operator=(const ModbusServer&) = delete;
+
+  /// Maximum count of registers per request.
+  static constexpr uint8_t MAX_REGISTERS = 32;
+
+  /// Modbus exception codes.
+  enum class ExceptionCode : uint8_t
+  {
+    None = 0,             ///< No exception.
+    IllegalFunction = 1,  ///< Function code not supported.
+    IllegalAddress = 2,   ///< Register address out of range.
+    IllegalValue = 3,     ///< Invalid register count or value.
+    DeviceFailure = 4     ///< Value was rejected by the command handler.
+  };
+
+  /// Source of register values.
+  class Registers {
+  public:
+    /// Read input register value (address is checked by the server).
+    virtual uint16_t modbusReadInput(uint16_t addr) = 0;
+    /// Read holding register value (address is checked by the server).
+    virtual uint16_t modbusReadHolding(uint16_t addr) = 0;
+    virtual ~Registers() {}
+  };
+
+  /*!
+   * @brief Construct Modbus server.
+   *
+   * @param transport transport to accept connections on.
+   * @param config configuration, which is written once per write request.
+   */
+  ModbusServer(NetworkTransport& transport, KWLPersistentConfig& config);
+
+  /*!
+   * @brief Start listening.
+   *
+   * Must be called after the transport was started.
+   *
+   * @param initTracer tracer for startup messages.
+   * @param registers source of register values.
+   * @param port TCP port to listen on (typically KWLConfig::ModbusPort, 0 to disable).
+   */
+  void begin(Print& initTracer, Registers& registers, uint16_t port);
+
+private:
+  /// Size of a frame (MBAP header and PDU of the largest supported request).
+  static constexpr uint8_t FRAME_SIZE = 13 + 2 * MAX_REGISTERS;
+
+  /// Accept connection or read and handle requests.
+  void loop();
+
+  /*!
+   * @brief Receive bytes of the current frame.
+   *
+   * Closes the connection, if the client disconnected or was idle too long.
+   *
+   * @param size expected size of the frame received so far.
+   * @param current_time current time (micros).
+   * @return @c true, if the frame is received up to @p size.
+   */
+  bool receive(uint8_t size, unsigned long current_time);
+
+  /// Close current connection.
+  void close();
+
+  /*!
+   * @brief Handle request in the frame buffer and replace it with the response.
+   *
+   * @return length of the response PDU.
+   */
+  uint8_t handleRequest();
+
+  /// Read registers into the frame buffer (at @p out).
+  ExceptionCode readRegisters(bool input, uint16_t addr, uint16_t count, uint8_t* out);
+
+  /// Write holding registers from big-endian values at @p values.
+  ExceptionCode writeHolding(uint16_t addr, uint16_t count, const uint8_t* values);
+
+  /// Transport to accept connections on.
+  NetworkTransport& transport_;
+  /// Configuration, which is written once per write request.
+  KWLPersistentConfig& config_;
+  /// Source of register values.
+  Registers* registers_ = nullptr;
+  /// Connected client or nullptr.
+  Client* client_ = nullptr;
+  /// Last time when incoming connection was checked or the client was polled.
+  unsigned long last_poll_time_ = 0;
+  /// Last time when a request was received.
+  unsigned long last_request_time_ = 0;
+  /// Frame buffer for request and response.
+  uint8_t frame_[FRAME_SIZE];
+  /// Bytes received in the frame buffer.
+  uint8_t fill_ = 0;
+  /// Transport server index or -1, if not listening.
+  int8_t server_ = -1;
+  /// Task polling statistics.
+  Scheduler::TaskPollingStats stats_;
+  /// Poll task serving requests.
+  Scheduler::PollTask<ModbusServer> poll_task_;
+};
@@ -28,67 +28,219 @@
 
 #include <MicroNTP.h>
 
-#define WIFI_SUPPORT
-
-#ifdef WIFI_SUPPORT
-  #include "UserConfig.WifiData.h"
-  /*
-  #define WIFI_AP "MyAP"
-  #define WIFI_PASSWORD "MyPassword"
-  */
-#endif
-
 // To prevent crashes while debugging in lab settings without Ethernet module
 //#define NO_ETHERNET
 
 /// Interval for checking LAN network OK (10 seconds).
 static constexpr unsigned long LAN_CHECK_INTERVAL = 10000000;
 
+/// Maximum interval for checking LAN network OK with backoff (160 seconds).
+static constexpr unsigned long LAN_CHECK_MAX_INTERVAL = 160000000;
+
 /// Interval for reconnecting MQTT (15 seconds).
 static constexpr unsigned long MQTT_RECONNECT_INTERVAL = 15000000;
 
+/// Maximum interval for reconnecting MQTT with backoff (240 seconds).
+static constexpr unsigned long MQTT_RECONNECT_MAX_INTERVAL = 240000000;
+
+/// Timeout for MQTT connect acknowledgement from the broker, in seconds.
+static constexpr uint16_t MQTT_CONNACK_TIMEOUT = 2;
+
 /// MQTT heartbeat period.
 static constexpr unsigned long MQTT_HEARTBEAT_PERIOD = KWLConfig::HeartbeatPeriod * 1000000UL;
 
+/// Interval for checking incoming metrics scrape connection (100ms).
+static constexpr unsigned long METRICS_ACCEPT_INTERVAL = 100000;
+
+/// Timeout for receiving metrics scrape request header (2 seconds).
+static constexpr unsigned long METRICS_REQUEST_TIMEOUT = 2000000;
+
+/// Timeout for sending the whole metrics response (10 seconds).
+static constexpr unsigned long METRICS_RESPONSE_TIMEOUT = 10000000;
+
+/// Maximum size of MQTT publish packet besides topic and payload (fixed header, topic length).
+static constexpr size_t MQTT_PUBLISH_OVERHEAD = 5;
+
 namespace {
   /// MQTT prefix length.
   static uint8_t s_mqtt_prefix_len = 0;
   /// MQTT prefix.
   static const char* s_mqtt_prefix = nullptr;
-}
+  /// Count of messages which couldn't be published while connected.
+  static unsigned long s_publish_failures = 0;
+  /// Flag set when an MQTT message was received, so the client is polled again immediately.
+  static bool s_message_received = false;
+
+  /*!
+   * @brief Compute delay until next attempt with capped exponential backoff and jitter.
+   *
+   * @param interval current backoff interval, which is doubled up to max_interval.
+   * @param max_interval maximum backoff interval.
+   * @return delay until next attempt, randomly chosen between half and full interval.
+   */
+  unsigned long backoff(unsigned long& interval, unsigned long max_interval)
+  {
+    auto half = interval / 2;
+    auto delay = half + (unsigned long)(random(long(half / 1000) + 1)) * 1000UL;
+    interval = (interval >= max_interval / 2) ? max_interval : interval * 2;
+    return delay;
+  }
 
-NetworkClient::NetworkClient(KWLPersistentConfig& config, MicroNTP& ntp) :
-  MessageHandler(F("NetworkClient")),
+  /*!
+   * @brief Build full MQTT topic for a state topic and call a function with it.
+   *
+   * Debug states (starting with '/') are prefixed by MQTT prefix and debug state
+   * path, normal states by MQTT prefix and state path.
+   *
+   * @param topic state topic.
+   * @param fnc function to call with full topic.
+   * @return value returned by the function.
+   */
+  template<typename Func>
+  bool withFullTopic(const char* topic, Func&& fnc)
+  {
+    auto topiclen = strlen(topic);
+    if (topic[0] == '/') {
+      // debug state
+      char real_topic[topiclen + s_mqtt_prefix_len + MQTTTopic::StateDebug.length()];
+      memcpy(real_topic, s_mqtt_prefix, s_mqtt_prefix_len);
+      MQTTTopic::StateDebug.store(real_topic + s_mqtt_prefix_len);
+      memcpy(real_topic + MQTTTopic::StateDebug.length() + s_mqtt_prefix_len, topic + 1, topiclen);
+      return fnc(real_topic);
+    } else {
+      // normal state
+      char real_topic[topiclen + s_mqtt_prefix_len + MQTTTopic::State.length() + 1];
+      memcpy(real_topic, s_mqtt_prefix, s_mqtt_prefix_len);
+      MQTTTopic::State.store(real_topic + s_mqtt_prefix_len);
+      memcpy(real_topic + MQTTTopic::State.length() + s_mqtt_prefix_len, topic, topiclen + 1);
+      return fnc(real_topic);
+    }
+  }
+
+  /*!
+   * @brief Stream collecting output in small chunks before sending it to the client.
+   *
+   * Transports send each write as a separate packet (or AT command), so
+   * writing metrics byte by byte would be very slow. Chunk is flushed when
+   * full and by finish().
+   *
+   * Writes to the client may be short, if its send buffer is full. Then the
+   * rest of the output is ignored and the output is printed again later,
+   * skipping the bytes sent before.
+   */
+  class ChunkedPrint : public Print
+  {
+  public:
+    /*!
+     * @brief Construct the stream.
+     *
+     * @param out client to send chunks to.
+     * @param skip count of bytes of the output to skip (sent before).
+     */
+    ChunkedPrint(Client& out, unsigned skip) noexcept : out_(out), skip_(skip), sent_(skip) {}
+
+    virtual size_t write(uint8_t c) override
+    {
+      if (skip_) {
+        --skip_;
+        return 1;
+      }
+      if (fill_ == sizeof(chunk_))
+        flushChunk();
+      if (blocked_)
+        return 0;
+      chunk_[fill_++] = c;
+      return 1;
+    }
 
-#ifdef WIFI_SUPPORT
-  mqtt_client_(wifi_client_),
-#else
-  mqtt_client_(eth_client_),
+    /// Send the rest of the output, return @c true, if all output was sent.
+    bool finish()
+    {
+      flushChunk();
+      return !blocked_;
+    }
+
+    /// Get count of bytes sent, including skipped ones.
+    unsigned getSent() const noexcept { return sent_; }
+
+  private:
+    void flushChunk()
+    {
+      if (fill_ && !blocked_) {
+        auto count = out_.write(chunk_, fill_);
+        sent_ += unsigned(count);
+        blocked_ = count < fill_;
+      }
+      fill_ = 0;
+    }
+
+    Client& out_;           ///< Client to send chunks to.
+    unsigned skip_;         ///< Count of bytes still to skip.
+    unsigned sent_;         ///< Count of bytes sent, including skipped ones.
+    bool blocked_ = false;  ///< Set, if the client didn't accept the last chunk.
+    uint8_t fill_ = 0;      ///< Bytes used in the chunk.
+    uint8_t chunk_[48];     ///< Chunk buffer.
+  };
+
+#ifdef NO_ETHERNET
+  /// Stream ignoring all output.
+  class NullPrint : public Print
+  {
+  public:
+    virtual size_t write(uint8_t) override { return 1; }
+    virtual size_t write(const uint8_t*, size_t size) override { return size; }
+  };
 #endif
+}
 
+NetworkClient::NetworkClient(KWLPersistentConfig& config, MicroNTP& ntp, NetworkTransport& transport) :
+  MessageHandler(F("NetworkClient")),
+  transport_(transport),
+  mqtt_client_(transport.getClient()),
   config_(config),
   ntp_(ntp),
   stats_(F("NetworkClient")),
   timer_task_(stats_, &NetworkClient::run, *this),
+  link_task_(stats_, &NetworkClient::refreshLink, *this),
   poll_stats_(F("NetworkClientPoll")),
   poll_task_(poll_stats_, &NetworkClient::loop, *this),
-  mqtt_send_poll_task_(poll_stats_, &NetworkClient::sendMQTT)
+  mqtt_send_poll_task_(poll_stats_, &NetworkClient::sendMQTT),
+  mqtt_connected_metric_(F("kwl_mqtt_connected"), F("MQTT connection state (1 = connected)."), Metric::Type::Gauge,
+    [](Metric::Writer& out, void* arg) {
+      out.sample(unsigned(static_cast<NetworkClient*>(arg)->mqtt_ok_));
+    }, this),
+  reconnects_metric_(F("kwl_mqtt_reconnects_total"), F("Count of reconnects after connection loss."), Metric::Type::Counter,
+    [](Metric::Writer& out, void* arg) {
+      out.sample(static_cast<NetworkClient*>(arg)->conn_stats_.reconnects);
+    }, this),
+  downtime_metric_(F("kwl_network_downtime_seconds_total"), F("Cumulative duration of MQTT outages."), Metric::Type::Counter,
+    [](Metric::Writer& out, void* arg) {
+      out.sample(static_cast<NetworkClient*>(arg)->conn_stats_.downtime);
+    }, this),
+  publish_failures_metric_(F("kwl_mqtt_publish_failures_total"), F("Count of messages which couldn't be published while connected."), Metric::Type::Counter,
+    [](Metric::Writer& out, void*) {
+      out.sample(s_publish_failures);
+    }),
+  transport_calls_metric_(F("kwl_network_transport_calls_total"), F("Count of calls into the network transport."), Metric::Type::Counter,
+    [](Metric::Writer& out, void* arg) {
+      auto self = static_cast<NetworkClient*>(arg);
+      out.sample(self->transport_calls_total_ + self->transport_calls_);
+    }, this)
 {}
 
 void NetworkClient::begin(Print& initTracer)
 {
-
-#ifdef WIFI_SUPPORT
-  // this is written for a WEMOS MEGA + WIFI, the ESP is connected to Serial3 in "special mode" DIP 1-4 on, others off
-  Serial.println("Initialize serial for ESP module");
-  Serial3.begin(115200);
-  WiFi.init(&Serial3);
-#endif
-
-  initEthernet(initTracer);
+  transport_.begin(initTracer);
+  // join in the first loop, if the join request cannot be sent now
+  last_lan_join_time_ = micros() - transport_.getRejoinInterval();
+  initNetwork(initTracer);
   delay(1500);  // to give Ethernet link time to start
-  last_lan_reconnect_attempt_time_ = micros();
-  lan_ok_ = true;
+  // check link immediately in the first loop
+  state_ = State::LinkDown;
+  last_lan_reconnect_attempt_time_ = micros() - LAN_CHECK_INTERVAL;
+  lan_retry_delay_ = lan_backoff_ = LAN_CHECK_INTERVAL;
+  // jitter of reconnect attempts should differ between devices
+  randomSeed(config_.getPhaseOffset(0xffffffffUL) ^ micros());
   s_mqtt_prefix = config_.getMQTTPrefix();
   s_mqtt_prefix_len = uint8_t(strlen(s_mqtt_prefix));
 
@@ -97,7 +249,9 @@ void NetworkClient::begin(Print& initTracer)
   initTracer.print(F("], broker "));
   initTracer.println(IPAddress(config_.getNetworkMQTTBroker()));
   mqtt_client_.setServer(config_.getNetworkMQTTBroker(), config_.getNetworkMQTTPort());
+  mqtt_client_.setSocketTimeout(MQTT_CONNACK_TIMEOUT);
   mqtt_client_.setCallback([](char* topic, uint8_t* payload, unsigned length) {
+    s_message_received = true;
     // first check whether it's for us
     if (memcmp(topic, s_mqtt_prefix, s_mqtt_prefix_len) == 0) {
       StringView t(topic + s_mqtt_prefix_len);
@@ -124,101 +278,119 @@ void NetworkClient::begin(Print& initTracer)
   #ifdef NO_ETHERNET
     return true;
   #else
-    // prefix name
-    PubSubClient* client = reinterpret_cast<PubSubClient*>(instance);
-    auto topiclen = strlen(topic);
-    if (topic[0] == '/') {
-      // debug state
-      char real_topic[topiclen + s_mqtt_prefix_len + MQTTTopic::StateDebug.length()];
-      memcpy(real_topic, s_mqtt_prefix, s_mqtt_prefix_len);
-      MQTTTopic::StateDebug.store(real_topic + s_mqtt_prefix_len);
-      memcpy(real_topic + MQTTTopic::StateDebug.length() + s_mqtt_prefix_len, topic + 1, topiclen);
-      return client->publish(real_topic, payload, retained);
-    } else {
-      // normal state
-      char real_topic[topiclen + s_mqtt_prefix_len + MQTTTopic::State.length() + 1];
-      memcpy(real_topic, s_mqtt_prefix, s_mqtt_prefix_len);
-      MQTTTopic::State.store(real_topic + s_mqtt_prefix_len);
-      memcpy(real_topic + MQTTTopic::State.length() + s_mqtt_prefix_len, topic, topiclen + 1);
+    auto self = reinterpret_cast<NetworkClient*>(instance);
+    PubSubClient* client = &self->mqtt_client_;
+    if (!client->connected())
+      return false;
+    bool sent = withFullTopic(topic, [self, client, payload, retained](const char* real_topic) {
+      auto size = MQTT_PUBLISH_OVERHEAD + strlen(real_topic) + strlen(payload);
+      if (!self->transport_.canWrite(size))
+        return false; // transport busy, publish task retries
       return client->publish(real_topic, payload, retained);
+    });
+    if (!sent)
+      ++s_publish_failures;
+    return sent;
+  #endif
+  }, this, KWLConfig::serialDebug);
+  MessageHandler::setStreamCallbacks([](void* instance, const char* topic, unsigned length, bool retained) -> Print* {
+  #ifdef NO_ETHERNET
+    static NullPrint s_null;
+    return &s_null;
+  #else
+    auto self = reinterpret_cast<NetworkClient*>(instance);
+    PubSubClient* client = &self->mqtt_client_;
+    if (!client->connected())
+      return nullptr;
+    bool started = withFullTopic(topic, [self, client, length, retained](const char* real_topic) {
+      // whole message must fit, a stream can't be continued later
+      if (!self->transport_.canWrite(MQTT_PUBLISH_OVERHEAD + strlen(real_topic) + length))
+        return false;
+      return client->beginPublish(real_topic, length, retained);
+    });
+    if (!started)
+      ++s_publish_failures;
+    return started ? client : nullptr;
+  #endif
+  }, [](void* instance, bool complete) {
+  #ifdef NO_ETHERNET
+    return complete;
+  #else
+    auto self = reinterpret_cast<NetworkClient*>(instance);
+    if (!complete) {
+      // partially sent message can't be finished, the broker would read following data as payload
+      if (KWLConfig::serialDebug)
+        Serial.println(F("MQTT: streamed message incomplete, aborting connection"));
+      self->transport_.getClient().stop();
+      ++s_publish_failures;
+      return false;
     }
+    bool sent = self->mqtt_client_.endPublish() != 0;
+    if (!sent)
+      ++s_publish_failures;
+    return sent;
   #endif
-  }, &mqtt_client_, KWLConfig::serialDebug);
-  last_mqtt_reconnect_attempt_time_ = micros();
-  mqtt_ok_ = true;
-  loop();  // first run call here to connect MQTT
+  });
+  // delay first connect by per-device phase to not connect in lockstep with other devices
+  last_mqtt_reconnect_attempt_time_ = micros() - MQTT_RECONNECT_INTERVAL + config_.getPhaseOffset(MQTT_RECONNECT_INTERVAL);
+  mqtt_retry_delay_ = mqtt_backoff_ = MQTT_RECONNECT_INTERVAL;
+  mqtt_ok_ = false;
+  poll_cost_start_ = millis();
+  if (KWLConfig::MetricsPort) {
+    metrics_server_ = transport_.listen(KWLConfig::MetricsPort);
+    if (metrics_server_ < 0)
+      initTracer.println(F("Metrics server not available"));
+  }
+  link_task_.runRepeated(KWLConfig::NetworkLinkCheckPeriod * 1000UL);
+  loop();  // first run call here to check the link
 }
 
-void NetworkClient::initEthernet(Print& initTracer)
+void NetworkClient::initNetwork(Print& initTracer)
 {
- 
-#ifdef WIFI_SUPPORT
-  initTracer.print(F("Initialisierung WIFI on serial3, access point "));
-  initTracer.println(WIFI_AP);
-
-  IPAddress ip = config_.getNetworkIPAddress();
-  IPAddress gw = config_.getNetworkGateway();
-  IPAddress subnet = config_.getNetworkSubnetMask();
-  IPAddress dns = config_.getNetworkDNSServer();
+  initTracer.print(F("Initialisierung Netzwerk, IP "));
+
+  NetworkTransport::Settings settings;
+  settings.ip = config_.getNetworkIPAddress();
+  settings.gateway = config_.getNetworkGateway();
+  settings.subnet = config_.getNetworkSubnetMask();
+  settings.dns = config_.getNetworkDNSServer();
+  uint8_t mac[6];
+  config_.getNetworkMACAddress().copy_to(mac);
+  settings.mac = mac;
   IPAddress ntp = config_.getNetworkNTPServer();
-  initTracer.print(ip);
+  initTracer.print(settings.ip);
   Serial.print('/');
-  Serial.print(subnet);
+  Serial.print(settings.subnet);
   Serial.print(F(" gw "));
-  Serial.print(gw);
+  Serial.print(settings.gateway);
   Serial.print(F(" dns "));
-  Serial.print(dns);
+  Serial.print(settings.dns);
   Serial.print(F(" ntp "));
   Serial.print(ntp);
   initTracer.println();
 
-  // check for the presence of the shield
-  if (WiFi.status() == WL_NO_SHIELD) {
-    initTracer.println("WiFi shield not present");
-  }
-  else {
-    wifi_status_ = WiFi.begin(WIFI_AP, WIFI_PASSWORD);
-    if (wifi_status_ == WL_CONNECTED) {
-      initTracer.print("Connected to WIFI with IP ");
-      initTracer.println(WiFi.localIP());
-    }
-
-    // attempt to connect to WiFi network
+  // joining may be asynchronous, link state is checked by the loop
+  if (transport_.join(settings))
+    last_lan_join_time_ = micros();
+  else
+    initTracer.println(F("Network transport not ready"));
+}
 
-    /* 
-    while (wifi_status_ != WL_CONNECTED) {
-      Serial.print("Attempting to connect to WPA SSID: ");
-      Serial.println(WIFI_AP);
-      // Connect to WPA/WPA2 network
-      wifi_status_ = WiFi.begin(WIFI_AP, WIFI_PASSWORD);
-      delay(500);
-    }
-    Serial.println("Connected to AP");
-    */
+bool NetworkClient::tcpConnect()
+{
+  Serial.print(F("MQTT TCP connect start at "));
+  Serial.println(micros());
+  // bounded by connection timeout or opened asynchronously, result is checked in TcpWait state
+  bool rc = transport_.connect(IPAddress(config_.getNetworkMQTTBroker()), config_.getNetworkMQTTPort());
+  Serial.print(F("MQTT TCP connect end at "));
+  Serial.print(micros());
+  if (rc) {
+    Serial.println(F(" [successful]"));
+  } else {
+    Serial.println(F(" [failed]"));
+    transport_.getClient().stop();
   }
-#else
-  initTracer.print(F("Initialisierung Ethernet, IP "));
-
-  IPAddress ip = config_.getNetworkIPAddress();
-  IPAddress gw = config_.getNetworkGateway();
-  IPAddress subnet = config_.getNetworkSubnetMask();
-  IPAddress dns = config_.getNetworkDNSServer();
-  IPAddress ntp = config_.getNetworkNTPServer();
-  initTracer.print(ip);
-  Serial.print('/');
-  Serial.print(subnet);
-  Serial.print(F(" gw "));
-  Serial.print(gw);
-  Serial.print(F(" dns "));
-  Serial.print(dns);
-  Serial.print(F(" ntp "));
-  Serial.print(ntp);
-  initTracer.println();
-
-  uint8_t mac[6];
-  config_.getNetworkMACAddress().copy_to(mac);
-  Ethernet.begin(mac, ip, dns, gw, subnet);
-#endif
+  return rc;
 }
 
 bool NetworkClient::mqttConnect()
@@ -234,6 +406,8 @@ bool NetworkClient::mqttConnect()
   NAME.store(buffer);
   buffer[NAME.length()] = ':';
   strcpy(buffer + NAME.length() + 1, config_.getMQTTPrefix());
+  // TCP connection is already open, so this only sends the connect request and waits
+  // for acknowledgement, bounded by socket timeout
   bool rc = mqtt_client_.connect(buffer,
                                  KWLConfig::NetworkMQTTUsername, KWLConfig::NetworkMQTTPassword,
                                  MQTTTopic::Heartbeat.load(), 0, true, WILL_MESSAGE.load());
@@ -244,12 +418,28 @@ bool NetworkClient::mqttConnect()
     // subscribe
     subscribed_command_ = subscribed_debug_ = false;
     resubscribe();
-    timer_task_.runRepeated(1, MQTT_HEARTBEAT_PERIOD); // next run should send heartbeat
+    // next run should send heartbeat, shifted by per-device phase
+    timer_task_.runRepeated(1 + config_.getPhaseOffset(MQTT_HEARTBEAT_PERIOD), MQTT_HEARTBEAT_PERIOD);
+    // update and report connection quality
+    auto now = millis();
+    conn_stats_.connect_time = now - connect_start_;
+    if (in_outage_) {
+      in_outage_ = false;
+      auto outage = (now - outage_start_) / 1000;
+      ++conn_stats_.reconnects;
+      conn_stats_.downtime += outage;
+      if (outage > conn_stats_.longest_outage)
+        conn_stats_.longest_outage = outage;
+    }
+    conn_stats_publish_.publish([this]() {
+      return MessageHandler::publishStream(MQTTTopic::KwlNetworkStats, [this](Print& out) {
+        conn_stats_.printTo(out);
+      }, true);
+    });
   }
-  last_mqtt_reconnect_attempt_time_ = micros();
   Serial.print(F("MQTT connect end at "));
-  Serial.print(last_mqtt_reconnect_attempt_time_);
-  if (mqtt_client_.connected()) {
+  Serial.print(micros());
+  if (rc && mqtt_client_.connected()) {
     Serial.println(F(" [successful]"));
     return true;
   } else {
@@ -259,134 +449,244 @@ bool NetworkClient::mqttConnect()
   }
 }
 
-void NetworkClient::loop()
+void NetworkClient::startOutage()
 {
-  if (Serial.available()) {
-    // there is data on serial port, read command from there
-    char c = char(Serial.read());
-    if (c == 10 || c == 13) {
-      // process command in form <topic> <value>
-      if (serial_data_size_) {
-        serial_data_[serial_data_size_] = 0;
-        auto delim = strchr(serial_data_, ' ');
-        if (!delim) {
-          static constexpr auto NO_VALUE = makeFlashStringLiteral("<no value>");
-          char* p = NO_VALUE.load();
-          MessageHandler::mqttMessageReceived(
-                serial_data_,
-                reinterpret_cast<uint8_t*>(p),
-                NO_VALUE.length());
-        } else {
-          *delim++ = 0;
-          while (*delim == ' ' || *delim == '\t')
-            ++delim;
-          MessageHandler::mqttMessageReceived(
-                serial_data_,
-                reinterpret_cast<uint8_t*>(delim),
-                unsigned(serial_data_size_ - (delim - serial_data_)));
+  if (!in_outage_) {
+    in_outage_ = true;
+    outage_start_ = millis();
+  }
+}
+
+void NetworkClient::serveMetrics(unsigned long current_time)
+{
+  switch (metrics_state_) {
+    case MetricsState::Idle:
+      if (metrics_server_ < 0 || current_time - last_metrics_accept_time_ < METRICS_ACCEPT_INTERVAL)
+        return; // not due yet
+      last_metrics_accept_time_ = current_time;
+      ++transport_calls_;
+      metrics_client_ = transport_.accept(uint8_t(metrics_server_));
+      if (metrics_client_) {
+        metrics_start_ = current_time;
+        metrics_eol_ = 0;
+        metrics_state_ = MetricsState::Request;
+      }
+      return;
+
+    case MetricsState::Request:
+      // any request is answered with metrics, just skip the header up to the empty line
+      ++transport_calls_;
+      while (metrics_eol_ < 2) {
+        int c = metrics_client_->read();
+        if (c < 0)
+          break;
+        if (c == '\n')
+          ++metrics_eol_;
+        else if (c != '\r')
+          metrics_eol_ = 0;
+      }
+      if (metrics_eol_ < 2) {
+        if (!metrics_client_->connected() || current_time - metrics_start_ >= METRICS_REQUEST_TIMEOUT) {
+          metrics_client_->stop();
+          metrics_state_ = MetricsState::Idle;
         }
-        serial_data_size_ = 0;
+        return;
       }
-    } else if (serial_data_size_ < SERIAL_BUFFER_SIZE - 1) {
-      serial_data_[serial_data_size_++] = c;
-    }
+      metrics_sent_ = 0;
+      metrics_state_ = MetricsState::Header;
+      // fall through
+
+    case MetricsState::Header:
+    case MetricsState::Response:
+      // send one metric per call to keep loop time short, response is never buffered as a whole
+      ++transport_calls_;
+      if (!metrics_client_->connected() || current_time - metrics_start_ >= METRICS_RESPONSE_TIMEOUT) {
+        metrics_client_->stop();
+        metrics_state_ = MetricsState::Idle;
+        return;
+      }
+      if (metrics_state_ == MetricsState::Response && metrics_pos_ == Metric::end()) {
+        metrics_client_->flush();
+        metrics_client_->stop();
+        metrics_state_ = MetricsState::Idle;
+        return;
+      }
+      {
+        ChunkedPrint out(*metrics_client_, metrics_sent_);
+        if (metrics_state_ == MetricsState::Header)
+          out.print(F("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n"));
+        else
+          metrics_pos_->printTo(out);
+        if (!out.finish()) {
+          // send buffer full, continue in the next call
+          metrics_sent_ = out.getSent();
+          return;
+        }
+      }
+      metrics_sent_ = 0;
+      if (metrics_state_ == MetricsState::Header) {
+        metrics_pos_ = Metric::begin();
+        metrics_state_ = MetricsState::Response;
+      } else {
+        ++metrics_pos_;
+      }
+      return;
   }
+}
 
-#ifndef NO_ETHERNET
+void NetworkClient::ConnectionStats::printTo(Print& out) const
+{
+  out.print(F("reconn "));
+  out.print(reconnects);
+  out.print(F(" down "));
+  out.print(downtime);
+  out.print(F(" maxdown "));
+  out.print(longest_outage);
+  out.print(F(" pubfail "));
+  out.print(s_publish_failures);
+  out.print(F(" conn "));
+  out.print(connect_time);
+}
 
-#ifdef WIFI_SUPPORT
-  //auto new_wifi_status = WiFi.status();
-  auto current_time = micros();
+void NetworkClient::refreshLink()
+{
+  if (state_ != State::LinkDown) {
+    // while the link is down, it's checked by the loop with backoff
+    link_up_ = transport_.isLinkUp();
+    ++transport_calls_;
+  }
+  auto now = millis();
+  auto elapsed = now - poll_cost_start_;
+  if (elapsed >= 1000) {
+    calls_per_sec_ = transport_calls_ * 1000 / elapsed;
+    if (calls_per_sec_ > max_calls_per_sec_)
+      max_calls_per_sec_ = calls_per_sec_;
+    transport_calls_total_ += transport_calls_;
+    transport_calls_ = 0;
+    poll_cost_start_ = now;
+  }
+}
 
-  wifi_status_ = WiFi.status();
-  if (lan_ok_) {
-    if (wifi_status_ != WL_CONNECTED) {
-      Serial.println(F("WLAN disconnected, attempting to connect"));
-      lan_ok_ = false;
-      timer_task_.cancel();
+void NetworkClient::linkLost(unsigned long current_time)
+{
+  if (mqtt_ok_)
+    startOutage();
+  lan_ok_ = false;
+  link_up_ = false;
+  mqtt_ok_ = false;
+  timer_task_.cancel();
+  transport_.getClient().stop();
+  state_ = State::LinkDown;
+  // shift reconnect attempts by per-device phase
+  last_lan_reconnect_attempt_time_ = current_time - config_.getPhaseOffset(LAN_CHECK_INTERVAL);
+  lan_retry_delay_ = lan_backoff_ = LAN_CHECK_INTERVAL;
+  // some transports reconnect by themselves, join explicitly only if they don't succeed
+  if (transport_.getRejoinInterval())
+    last_lan_join_time_ = current_time;
+  else
+    initNetwork(Serial);
+}
 
-      initEthernet(Serial); // nothing more to do now
+void NetworkClient::loop()
+{
+#ifndef NO_ETHERNET
+  transport_.loop();
+  auto current_time = micros();
 
-      last_lan_reconnect_attempt_time_ = current_time;
-      return;
-    }
-    // have Ethernet, do other checks
-  } else {
-    // no Ethernet previously, check if now connected
-    if (wifi_status_ == WL_CONNECTED) {
-      Serial.print(F("WLAN connected, IP: "));
-      Serial.println(WiFi.localIP());
-      lan_ok_ = true;
-      mqtt_ok_ = true; // to force check and immediate reconnect
-    } else {
-      // still no Ethernet
-      if (current_time - last_lan_reconnect_attempt_time_ >= LAN_CHECK_INTERVAL) {
-        // try reconnecting
-        initEthernet(Serial);
-        last_lan_reconnect_attempt_time_ = current_time;
-      }
+  if (state_ == State::LinkDown) {
+    // no link previously, check if now connected
+    if (current_time - last_lan_reconnect_attempt_time_ < lan_retry_delay_)
       return;
-    }
-#else  
-  Ethernet.maintain();
-  auto current_time = micros();
-  if (lan_ok_) {
-    if (Ethernet.localIP()[0] == 0) {
-      Serial.println(F("LAN disconnected, attempting to connect"));
-      lan_ok_ = false;
-      timer_task_.cancel();
-      initEthernet(Serial); // nothing more to do now
-      last_lan_reconnect_attempt_time_ = current_time;
+    last_lan_reconnect_attempt_time_ = current_time;
+    link_up_ = transport_.isLinkUp();
+    ++transport_calls_;
+    if (!link_up_) {
+      // check less often the longer the outage lasts
+      lan_retry_delay_ = backoff(lan_backoff_, LAN_CHECK_MAX_INTERVAL);
+      if (current_time - last_lan_join_time_ >= transport_.getRejoinInterval() && !transport_.isJoining())
+        initNetwork(Serial);
       return;
     }
-    // have Ethernet, do other checks
-  } else {
-    // no Ethernet previously, check if now connected
-    if (Ethernet.localIP()[0] != 0) {
-      Serial.print(F("LAN connected, IP: "));
-      Serial.println(Ethernet.localIP());
-      lan_ok_ = true;
-      mqtt_ok_ = true; // to force check and immediate reconnect
-    } else {
-      // still no Ethernet
-      if (current_time - last_lan_reconnect_attempt_time_ >= LAN_CHECK_INTERVAL) {
-        // try reconnecting
-        initEthernet(Serial);
-        last_lan_reconnect_attempt_time_ = current_time;
+    Serial.print(F("LAN connected, IP: "));
+    Serial.println(transport_.localIP());
+    lan_ok_ = true;
+    lan_backoff_ = LAN_CHECK_INTERVAL;
+    state_ = State::TcpConnect;
+    return;
+  }
+
+  if (!link_up_) {
+    Serial.println(F("LAN disconnected, attempting to connect"));
+    linkLost(current_time);
+    return;
+  }
+
+  if (ntp_.loop())
+    ++transport_calls_;
+
+  serveMetrics(current_time);
+
+  switch (state_) {
+    case State::TcpConnect:
+      if (current_time - last_mqtt_reconnect_attempt_time_ < mqtt_retry_delay_)
+        return; // not due yet
+      last_mqtt_reconnect_attempt_time_ = current_time;
+      connect_start_ = millis();
+      if (tcpConnect()) {
+        state_ = State::TcpWait;  // continue in the next call
+      } else {
+        mqtt_retry_delay_ = backoff(mqtt_backoff_, MQTT_RECONNECT_MAX_INTERVAL);
       }
       return;
-    }
-#endif  
-  }
 
-  ntp_.loop();
+    case State::TcpWait:
+      if (transport_.isConnecting())
+        return; // still opening
+      if (transport_.getClient().connected()) {
+        Serial.println(F("MQTT TCP connection open"));
+        state_ = State::MqttConnect;
+      } else {
+        Serial.println(F("MQTT TCP connection failed"));
+        transport_.getClient().stop();
+        mqtt_retry_delay_ = backoff(mqtt_backoff_, MQTT_RECONNECT_MAX_INTERVAL);
+        state_ = State::TcpConnect;
+      }
+      return;
 
-  if (mqtt_ok_) {
-    if (!mqtt_client_.connected()) {
-      Serial.println(F("MQTT disconnected, attempting to connect"));
-      timer_task_.cancel();
+    case State::MqttConnect:
       mqtt_ok_ = mqttConnect();
-      if (!mqtt_ok_) 
-        return; // couldn't connect now, cannot continue
-    }
-    // have MQTT receive messages
-  } else {
-    // no MQTT previously, check if now connected
-    if (current_time - last_mqtt_reconnect_attempt_time_ >= MQTT_RECONNECT_INTERVAL) {
-      // new reconnect attempt
-      mqtt_ok_ = mqttConnect();
-      if (!mqtt_ok_)
+      if (mqtt_ok_) {
+        mqtt_backoff_ = MQTT_RECONNECT_INTERVAL;
+        state_ = State::Connected;
+      } else {
+        mqtt_retry_delay_ = backoff(mqtt_backoff_, MQTT_RECONNECT_MAX_INTERVAL);
+        state_ = State::TcpConnect;
+      }
+      return;
+
+    default:
+      if (!s_message_received && current_time - last_mqtt_poll_time_ < KWLConfig::NetworkMQTTPollPeriod * 1000UL)
+        return; // not due yet
+      last_mqtt_poll_time_ = current_time;
+      s_message_received = false;
+      // now MQTT messages can be received
+      ++transport_calls_;
+      if (!mqtt_client_.loop()) {
+        Serial.println(F("MQTT disconnected, attempting to connect"));
+        timer_task_.cancel();
+        startOutage();
+        mqtt_ok_ = false;
+        state_ = State::TcpConnect;
+        // reconnect immediately
+        last_mqtt_reconnect_attempt_time_ = current_time;
+        mqtt_retry_delay_ = 0;
         return;
-    } else {
-      return; // not connected
-    }
+      }
+      break;
   }
 
   // Make sure we are subscribed, if after connect we didn't succeed
   resubscribe();
-
-  // now MQTT messages can be received
-  mqtt_client_.loop();
 #endif
 }
 
@@ -431,6 +731,20 @@ bool NetworkClient::mqttReceiveMsg(const StringView& topic, const StringView& s)
         Serial.println(s.c_str());
       }
     }
+  } else if (topic == MQTTTopic::KwlDebugsetNetworkGetvalues) {
+    poll_cost_publish_.publish([this]() {
+      return publishStream(MQTTTopic::KwlDebugstateNetworkPollCost, [this](Print& out) {
+        out.print(F("cps "));
+        out.print(calls_per_sec_);
+        out.print(F(" max "));
+        out.print(max_calls_per_sec_);
+        out.print(F(" tot "));
+        out.print(transport_calls_total_ + transport_calls_);
+      });
+    });
+  } else if (topic == MQTTTopic::KwlDebugsetNetworkResetvalues) {
+    max_calls_per_sec_ = 0;
+    transport_calls_total_ = 0;
   } else {
     return false;
   }
@@ -27,16 +27,9 @@
 #include "StringView.h"
 #include "TimeScheduler.h"
 #include "MessageHandler.h"
+#include "NetworkTransport.h"
 
-#define WIFI_SUPPORT
-
-#ifdef WIFI_SUPPORT
-  #include <WiFiEspClient.h>
-  #include <WiFiEsp.h>
-  #include <WiFiEspUdp.h>
-#else
-  #include <Ethernet.h>
-#endif
+#include <Metrics.h>
 
 #include <PubSubClient.h>
 
@@ -44,7 +37,18 @@ class MicroNTP;
 class KWLPersistentConfig;
 
 /*!
- * @brief Client to communicate with MQTT protocol over Ethernet.
+ * @brief Client to communicate with MQTT protocol over a network transport.
+ *
+ * Connection setup is a state machine driven by the poll task. Each call
+ * executes at most one step of the setup (link check, TCP connect, MQTT
+ * connect) and each step is bounded by a timeout well below the watchdog
+ * period, so other tasks like fan control continue to run during reconnects.
+ *
+ * Calls into the transport are expensive (especially over ESP AT link), so
+ * the poll task doesn't query the transport on each call. Link state is
+ * cached and refreshed by a timed task, NTP is only polled while waiting
+ * for a reply and MQTT client is polled at a fixed rate, unless a message
+ * was just received.
  */
 class NetworkClient : private MessageHandler
 {
@@ -52,8 +56,8 @@ public:
   NetworkClient(const NetworkClient&) = delete;
   NetworkClient& operator=(const NetworkClient&) = delete;
 
-  /// Construct network client.
-  NetworkClient(KWLPersistentConfig& config, MicroNTP& ntp);
+  /// Construct network client using given transport.
+  NetworkClient(KWLPersistentConfig& config, MicroNTP& ntp, NetworkTransport& transport);
 
   /// Start network client.
   void begin(Print& initTracer);
@@ -65,12 +69,37 @@ public:
   bool isMQTTOk() const { return mqtt_ok_; }
 
 private:
-  /// Initialize Ethernet connection.
-  void initEthernet(Print& initTracer);
-
-  /// Initialize MQTT connection.
+  /// State of the connection setup.
+  enum class State : uint8_t
+  {
+    LinkDown,     ///< No network link, check link periodically.
+    TcpConnect,   ///< Network link present, open TCP connection to the broker when due.
+    TcpWait,      ///< Waiting for TCP connection to be opened.
+    MqttConnect,  ///< TCP connection open, send MQTT connect request.
+    Connected     ///< MQTT connection established.
+  };
+
+  /// Join the network using configured settings.
+  void initNetwork(Print& initTracer);
+
+  /// Open TCP connection to the MQTT broker (or start opening it asynchronously).
+  bool tcpConnect();
+
+  /// Initialize MQTT connection over open TCP connection.
   bool mqttConnect();
 
+  /// Handle link loss.
+  void linkLost(unsigned long current_time);
+
+  /// Refresh cached link state and poll cost statistics.
+  void refreshLink();
+
+  /// Record start of an outage of MQTT connection, if not recorded yet.
+  void startOutage();
+
+  /// Serve metrics scrape requests, one step per call.
+  void serveMetrics(unsigned long current_time);
+
   /// Check network.
   void run();
 
@@ -85,50 +114,124 @@ private:
 
   virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override;
 
-  /// Maximum size of serial buffer for sending messages over serial port.
-  static constexpr uint8_t SERIAL_BUFFER_SIZE = 128;
-
-  /// Ethernet client for MQTT client.
-#ifdef WIFI_SUPPORT
-  int wifi_status_ = WL_IDLE_STATUS;
-  WiFiEspClient wifi_client_;
-#else
-  EthernetClient eth_client_;
-#endif
-
+  /// State of the metrics responder.
+  enum class MetricsState : uint8_t
+  {
+    Idle,     ///< Waiting for incoming connection.
+    Request,  ///< Reading HTTP request header.
+    Header,   ///< Sending response header.
+    Response  ///< Sending metrics, one metric per call.
+  };
+
+  /// Network transport.
+  NetworkTransport& transport_;
   /// MQTT client.
   PubSubClient mqtt_client_;
 
+  /// Connection quality statistics.
+  struct ConnectionStats
+  {
+    unsigned long reconnects = 0;     ///< Count of reconnects after connection loss.
+    unsigned long downtime = 0;       ///< Cumulative duration of outages in seconds.
+    unsigned long longest_outage = 0; ///< Longest outage in seconds.
+    unsigned long connect_time = 0;   ///< Duration of the last connect in milliseconds.
+
+    /// Print statistics, including count of failed publish requests.
+    void printTo(Print& out) const;
+  };
+
   /// Persistent configuration.
   KWLPersistentConfig& config_;
   /// NTP client to report online as timestamp.
   MicroNTP& ntp_;
-  /// Last time when LAN started a reconnect attempt.
-  unsigned long last_mqtt_reconnect_attempt_time_ = 0;
   /// Last time when MQTT started a reconnect attempt.
+  unsigned long last_mqtt_reconnect_attempt_time_ = 0;
+  /// Delay between MQTT reconnect attempts (with backoff).
+  unsigned long mqtt_retry_delay_ = 0;
+  /// Current MQTT reconnect backoff interval.
+  unsigned long mqtt_backoff_ = 0;
+  /// Last time when LAN link was checked.
   unsigned long last_lan_reconnect_attempt_time_ = 0;
+  /// Delay between LAN link checks (with backoff).
+  unsigned long lan_retry_delay_ = 0;
+  /// Current LAN check backoff interval.
+  unsigned long lan_backoff_ = 0;
+  /// Time when the last connect attempt started (millis).
+  unsigned long connect_start_ = 0;
+  /// Time when the current outage started (millis).
+  unsigned long outage_start_ = 0;
+  /// Connection quality statistics.
+  ConnectionStats conn_stats_;
+  /// Last time when MQTT client was polled for incoming messages.
+  unsigned long last_mqtt_poll_time_ = 0;
+  /// Count of transport calls in the current poll cost window.
+  unsigned long transport_calls_ = 0;
+  /// Total count of transport calls.
+  unsigned long transport_calls_total_ = 0;
+  /// Start of the current poll cost window (millis).
+  unsigned long poll_cost_start_ = 0;
+  /// Transport calls per second in the last poll cost window.
+  unsigned long calls_per_sec_ = 0;
+  /// Maximum transport calls per second.
+  unsigned long max_calls_per_sec_ = 0;
+  /// Last time when the network was joined explicitly.
+  unsigned long last_lan_join_time_ = 0;
+  /// Last time when incoming metrics connection was checked.
+  unsigned long last_metrics_accept_time_ = 0;
+  /// Time when the current metrics request was accepted.
+  unsigned long metrics_start_ = 0;
+  /// Client of the current metrics request.
+  Client* metrics_client_ = nullptr;
+  /// Next metric to send in the current metrics response.
+  Metric::iterator metrics_pos_ = Metric::end();
+  /// Bytes of the current metric (or header) already sent.
+  unsigned metrics_sent_ = 0;
+  /// Current state of the connection setup.
+  State state_ = State::LinkDown;
+  /// Current state of the metrics responder.
+  MetricsState metrics_state_ = MetricsState::Idle;
+  /// Count of consecutive line ends seen in the metrics request.
+  uint8_t metrics_eol_ = 0;
+  /// Transport server for metrics scrapes or -1, if not listening.
+  int8_t metrics_server_ = -1;
   /// Flag set when LAN is present.
   bool lan_ok_ = false;
+  /// Cached link state, refreshed by link task.
+  bool link_up_ = false;
   /// Flag set when MQTT is present.
   bool mqtt_ok_ = false;
+  /// Flag set while MQTT connection is lost after it was established.
+  bool in_outage_ = false;
   /// Subscribe flag for commands.
   bool subscribed_command_ = false;
   /// Subscribe flag for debug commands.
   bool subscribed_debug_ = false;
   /// Task to publish MQTT heartbeat message.
   PublishTask publish_task_;
-  /// Data received over serial port.
-  char serial_data_[SERIAL_BUFFER_SIZE];
-  /// Size of data received so far.
-  uint8_t serial_data_size_ = 0;
+  /// Task to publish connection quality statistics.
+  PublishTask conn_stats_publish_;
+  /// Task to publish poll cost statistics.
+  PublishTask poll_cost_publish_;
   /// Task timing statistics.
   Scheduler::TaskTimingStats stats_;
   /// Timer tasks handling heartbeat.
   Scheduler::TimedTask<NetworkClient> timer_task_;
+  /// Timer task refreshing cached link state.
+  Scheduler::TimedTask<NetworkClient> link_task_;
   /// Task polling statistics.
   Scheduler::TaskPollingStats poll_stats_;
   /// Poll tasks for maintaining network connection.
   Scheduler::PollTask<NetworkClient> poll_task_;
   /// Poll tasks for sending MQTT messages.
   Scheduler::PollTask<> mqtt_send_poll_task_;
+  /// Metric: MQTT connection state.
+  Metric mqtt_connected_metric_;
+  /// Metric: count of reconnects.
+  Metric reconnects_metric_;
+  /// Metric: cumulative outage time.
+  Metric downtime_metric_;
+  /// Metric: count of failed publish requests.
+  Metric publish_failures_metric_;
+  /// Metric: count of transport calls.
+  Metric transport_calls_metric_;
 };
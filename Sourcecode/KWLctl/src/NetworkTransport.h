@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Interface of network transports used by the network client.
+ */
+#pragma once
+
+#include <Client.h>
+#include <Udp.h>
+#include <IPAddress.h>
+
+// Select network transport by defining one of the following symbols. If none
+// is defined, Ethernet (W5100 shield) is used. Builds for other platforms than
+// AVR (e.g., host builds on Linux) always use the loopback transport.
+
+/// ESP8266 module connected to Serial3 and driven by AT commands.
+#define WIFI_SUPPORT
+/// In-process MQTT broker stand-in, for testing and benchmarking without hardware.
+//#define LOOPBACK_TRANSPORT
+
+#if !defined(__AVR__) && !defined(LOOPBACK_TRANSPORT)
+  #define LOOPBACK_TRANSPORT
+#endif
+#ifdef LOOPBACK_TRANSPORT
+  #undef WIFI_SUPPORT
+#endif
+
+/*!
+ * @brief Interface of network transports used by the network client.
+ *
+ * A transport provides network link management, a TCP client for the MQTT
+ * connection, a TCP client for one-off connections, an UDP endpoint for
+ * NTP and up to MAX_SERVERS servers accepting one incoming connection at a
+ * time each. Opening the MQTT connection may be asynchronous, the network
+ * client checks isConnecting() in subsequent polls.
+ */
+class NetworkTransport
+{
+public:
+  NetworkTransport(const NetworkTransport&) = delete;
+  NetworkTransport& operator=(const NetworkTransport&) = delete;
+
+  /// Maximum count of servers (listening ports).
+  static constexpr uint8_t MAX_SERVERS = 2;
+
+  /// Network settings to join the network with.
+  struct Settings
+  {
+    IPAddress ip;         ///< Local IP address.
+    IPAddress subnet;     ///< Subnet mask.
+    IPAddress gateway;    ///< Gateway.
+    IPAddress dns;        ///< DNS server.
+    const uint8_t* mac;   ///< MAC address (6 bytes), if supported by the transport.
+  };
+
+  /// Initialize the hardware (called once at startup).
+  virtual void begin(Print& initTracer) = 0;
+
+  /*!
+   * @brief Join the network (or start joining it asynchronously).
+   *
+   * @param settings network settings.
+   * @return @c true, if join was started or done, @c false if the transport is not ready.
+   */
+  virtual bool join(const Settings& settings) = 0;
+
+  /// Check whether the transport is still joining the network.
+  virtual bool isJoining() { return false; }
+
+  /*!
+   * @brief Get interval after which to join again, if the link doesn't come up (in microseconds).
+   *
+   * Transports which don't reconnect by themselves return 0 to join on each link check.
+   */
+  virtual unsigned long getRejoinInterval() const { return 0; }
+
+  /// Call in each poll to process transport events.
+  virtual void loop() {}
+
+  /// Check whether network link is present.
+  virtual bool isLinkUp() = 0;
+
+  /// Get local IP address.
+  virtual IPAddress localIP() = 0;
+
+  /*!
+   * @brief Start opening the MQTT connection of getClient().
+   *
+   * The connection may be opened synchronously (bounded by a timeout) or
+   * asynchronously, in which case isConnecting() returns @c true until
+   * the attempt is finished.
+   *
+   * @param ip remote IP address.
+   * @param port remote port.
+   * @return @c true, if the connection is open or being opened.
+   */
+  virtual bool connect(IPAddress ip, uint16_t port) = 0;
+
+  /// Check whether the MQTT connection is being opened.
+  virtual bool isConnecting() { return false; }
+
+  /// Get client for MQTT connection.
+  virtual Client& getClient() = 0;
+
+  /*!
+   * @brief Check whether a packet can be written to getClient() now as a whole.
+   *
+   * Transports with non-blocking writes return @c false while their send
+   * buffer is full, so the packet is retried later instead of being split.
+   *
+   * @param size packet size.
+   */
+  virtual bool canWrite(size_t size) { (void) size; return true; }
+
+  /// Get client for one-off connections (e.g., screenshot).
+  virtual Client& getAuxClient() = 0;
+
+  /// Get UDP endpoint for NTP.
+  virtual UDP& getUDP() = 0;
+
+  /*!
+   * @brief Start a server listening for incoming TCP connections.
+   *
+   * Transports may support less than MAX_SERVERS servers.
+   *
+   * @param port local port.
+   * @return server index to pass to accept() or -1, if no more servers
+   *    can be started.
+   */
+  virtual int8_t listen(uint16_t port) = 0;
+
+  /*!
+   * @brief Accept an incoming connection of a server.
+   *
+   * Each server handles only one incoming connection at a time, the
+   * previously accepted connection of the server is closed.
+   *
+   * @param server server index returned by listen().
+   * @return client for the connection (valid until the next call) or
+   *    @c nullptr, if no new incoming connection.
+   */
+  virtual Client* accept(uint8_t server) = 0;
+
+protected:
+  NetworkTransport() = default;
+  ~NetworkTransport() = default;
+};
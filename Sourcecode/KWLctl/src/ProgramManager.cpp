@@ -23,6 +23,8 @@
 #include "MQTTTopic.hpp"
 #include "StringView.h"
 
+#include <TopicRouter.h>
+
 #include <MicroNTP.h>
 
 /// Check current program every 5s.
@@ -157,174 +159,213 @@ bool ProgramData::matches(HMS hms) const
 
 bool ProgramManager::mqttReceiveMsg(const StringView& topic, const StringView& s)
 {
-  if (topic == MQTTTopic::CmdSetProgramSet) {
-    // set program index
-    auto set = s.toInt();
-    if (set < 0 || set > 7) {
-      if (KWLConfig::serialDebugProgram)
-        Serial.println(F("PROG: Invalid program set index"));
-    } else {
-      config_.setProgramSetIndex(uint8_t(set));
-      run();  // to pick proper program, if any change
-      publishProgramIndex();
-    }
+  static const TopicRoute<ProgramManager> ROUTES[] PROGMEM = {
+    { MQTTTopic::CmdSetProgramSet.data_P(), &ProgramManager::mqttSetProgramSet },
+    { MQTTTopic::CmdProgramGetAll.data_P(), &ProgramManager::mqttGetAllPrograms },
+    { MQTTTopic::CmdProgramGet.data_P(), &ProgramManager::mqttGetProgram },
+    { MQTTTopic::CmdProgramData.data_P(), &ProgramManager::mqttSetProgramData },
+    { MQTTTopic::CmdProgramEnable.data_P(), &ProgramManager::mqttEnableProgram },
+    { MQTTTopic::CmdProgramInvalid.data_P(), &ProgramManager::mqttInvalidProgram },
+  };
+  return routeTopic(*this, ROUTES, topic, s);
+}
+
+bool ProgramManager::checkIndex(unsigned index)
+{
+  if (index < KWLConfig::MaxProgramCount)
     return true;
-  }
-  if (topic.substr(0, MQTTTopic::CmdSetProgram.length()) != MQTTTopic::CmdSetProgram) {
-    // wrong topic
-    return false;
-  }
-  // strip the command and decode index
-  auto command = topic.c_str() + MQTTTopic::CmdSetProgram.length();
-  auto end = strchr(command, '/');
-  if (!end) {
-    // wrong topic
-    return false;
-  }
-  char* parse_end;
-  auto index = unsigned(strtoul(command, &parse_end, 10));
-  bool valid_index = (parse_end == end) && (end != command) && (index < KWLConfig::MaxProgramCount);
-  StringView index_str(command, size_t(end - command));
-  StringView command_str(end + 1);
+  if (KWLConfig::serialDebugProgram)
+    Serial.println(F("PROG: Invalid program index"));
+  reportMalformed();
+  return false;
+}
 
-  if (command_str == MQTTTopic::SubtopicProgramGet) {
-    // get specified program or ALL
-    if (index_str == F("all")) {
-      // send all programs
-      unsigned i = 0;
-      bool all = false;
-      publisher_.publish([this, i, all]() mutable {
-        while (i < KWLConfig::MaxProgramCount) {
-          if (!mqttSendProgram(i, all))
-            return false; // continue next time
-          ++i;
-          all = false;
-        }
-        return true;  // all sent
-      });
-    } else if (valid_index) {
-      publishProgram(index);
-    } else {
-      if (KWLConfig::serialDebugProgram)
-        Serial.println(F("PROG: Invalid program index"));
-    }
+bool ProgramManager::mqttSetProgramSet(const TopicParams&, const StringView& s)
+{
+  // set program index
+  auto set = s.toInt();
+  if (set < 0 || set > 7) {
+    if (KWLConfig::serialDebugProgram)
+      Serial.println(F("PROG: Invalid program set index"));
+    reportMalformed();
+  } else {
+    config_.setProgramSetIndex(uint8_t(set));
+    run();  // to pick proper program, if any change
     publishProgramIndex();
-  } else if (command_str == MQTTTopic::SubtopicProgramData) {
-    // Parse program string "HH:MM HH:MM F wwwwwww pppppppp", where
-    // F is fan mode, wwwwwww are flags for weekdays indicating whether to run
-    // the program on a given weekday (0 or 1) and pppppppp are program sets
-    // in which to consider the program.
-    // Weekday and program sets flags are optional, if not set, run every day
-    // and in every program set.
-    unsigned start_h, start_m, end_h, end_m, mode;
-    char wd_buf[8], ps_buf[9];
-    char FORMAT[] = "%u:%u %u:%u %u %7s %8s";
-    int rc = sscanf(s.c_str(), FORMAT,
-                    &start_h, &start_m, &end_h, &end_m, &mode, wd_buf, ps_buf);
-    if (rc < 5 || !valid_index) {
-      if (KWLConfig::serialDebugProgram) {
-        Serial.print(F("PROG: Invalid program string or program index, parsed items "));
-        Serial.print(rc);
-        Serial.print('/');
-        Serial.println('7');
-      }
-      return true;
-    }
-    ProgramData prog;
-    if (start_h > 23 || start_m > 59) {
-      if (KWLConfig::serialDebugProgram)
-        Serial.println(F("PROG: Invalid start time"));
-      return true;
-    }
-    prog.start_h_ = uint8_t(start_h);
-    prog.start_m_ = uint8_t(start_m);
-    if (end_h > 23 || end_m > 59) {
-      if (KWLConfig::serialDebugProgram)
-        Serial.println(F("PROG: Invalid end time"));
-      return true;
+  }
+  return true;
+}
+
+bool ProgramManager::mqttGetAllPrograms(const TopicParams&, const StringView&)
+{
+  // send all programs
+  unsigned i = 0;
+  bool all = false;
+  publisher_.publish([this, i, all]() mutable {
+    while (i < KWLConfig::MaxProgramCount) {
+      if (!mqttSendProgram(i, all))
+        return false; // continue next time
+      ++i;
+      all = false;
     }
-    prog.end_h_ = uint8_t(end_h);
-    prog.end_m_ = uint8_t(end_m);
-    if (mode >= KWLConfig::StandardModeCnt) {
-      if (KWLConfig::serialDebugProgram)
-        Serial.println(F("PROG: Invalid mode"));
-      return true;
+    return true;  // all sent
+  });
+  publishProgramIndex();
+  return true;
+}
+
+bool ProgramManager::mqttGetProgram(const TopicParams& params, const StringView&)
+{
+  auto index = params.getNumber(0);
+  if (checkIndex(index))
+    publishProgram(index);
+  publishProgramIndex();
+  return true;
+}
+
+bool ProgramManager::mqttSetProgramData(const TopicParams& params, const StringView& s)
+{
+  // Parse program string "HH:MM HH:MM F wwwwwww pppppppp", where
+  // F is fan mode, wwwwwww are flags for weekdays indicating whether to run
+  // the program on a given weekday (0 or 1) and pppppppp are program sets
+  // in which to consider the program.
+  // Weekday and program sets flags are optional, if not set, run every day
+  // and in every program set.
+  auto index = params.getNumber(0);
+  if (!checkIndex(index))
+    return true;
+  unsigned start_h, start_m, end_h, end_m, mode;
+  char wd_buf[8], ps_buf[9];
+  char FORMAT[] = "%u:%u %u:%u %u %7s %8s";
+  int rc = sscanf(s.c_str(), FORMAT,
+                  &start_h, &start_m, &end_h, &end_m, &mode, wd_buf, ps_buf);
+  if (rc < 5) {
+    if (KWLConfig::serialDebugProgram) {
+      Serial.print(F("PROG: Invalid program string, parsed items "));
+      Serial.print(rc);
+      Serial.print('/');
+      Serial.println('7');
     }
-    prog.fan_mode_ = uint8_t(mode);
-    if (rc >= 6) {
-      prog.weekdays_ = 0;
-      const char* p = wd_buf;
-      const char* e = p + 7;
-      for (uint8_t bit = 1; p < e; bit <<= 1, ++p) {
-        switch (*p) {
-        case '0':
-          break;
-        case '1':
-          prog.weekdays_ |= bit;
-          break;
-        default:
-          // invalid string
-          if (KWLConfig::serialDebugProgram)
-            Serial.println(F("PROG: Weekdays must be [01]{7}"));
-          return true;
-        }
+    reportMalformed();
+    return true;
+  }
+  ProgramData prog;
+  if (start_h > 23 || start_m > 59) {
+    if (KWLConfig::serialDebugProgram)
+      Serial.println(F("PROG: Invalid start time"));
+    reportMalformed();
+    return true;
+  }
+  prog.start_h_ = uint8_t(start_h);
+  prog.start_m_ = uint8_t(start_m);
+  if (end_h > 23 || end_m > 59) {
+    if (KWLConfig::serialDebugProgram)
+      Serial.println(F("PROG: Invalid end time"));
+    reportMalformed();
+    return true;
+  }
+  prog.end_h_ = uint8_t(end_h);
+  prog.end_m_ = uint8_t(end_m);
+  if (mode >= KWLConfig::StandardModeCnt) {
+    if (KWLConfig::serialDebugProgram)
+      Serial.println(F("PROG: Invalid mode"));
+    reportMalformed();
+    return true;
+  }
+  prog.fan_mode_ = uint8_t(mode);
+  if (rc >= 6) {
+    prog.weekdays_ = 0;
+    const char* p = wd_buf;
+    const char* e = p + 7;
+    for (uint8_t bit = 1; p < e; bit <<= 1, ++p) {
+      switch (*p) {
+      case '0':
+        break;
+      case '1':
+        prog.weekdays_ |= bit;
+        break;
+      default:
+        // invalid string
+        if (KWLConfig::serialDebugProgram)
+          Serial.println(F("PROG: Weekdays must be [01]{7}"));
+        reportMalformed();
+        return true;
       }
-    } else {
-      // all weekdays
-      prog.weekdays_ = 0x7f;
     }
-    if (rc >= 7) {
-      prog.enabled_progsets_ = 0;
-      const char* p = ps_buf;
-      const char* e = p + 8;
-      for (uint8_t bit = 1; p < e; bit <<= 1, ++p) {
-        switch (*p) {
-        case '0':
-          break;
-        case '1':
-          prog.enabled_progsets_ |= bit;
-          break;
-        default:
-          // invalid string
-          if (KWLConfig::serialDebugProgram)
-            Serial.println(F("PROG: Program set mask must be [01]{8}"));
-          return true;
-        }
+  } else {
+    // all weekdays
+    prog.weekdays_ = 0x7f;
+  }
+  if (rc >= 7) {
+    prog.enabled_progsets_ = 0;
+    const char* p = ps_buf;
+    const char* e = p + 8;
+    for (uint8_t bit = 1; p < e; bit <<= 1, ++p) {
+      switch (*p) {
+      case '0':
+        break;
+      case '1':
+        prog.enabled_progsets_ |= bit;
+        break;
+      default:
+        // invalid string
+        if (KWLConfig::serialDebugProgram)
+          Serial.println(F("PROG: Program set mask must be [01]{8}"));
+        reportMalformed();
+        return true;
       }
-    } else {
-      // all program sets
-      prog.enabled_progsets_ = 0xff;
     }
-    prog.reserved_ = 0;
-    setProgram(index, prog);
-  } else if (command_str == MQTTTopic::SubtopicProgramEnable) {
-    // enable or disable a program
-    if (valid_index) {
-      const char* p = s.c_str();
-      const char* e = p + 8;
-      uint8_t progset = 0;
-      for (uint8_t bit = 1; p < e; bit <<= 1, ++p) {
-        switch (*p) {
-        case '0':
-          break;
-        case '1':
-          progset |= bit;
-          break;
-        default:
-          // invalid string
-          if (KWLConfig::serialDebugProgram)
-            Serial.println(F("PROG: Program set mask must be [01]{8}"));
-          return true;
-        }
-      }
-      enableProgram(index, progset);
-    } else {
+  } else {
+    // all program sets
+    prog.enabled_progsets_ = 0xff;
+  }
+  prog.reserved_ = 0;
+  setProgram(index, prog);
+  return true;
+}
+
+bool ProgramManager::mqttEnableProgram(const TopicParams& params, const StringView& s)
+{
+  // enable or disable a program
+  auto index = params.getNumber(0);
+  if (!checkIndex(index))
+    return true;
+  const char* p = s.c_str();
+  const char* e = p + 8;
+  uint8_t progset = 0;
+  for (uint8_t bit = 1; p < e; bit <<= 1, ++p) {
+    switch (*p) {
+    case '0':
+      break;
+    case '1':
+      progset |= bit;
+      break;
+    default:
+      // invalid string
       if (KWLConfig::serialDebugProgram)
-        Serial.println(F("PROG: Invalid program index"));
+        Serial.println(F("PROG: Program set mask must be [01]{8}"));
+      reportMalformed();
+      return true;
     }
-  } else {
-    return false;
   }
+  enableProgram(index, progset);
+  return true;
+}
+
+bool ProgramManager::mqttInvalidProgram(const TopicParams& params, const StringView&)
+{
+  // non-numeric index or unknown command
+  auto command = params.getString(1);
+  if (command == MQTTTopic::SubtopicProgramGet) {
+    // same reply as for a numeric index out of range, see mqttGetProgram()
+    checkIndex(KWLConfig::MaxProgramCount);
+    publishProgramIndex();
+    return true;
+  }
+  if (command != MQTTTopic::SubtopicProgramData &&
+      command != MQTTTopic::SubtopicProgramEnable)
+    return false;
+  checkIndex(KWLConfig::MaxProgramCount);
   return true;
 }
 
@@ -357,8 +398,11 @@ bool ProgramManager::mqttSendProgram(unsigned index, bool& all)
     return true;
   auto& prog = config_.getProgram(index);
 
+  // "program/NN/" + longer subtopic + NUL
   static constexpr size_t len = MQTTTopic::KwlProgramData.length();
-  char topic[len + 8];
+  static constexpr size_t sublen = MQTTTopic::SubtopicProgramData.length() > MQTTTopic::SubtopicProgramEnable.length() ?
+        MQTTTopic::SubtopicProgramData.length() : MQTTTopic::SubtopicProgramEnable.length();
+  char topic[len + 3 + sublen + 1];
   MQTTTopic::KwlProgramData.store(topic);
   char* pt = topic + len;
   *pt++ = char(index / 10) + '0';
@@ -368,31 +412,32 @@ bool ProgramManager::mqttSendProgram(unsigned index, bool& all)
   if (all) {
     MQTTTopic::SubtopicProgramEnable.store(pt);
     // Send enabled flags only
-    char buf[9];
-    char* p = buf;
-    for (uint8_t bit = 1; bit != 0; bit <<= 1)
-      *p++ = (prog.enabled_progsets_ & bit) ? '1' : '0';
-    *p = 0;
-    return publish(topic, buf, KWLConfig::RetainProgram);
+    return publishStream(topic, [&prog](Print& out) {
+      printBits(out, prog.enabled_progsets_, 8);
+    }, KWLConfig::RetainProgram);
   } else {
     MQTTTopic::SubtopicProgramData.store(pt);
-    // Build program string "HH:MM HH:MM M wwwwwww pppppppp"
-    char buffer[32];
-    HMS(prog.start_h_, prog.start_m_).writeHM(buffer);
-    buffer[5] = ' ';
-    HMS(prog.end_h_, prog.end_m_).writeHM(buffer + 6);
-    buffer[11] = ' ';
-    buffer[12] = char(prog.fan_mode_ + '0');
-    buffer[13] = ' ';
-    char* p = buffer + 14;
-    for (uint8_t bit = 1; bit < 0x80; bit <<= 1)
-      *p++ = (prog.weekdays_ & bit) ? '1' : '0';
-    *p++ = ' ';
-    for (uint8_t bit = 1; bit != 0; bit <<= 1)
-      *p++ = (prog.enabled_progsets_ & bit) ? '1' : '0';
-    *p = 0;
-
-    all = publish(topic, buffer, KWLConfig::RetainProgram);
+    // Program string "HH:MM HH:MM M wwwwwww pppppppp" is written directly to the network
+    all = publishStream(topic, [&prog](Print& out) {
+      char hm[5];
+      HMS(prog.start_h_, prog.start_m_).writeHM(hm);
+      out.write(hm, sizeof(hm));
+      out.write(' ');
+      HMS(prog.end_h_, prog.end_m_).writeHM(hm);
+      out.write(hm, sizeof(hm));
+      out.write(' ');
+      out.write(char(prog.fan_mode_ + '0'));
+      out.write(' ');
+      printBits(out, prog.weekdays_, 7);
+      out.write(' ');
+      printBits(out, prog.enabled_progsets_, 8);
+    }, KWLConfig::RetainProgram);
     return false; // we need to send enable flag
   }
 }
+
+void ProgramManager::printBits(Print& out, uint8_t bits, uint8_t count)
+{
+  for (uint8_t bit = 1; count; bit = uint8_t(bit << 1), --count)
+    out.write((bits & bit) ? '1' : '0');
+}
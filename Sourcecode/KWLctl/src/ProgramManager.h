@@ -28,6 +28,7 @@
 #include "ProgramData.h"
 
 class KWLPersistentConfig;
+class TopicParams;
 class FanControl;
 class MicroNTP;
 
@@ -65,6 +66,27 @@ private:
 
   virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override;
 
+  /// Check program index from a topic, print error if invalid.
+  static bool checkIndex(unsigned index);
+
+  /// Handle setting program set index.
+  bool mqttSetProgramSet(const TopicParams& params, const StringView& s);
+
+  /// Handle request to send all programs.
+  bool mqttGetAllPrograms(const TopicParams& params, const StringView& s);
+
+  /// Handle request to send one program.
+  bool mqttGetProgram(const TopicParams& params, const StringView& s);
+
+  /// Handle setting program data.
+  bool mqttSetProgramData(const TopicParams& params, const StringView& s);
+
+  /// Handle enabling/disabling a program.
+  bool mqttEnableProgram(const TopicParams& params, const StringView& s);
+
+  /// Handle program command with an invalid index.
+  bool mqttInvalidProgram(const TopicParams& params, const StringView& s);
+
   /// Publish program data via MQTT.
   void publishProgram(unsigned index);
 
@@ -74,6 +96,9 @@ private:
   /// Send program data via MQTT.
   bool mqttSendProgram(unsigned index, bool& all);
 
+  /// Print lowest bits of a bitmask as '0'/'1' characters, starting with the lowest bit.
+  static void printBits(Print& out, uint8_t bits, uint8_t count);
+
   KWLPersistentConfig& config_;     ///< Persistent configuration.
   FanControl& fan_;                 ///< Fan control to set mode.
   const MicroNTP& ntp_;             ///< Time service.
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "Reporting.h"
+#include "AdditionalSensors.h"
+#include "KWLConfig.h"
+#include "MQTTTopic.hpp"
+#include "StringView.h"
+
+#include <TopicRouter.h>
+
+namespace
+{
+  /// Role of a parameter in a pair of minimum and maximum interval.
+  enum class Pair : uint8_t
+  {
+    None,   ///< Not part of a pair.
+    Min,    ///< Minimum interval, maximum interval follows.
+    Max     ///< Maximum interval, minimum interval precedes.
+  };
+
+  /// Description of one reporting parameter.
+  struct ReportingParamInfo
+  {
+    const char* name;   ///< Parameter name in Flash (MQTT subtopic).
+    uint16_t min;       ///< Minimum allowed value.
+    uint16_t max;       ///< Maximum allowed value.
+    Pair pair;          ///< Role in pair of minimum and maximum interval.
+  };
+
+  /// Maximum reporting interval.
+  static constexpr uint16_t MAX_INTERVAL = REPORTING_MAX_INTERVAL;
+  /// Maximum slowdown of measurement reporting while summaries are active.
+  static constexpr uint16_t MAX_SLOWDOWN = 60;
+  /// Maximum deadband.
+  static constexpr uint16_t MAX_DIFF = 10000;
+
+  const char NAME_TEMP_MIN_INTERVAL[] PROGMEM   = "TempMinInterval";
+  const char NAME_TEMP_MAX_INTERVAL[] PROGMEM   = "TempMaxInterval";
+  const char NAME_TEMP_MIN_DIFF[] PROGMEM       = "TempMinDiff";
+  const char NAME_DHT_MIN_INTERVAL[] PROGMEM    = "DHTMinInterval";
+  const char NAME_DHT_MAX_INTERVAL[] PROGMEM    = "DHTMaxInterval";
+  const char NAME_DHT_MIN_DIFF_TEMP[] PROGMEM   = "DHTMinDiffTemp";
+  const char NAME_DHT_MIN_DIFF_HUM[] PROGMEM    = "DHTMinDiffHum";
+  const char NAME_CO2_MIN_INTERVAL[] PROGMEM    = "CO2MinInterval";
+  const char NAME_CO2_MAX_INTERVAL[] PROGMEM    = "CO2MaxInterval";
+  const char NAME_CO2_MIN_DIFF[] PROGMEM        = "CO2MinDiff";
+  const char NAME_VOC_MIN_INTERVAL[] PROGMEM    = "VOCMinInterval";
+  const char NAME_VOC_MAX_INTERVAL[] PROGMEM    = "VOCMaxInterval";
+  const char NAME_VOC_MIN_DIFF[] PROGMEM        = "VOCMinDiff";
+  const char NAME_FAN_MIN_INTERVAL[] PROGMEM    = "FanMinInterval";
+  const char NAME_FAN_MAX_INTERVAL[] PROGMEM    = "FanMaxInterval";
+  const char NAME_FAN_MIN_DIFF[] PROGMEM        = "FanMinDiff";
+  const char NAME_FAN_MODE_INTERVAL[] PROGMEM   = "FanModeInterval";
+  const char NAME_BYPASS_INTERVAL[] PROGMEM     = "BypassInterval";
+  const char NAME_SUMMARY_WINDOW[] PROGMEM      = "SummaryWindow";
+  const char NAME_RAW_SLOWDOWN[] PROGMEM        = "RawSlowdown";
+
+  /// Parameter descriptions, in order of ReportingParam.
+  const ReportingParamInfo PARAMS[] PROGMEM = {
+    { NAME_TEMP_MIN_INTERVAL, 1, MAX_INTERVAL, Pair::Min },
+    { NAME_TEMP_MAX_INTERVAL, 1, MAX_INTERVAL, Pair::Max },
+    { NAME_TEMP_MIN_DIFF, 0, MAX_DIFF, Pair::None },
+    { NAME_DHT_MIN_INTERVAL, 1, MAX_INTERVAL, Pair::Min },
+    { NAME_DHT_MAX_INTERVAL, 1, MAX_INTERVAL, Pair::Max },
+    { NAME_DHT_MIN_DIFF_TEMP, 0, MAX_DIFF, Pair::None },
+    { NAME_DHT_MIN_DIFF_HUM, 0, 100, Pair::None },
+    { NAME_CO2_MIN_INTERVAL, 1, MAX_INTERVAL, Pair::Min },
+    { NAME_CO2_MAX_INTERVAL, 1, MAX_INTERVAL, Pair::Max },
+    { NAME_CO2_MIN_DIFF, 0, MAX_DIFF, Pair::None },
+    { NAME_VOC_MIN_INTERVAL, 1, MAX_INTERVAL, Pair::Min },
+    { NAME_VOC_MAX_INTERVAL, 1, MAX_INTERVAL, Pair::Max },
+    { NAME_VOC_MIN_DIFF, 0, MAX_DIFF, Pair::None },
+    { NAME_FAN_MIN_INTERVAL, 1, MAX_INTERVAL, Pair::Min },
+    { NAME_FAN_MAX_INTERVAL, 1, MAX_INTERVAL, Pair::Max },
+    { NAME_FAN_MIN_DIFF, 0, MAX_DIFF, Pair::None },
+    { NAME_FAN_MODE_INTERVAL, 1, MAX_INTERVAL, Pair::None },
+    { NAME_BYPASS_INTERVAL, 1, MAX_INTERVAL, Pair::None },
+    { NAME_SUMMARY_WINDOW, 0, MAX_INTERVAL, Pair::None },
+    { NAME_RAW_SLOWDOWN, 1, MAX_SLOWDOWN, Pair::None },
+  };
+
+  static_assert(sizeof(PARAMS) / sizeof(PARAMS[0]) == unsigned(ReportingParam::Count), "Reporting parameter description missing");
+
+  /// Get description of a parameter.
+  ReportingParamInfo getInfo(uint8_t index)
+  {
+    ReportingParamInfo info;
+    memcpy_P(&info, &PARAMS[index], sizeof(info));
+    return info;
+  }
+}
+
+Reporting::Reporting(KWLPersistentConfig& config, AdditionalSensors& sensors) :
+  MessageHandler(F("Reporting")),
+  config_(config),
+  sensors_(sensors)
+{}
+
+bool Reporting::mqttReceiveMsg(const StringView& topic, const StringView& s)
+{
+  static const TopicRoute<Reporting> ROUTES[] PROGMEM = {
+    { MQTTTopic::CmdReportingGet.data_P(), &Reporting::mqttGetAll },
+    { MQTTTopic::CmdReporting.data_P(), &Reporting::mqttSetParam },
+  };
+  return routeTopic(*this, ROUTES, topic, s);
+}
+
+bool Reporting::mqttGetAll(const TopicParams&, const StringView&)
+{
+  publishParams(0, uint8_t(ReportingParam::Count));
+  return true;
+}
+
+bool Reporting::mqttSetParam(const TopicParams& params, const StringView& s)
+{
+  auto name = params.getString(0);
+  for (uint8_t i = 0; i < uint8_t(ReportingParam::Count); ++i) {
+    auto info = getInfo(i);
+    if (name != reinterpret_cast<const __FlashStringHelper*>(info.name))
+      continue;
+    auto value = s.toInt();
+    // minimum interval must not exceed maximum interval
+    bool ordered = true;
+    if (info.pair == Pair::Min)
+      ordered = value <= long(config_.getReporting(ReportingParam(i + 1)));
+    else if (info.pair == Pair::Max)
+      ordered = value >= long(config_.getReporting(ReportingParam(i - 1)));
+    if (value < info.min || value > info.max || !ordered) {
+      if (KWLConfig::serialDebug) {
+        Serial.print(F("Invalid value for reporting parameter "));
+        Serial.println(reinterpret_cast<const __FlashStringHelper*>(info.name));
+      }
+      reportMalformed();
+    } else if (!isValidating()) {
+      config_.setReporting(ReportingParam(i), uint16_t(value));
+      sensors_.reschedule();
+    }
+    if (!isValidating())
+      publishParams(i, i + 1);
+    return true;
+  }
+  // unknown parameter, let it count as unhandled message
+  if (KWLConfig::serialDebug) {
+    Serial.print(F("Unknown reporting parameter "));
+    Serial.write(name.c_str(), name.length());
+    Serial.println();
+  }
+  return false;
+}
+
+void Reporting::publishParams(uint8_t index, uint8_t end)
+{
+  publisher_.publish([this, index, end]() mutable {
+    while (index < end) {
+      static constexpr size_t len = MQTTTopic::KwlReporting.length();
+      char topic[len + 20];
+      MQTTTopic::KwlReporting.store(topic);
+      strlcpy_P(topic + len, getInfo(index).name, sizeof(topic) - len);
+      if (!publish(topic, unsigned(config_.getReporting(ReportingParam(index)))))
+        return false; // retry later
+      ++index;
+    }
+    return true;
+  });
+}
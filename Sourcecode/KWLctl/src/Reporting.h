@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Runtime-tunable reporting intervals and deadbands.
+ */
+#pragma once
+
+#include "MessageHandler.h"
+#include "ReportingParam.h"
+
+class AdditionalSensors;
+class KWLPersistentConfig;
+class TopicParams;
+
+/*!
+ * @brief Runtime-tunable reporting intervals and deadbands.
+ *
+ * Handles MQTT commands to read and change reporting parameters, which are
+ * stored in persistent configuration. Modules sending measurements read
+ * parameters from the configuration upon each decision to send. Send tasks
+ * of additional sensors are rescheduled immediately upon change.
+ */
+class Reporting : private MessageHandler
+{
+public:
+  Reporting(const Reporting&) = delete;
+  Reporting& operator=(const Reporting&) = delete;
+
+  Reporting(KWLPersistentConfig& config, AdditionalSensors& sensors);
+
+private:
+  virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override;
+
+  /// Handle request to send all parameters.
+  bool mqttGetAll(const TopicParams& params, const StringView& s);
+
+  /// Handle setting a parameter.
+  bool mqttSetParam(const TopicParams& params, const StringView& s);
+
+  /// Publish all parameters starting at given index.
+  void publishParams(uint8_t index, uint8_t end);
+
+  KWLPersistentConfig& config_; ///< Persistent configuration.
+  AdditionalSensors& sensors_;  ///< Additional sensors to reschedule upon change.
+  PublishTask publisher_;       ///< Task to publish parameters.
+};
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Runtime-tunable reporting parameters.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/// Maximum reporting interval (1 hour), also limited by scheduler time range.
+static constexpr uint16_t REPORTING_MAX_INTERVAL = 3600;
+
+/*!
+ * @brief Reporting parameters stored in persistent configuration.
+ *
+ * Intervals are in seconds, deadbands (minimum change to report a value
+ * earlier than at maximum interval) in units noted below. Defaults are
+ * taken from KWLConfig.
+ *
+ * NOTE: this is PERSISTENT layout, only append new parameters.
+ */
+enum class ReportingParam : uint8_t
+{
+  TempMinInterval,    ///< Minimum interval for temperatures.
+  TempMaxInterval,    ///< Maximum interval for temperatures.
+  TempMinDiff,        ///< Deadband for temperatures (in 0.01 ºC).
+  DHTMinInterval,     ///< Minimum interval for DHT sensors.
+  DHTMaxInterval,     ///< Maximum interval for DHT sensors.
+  DHTMinDiffTemp,     ///< Deadband for DHT temperatures (in 0.01 ºC).
+  DHTMinDiffHum,      ///< Deadband for DHT humidity (in %).
+  CO2MinInterval,     ///< Minimum interval for CO2 sensor.
+  CO2MaxInterval,     ///< Maximum interval for CO2 sensor.
+  CO2MinDiff,         ///< Deadband for CO2 sensor (in ppm).
+  VOCMinInterval,     ///< Minimum interval for VOC sensor.
+  VOCMaxInterval,     ///< Maximum interval for VOC sensor.
+  VOCMinDiff,         ///< Deadband for VOC sensor (in ppm).
+  FanMinInterval,     ///< Minimum interval for fan speeds.
+  FanMaxInterval,     ///< Maximum interval for fan speeds.
+  FanMinDiff,         ///< Deadband for fan speeds (in rpm).
+  FanModeInterval,    ///< Interval for ventilation mode.
+  BypassInterval,     ///< Interval for summer bypass state.
+  SummaryWindow,      ///< Window for summaries of measurements (0 = no summaries).
+  RawSlowdown,        ///< Factor for measurement intervals while summaries are active.
+  Count               ///< Count of parameters (not a parameter).
+};
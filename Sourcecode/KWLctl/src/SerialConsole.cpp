@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+#include "SerialConsole.h"
+#include "KWLConfig.h"
+#include "MessageHandler.h"
+
+#include <util/crc16.h>
+#include <avr/wdt.h>
+
+/// Start of a binary frame.
+static constexpr uint8_t STX = 0x02;
+
+/// Maximum time to receive a binary frame (ms).
+static constexpr unsigned long FRAME_TIMEOUT = 2000;
+
+/// Command to get configuration version and size.
+static constexpr uint8_t CMD_INFO = 'I';
+/// Command to read configuration image.
+static constexpr uint8_t CMD_READ = 'R';
+/// Command to write configuration image.
+static constexpr uint8_t CMD_WRITE = 'W';
+/// Response reporting an error.
+static constexpr uint8_t CMD_ERROR = 'E';
+
+SerialConsole::SerialConsole(KWLPersistentConfig& config) :
+  config_(config),
+  stats_(F("SerialConsole")),
+  poll_task_(stats_, &SerialConsole::loop, *this)
+{}
+
+void SerialConsole::loop()
+{
+  while (Serial.available()) {
+    auto c = char(Serial.read());
+    if (c == char(STX) && !line_size_) {
+      handleFrame();
+      return;
+    }
+    if (c == 10 || c == 13) {
+      if (line_size_) {
+        dispatchLine();
+        line_size_ = 0;
+        return; // next command in the next poll
+      }
+    } else if (line_size_ < LINE_BUFFER_SIZE - 1) {
+      line_[line_size_++] = c;
+    }
+  }
+}
+
+void SerialConsole::dispatchLine()
+{
+  // process command in form <topic> <value>
+  line_[line_size_] = 0;
+  auto delim = strchr(line_, ' ');
+  if (!delim) {
+    static constexpr auto NO_VALUE = makeFlashStringLiteral("<no value>");
+    auto value = NO_VALUE.load();  // keep the copy alive until the message is handled
+    char* p = value;
+    MessageHandler::mqttMessageReceived(
+          line_,
+          reinterpret_cast<uint8_t*>(p),
+          NO_VALUE.length());
+  } else {
+    *delim++ = 0;
+    while (*delim == ' ' || *delim == '\t')
+      ++delim;
+    MessageHandler::mqttMessageReceived(
+          line_,
+          reinterpret_cast<uint8_t*>(delim),
+          unsigned(line_size_ - (delim - line_)));
+  }
+}
+
+void SerialConsole::handleFrame()
+{
+  auto start = millis();
+  uint8_t header[3];
+  uint16_t crc = 0xffff;
+  for (auto& b : header) {
+    auto c = readByte(start);
+    if (c < 0) {
+      sendError(ErrorCode::Timeout);
+      return;
+    }
+    b = uint8_t(c);
+    crc = _crc16_update(crc, b);
+  }
+  auto cmd = header[0];
+  uint16_t len = uint16_t(header[1] | (header[2] << 8));
+
+  // configuration image is received directly into the configuration in memory,
+  // EEPROM still contains the old one, so it can be reloaded if invalid
+  auto image = reinterpret_cast<uint8_t*>(&config_);
+  bool store = cmd == CMD_WRITE && len == sizeof(KWLPersistentConfig);
+  auto version = config_.getVersion();
+  for (uint16_t i = 0; i < len; ++i) {
+    auto c = readByte(start);
+    if (c < 0) {
+      if (store)
+        config_.reload();
+      sendError(ErrorCode::Timeout);
+      return;
+    }
+    crc = _crc16_update(crc, uint8_t(c));
+    if (store)
+      image[i] = uint8_t(c);
+  }
+  auto crc_lo = readByte(start);
+  auto crc_hi = readByte(start);
+  if (crc_lo < 0 || crc_hi < 0) {
+    if (store)
+      config_.reload();
+    sendError(ErrorCode::Timeout);
+    return;
+  }
+  if (uint16_t(crc_lo | (crc_hi << 8)) != crc) {
+    if (store)
+      config_.reload();
+    sendError(ErrorCode::Checksum);
+    return;
+  }
+
+  switch (cmd) {
+    case CMD_INFO:
+      if (len) {
+        sendError(ErrorCode::Length);
+      } else {
+        uint16_t size = sizeof(KWLPersistentConfig);
+        uint8_t info[4] = { uint8_t(version), uint8_t(version >> 8), uint8_t(size), uint8_t(size >> 8) };
+        sendFrame(CMD_INFO, info, sizeof(info));
+      }
+      break;
+
+    case CMD_READ:
+      if (len)
+        sendError(ErrorCode::Length);
+      else
+        sendFrame(CMD_READ, image, sizeof(KWLPersistentConfig));
+      break;
+
+    case CMD_WRITE:
+      if (!store) {
+        sendError(ErrorCode::Length);
+      } else if (config_.getVersion() != version) {
+        config_.reload();
+        sendError(ErrorCode::Version);
+      } else {
+        config_.updateAll();
+        sendFrame(CMD_WRITE, nullptr, 0);
+        // restart to apply new configuration in all modules
+        Serial.flush();
+        delay(100);
+#ifdef __AVR__
+        // host builds (tests) continue with the new configuration in memory
+        wdt_disable();
+        asm volatile ("jmp 0");
+#endif
+      }
+      break;
+
+    default:
+      sendError(ErrorCode::Command);
+      break;
+  }
+}
+
+int SerialConsole::readByte(unsigned long start)
+{
+  while (!Serial.available()) {
+    if (millis() - start >= FRAME_TIMEOUT)
+      return -1;
+  }
+  return Serial.read();
+}
+
+void SerialConsole::sendFrame(uint8_t cmd, const uint8_t* payload, uint16_t len)
+{
+  uint8_t header[4] = { STX, cmd, uint8_t(len), uint8_t(len >> 8) };
+  uint16_t crc = 0xffff;
+  for (uint8_t i = 1; i < sizeof(header); ++i)
+    crc = _crc16_update(crc, header[i]);
+  for (uint16_t i = 0; i < len; ++i)
+    crc = _crc16_update(crc, payload[i]);
+  Serial.write(header, sizeof(header));
+  if (len)
+    Serial.write(payload, len);
+  Serial.write(uint8_t(crc));
+  Serial.write(uint8_t(crc >> 8));
+}
+
+void SerialConsole::sendError(ErrorCode code)
+{
+  uint8_t payload = uint8_t(code);
+  sendFrame(CMD_ERROR, &payload, 1);
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Console for commands and provisioning over serial port.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include "TimeScheduler.h"
+
+class KWLPersistentConfig;
+
+/*!
+ * @brief Console for commands and provisioning over serial port.
+ *
+ * All bytes available on the serial port are read on each poll and assembled
+ * into lines. A complete line in form <tt>&lt;topic&gt; &lt;value&gt;</tt>
+ * is dispatched like an MQTT command (at most one line per poll).
+ *
+ * A byte STX (0x02) at the start of a line switches to binary mode for one
+ * frame, which is read at once (bounded by a timeout). A frame consists of:
+ *  - STX,
+ *  - command byte,
+ *  - payload length (16 bits, little endian),
+ *  - payload,
+ *  - CRC-16/MODBUS of command, length and payload (16 bits, little endian).
+ *
+ * Responses use the same format. Supported commands:
+ *  - @c 'I' - get info, response payload contains configuration version and
+ *    size (16 bits each, little endian),
+ *  - @c 'R' - read configuration, response payload contains raw image of
+ *    KWLPersistentConfig (including program table),
+ *  - @c 'W' - write configuration, request payload contains raw image of
+ *    KWLPersistentConfig, which must have the same version and size;
+ *    after storing it in EEPROM, an empty response is sent and the
+ *    controller restarts.
+ *
+ * Errors are reported by a response with command @c 'E' and one byte of
+ * error code (see ErrorCode).
+ */
+class SerialConsole
+{
+public:
+  SerialConsole(const SerialConsole&) = delete;
+  SerialConsole& operator=(const SerialConsole&) = delete;
+
+  explicit SerialConsole(KWLPersistentConfig& config);
+
+  /// Error codes reported in binary mode.
+  enum class ErrorCode : uint8_t
+  {
+    Checksum = 1, ///< CRC mismatch.
+    Length = 2,   ///< Invalid payload length for the command.
+    Version = 3,  ///< Configuration version doesn't match.
+    Command = 4,  ///< Unknown command.
+    Timeout = 5   ///< Frame not received completely in time.
+  };
+
+private:
+  /// Maximum size of a command line.
+  static constexpr uint8_t LINE_BUFFER_SIZE = 128;
+
+  /// Read available bytes from the serial port.
+  void loop();
+
+  /// Dispatch assembled command line.
+  void dispatchLine();
+
+  /// Receive and handle a binary frame (STX already read).
+  void handleFrame();
+
+  /*!
+   * @brief Read one byte of a frame.
+   *
+   * @param start time when the frame started (millis).
+   * @return byte read or -1 on timeout.
+   */
+  static int readByte(unsigned long start);
+
+  /// Send a frame with given command and payload.
+  static void sendFrame(uint8_t cmd, const uint8_t* payload, uint16_t len);
+
+  /// Send an error frame.
+  static void sendError(ErrorCode code);
+
+  /// Persistent configuration.
+  KWLPersistentConfig& config_;
+  /// Data of the current line.
+  char line_[LINE_BUFFER_SIZE];
+  /// Size of the current line.
+  uint8_t line_size_ = 0;
+  /// Task polling statistics.
+  Scheduler::TaskPollingStats stats_;
+  /// Poll task reading the serial port.
+  Scheduler::PollTask<SerialConsole> poll_task_;
+};
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+#include "Summary.h"
+#include "KWLConfig.h"
+#include "MQTTTopic.hpp"
+#include "TempSensors.h"
+#include "FanControl.h"
+#include "AdditionalSensors.h"
+
+namespace
+{
+  /// Interval between two samples (10s).
+  static constexpr unsigned long SAMPLE_INTERVAL = 10000000;
+  /// Interval between two samples in seconds.
+  static constexpr uint16_t SAMPLE_INTERVAL_S = uint16_t(SAMPLE_INTERVAL / 1000000);
+
+  /// Description of one summarized measurement.
+  struct MetricInfo
+  {
+    const char* topic;  ///< Topic of the measurement in Flash (MQTT subtopic of the summary).
+    uint8_t decimals;   ///< Count of decimals of the integer form.
+  };
+
+  /// Measurement descriptions, in order of sampling in Summary::sample().
+  const MetricInfo METRICS[] PROGMEM = {
+    { MQTTTopic::KwlTemperaturAussenluft.data_P(), 2 },
+    { MQTTTopic::KwlTemperaturZuluft.data_P(), 2 },
+    { MQTTTopic::KwlTemperaturAbluft.data_P(), 2 },
+    { MQTTTopic::KwlTemperaturFortluft.data_P(), 2 },
+    { MQTTTopic::KwlEffiency.data_P(), 0 },
+    { MQTTTopic::Fan1Speed.data_P(), 0 },
+    { MQTTTopic::Fan2Speed.data_P(), 0 },
+    { MQTTTopic::KwlDHT1Temperatur.data_P(), 1 },
+    { MQTTTopic::KwlDHT1Humidity.data_P(), 1 },
+    { MQTTTopic::KwlDHT2Temperatur.data_P(), 1 },
+    { MQTTTopic::KwlDHT2Humidity.data_P(), 1 },
+    { MQTTTopic::KwlCO2Abluft.data_P(), 0 },
+    { MQTTTopic::KwlVOCAbluft.data_P(), 0 },
+  };
+
+  /// Get description of a measurement.
+  MetricInfo getInfo(uint8_t index)
+  {
+    MetricInfo info;
+    memcpy_P(&info, &METRICS[index], sizeof(info));
+    return info;
+  }
+
+  /// Convert a measurement to integer form with given scale.
+  int16_t toFixed(double value, int scale)
+  {
+    return int16_t(lround(value * scale));
+  }
+
+  /// Print value in integer form with given count of decimals.
+  void printFixed(Print& out, long value, uint8_t decimals)
+  {
+    if (!decimals) {
+      out.print(value);
+      return;
+    }
+    if (value < 0) {
+      out.print('-');
+      value = -value;
+    }
+    long scale = 1;
+    for (uint8_t i = 0; i < decimals; ++i)
+      scale *= 10;
+    out.print(value / scale);
+    out.print('.');
+    auto frac = value % scale;
+    for (scale /= 10; scale > 1 && frac < scale; scale /= 10)
+      out.print('0');
+    out.print(frac);
+  }
+}
+
+void Summary::Accumulator::add(int16_t value) noexcept
+{
+  if (!count) {
+    min = max = value;
+    sum = value;
+  } else {
+    if (value < min)
+      min = value;
+    if (value > max)
+      max = value;
+    sum += value;
+  }
+  ++count;
+}
+
+void Summary::Accumulator::printTo(Print& out, uint8_t decimals) const
+{
+  // average rounded half away from zero
+  long avg = (sum >= 0 ? sum + count / 2 : sum - long(count / 2)) / long(count);
+  out.print(F("min "));
+  printFixed(out, min, decimals);
+  out.print(F(" max "));
+  printFixed(out, max, decimals);
+  out.print(F(" avg "));
+  printFixed(out, avg, decimals);
+  out.print(F(" cnt "));
+  out.print(count);
+}
+
+Summary::Summary(const KWLPersistentConfig& config, const TempSensors& temp, FanControl& fans, const AdditionalSensors& sensors) :
+  config_(config),
+  temp_(temp),
+  fans_(fans),
+  sensors_(sensors),
+  acc_(),
+  stats_(F("Summary")),
+  timer_task_(stats_, &Summary::run, *this)
+{
+  static_assert(sizeof(METRICS) / sizeof(METRICS[0]) == METRIC_COUNT, "Measurement description missing");
+}
+
+void Summary::begin()
+{
+  timer_task_.runRepeated(SAMPLE_INTERVAL);
+}
+
+void Summary::run()
+{
+  auto window = config_.getReporting(ReportingParam::SummaryWindow);
+  if (!window) {
+    active_ = false;
+    return;
+  }
+  if (!active_) {
+    // first window is shortened by per-device phase to not publish in lockstep with other devices
+    active_ = true;
+    elapsed_ = uint16_t(config_.getPhaseOffset(window));
+    for (auto& acc : acc_[current_])
+      acc.count = 0;
+  }
+
+  sample();
+  elapsed_ += SAMPLE_INTERVAL_S;
+  if (elapsed_ >= window) {
+    // start new window and publish the last one
+    elapsed_ = 0;
+    current_ ^= 1;
+    for (auto& acc : acc_[current_])
+      acc.count = 0;
+    publish();
+  }
+}
+
+void Summary::sample() noexcept
+{
+  auto acc = acc_[current_];
+  auto addTemp = [](Accumulator& a, double t) {
+    if (t > TempSensors::INVALID)
+      a.add(toFixed(t, 100));
+  };
+  addTemp(acc[0], temp_.get_t1_outside());
+  addTemp(acc[1], temp_.get_t2_inlet());
+  addTemp(acc[2], temp_.get_t3_outlet());
+  addTemp(acc[3], temp_.get_t4_exhaust());
+  acc[4].add(int16_t(temp_.getEfficiency()));
+  acc[5].add(int16_t(fans_.getFan1().getSpeed()));
+  acc[6].add(int16_t(fans_.getFan2().getSpeed()));
+  auto addDHT = [](Accumulator& a, float v) {
+    if (!isnan(v))
+      a.add(toFixed(v, 10));
+  };
+  if (sensors_.hasDHT1()) {
+    addDHT(acc[7], sensors_.getDHT1Temp());
+    addDHT(acc[8], sensors_.getDHT1Hum());
+  }
+  if (sensors_.hasDHT2()) {
+    addDHT(acc[9], sensors_.getDHT2Temp());
+    addDHT(acc[10], sensors_.getDHT2Hum());
+  }
+  if (sensors_.hasCO2() && sensors_.getCO2() >= 0)
+    acc[11].add(int16_t(sensors_.getCO2()));
+  if (sensors_.hasVOC() && sensors_.getVOC() >= 0)
+    acc[12].add(int16_t(sensors_.getVOC()));
+}
+
+void Summary::publish()
+{
+  uint8_t index = 0;
+  publish_task_.publish([this, index]() mutable {
+    const auto last = acc_[current_ ^ 1];
+    while (index < METRIC_COUNT) {
+      const auto& acc = last[index];
+      if (acc.count) {
+        static constexpr size_t len = MQTTTopic::KwlSummary.length();
+        char topic[len + 24];
+        MQTTTopic::KwlSummary.store(topic);
+        auto info = getInfo(index);
+        strlcpy_P(topic + len, info.topic, sizeof(topic) - len);
+        if (!MessageHandler::publishStream(topic, [&acc, &info](Print& out) { acc.printTo(out, info.decimals); }, KWLConfig::RetainMeasurements))
+          return false; // retry later
+      }
+      ++index;
+    }
+    return true;
+  });
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Periodic summaries (min/max/average) of measurements.
+ */
+#pragma once
+
+#include "TimeScheduler.h"
+#include "MessageHandler.h"
+
+class KWLPersistentConfig;
+class TempSensors;
+class FanControl;
+class AdditionalSensors;
+
+/*!
+ * @brief Periodic summaries (min/max/average) of measurements.
+ *
+ * Measurements are sampled periodically and minimum, maximum, sum and count
+ * of samples are accumulated per measurement in integer form. At the end of
+ * each summary window (reporting parameter SummaryWindow), one summary per
+ * measurement is published. Long-term dashboards can use summaries instead
+ * of raw values, which are then reported less often (reporting parameter
+ * RawSlowdown).
+ */
+class Summary
+{
+public:
+  Summary(const Summary&) = delete;
+  Summary& operator=(const Summary&) = delete;
+
+  /*!
+   * @brief Construct summary object.
+   *
+   * @param config configuration with reporting parameters.
+   * @param temp temperature sensors.
+   * @param fans fan control.
+   * @param sensors additional sensors.
+   */
+  Summary(const KWLPersistentConfig& config, const TempSensors& temp, FanControl& fans, const AdditionalSensors& sensors);
+
+  /// Start sampling measurements.
+  void begin();
+
+private:
+  /// Count of summarized measurements.
+  static constexpr uint8_t METRIC_COUNT = 13;
+
+  /// Accumulated values of one measurement in one window.
+  struct Accumulator
+  {
+    int16_t min;      ///< Minimum value.
+    int16_t max;      ///< Maximum value.
+    int32_t sum;      ///< Sum of all values.
+    uint16_t count;   ///< Count of values (0 if no value in the window).
+
+    /// Add one sample.
+    void add(int16_t value) noexcept;
+
+    /// Print the summary to given output, scaled by given count of decimals.
+    void printTo(Print& out, uint8_t decimals) const;
+  };
+
+  /// Sample measurements and publish summaries at the end of the window.
+  void run();
+
+  /// Sample all measurements into current accumulators.
+  void sample() noexcept;
+
+  /// Publish summaries of the last window.
+  void publish();
+
+  const KWLPersistentConfig& config_;   ///< Configuration with reporting parameters.
+  const TempSensors& temp_;             ///< Temperature sensors.
+  FanControl& fans_;                    ///< Fan control.
+  const AdditionalSensors& sensors_;    ///< Additional sensors.
+  bool active_ = false;                 ///< Set, if summaries are active.
+  uint16_t elapsed_ = 0;                ///< Seconds elapsed in current window.
+  uint8_t current_ = 0;                 ///< Index of accumulators for current window.
+  Accumulator acc_[2][METRIC_COUNT];   ///< Accumulators for current and last window.
+  PublishTask publish_task_;            ///< Task to publish summaries.
+  Scheduler::TaskTimingStats stats_;    ///< Task runtime statistics.
+  Scheduler::TimedTask<Summary> timer_task_;  ///< Task for sampling measurements.
+};
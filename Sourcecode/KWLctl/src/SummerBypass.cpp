@@ -27,15 +27,18 @@
 /// Check bypass every 20s (also terminates motor running, if needed).
 static constexpr unsigned long INTERVAL_BYPASS_CHECK = 20000000;
 
-/// Interval for sending MQTT messages when nothing changes (15 min).
-static constexpr unsigned long INTERVAL_MQTT_BYPASS_STATE = 900000000UL;
-
 /// Runtime of the bypass motor in ms (2 minutes).
 static constexpr unsigned long BYPASS_FLAPS_DRIVE_TIME = 120 * 1000000UL;
 
 /// Maximum hysteresis temperature, which makes sense.
 static constexpr long MAX_TEMP_HYSTERESIS = 10;
 
+/// Maximum temperature limit for bypass in °C.
+static constexpr long MAX_TEMP_LIMIT = 40;
+
+/// Maximum hysteresis of bypass in minutes (1 day).
+static constexpr long MAX_HYSTERESIS_MINUTES = 24 * 60;
+
 SummerBypass::SummerBypass(KWLPersistentConfig& config, const TempSensors& temp) :
   MessageHandler(F("SummerBypass")),
   config_(config),
@@ -58,6 +61,10 @@ void SummerBypass::begin(Print& initTrace)
 
   if (KWLConfig::RetainBypassConfigState)
     sendMQTT(true);
+
+  // shift periodic sending by per-device phase to not send in lockstep with other devices
+  mqtt_countdown_ = int16_t(1 + config_.getPhaseOffset(
+    config_.getReporting(ReportingParam::BypassInterval) * 1000000UL / INTERVAL_BYPASS_CHECK));
 }
 
 void SummerBypass::forceSend(bool all_values)
@@ -185,46 +192,50 @@ void SummerBypass::run()
 
 bool SummerBypass::mqttReceiveMsg(const StringView& topic, const StringView& s)
 {
+  // configuration commands are validated first by bulk configuration and Modbus, see MessageHandler::validate()
+  long i;
   if (topic == MQTTTopic::CmdBypassGetValues) {
     forceSend(true);
   } else if (topic == MQTTTopic::CmdBypassHystereseMinutes) {
-    unsigned i = unsigned(s.toInt());
-    config_.setBypassHystereseMinutes(i);
+    if (!s.parseInt(i) || i < 0 || i > MAX_HYSTERESIS_MINUTES)
+      reportMalformed();
+    else if (!isValidating())
+      config_.setBypassHystereseMinutes(unsigned(i));
   } else if (topic == MQTTTopic::CmdBypassManualFlap) {
-    if (s == F("open"))
-      config_.setBypassManualSetpoint(SummerBypassFlapState::OPEN);
-    if (s == F("close"))
-      config_.setBypassManualSetpoint(SummerBypassFlapState::CLOSED);
     // Stellung Bypassklappe bei manuellem Modus
+    if (s != F("open") && s != F("close"))
+      reportMalformed();
+    else if (!isValidating())
+      config_.setBypassManualSetpoint(s == F("open") ? SummerBypassFlapState::OPEN : SummerBypassFlapState::CLOSED);
   } else if (topic == MQTTTopic::CmdBypassMode) {
     // Auto oder manueller Modus
-    if (s == F("auto"))   {
-      config_.setBypassMode(SummerBypassMode::AUTO);
-      forceSend();
-    } else if (s == F("manual")) {
-      config_.setBypassMode(SummerBypassMode::USER);
+    if (s != F("auto") && s != F("manual")) {
+      reportMalformed();
+    } else if (!isValidating()) {
+      config_.setBypassMode(s == F("auto") ? SummerBypassMode::AUTO : SummerBypassMode::USER);
       forceSend();
     }
   } else if (topic == MQTTTopic::CmdBypassHyst) {
-      auto i = s.toInt();
-      if (i < 0)
-        i = 0;
-      if (i > MAX_TEMP_HYSTERESIS)
-        i = MAX_TEMP_HYSTERESIS;
+    if (!s.parseInt(i) || i < 0 || i > MAX_TEMP_HYSTERESIS) {
+      reportMalformed();
+    } else if (!isValidating()) {
       config_.setBypassHysteresisTemp(uint8_t(i));
       forceSend(true);
+    }
   } else if (topic == MQTTTopic::CmdBypassTempAbluftMin) {
-      auto i = s.toInt();
-      if (i < 0)
-        i = 0;
+    if (!s.parseInt(i) || i < 0 || i > MAX_TEMP_LIMIT) {
+      reportMalformed();
+    } else if (!isValidating()) {
       config_.setBypassTempAbluftMin(unsigned(i));
       forceSend(true);
+    }
   } else if (topic == MQTTTopic::CmdBypassTempAussenluftMin) {
-      auto i = s.toInt();
-      if (i < 0)
-        i = 0;
+    if (!s.parseInt(i) || i < 0 || i > MAX_TEMP_LIMIT) {
+      reportMalformed();
+    } else if (!isValidating()) {
       config_.setBypassTempAussenluftMin(unsigned(i));
       forceSend(true);
+    }
   } else {
     return false;
   }
@@ -248,7 +259,8 @@ void SummerBypass::startMoveFlap()
 
 void SummerBypass::sendMQTT(bool all_values)
 {
-  mqtt_countdown_ = INTERVAL_MQTT_BYPASS_STATE / INTERVAL_BYPASS_CHECK;
+  // interval for sending MQTT messages when nothing changes (reporting parameter)
+  mqtt_countdown_ = int16_t(config_.getReporting(ReportingParam::BypassInterval) * 1000000UL / INTERVAL_BYPASS_CHECK);
   mqtt_state_ = state_;
 
   uint8_t bitmask = all_values ? 31 : 1;
@@ -1599,8 +1599,8 @@ protected:
     newMenuEntry(1, icon_fan_52x52, 52,
       [this]() noexcept {
         auto& fan = getControl().getFanControl();
-        if (fan.getVentilationMode() < int(KWLConfig::StandardModeCnt - 1)) {
-          fan.setVentilationMode(fan.getVentilationMode() + 1);
+        if (fan.isStepless() || fan.getVentilationMode() < int(KWLConfig::StandardModeCnt - 1)) {
+          fan.stepVentilationMode(+1);
           update();
         }
       }
@@ -1608,8 +1608,8 @@ protected:
     newMenuEntry(2, icon_fan_24x24, 24,
       [this]() noexcept {
         auto& fan = getControl().getFanControl();
-        if (fan.getVentilationMode() > 0) {
-          fan.setVentilationMode(fan.getVentilationMode() - 1);
+        if (fan.isStepless() || fan.getVentilationMode() > 0) {
+          fan.stepVentilationMode(-1);
           update();
         }
       }
@@ -1634,20 +1634,26 @@ protected:
     auto& temp = getControl().getTempSensors();
     tft_.setTextColor(colFontColor, colBackColor);
 
-    auto currentMode = fan.getVentilationMode();
+    // stepless airflow is shown as percentage, encoded above mode numbers
+    auto currentMode = fan.isStepless() ? 100 + fan.getAirflow() : fan.getVentilationMode();
     if (kwl_mode_ != currentMode) {
       // KWL Mode
       tft_.setTextColor(colFontColor, colBackColor);
-      tft_.setFont(&Nimbus_Sans_L_Bold_Condensed_84);
-      char buffer[2];
-      buffer[0] = char('0' + currentMode);
-      buffer[1] = 0;
+      char buffer[5];
+      if (currentMode >= 100) {
+        tft_.setFont(&FreeSans12pt7b);
+        snprintf_P(buffer, sizeof(buffer), PSTR("%d%%"), currentMode - 100);
+      } else {
+        tft_.setFont(&Nimbus_Sans_L_Bold_Condensed_84);
+        buffer[0] = char('0' + currentMode);
+        buffer[1] = 0;
+      }
       int16_t tx, ty;
       uint16_t tw, th;
       tft_.getTextBounds(buffer, 0, 0, &tx, &ty, &tw, &th);
-      tft_.setCursor(XX + 64 + 30 - int16_t(tw) / 2, 64 + 62);
+      tft_.setCursor(XX + 64 + 30 - int16_t(tw) / 2, (currentMode >= 100) ? 100 + BASELINE_MIDDLE / 2 : 64 + 62);
       tft_.fillRect(XX + 64, 60, 60, 80, colBackColor);
-      tft_.print(buffer[0]);
+      tft_.print(buffer);
       kwl_mode_ = currentMode;
     }
 
@@ -1986,6 +1992,7 @@ public:
     ipr_l1_in_ = ipr_l1_ = find_ipr_index(config.getFan1ImpulsesPerRotation());
     ipr_l2_in_ = ipr_l2_ = find_ipr_index(config.getFan2ImpulsesPerRotation());
     calculate_speed_mode_ = getControl().getFanControl().getCalculateSpeedMode();
+    airflow_in_ = airflow_ = getControl().getFanControl().isStepless() ? getControl().getFanControl().getAirflow() : 0;
   }
 
 protected:
@@ -2001,19 +2008,18 @@ protected:
     setupInputFieldRow(3, 1, F("Luefterregelung:"));
     setupInputFieldColumnWidth(4, 60);
     setupInputFieldRow(4, 2, F("Impulse/Umdr. Zu/Ab:"));
+    setupInputFieldRow(5, 1, F("Stufenlos:"));
 
     tft_.setFont(&FreeSans9pt7b);
     tft_.setTextColor(colFontColor, colBackColor);
-    tft_.setCursor(18, 198 + BASELINE_MIDDLE);
-    tft_.print (F("Nach der Aenderung der Normdrehzahlen"));
-    tft_.setCursor(18, 216 + BASELINE_MIDDLE);
-    tft_.print (F("der Luefter muessen diese kalibriert werden."));
-    tft_.setCursor(18, 234 + BASELINE_MIDDLE);
-    tft_.print (F("Bei der Kalibrierung werden die Drehzahlen"));
-    tft_.setCursor(18, 252 + BASELINE_MIDDLE);
-    tft_.print (F("der Luefter eingestellt und die notwendigen"));
-    tft_.setCursor(18, 270 + BASELINE_MIDDLE);
-    tft_.print (F("PWM-Werte fuer jede Stufe gespeichert."));
+    tft_.setCursor(18, 240 + BASELINE_MIDDLE);
+    tft_.print (F("Nach der Aenderung der Normdrehzahlen muessen"));
+    tft_.setCursor(18, 258 + BASELINE_MIDDLE);
+    tft_.print (F("die Luefter kalibriert werden. Dabei werden"));
+    tft_.setCursor(18, 276 + BASELINE_MIDDLE);
+    tft_.print (F("die Drehzahlen eingestellt und die PWM-Werte"));
+    tft_.setCursor(18, 294 + BASELINE_MIDDLE);
+    tft_.print (F("fuer jede Stufe gespeichert."));
 
     newMenuEntry(1, icon_back_32x32, 32,
       [this]() noexcept {
@@ -2039,6 +2045,12 @@ protected:
           case 4:
             update_ipr((getCurrentColumn() == 0) ? ipr_l1_ : ipr_l2_, -1);
             break;
+          case 5:
+            if (airflow_ == 0)
+              airflow_ = int(KWLConfig::StandardSteplessMinPercent);
+            else if (airflow_ + AIRFLOW_STEP <= FanControl::getMaxAirflow())
+              airflow_ += AIRFLOW_STEP;
+            break;
         }
         updateCurrentInputField();
       }
@@ -2064,6 +2076,13 @@ protected:
           case 4:
             update_ipr((getCurrentColumn() == 0) ? ipr_l1_ : ipr_l2_, +1);
             break;
+          case 5:
+            // below minimum, stepless operation is off
+            if (airflow_ - AIRFLOW_STEP >= int(KWLConfig::StandardSteplessMinPercent))
+              airflow_ -= AIRFLOW_STEP;
+            else
+              airflow_ = 0;
+            break;
          }
          updateCurrentInputField();
        }
@@ -2071,6 +2090,16 @@ protected:
     newMenuEntry(4, icon_ok_40x40, 40,
       [this]() noexcept {
         resetInput();
+        // stepless airflow is runtime state like ventilation mode, switch immediately
+        auto& fan = getControl().getFanControl();
+        const bool airflow_changed = airflow_in_ != airflow_;
+        if (airflow_changed) {
+          if (airflow_ > 0)
+            fan.setAirflow(airflow_);
+          else
+            fan.setVentilationMode(fan.getVentilationMode());  // back to nearest mode
+          airflow_in_ = airflow_;
+        }
         // write to EEPROM and restart
         auto& config = getControl().getPersistentConfig();
         const bool ipr_changed =
@@ -2095,7 +2124,7 @@ protected:
           doPopup<ScreenSetupFan>(
             F("Einstellungen gespeichert"),
             F("Nenndrehzahlen geaendert.\nBitte Kalibrierung starten."));
-        } else if (getControl().getFanControl().getCalculateSpeedMode() != calculate_speed_mode_) {
+        } else if (getControl().getFanControl().getCalculateSpeedMode() != calculate_speed_mode_ || airflow_changed) {
           getControl().getFanControl().setCalculateSpeedMode(calculate_speed_mode_);
           doPopup<ScreenSetup>(
             F("Einstellungen gespeichert"),
@@ -2131,6 +2160,7 @@ protected:
         config.getSpeedSetpointFan2() != setpoint_l2_ ||
         ipr_l1_in_ != ipr_l1_ ||
         ipr_l2_in_ != ipr_l2_ ||
+        airflow_in_ != airflow_ ||
         getControl().getFanControl().getCalculateSpeedMode() != calculate_speed_mode_;
   }
 
@@ -2143,6 +2173,12 @@ private:
       case 1: snprintf_P(buf, sizeof(buf), PSTR("%u"), setpoint_l1_); break;
       case 2: snprintf_P(buf, sizeof(buf), PSTR("%u"), setpoint_l2_); break;
       case 3: strcpy_P(buf, fanModeToString(calculate_speed_mode_)); break;
+      case 5:
+        if (airflow_ == 0)
+          strcpy_P(buf, PSTR("AUS"));
+        else
+          snprintf_P(buf, sizeof(buf), PSTR("%d%%"), airflow_);
+        break;
       case 4:
       {
         auto val = (col == 0) ? ipr_l1_ : ipr_l2_;
@@ -2194,8 +2230,15 @@ private:
     {2, 1}
   };
 
+  /// Step for changing stepless airflow in percent.
+  static constexpr int AIRFLOW_STEP = 5;
+
   /// Mode to calculate fan speed.
   FanCalculateSpeedMode calculate_speed_mode_;
+  /// Stepless airflow in percent (0=off).
+  int airflow_;
+  /// Stepless airflow in percent (at startup).
+  int airflow_in_;
   /// Setpoint for intake fan.
   unsigned setpoint_l1_;
   /// Setpoint for exhaust fan.
@@ -2211,6 +2254,7 @@ private:
 };
 
 constexpr uint8_t ScreenSetupFan::IPR_CONFIG_COUNT;
+constexpr int ScreenSetupFan::AIRFLOW_STEP;
 constexpr ScreenSetupFan::ratio ScreenSetupFan::IPR_CONFIGS[IPR_CONFIG_COUNT];
 
 /// IP configuration setup screen.
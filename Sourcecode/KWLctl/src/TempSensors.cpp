@@ -85,8 +85,9 @@ void TempSensors::TempSensor::retry()
   state_ = -1; // start next retry
 }
 
-TempSensors::TempSensors() :
+TempSensors::TempSensors(const KWLPersistentConfig& config) :
   MessageHandler(F("TempSensors")),
+  config_(config),
   t1_(KWLConfig::PinTemp1OneWireBus),
   t2_(KWLConfig::PinTemp2OneWireBus),
   t3_(KWLConfig::PinTemp3OneWireBus),
@@ -105,6 +106,9 @@ void TempSensors::begin(Print& initTracer)
   t3_.begin();
   t4_.begin();
 
+  // delay first sending by per-device phase to not send in lockstep with other devices
+  mqtt_ticks_ = -int16_t(config_.getPhaseOffset(config_.getMeasurementInterval(ReportingParam::TempMaxInterval)));
+
   // call regularly to update
   timer_task_.runRepeated(SCHEDULING_INTERVAL);
 }
@@ -137,12 +141,13 @@ void TempSensors::run()
   //   - if min time reached and min difference found, send,
   //   - else wait for the next call.
   ++mqtt_ticks_;
-  if (mqtt_ticks_ >= KWLConfig::MaxIntervalMqttTemp ||
-      (mqtt_ticks_ >= KWLConfig::MinIntervalMqttTemp && new_temp && (
-         (abs(get_t1_outside() - last_mqtt_t1_) > KWLConfig::MinDiffMqttTemp) ||
-         (abs(get_t2_inlet() - last_mqtt_t2_) > KWLConfig::MinDiffMqttTemp) ||
-         (abs(get_t3_outlet() - last_mqtt_t3_) > KWLConfig::MinDiffMqttTemp) ||
-         (abs(get_t4_exhaust() - last_mqtt_t4_) > KWLConfig::MinDiffMqttTemp)
+  auto min_diff = config_.getReporting(ReportingParam::TempMinDiff) * 0.01;
+  if (mqtt_ticks_ >= int16_t(config_.getMeasurementInterval(ReportingParam::TempMaxInterval)) ||
+      (mqtt_ticks_ >= int16_t(config_.getMeasurementInterval(ReportingParam::TempMinInterval)) && new_temp && (
+         (abs(get_t1_outside() - last_mqtt_t1_) > min_diff) ||
+         (abs(get_t2_inlet() - last_mqtt_t2_) > min_diff) ||
+         (abs(get_t3_outlet() - last_mqtt_t3_) > min_diff) ||
+         (abs(get_t4_exhaust() - last_mqtt_t4_) > min_diff)
       ))
      )
     sendMQTT();
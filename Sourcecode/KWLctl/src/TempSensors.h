@@ -29,6 +29,8 @@
 #include <OneWire.h>            // OneWire Temperatursensoren
 #include <DallasTemperature.h>  // https://www.milesburton.com/Dallas_Temperature_Control_Library
 
+class KWLPersistentConfig;
+
 /*!
  * @brief Collection of temperature sensors of the ventilation system.
  *
@@ -76,8 +78,8 @@ class TempSensors : private MessageHandler
   };
 
 public:
-  /// Construct sensor array.
-  TempSensors();
+  /// Construct sensor array, reporting parameters are read from given configuration.
+  explicit TempSensors(const KWLPersistentConfig& config);
 
   /// Start sensors.
   void begin(Print& initTrace);
@@ -116,13 +118,14 @@ private:
   /// Send messages via MQTT.
   void sendMQTT();
 
+  const KWLPersistentConfig& config_; ///< Configuration with reporting parameters.
   TempSensor t1_; ///< Outside/intake temperature.
   TempSensor t2_; ///< Temperature of inlet air being pushed into the house.
   TempSensor t3_; ///< (Inside) temperature of outlet air being pulled from the house.
   TempSensor t4_; ///< Temperature of exhaust air being pushed to the outside.
   int efficiency_ = 0;        ///< Current efficiency of heat exchange.
   uint8_t next_sensor_ = 0;   ///< Next sensor to talk to.
-  uint8_t mqtt_ticks_ = 0;    ///< MQTT seconds ticks.
+  int16_t mqtt_ticks_ = 0;    ///< MQTT seconds ticks (negative to delay first sending).
   double last_mqtt_t1_ = INVALID; ///< Last T1 temperature sent via MQTT.
   double last_mqtt_t2_ = INVALID; ///< Last T2 temperature sent via MQTT.
   double last_mqtt_t3_ = INVALID; ///< Last T3 temperature sent via MQTT.
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Cycle benchmark of the fixed-point PID controller on the controller.
+ *
+ * Run with `pio test -e megaatmega2560 -f embedded/test_fixed_pid -v`.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include <FixedPID.h>
+
+namespace {
+
+  /// Count of computations measured.
+  constexpr unsigned COUNT = 1000;
+
+  /// Measure average cycles per call of a function.
+  template<typename Func>
+  unsigned long cycles(Func&& f)
+  {
+    noInterrupts();
+    // Timer 1 is free during the test, count CPU cycles with overflow
+    uint8_t tccr1a = TCCR1A, tccr1b = TCCR1B;
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TCNT1 = 0;
+    TIFR1 = _BV(TOV1);
+    unsigned long overflows = 0;
+    for (unsigned i = 0; i < COUNT; ++i) {
+      f(i);
+      if (TIFR1 & _BV(TOV1)) {
+        TIFR1 = _BV(TOV1);
+        ++overflows;
+      }
+    }
+    unsigned long total = (overflows << 16) + TCNT1;
+    TCCR1A = tccr1a;
+    TCCR1B = tccr1b;
+    interrupts();
+    return total / COUNT;
+  }
+
+  volatile FixedPID::value_t s_sink;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_compute_cycles()
+{
+  // sample time 0, so every call computes
+  FixedPID pid(FixedPID::tunings(0.05, 0.1, 0.001, 200), 0, 0, FixedPID::fromInt(1000));
+  pid.start(0, 0);
+  auto overhead = cycles([](unsigned i) { s_sink = FixedPID::value_t(i); });
+  auto total = cycles([&pid](unsigned i) {
+    FixedPID::value_t out;
+    pid.compute(FixedPID::input_t(i & 2047), 1000, out);
+    s_sink = out;
+  });
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "FixedPID::compute: %lu cycles", total - overhead);
+  TEST_MESSAGE(buffer);
+  // only 16x16 bit multiplications and 32-bit additions, no 64-bit helpers
+  TEST_ASSERT_LESS_THAN(400, total - overhead);
+}
+
+void setup()
+{
+  delay(2000);  // wait for the serial monitor after reset
+  UNITY_BEGIN();
+  RUN_TEST(test_compute_cycles);
+  UNITY_END();
+}
+
+void loop() {}
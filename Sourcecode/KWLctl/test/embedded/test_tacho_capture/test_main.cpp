@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Cycle benchmark of tacho interrupt routines on the controller.
+ *
+ * Measures the routines called by the interrupts of the tacho signal, both
+ * via input capture (KWLConfig::TachoInputCapture) and via attachInterrupt()
+ * with micros(). Entry and exit of the interrupt are not included, add about
+ * 30 cycles for capture and overflow routines and about 70 cycles for the
+ * dispatch of attachInterrupt(). FanRPM::edge(), the common part of all tacho
+ * routines, is measured at 500, 2000 and 5000 rpm. See RuntimeStatistics.md
+ * for the interrupt load computed from the results.
+ *
+ * Run with `pio test -e megaatmega2560 -f embedded/test_tacho_capture -v`.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include <FanRPM.h>
+#include <TachoCapture.h>
+
+namespace {
+
+  /// Count of calls measured.
+  constexpr unsigned COUNT = 1000;
+
+  /// Measure average cycles per call of a function.
+  template<typename Func>
+  unsigned long cycles(Func&& f)
+  {
+    noInterrupts();
+    // Timer 1 is free during the test, count CPU cycles with overflow
+    uint8_t tccr1a = TCCR1A, tccr1b = TCCR1B;
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TCNT1 = 0;
+    TIFR1 = _BV(TOV1);
+    unsigned long overflows = 0;
+    for (unsigned i = 0; i < COUNT; ++i) {
+      f(i);
+      if (TIFR1 & _BV(TOV1)) {
+        TIFR1 = _BV(TOV1);
+        ++overflows;
+      }
+    }
+    unsigned long total = (overflows << 16) + TCNT1;
+    TCCR1A = tccr1a;
+    TCCR1B = tccr1b;
+    interrupts();
+    return total / COUNT;
+  }
+
+  volatile uint16_t s_sink;
+
+  void report(const char* what, unsigned long value)
+  {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s: %lu cycles", what, value);
+    TEST_MESSAGE(buffer);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_interrupt_cycles()
+{
+  FanRPM rpm4, rpm5, rpm_isr;
+  TEST_ASSERT_TRUE(TachoCapture::begin(TachoCapture::PIN_ICP4, rpm4, true));
+  TEST_ASSERT_TRUE(TachoCapture::begin(TachoCapture::PIN_ICP5, rpm5, true));
+  // routines are called directly, the timers must not interrupt
+  TIMSK4 = 0;
+  TIMSK5 = 0;
+
+  auto overhead = cycles([](unsigned i) { s_sink = uint16_t(i); });
+  // edges at 1500 rpm, so each edge is a valid measurement
+  auto capture4 = cycles([](unsigned i) { ICR4 = uint16_t(i * 40000U); TachoCapture::captureICP4(); });
+  auto overflow4 = cycles([](unsigned) { TachoCapture::overflowICP4(); });
+  auto capture5 = cycles([](unsigned i) { ICR5 = uint16_t(i * 40000U); TachoCapture::captureICP5(); });
+  auto overflow5 = cycles([](unsigned) { TachoCapture::overflowICP5(); });
+  auto isr = cycles([&rpm_isr](unsigned) { rpm_isr.interrupt(); });
+
+  report("TachoCapture::captureICP4", capture4 - overhead);
+  report("TachoCapture::overflowICP4", overflow4 - overhead);
+  report("TachoCapture::captureICP5", capture5 - overhead);
+  report("TachoCapture::overflowICP5", overflow5 - overhead);
+  report("FanRPM::interrupt (micros)", isr - overhead);
+  // capture doesn't need to read micros(), so it's shorter
+  TEST_ASSERT_LESS_THAN(isr, capture4);
+  TEST_ASSERT_LESS_THAN(100, overflow4 - overhead);
+  TEST_ASSERT_LESS_THAN(100, overflow5 - overhead);
+}
+
+void test_edge_cycles()
+{
+  auto overhead = cycles([](unsigned i) { s_sink = uint16_t(i); });
+  static const unsigned long speeds[] = {500, 2000, 5000};
+  for (auto rpm : speeds) {
+    FanRPM fan;
+    const unsigned long period = 60000000UL / rpm;
+    auto edge = cycles([&fan, period](unsigned i) { fan.edge(1000000UL + i * period); });
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "FanRPM::edge at %lu rpm", rpm);
+    report(buffer, edge - overhead);
+  }
+}
+
+void setup()
+{
+  delay(2000);  // wait for the serial monitor after reset
+  UNITY_BEGIN();
+  RUN_TEST(test_interrupt_cycles);
+  RUN_TEST(test_edge_cycles);
+  UNITY_END();
+}
+
+void loop() {}
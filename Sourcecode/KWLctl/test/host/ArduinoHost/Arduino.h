@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Minimal Arduino API for host builds.
+ *
+ * Only the subset of the Arduino and avr-libc API used by the controller is
+ * provided. Time, pins and interrupts are simulated, see ArduinoHost.h.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <avr/pgmspace.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define NOT_AN_INTERRUPT -1
+#define LED_BUILTIN 13
+
+// analog pins of Arduino Mega
+#define A0 54
+#define A1 55
+#define A2 56
+#define A3 57
+#define A4 58
+#define A5 59
+#define A6 60
+#define A7 61
+#define A8 62
+#define A9 63
+#define A10 64
+#define A11 65
+#define A12 66
+#define A13 67
+#define A14 68
+#define A15 69
+
+#define clockCyclesPerMicrosecond() (F_CPU / 1000000L)
+#define clockCyclesToMicroseconds(a) ((a) / clockCyclesPerMicrosecond())
+#define microsecondsToClockCycles(a) ((a) * clockCyclesPerMicrosecond())
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define sq(x) ((x) * (x))
+#define bit(b) (1UL << (b))
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+
+#define interrupts() sei()
+#define noInterrupts() cli()
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef unsigned int word;
+
+// min() and max() are macros in Arduino, templates don't break the standard library
+template<typename T, typename U>
+constexpr auto min(const T& a, const U& b) -> decltype(a < b ? a : b) { return (b < a) ? b : a; }
+template<typename T, typename U>
+constexpr auto max(const T& a, const U& b) -> decltype(a < b ? a : b) { return (a < b) ? b : a; }
+
+// declared with C linkage as in the Arduino core, libraries redeclare some of them
+extern "C" {
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode);
+void detachInterrupt(uint8_t interrupt);
+}
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+// avr-libc extensions of stdlib
+char* itoa(int val, char* s, int radix);
+char* ltoa(long val, char* s, int radix);
+char* utoa(unsigned val, char* s, int radix);
+char* ultoa(unsigned long val, char* s, int radix);
+char* dtostrf(double val, signed char width, unsigned char prec, char* s);
+
+void setup();
+void loop();
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "Arduino.h"
+#include "ArduinoHost.h"
+#include "EEPROM.h"
+
+#include <chrono>
+#include <deque>
+#include <stdio.h>
+#include <thread>
+
+// simulated registers
+volatile uint8_t SREG = _BV(SREG_I);
+volatile uint16_t SP = 0x21ff;
+volatile uint8_t MCUSR;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, ICR1, OCR1A, OCR1B, OCR1C;
+volatile uint8_t TCCR3A, TCCR3B, TCCR3C, TIMSK3, TIFR3;
+volatile uint16_t TCNT3, ICR3, OCR3A, OCR3B, OCR3C;
+volatile uint8_t TCCR4A, TCCR4B, TCCR4C, TIMSK4, TIFR4;
+volatile uint16_t TCNT4, ICR4, OCR4A, OCR4B, OCR4C;
+volatile uint8_t TCCR5A, TCCR5B, TCCR5C, TIMSK5, TIFR5;
+volatile uint16_t TCNT5, ICR5, OCR5A, OCR5B, OCR5C;
+volatile uint8_t PIND, DDRD, PORTD, PINL, DDRL, PORTL;
+volatile uint8_t TWBR, TWSR, TWAR, TWDR, TWCR;
+volatile uint8_t UCSR3A = _BV(UDRE3), UCSR3B, UCSR3C, UBRR3H, UBRR3L, UDR3;
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+HardwareSerial Serial3;
+EEPROMClass EEPROM;
+
+namespace
+{
+  /// Count of pins of Arduino Mega.
+  constexpr uint8_t PIN_COUNT = 70;
+  /// Count of external interrupts of Arduino Mega.
+  constexpr uint8_t INTERRUPT_COUNT = 6;
+
+  unsigned long s_micros = 0;
+  unsigned long s_auto_advance = 0;
+  bool s_real_clock = false;
+  std::chrono::steady_clock::time_point s_clock_start = std::chrono::steady_clock::now();
+  int s_pin_output[PIN_COUNT];
+  int s_pin_input[PIN_COUNT];
+  void (*s_interrupt_handler[INTERRUPT_COUNT])();
+  unsigned long s_random = 1;
+  std::string s_serial_output;
+  std::deque<uint8_t> s_serial_input;
+  bool s_serial_echo = getenv("ARDUINO_HOST_SERIAL") != nullptr;
+  uint8_t s_eeprom[4096];
+  bool s_eeprom_erased = false;
+
+  uint8_t* eeprom()
+  {
+    if (!s_eeprom_erased) {
+      memset(s_eeprom, 0xff, sizeof(s_eeprom));
+      s_eeprom_erased = true;
+    }
+    return s_eeprom;
+  }
+
+  unsigned long now()
+  {
+    if (s_real_clock) {
+      auto d = std::chrono::steady_clock::now() - s_clock_start;
+      return (unsigned long) std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    }
+    auto t = s_micros;
+    s_micros += s_auto_advance;
+    return t;
+  }
+}
+
+namespace ArduinoHost
+{
+  void setMicros(unsigned long us) { s_micros = us; }
+  void advanceMicros(unsigned long us) { s_micros += us; }
+  void setAutoAdvance(unsigned long us) { s_auto_advance = us; }
+
+  void useRealClock(bool real)
+  {
+    s_real_clock = real;
+    s_clock_start = std::chrono::steady_clock::now() - std::chrono::microseconds(s_micros);
+  }
+
+  int getPinOutput(uint8_t pin) { return pin < PIN_COUNT ? s_pin_output[pin] : 0; }
+
+  void setPinInput(uint8_t pin, int value)
+  {
+    if (pin < PIN_COUNT)
+      s_pin_input[pin] = value;
+  }
+
+  void raiseInterrupt(uint8_t interrupt)
+  {
+    if (interrupt < INTERRUPT_COUNT && s_interrupt_handler[interrupt])
+      s_interrupt_handler[interrupt]();
+  }
+
+  const std::string& getSerialOutput() { return s_serial_output; }
+  void clearSerialOutput() { s_serial_output.clear(); }
+  void setSerialEcho(bool echo) { s_serial_echo = echo; }
+  void addSerialInput(const char* data, size_t size) { s_serial_input.insert(s_serial_input.end(), data, data + size); }
+  void clearEEPROM() { s_eeprom_erased = false; }
+}
+
+unsigned long millis() { return now() / 1000; }
+unsigned long micros() { return now(); }
+
+void delay(unsigned long ms)
+{
+  if (s_real_clock)
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  else
+    s_micros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  if (s_real_clock)
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+  else
+    s_micros += us;
+}
+
+void yield() {}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if (pin < PIN_COUNT)
+    s_pin_output[pin] = val;
+}
+
+int digitalRead(uint8_t pin) { return pin < PIN_COUNT ? (s_pin_input[pin] ? HIGH : LOW) : LOW; }
+int analogRead(uint8_t pin) { return pin < PIN_COUNT ? s_pin_input[pin] : 0; }
+
+void analogWrite(uint8_t pin, int val)
+{
+  if (pin < PIN_COUNT)
+    s_pin_output[pin] = val;
+}
+
+int digitalPinToInterrupt(uint8_t pin)
+{
+  switch (pin) {
+    case 2: return 0;
+    case 3: return 1;
+    case 21: return 2;
+    case 20: return 3;
+    case 19: return 4;
+    case 18: return 5;
+    default: return NOT_AN_INTERRUPT;
+  }
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int)
+{
+  if (interrupt < INTERRUPT_COUNT)
+    s_interrupt_handler[interrupt] = handler;
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+  if (interrupt < INTERRUPT_COUNT)
+    s_interrupt_handler[interrupt] = nullptr;
+}
+
+long random(long max)
+{
+  if (max <= 0)
+    return 0;
+  // 31-bit LCG, deterministic on all hosts
+  s_random = (s_random * 1103515245UL + 12345UL) & 0x7fffffffUL;
+  return long(s_random % (unsigned long) max);
+}
+
+long random(long min, long max)
+{
+  if (min >= max)
+    return min;
+  return random(max - min) + min;
+}
+
+void randomSeed(unsigned long seed)
+{
+  if (seed)
+    s_random = seed;
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+static char* format(char* s, const char* fmt, long long val, int radix)
+{
+  if (radix == 10) {
+    sprintf(s, fmt, val);
+    return s;
+  }
+  // other radixes only for non-negative values, as used in the controller
+  char buf[8 * sizeof(val) + 1];
+  char* p = &buf[sizeof(buf) - 1];
+  *p = 0;
+  auto v = (unsigned long long) val;
+  do {
+    auto c = char(v % unsigned(radix));
+    v /= unsigned(radix);
+    *--p = char(c < 10 ? c + '0' : c + 'a' - 10);
+  } while (v);
+  strcpy(s, p);
+  return s;
+}
+
+char* itoa(int val, char* s, int radix) { return format(s, "%lld", val, radix); }
+char* ltoa(long val, char* s, int radix) { return format(s, "%lld", val, radix); }
+char* utoa(unsigned val, char* s, int radix) { return format(s, "%lld", (long long) val, radix); }
+char* ultoa(unsigned long val, char* s, int radix) { return format(s, "%lld", (long long) val, radix); }
+
+char* dtostrf(double val, signed char width, unsigned char prec, char* s)
+{
+  sprintf(s, "%*.*f", width, prec, val);
+  return s;
+}
+
+int HardwareSerial::available()
+{
+  return this == &Serial ? int(s_serial_input.size()) : 0;
+}
+
+int HardwareSerial::read()
+{
+  if (this != &Serial || s_serial_input.empty())
+    return -1;
+  auto c = s_serial_input.front();
+  s_serial_input.pop_front();
+  return c;
+}
+
+int HardwareSerial::peek()
+{
+  if (this != &Serial || s_serial_input.empty())
+    return -1;
+  return s_serial_input.front();
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  if (this == &Serial) {
+    if (s_serial_output.size() >= 1000000)
+      s_serial_output.erase(0, 500000);  // keep only recent output
+    s_serial_output += char(c);
+    if (s_serial_echo)
+      putchar(c);
+  }
+  return 1;
+}
+
+uint8_t EEPROMClass::read(int idx)
+{
+  return eeprom()[idx & 4095];
+}
+
+void EEPROMClass::write(int idx, uint8_t val)
+{
+  eeprom()[idx & 4095] = val;
+}
+
+void EEPROMClass::update(int idx, uint8_t val)
+{
+  eeprom()[idx & 4095] = val;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Control of the simulated hardware in host builds.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+/*!
+ * @brief Control of the simulated hardware in host builds.
+ *
+ * By default, time stands still and is advanced explicitly by the test
+ * (delay() advances it as well). Benchmarks can switch to the real clock
+ * of the host.
+ */
+namespace ArduinoHost
+{
+  /// Set simulated time in microseconds.
+  void setMicros(unsigned long us);
+
+  /// Advance simulated time by given microseconds.
+  void advanceMicros(unsigned long us);
+
+  /// Advance simulated time by given microseconds on each call to millis() or micros().
+  void setAutoAdvance(unsigned long us);
+
+  /// Use the real clock of the host (monotonic) instead of simulated time.
+  void useRealClock(bool real);
+
+  /// Get value last written to the pin by digitalWrite() or analogWrite().
+  int getPinOutput(uint8_t pin);
+
+  /// Set value returned by digitalRead() or analogRead() for the pin.
+  void setPinInput(uint8_t pin, int value);
+
+  /// Call the handler attached to an external interrupt, if any.
+  void raiseInterrupt(uint8_t interrupt);
+
+  /// Get output written to Serial since the last call to clearSerialOutput().
+  const std::string& getSerialOutput();
+
+  /// Clear collected output of Serial.
+  void clearSerialOutput();
+
+  /// Copy Serial output also to stdout.
+  void setSerialEcho(bool echo);
+
+  /// Provide input to be read from Serial.
+  void addSerialInput(const char* data, size_t size);
+
+  /// Clear EEPROM (to 0xff, as on erased chip).
+  void clearEEPROM();
+}
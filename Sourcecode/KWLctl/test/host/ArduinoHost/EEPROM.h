@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Simulated EEPROM (4KB, as on ATmega2560).
+ */
+#pragma once
+
+#include <stdint.h>
+
+/// Simulated EEPROM, compatible with the Arduino EEPROM library (without references).
+class EEPROMClass
+{
+public:
+  uint8_t read(int idx);
+  void write(int idx, uint8_t val);
+  void update(int idx, uint8_t val);
+  uint16_t length() { return 4096; }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Serial ports of the host build.
+ */
+#pragma once
+
+#include "Stream.h"
+
+/*!
+ * @brief Serial port of the host build.
+ *
+ * Output is collected and can be checked via ArduinoHost::getSerialOutput()
+ * (only for Serial), input is provided via ArduinoHost::addSerialInput().
+ */
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  void end() {}
+  virtual int available() override;
+  virtual int read() override;
+  virtual int peek() override;
+  virtual int availableForWrite() override { return 63; }
+  virtual size_t write(uint8_t c) override;
+  using Print::write;
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "IPAddress.h"
+#include "Print.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool IPAddress::fromString(const char* address)
+{
+  uint8_t bytes[4];
+  for (uint8_t i = 0; i < 4; ++i) {
+    if (i > 0) {
+      if (*address != '.')
+        return false;
+      ++address;
+    }
+    char* end;
+    auto v = strtoul(address, &end, 10);
+    if (end == address || v > 255)
+      return false;
+    bytes[i] = uint8_t(v);
+    address = end;
+  }
+  if (*address)
+    return false;
+  memcpy(bytes_, bytes, sizeof(bytes_));
+  return true;
+}
+
+IPAddress::operator uint32_t() const noexcept
+{
+  uint32_t v;
+  memcpy(&v, bytes_, sizeof(v));
+  return v;
+}
+
+bool IPAddress::operator==(const uint8_t* address) const noexcept
+{
+  return memcmp(address, bytes_, sizeof(bytes_)) == 0;
+}
+
+IPAddress& IPAddress::operator=(const uint8_t* address) noexcept
+{
+  memcpy(bytes_, address, sizeof(bytes_));
+  return *this;
+}
+
+IPAddress& IPAddress::operator=(uint32_t address) noexcept
+{
+  memcpy(bytes_, &address, sizeof(bytes_));
+  return *this;
+}
+
+size_t IPAddress::printTo(Print& p) const
+{
+  size_t n = 0;
+  for (uint8_t i = 0; i < 4; ++i) {
+    if (i)
+      n += p.print('.');
+    n += p.print(bytes_[i], DEC);
+  }
+  return n;
+}
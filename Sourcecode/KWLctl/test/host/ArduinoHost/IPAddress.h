@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief IPv4 address.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "Printable.h"
+
+/// IPv4 address, compatible with Arduino IPAddress.
+class IPAddress : public Printable
+{
+public:
+  IPAddress() noexcept : IPAddress(0, 0, 0, 0) {}
+  IPAddress(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4) noexcept : bytes_{b1, b2, b3, b4} {}
+  IPAddress(uint32_t address) noexcept { *this = address; }
+  IPAddress(const uint8_t* address) noexcept { *this = address; }
+
+  bool fromString(const char* address);
+
+  /// Get address as 32-bit integer (in memory order, as on Arduino).
+  operator uint32_t() const noexcept;
+  bool operator==(const IPAddress& other) const noexcept { return uint32_t(*this) == uint32_t(other); }
+  bool operator!=(const IPAddress& other) const noexcept { return !(*this == other); }
+  bool operator==(const uint8_t* address) const noexcept;
+
+  uint8_t operator[](int index) const noexcept { return bytes_[index]; }
+  uint8_t& operator[](int index) noexcept { return bytes_[index]; }
+
+  IPAddress& operator=(const uint8_t* address) noexcept;
+  IPAddress& operator=(uint32_t address) noexcept;
+
+  virtual size_t printTo(Print& p) const override;
+
+private:
+  friend class Client;
+  friend class Server;
+  friend class UDP;
+
+  uint8_t* raw_address() noexcept { return bytes_; }
+
+  uint8_t bytes_[4];
+};
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+#include "Print.h"
+
+#include <math.h>
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--) {
+    if (write(*buffer++))
+      ++n;
+    else
+      break;
+  }
+  return n;
+}
+
+size_t Print::print(const __FlashStringHelper* s)
+{
+  return write(reinterpret_cast<const char*>(s));
+}
+
+size_t Print::print(const char s[])
+{
+  return write(s);
+}
+
+size_t Print::print(char c)
+{
+  return write(uint8_t(c));
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+  return print((unsigned long) n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+  return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+  return print((unsigned long) n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+  if (base == 0)
+    return write(uint8_t(n));
+  if (base == 10 && n < 0)
+    return print('-') + printNumber(0ULL - (unsigned long long) n, 10);
+  return printNumber((unsigned long) n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  if (base == 0)
+    return write(uint8_t(n));
+  return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+  return printFloat(n, digits);
+}
+
+size_t Print::print(const Printable& x)
+{
+  return x.printTo(*this);
+}
+
+size_t Print::println(const __FlashStringHelper* s)
+{
+  size_t n = print(s);
+  return n + println();
+}
+
+size_t Print::println(const char s[])
+{
+  size_t n = print(s);
+  return n + println();
+}
+
+size_t Print::println(char c)
+{
+  size_t n = print(c);
+  return n + println();
+}
+
+size_t Print::println(unsigned char b, int base)
+{
+  size_t n = print(b, base);
+  return n + println();
+}
+
+size_t Print::println(int num, int base)
+{
+  size_t n = print(num, base);
+  return n + println();
+}
+
+size_t Print::println(unsigned int num, int base)
+{
+  size_t n = print(num, base);
+  return n + println();
+}
+
+size_t Print::println(long num, int base)
+{
+  size_t n = print(num, base);
+  return n + println();
+}
+
+size_t Print::println(unsigned long num, int base)
+{
+  size_t n = print(num, base);
+  return n + println();
+}
+
+size_t Print::println(double num, int digits)
+{
+  size_t n = print(num, digits);
+  return n + println();
+}
+
+size_t Print::println(const Printable& x)
+{
+  size_t n = print(x);
+  return n + println();
+}
+
+size_t Print::println()
+{
+  return write("\r\n");
+}
+
+size_t Print::printNumber(unsigned long long n, int base)
+{
+  char buf[8 * sizeof(n) + 1];
+  char* str = &buf[sizeof(buf) - 1];
+  *str = 0;
+  if (base < 2)
+    base = 10;
+  do {
+    char c = char(n % unsigned(base));
+    n /= unsigned(base);
+    *--str = char(c < 10 ? c + '0' : c + 'A' - 10);
+  } while (n);
+  return write(str);
+}
+
+size_t Print::printFloat(double number, int digits)
+{
+  if (isnan(number))
+    return print("nan");
+  if (isinf(number))
+    return print("inf");
+  if (number > 4294967040.0 || number < -4294967040.0)
+    return print("ovf");
+
+  size_t n = 0;
+  if (number < 0.0) {
+    n += print('-');
+    number = -number;
+  }
+  double rounding = 0.5;
+  for (int i = 0; i < digits; ++i)
+    rounding /= 10.0;
+  number += rounding;
+
+  auto int_part = (unsigned long) number;
+  double remainder = number - double(int_part);
+  n += print(int_part);
+  if (digits > 0)
+    n += print('.');
+  while (digits-- > 0) {
+    remainder *= 10.0;
+    auto digit = unsigned(remainder);
+    n += print(digit);
+    remainder -= digit;
+  }
+  return n;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Base class for formatted output.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "WString.h"
+#include "Printable.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+/// Base class for formatted output, compatible with Arduino Print.
+class Print
+{
+public:
+  Print() = default;
+  virtual ~Print() = default;
+
+  int getWriteError() { return write_error_; }
+  void clearWriteError() { setWriteError(0); }
+
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str) { return str ? write(reinterpret_cast<const uint8_t*>(str), strlen(str)) : 0; }
+  size_t write(const char* buffer, size_t size) { return write(reinterpret_cast<const uint8_t*>(buffer), size); }
+
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const __FlashStringHelper* s);
+  size_t print(const char s[]);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+  size_t print(const Printable& x);
+
+  size_t println(const __FlashStringHelper* s);
+  size_t println(const char s[]);
+  size_t println(char c);
+  size_t println(unsigned char n, int base = DEC);
+  size_t println(int n, int base = DEC);
+  size_t println(unsigned int n, int base = DEC);
+  size_t println(long n, int base = DEC);
+  size_t println(unsigned long n, int base = DEC);
+  size_t println(double n, int digits = 2);
+  size_t println(const Printable& x);
+  size_t println();
+
+protected:
+  void setWriteError(int err = 1) { write_error_ = err; }
+
+private:
+  size_t printNumber(unsigned long long n, int base);
+  size_t printFloat(double n, int digits);
+
+  int write_error_ = 0;
+};
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Interface of UDP endpoints.
+ */
+#pragma once
+
+#include "Stream.h"
+#include "IPAddress.h"
+
+/// Interface of UDP endpoints, compatible with Arduino UDP.
+class UDP : public Stream
+{
+public:
+  virtual uint8_t begin(uint16_t port) = 0;
+  virtual uint8_t beginMulticast(IPAddress, uint16_t) { return 0; }
+  virtual void stop() = 0;
+  virtual int beginPacket(IPAddress ip, uint16_t port) = 0;
+  virtual int beginPacket(const char* host, uint16_t port) = 0;
+  virtual int endPacket() = 0;
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+  using Print::write;
+  virtual int parsePacket() = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int read(unsigned char* buffer, size_t len) = 0;
+  virtual int read(char* buffer, size_t len) = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+  virtual IPAddress remoteIP() = 0;
+  virtual uint16_t remotePort() = 0;
+
+protected:
+  uint8_t* rawIPAddress(IPAddress& addr) { return addr.raw_address(); }
+};
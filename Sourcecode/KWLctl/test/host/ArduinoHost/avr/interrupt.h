@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Interrupt control for host builds.
+ *
+ * Interrupt routines are plain functions named by the vector, so tests can
+ * call them directly, e.g., TIMER4_CAPT_vect().
+ */
+#pragma once
+
+#include <avr/io.h>
+
+#define ISR(vector, ...) extern "C" void vector(void)
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+
+inline void cli() { SREG &= uint8_t(~_BV(SREG_I)); }
+inline void sei() { SREG |= uint8_t(_BV(SREG_I)); }
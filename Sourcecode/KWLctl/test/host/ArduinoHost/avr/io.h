@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Simulated registers of the ATmega2560 used by the controller.
+ *
+ * Registers are plain variables. They don't have any side effects, tests
+ * set them to simulate the hardware (e.g., a captured timer value) and call
+ * the interrupt routines directly.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+// CPU
+extern volatile uint8_t SREG;
+extern volatile uint16_t SP;
+extern volatile uint8_t MCUSR;
+#define SREG_I 7
+
+// Timer 0 (millis)
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, TIMSK0, TIFR0;
+#define TOV0 0
+
+// 16-bit timers
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, ICR1, OCR1A, OCR1B, OCR1C;
+extern volatile uint8_t TCCR3A, TCCR3B, TCCR3C, TIMSK3, TIFR3;
+extern volatile uint16_t TCNT3, ICR3, OCR3A, OCR3B, OCR3C;
+extern volatile uint8_t TCCR4A, TCCR4B, TCCR4C, TIMSK4, TIFR4;
+extern volatile uint16_t TCNT4, ICR4, OCR4A, OCR4B, OCR4C;
+extern volatile uint8_t TCCR5A, TCCR5B, TCCR5C, TIMSK5, TIFR5;
+extern volatile uint16_t TCNT5, ICR5, OCR5A, OCR5B, OCR5C;
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define CS40 0
+#define CS41 1
+#define CS42 2
+#define WGM40 0
+#define WGM41 1
+#define WGM42 3
+#define WGM43 4
+#define ICES4 6
+#define ICNC4 7
+#define TOIE4 0
+#define ICIE4 5
+#define TOV4 0
+#define ICF4 5
+#define CS50 0
+#define CS51 1
+#define CS52 2
+#define WGM50 0
+#define WGM51 1
+#define WGM52 3
+#define WGM53 4
+#define ICES5 6
+#define ICNC5 7
+#define TOIE5 0
+#define ICIE5 5
+#define TOV5 0
+#define ICF5 5
+
+// ports
+extern volatile uint8_t PIND, DDRD, PORTD, PINL, DDRL, PORTL;
+#define PD0 0
+#define PD1 1
+#define PL0 0
+#define PL1 1
+
+// TWI
+extern volatile uint8_t TWBR, TWSR, TWAR, TWDR, TWCR;
+#define TWPS0 0
+#define TWPS1 1
+#define TWIE 0
+#define TWEN 2
+#define TWWC 3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA 6
+#define TWINT 7
+
+// USART3
+extern volatile uint8_t UCSR3A, UCSR3B, UCSR3C, UBRR3H, UBRR3L, UDR3;
+#define U2X3 1
+#define UDRE3 5
+#define RXC3 7
+#define TXEN3 3
+#define RXEN3 4
+#define UDRIE3 5
+#define RXCIE3 7
+#define UCSZ30 1
+#define UCSZ31 2
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Atomic blocks for host builds.
+ */
+#pragma once
+
+#include <avr/interrupt.h>
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1
+
+/// Helper for ATOMIC_BLOCK(), disables interrupts for one iteration.
+class HostAtomicBlock
+{
+public:
+  explicit HostAtomicBlock(int type) noexcept : sreg_(type == ATOMIC_FORCEON ? uint8_t(SREG | _BV(SREG_I)) : SREG) { cli(); }
+  ~HostAtomicBlock() noexcept { SREG = sreg_; }
+  bool once() noexcept { bool first = !done_; done_ = true; return first; }
+
+private:
+  uint8_t sreg_;
+  bool done_ = false;
+};
+
+#define ATOMIC_BLOCK(type) for (HostAtomicBlock atomic_block_(type); atomic_block_.once(); )
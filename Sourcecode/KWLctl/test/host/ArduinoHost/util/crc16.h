@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief CRC computations (same algorithms as in avr-libc).
+ */
+#pragma once
+
+#include <stdint.h>
+
+inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+  crc ^= a;
+  for (uint8_t i = 0; i < 8; ++i)
+    crc = (crc & 1) ? uint16_t((crc >> 1) ^ 0xA001) : uint16_t(crc >> 1);
+  return crc;
+}
+
+inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+  crc = uint16_t(crc ^ (uint16_t(data) << 8));
+  for (uint8_t i = 0; i < 8; ++i)
+    crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x1021) : uint16_t(crc << 1);
+  return crc;
+}
+
+inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+  data = uint8_t(data ^ (crc & 0xff));
+  data = uint8_t(data ^ (data << 4));
+  return uint16_t(((uint16_t(data) << 8) | (crc >> 8)) ^ uint8_t(data >> 4) ^ (uint16_t(data) << 3));
+}
+
+inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data)
+{
+  crc ^= data;
+  for (uint8_t i = 0; i < 8; ++i)
+    crc = (crc & 1) ? uint8_t((crc >> 1) ^ 0x8C) : uint8_t(crc >> 1);
+  return crc;
+}
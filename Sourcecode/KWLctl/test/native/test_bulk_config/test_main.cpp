@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Tests of bulk configuration.
+ *
+ * Real command handlers need the whole controller, so they are replaced by
+ * a handler, which checks and applies values the same way.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "BulkConfig.h"
+#include "KWLConfig.h"
+#include "MQTTTopic.hpp"
+
+#include <IPAddress.h>
+
+#include <string>
+
+namespace {
+
+  std::string s_published;  ///< Last published message.
+  bool s_connected = true;  ///< Simulated broker connection state.
+
+  bool publishCallback(void*, const char* topic, const char* payload, bool)
+  {
+    if (!s_connected)
+      return false;
+    s_published = std::string(topic) + '=' + payload;
+    return true;
+  }
+
+  /// Handler of single commands, which supports validation like the real ones.
+  class FakeHandler : public MessageHandler
+  {
+  public:
+    FakeHandler() : MessageHandler(F("Fake")) {}
+
+    virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override
+    {
+      long i;
+      if (topic == MQTTTopic::CmdFan1Speed || topic == MQTTTopic::CmdFan2Speed) {
+        if (!s.parseInt(i) || i < 60 || i > 10000)
+          reportMalformed();
+        else if (!isValidating())
+          (topic == MQTTTopic::CmdFan1Speed ? fan1_ : fan2_) = int(i);
+      } else if (topic == MQTTTopic::CmdBypassMode) {
+        if (s != F("auto") && s != F("manual"))
+          reportMalformed();
+        else if (!isValidating())
+          bypass_auto_ = (s == F("auto"));
+      } else if (topic == MQTTTopic::CmdNTPServer) {
+        IPAddress ip;
+        if (!ip.fromString(s.c_str()))
+          reportMalformed();
+        else if (!isValidating())
+          ++ntp_changes_;
+      } else {
+        return false;
+      }
+      return true;
+    }
+
+    int fan1_ = 0;
+    int fan2_ = 0;
+    bool bypass_auto_ = false;
+    int ntp_changes_ = 0;
+  };
+
+  KWLPersistentConfig s_config;
+  FakeHandler s_handler;
+  BulkConfig s_bulk(s_config);
+
+  /// Send bulk configuration and run publishing tasks.
+  void send(const char* payload)
+  {
+    char topic[] = "config/bulk";
+    std::string p(payload);
+    s_published.clear();
+    MessageHandler::mqttMessageReceived(topic, reinterpret_cast<uint8_t*>(&p[0]), unsigned(p.size()));
+    PublishTask::loop();
+  }
+
+}
+
+void setUp()
+{
+  s_connected = true;
+  PublishTask::loop();
+  s_handler.fan1_ = s_handler.fan2_ = 0;
+  s_handler.bypass_auto_ = false;
+  s_handler.ntp_changes_ = 0;
+}
+
+void tearDown() {}
+
+void test_applies_all_pairs()
+{
+  send("fan1/standardspeed=1300; fan2/standardspeed=1350\nsummerbypass/mode=auto ntp/server=192.168.1.1");
+  TEST_ASSERT_EQUAL_STRING("config/bulk=OK 4", s_published.c_str());
+  TEST_ASSERT_EQUAL(1300, s_handler.fan1_);
+  TEST_ASSERT_EQUAL(1350, s_handler.fan2_);
+  TEST_ASSERT_TRUE(s_handler.bypass_auto_);
+  TEST_ASSERT_EQUAL(1, s_handler.ntp_changes_);
+}
+
+void test_invalid_value_changes_nothing()
+{
+  // the handler rejects speed 0, so must bulk configuration
+  send("fan1/standardspeed=1300;fan2/standardspeed=0");
+  TEST_ASSERT_EQUAL_STRING("config/bulk=ERROR value fan2/standardspeed", s_published.c_str());
+  TEST_ASSERT_EQUAL(0, s_handler.fan1_);
+  TEST_ASSERT_EQUAL(0, s_handler.fan2_);
+
+  send("summerbypass/mode=auto;ntp/server=1.2.3.x");
+  TEST_ASSERT_EQUAL_STRING("config/bulk=ERROR value ntp/server", s_published.c_str());
+  TEST_ASSERT_FALSE(s_handler.bypass_auto_);
+  TEST_ASSERT_EQUAL(0, s_handler.ntp_changes_);
+
+  send("fan1/standardspeed=1300x");
+  TEST_ASSERT_EQUAL_STRING("config/bulk=ERROR value fan1/standardspeed", s_published.c_str());
+  send("fan1/standardspeed");
+  TEST_ASSERT_EQUAL_STRING("config/bulk=ERROR value fan1/standardspeed", s_published.c_str());
+  TEST_ASSERT_EQUAL(0, s_handler.fan1_);
+}
+
+void test_unknown_key_changes_nothing()
+{
+  // kwl/mode is a valid command, but not a configuration key
+  send("fan1/standardspeed=1300 mode=2");
+  TEST_ASSERT_EQUAL_STRING("config/bulk=ERROR key mode", s_published.c_str());
+  TEST_ASSERT_EQUAL(0, s_handler.fan1_);
+  send(" ;\n");
+  TEST_ASSERT_EQUAL_STRING("config/bulk=ERROR empty", s_published.c_str());
+}
+
+void test_busy_keeps_pending_ack()
+{
+  s_connected = false;
+  send("fan1/standardspeed=1300");
+  TEST_ASSERT_EQUAL(1300, s_handler.fan1_);
+  TEST_ASSERT_TRUE(s_published.empty());
+
+  // second configuration must not overwrite the pending acknowledgment
+  send("fan1/standardspeed=1400");
+  TEST_ASSERT_EQUAL(1300, s_handler.fan1_);
+
+  s_connected = true;
+  PublishTask::loop();
+  TEST_ASSERT_EQUAL_STRING("config/bulk=OK 1", s_published.c_str());
+
+  send("fan1/standardspeed=1400");
+  TEST_ASSERT_EQUAL_STRING("config/bulk=OK 1", s_published.c_str());
+  TEST_ASSERT_EQUAL(1400, s_handler.fan1_);
+}
+
+int main(int, char**)
+{
+  MessageHandler::begin(publishCallback, nullptr);
+  UNITY_BEGIN();
+  RUN_TEST(test_applies_all_pairs);
+  RUN_TEST(test_invalid_value_changes_nothing);
+  RUN_TEST(test_unknown_key_changes_nothing);
+  RUN_TEST(test_busy_keeps_pending_ack);
+  return UNITY_END();
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Tests of AsyncTWI and DacOutput against a simulated I2C slave.
+ *
+ * Off AVR, AsyncTWI runs the TWI state machine against a simulated bus.
+ * The slave here behaves like the Horter DAC: after its address, it takes
+ * the first channel followed by low and high byte for each consecutive
+ * channel. It can be told to refuse its address or data bytes to check
+ * retries and resending of failed channels.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "DacOutput.h"
+#include "KWLConfig.h"
+
+#include <AsyncTWI.h>
+#include <TimeScheduler.h>
+
+#include <vector>
+
+namespace {
+
+/// Simulated Horter DAC.
+class DacSlave : public AsyncTWI::Slave
+{
+public:
+  virtual bool start(uint8_t address) override
+  {
+    if (address != KWLConfig::DacI2COutAddr)
+      return false;
+    if (nack_address) {
+      --nack_address;
+      return false;
+    }
+    ++transactions;
+    pos_ = 0;
+    bytes.clear();
+    return true;
+  }
+
+  virtual bool receive(uint8_t data) override
+  {
+    if (nack_data) {
+      --nack_data;
+      return false;
+    }
+    bytes.push_back(data);
+    if (pos_ == 0)
+      channel_ = data;
+    else if (pos_ & 1)
+      low_ = data;
+    else if (channel_ < DacOutput::CHANNELS)
+      out[channel_++] = uint16_t(low_ | (data << 8));
+    ++pos_;
+    return bytes.size() != nack_at;
+  }
+
+  virtual void stop() override { ++stops; }
+
+  uint16_t out[DacOutput::CHANNELS] = {0, 0, 0, 0};   ///< Output values.
+  std::vector<uint8_t> bytes;   ///< Data bytes of the last transaction.
+  int transactions = 0;         ///< Count of acknowledged transactions.
+  int stops = 0;                ///< Count of STOP conditions.
+  int nack_address = 0;         ///< Count of address bytes to refuse.
+  int nack_data = 0;            ///< Count of data bytes to refuse.
+  size_t nack_at = 0;           ///< Take, but refuse data byte at this position (1-based, 0 for none).
+
+private:
+  uint8_t pos_ = 0;
+  uint8_t channel_ = 0;
+  uint8_t low_ = 0;
+};
+
+struct NullPrint : public Print
+{
+  virtual size_t write(uint8_t) override { return 1; }
+};
+
+NullPrint s_out;
+DacSlave s_slave;
+DacOutput s_dac;
+Scheduler::PollingScheduler s_scheduler;
+
+/// Run the poll tasks, which also completes simulated transactions.
+void run()
+{
+  for (int i = 0; i < 10; ++i)
+    s_scheduler.loop();
+}
+
+/// Completion statuses reported by AsyncTWI.
+std::vector<AsyncTWI::Status> s_status;
+
+void done(void*, AsyncTWI::Status status, const uint8_t*, uint8_t)
+{
+  s_status.push_back(status);
+}
+
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_twi_queue()
+{
+  const uint8_t data[AsyncTWI::MAX_DATA + 1] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  s_status.clear();
+  TEST_ASSERT_FALSE(AsyncTWI::write(KWLConfig::DacI2COutAddr, data, AsyncTWI::MAX_DATA + 1, done));
+
+  // transactions are sent one after another, completion is reported on poll
+  const int transactions = s_slave.transactions;
+  for (uint8_t i = 1; i <= AsyncTWI::QUEUE_SIZE; ++i)
+    TEST_ASSERT_TRUE(AsyncTWI::write(KWLConfig::DacI2COutAddr, data, i, done));
+  TEST_ASSERT_FALSE(AsyncTWI::write(KWLConfig::DacI2COutAddr, data, 1, done));
+  TEST_ASSERT_EQUAL(0, s_status.size());
+  AsyncTWI::poll();
+  TEST_ASSERT_TRUE(AsyncTWI::isIdle());
+  TEST_ASSERT_EQUAL(AsyncTWI::QUEUE_SIZE, s_status.size());
+  for (auto status : s_status)
+    TEST_ASSERT_TRUE(status == AsyncTWI::Status::Ok);
+  TEST_ASSERT_EQUAL(transactions + AsyncTWI::QUEUE_SIZE, s_slave.transactions);
+  TEST_ASSERT_EQUAL(AsyncTWI::QUEUE_SIZE, s_slave.bytes.size());
+}
+
+void test_twi_retry()
+{
+  const uint8_t data[3] = {3, 0x12, 0x34};
+  s_status.clear();
+
+  // address refused once, sent on retry
+  const auto retries = AsyncTWI::getRetryCount();
+  s_slave.nack_address = 1;
+  TEST_ASSERT_TRUE(AsyncTWI::write(KWLConfig::DacI2COutAddr, data, 3, done));
+  AsyncTWI::poll();
+  TEST_ASSERT_EQUAL(1, s_status.size());
+  TEST_ASSERT_TRUE(s_status[0] == AsyncTWI::Status::Ok);
+  TEST_ASSERT_EQUAL(retries + 1, AsyncTWI::getRetryCount());
+  TEST_ASSERT_EQUAL(0x3412, s_slave.out[3]);
+
+  // slave may refuse the last byte
+  s_slave.out[3] = 0;
+  s_slave.nack_at = 3;
+  TEST_ASSERT_TRUE(AsyncTWI::write(KWLConfig::DacI2COutAddr, data, 3, done));
+  AsyncTWI::poll();
+  s_slave.nack_at = 0;
+  TEST_ASSERT_TRUE(s_status[1] == AsyncTWI::Status::Ok);
+  TEST_ASSERT_EQUAL(retries + 1, AsyncTWI::getRetryCount());
+  TEST_ASSERT_EQUAL(0x3412, s_slave.out[3]);
+
+  // data refused on all attempts
+  const auto errors = AsyncTWI::getErrorCount();
+  s_slave.nack_data = 1 + AsyncTWI::MAX_RETRIES;
+  TEST_ASSERT_TRUE(AsyncTWI::write(KWLConfig::DacI2COutAddr, data, 3, done));
+  AsyncTWI::poll();
+  TEST_ASSERT_TRUE(s_status[2] == AsyncTWI::Status::DataNack);
+  TEST_ASSERT_EQUAL(errors + 1, AsyncTWI::getErrorCount());
+
+  // unknown address
+  TEST_ASSERT_TRUE(AsyncTWI::write(KWLConfig::DacI2COutAddr + 1, data, 3, done));
+  AsyncTWI::poll();
+  TEST_ASSERT_TRUE(s_status[3] == AsyncTWI::Status::AddressNack);
+  TEST_ASSERT_EQUAL(errors + 2, AsyncTWI::getErrorCount());
+  TEST_ASSERT_TRUE(AsyncTWI::isIdle());
+}
+
+void test_dac_batch()
+{
+  const int transactions = s_slave.transactions;
+  s_dac.set(KWLConfig::DacChannelFan1, 500);
+  s_dac.set(KWLConfig::DacChannelFan2, 400);
+  s_dac.set(KWLConfig::DacChannelPreheater, 0);
+  TEST_ASSERT_EQUAL(transactions, s_slave.transactions);
+  run();
+  TEST_ASSERT_EQUAL(500, s_slave.out[KWLConfig::DacChannelFan1]);
+  TEST_ASSERT_EQUAL(400, s_slave.out[KWLConfig::DacChannelFan2]);
+  TEST_ASSERT_EQUAL(0, s_slave.out[KWLConfig::DacChannelPreheater]);
+  if (KWLConfig::DacSequentialWrite)
+    TEST_ASSERT_EQUAL(transactions + 1, s_slave.transactions);
+  else
+    TEST_ASSERT_EQUAL(transactions + 3, s_slave.transactions);
+}
+
+void test_dac_unchanged()
+{
+  const int transactions = s_slave.transactions;
+  const auto skipped = s_dac.getSkippedCount();
+  s_dac.set(KWLConfig::DacChannelFan1, 500);
+  s_dac.set(KWLConfig::DacChannelFan2, 400);
+  run();
+  TEST_ASSERT_EQUAL(transactions, s_slave.transactions);
+  TEST_ASSERT_EQUAL(skipped + 2, s_dac.getSkippedCount());
+
+  // value changed back before sending
+  s_dac.set(KWLConfig::DacChannelFan1, 501);
+  s_dac.set(KWLConfig::DacChannelFan1, 500);
+  run();
+  TEST_ASSERT_EQUAL(500, s_slave.out[KWLConfig::DacChannelFan1]);
+}
+
+void test_dac_channel_range()
+{
+  if (!KWLConfig::DacSequentialWrite) {
+    TEST_IGNORE_MESSAGE("DAC channels are sent separately");
+    return;
+  }
+  // channels between changed channels are sent, too
+  const int transactions = s_slave.transactions;
+  s_dac.set(KWLConfig::DacChannelPreheater, 7);
+  s_dac.set(KWLConfig::DacChannelFan1, 501);
+  run();
+  TEST_ASSERT_EQUAL(transactions + 1, s_slave.transactions);
+  const uint8_t expected[] = {0, 501 & 255, 501 >> 8, 400 & 255, 400 >> 8, 7, 0};
+  TEST_ASSERT_EQUAL(sizeof(expected), s_slave.bytes.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, s_slave.bytes.data(), sizeof(expected));
+}
+
+void test_dac_resend()
+{
+  // transaction fails after all retries, channel is sent again after a delay
+  const auto errors = AsyncTWI::getErrorCount();
+  s_slave.nack_address = 1 + AsyncTWI::MAX_RETRIES;
+  s_dac.set(KWLConfig::DacChannelFan2, 333);
+  run();
+  TEST_ASSERT_EQUAL(errors + 1, AsyncTWI::getErrorCount());
+  TEST_ASSERT_EQUAL(400, s_slave.out[KWLConfig::DacChannelFan2]);
+
+  const int transactions = s_slave.transactions;
+  ArduinoHost::advanceMicros(500000);
+  run();
+  TEST_ASSERT_EQUAL(transactions, s_slave.transactions);
+  ArduinoHost::advanceMicros(600000);
+  run();
+  TEST_ASSERT_EQUAL(transactions + 1, s_slave.transactions);
+  TEST_ASSERT_EQUAL(333, s_slave.out[KWLConfig::DacChannelFan2]);
+  TEST_ASSERT_EQUAL(errors + 1, AsyncTWI::getErrorCount());
+}
+
+int main(int, char**)
+{
+  AsyncTWI::setSlave(&s_slave);
+  s_dac.begin(s_out);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_twi_queue);
+  RUN_TEST(test_twi_retry);
+  RUN_TEST(test_dac_batch);
+  RUN_TEST(test_dac_unchanged);
+  RUN_TEST(test_dac_channel_range);
+  RUN_TEST(test_dac_resend);
+  return UNITY_END();
+}
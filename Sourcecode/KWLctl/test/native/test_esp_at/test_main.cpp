@@ -0,0 +1,473 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Tests of the ESP8266 AT driver against a simulated module.
+ *
+ * The simulated module answers AT commands like the AT firmware 1.x does
+ * and sends received data and link state changes as unsolicited messages.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include <EspAT.h>
+#include <EspClient.h>
+#include <EspUDP.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace {
+
+  /// Simulated ESP8266 module with AT firmware.
+  class ModuleSim : public Stream
+  {
+  public:
+    virtual int available() override { return int(in_.size()); }
+
+    virtual int read() override
+    {
+      if (in_.empty())
+        return -1;
+      auto c = uint8_t(in_.front());
+      in_.pop_front();
+      return c;
+    }
+
+    virtual int peek() override { return in_.empty() ? -1 : uint8_t(in_.front()); }
+
+    virtual size_t write(uint8_t c) override
+    {
+      if (send_left) {
+        // data of AT+CIPSEND
+        sent += char(c);
+        if (--send_left == 0) {
+          if (hold_send)
+            send_held = true;
+          else
+            confirmSend();
+        }
+        return 1;
+      }
+      cmd_ += char(c);
+      if (cmd_.size() >= 2 && cmd_.compare(cmd_.size() - 2, 2, "\r\n") == 0) {
+        handle(cmd_.substr(0, cmd_.size() - 2));
+        cmd_.clear();
+      }
+      return 1;
+    }
+
+    using Print::write;
+
+    /// Send bytes from the module to the controller.
+    void reply(const std::string& s) { in_.insert(in_.end(), s.begin(), s.end()); }
+
+    /// Confirm data of the held send.
+    void confirmSend()
+    {
+      send_held = false;
+      reply("\r\nRecv " + std::to_string(sent.size()) + " bytes\r\n\r\nSEND OK\r\n");
+    }
+
+    /// Get the last command (at least one must have been received).
+    const std::string& lastCommand() const { return cmds.back(); }
+
+    /// Check whether a command was received.
+    bool hasCommand(const std::string& c) const
+    {
+      for (auto& i : cmds)
+        if (i == c)
+          return true;
+      return false;
+    }
+
+    std::vector<std::string> cmds;  ///< Commands received.
+    std::string sent;               ///< Data of the last AT+CIPSEND.
+    int send_link = -1;             ///< Link of the last AT+CIPSEND.
+    size_t send_left = 0;           ///< Data bytes of AT+CIPSEND still expected.
+    bool mute = false;              ///< Don't answer commands.
+    bool fail_open = false;         ///< Fail AT+CIPSTART.
+    bool hold_send = false;         ///< Don't confirm sent data until confirmSend().
+    bool send_held = false;         ///< Set, if a send confirmation is held.
+    std::string status = "5";       ///< WiFi state reported by AT+CIPSTATUS.
+    std::string status_links;       ///< Open links reported by AT+CIPSTATUS.
+
+  private:
+    void handle(const std::string& c)
+    {
+      cmds.push_back(c);
+      if (mute)
+        return;
+      if (c.compare(0, 12, "AT+CIPSTART=") == 0) {
+        auto id = std::string(1, c[12]);
+        if (fail_open)
+          reply(id + ",CONNECT FAIL\r\n\r\nERROR\r\n");
+        else
+          reply(id + ",CONNECT\r\n\r\nOK\r\n");
+      } else if (c.compare(0, 11, "AT+CIPSEND=") == 0) {
+        send_link = c[11] - '0';
+        send_left = size_t(std::stoi(c.substr(13)));
+        sent.clear();
+        reply("\r\nOK\r\n> ");
+      } else if (c.compare(0, 12, "AT+CWJAP_CUR") == 0) {
+        reply("WIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n");
+      } else if (c == "AT+CIFSR") {
+        reply("+CIFSR:STAIP,\"192.168.1.50\"\r\n+CIFSR:STAMAC,\"aa:bb:cc:dd:ee:ff\"\r\n\r\nOK\r\n");
+      } else if (c == "AT+CIPSTATUS") {
+        reply("STATUS:" + status + "\r\n" + status_links + "\r\nOK\r\n");
+      } else if (c.compare(0, 12, "AT+CIPCLOSE=") == 0) {
+        reply(std::string(1, c[12]) + ",CLOSED\r\n\r\nOK\r\n");
+      } else {
+        reply("\r\nOK\r\n");
+      }
+    }
+
+    std::string cmd_;         ///< Command being received.
+    std::deque<char> in_;     ///< Bytes sent by the module.
+  };
+
+  ModuleSim* s_sim;
+  EspAT* s_esp;
+
+  /// Run the driver for given simulated milliseconds.
+  void run(unsigned long ms)
+  {
+    for (unsigned long i = 0; i < ms; ++i) {
+      ArduinoHost::advanceMicros(1000);
+      s_esp->loop();
+    }
+  }
+
+  /// Initialize the module and join the network.
+  void startUp()
+  {
+    s_esp->begin(*s_sim);
+    run(50);
+    TEST_ASSERT_TRUE(s_esp->isReady());
+    TEST_ASSERT_TRUE(s_esp->join("ap", "pw"));
+    run(20);
+    TEST_ASSERT_TRUE(s_esp->isLinkUp());
+    s_sim->status = "2";
+  }
+
+  /// Open a TCP connection with client on link 0.
+  void connect(EspClient& c)
+  {
+    TEST_ASSERT_TRUE(c.connectAsync(IPAddress(10, 0, 0, 1), 1883));
+    run(5);
+    TEST_ASSERT_TRUE(c.connected());
+  }
+
+  const uint8_t* bytes(const char* s) { return reinterpret_cast<const uint8_t*>(s); }
+}
+
+void setUp()
+{
+  ArduinoHost::setMicros(100000000UL);
+  ArduinoHost::setAutoAdvance(0);
+  s_sim = new ModuleSim;
+  s_esp = new EspAT;
+}
+
+void tearDown()
+{
+  delete s_esp;
+  delete s_sim;
+}
+
+void test_init_and_join()
+{
+  startUp();
+  TEST_ASSERT_FALSE(s_esp->isJoining());
+  TEST_ASSERT_TRUE(s_esp->localIP() == IPAddress(192, 168, 1, 50));
+  TEST_ASSERT_TRUE(s_sim->hasCommand("AT+CIPMUX=1"));
+  TEST_ASSERT_TRUE(s_sim->hasCommand("AT+CWJAP_CUR=\"ap\",\"pw\""));
+}
+
+void test_join_escapes_parameters()
+{
+  s_esp->begin(*s_sim);
+  run(50);
+  TEST_ASSERT_TRUE(s_esp->join("my \"AP\",2", "p\\w,\""));
+  TEST_ASSERT_EQUAL_STRING("AT+CWJAP_CUR=\"my \\\"AP\\\"\\,2\",\"p\\\\w\\,\\\"\"", s_sim->lastCommand().c_str());
+}
+
+void test_tcp_send_receive()
+{
+  startUp();
+  EspClient c(*s_esp);
+  connect(c);
+  TEST_ASSERT_EQUAL_STRING("AT+CIPSTART=0,\"TCP\",\"10.0.0.1\",1883", s_sim->lastCommand().c_str());
+  // small writes are collected into one send
+  TEST_ASSERT_EQUAL(5, c.write(bytes("hello"), 5));
+  TEST_ASSERT_EQUAL(6, c.write(bytes(" world"), 6));
+  run(5);
+  TEST_ASSERT_EQUAL_STRING("hello world", s_sim->sent.c_str());
+  TEST_ASSERT_EQUAL(0, s_sim->send_link);
+  // link state is cached, no traffic to the module
+  auto cmds = s_esp->getCommandCount();
+  for (int i = 0; i < 1000; ++i)
+    c.connected();
+  TEST_ASSERT_EQUAL_UINT32(cmds, s_esp->getCommandCount());
+  s_sim->reply("+IPD,0,4,10.0.0.1,1883:abcd\r\n");
+  TEST_ASSERT_EQUAL(4, c.available());
+  char buf[8] = {0};
+  TEST_ASSERT_EQUAL(4, c.read(reinterpret_cast<uint8_t*>(buf), 8));
+  TEST_ASSERT_EQUAL_STRING("abcd", buf);
+  // remote close
+  s_sim->reply("0,CLOSED\r\n");
+  run(2);
+  TEST_ASSERT_FALSE(c.connected());
+}
+
+void test_udp()
+{
+  startUp();
+  EspUDP udp(*s_esp);
+  TEST_ASSERT_TRUE(udp.begin(8888));
+  TEST_ASSERT_TRUE(udp.beginPacket(IPAddress(10, 0, 0, 2), 123));
+  uint8_t pkt[48] = {0x1b};
+  TEST_ASSERT_EQUAL(48, udp.write(pkt, 48));
+  TEST_ASSERT_TRUE(udp.endPacket());
+  run(5);
+  TEST_ASSERT_EQUAL_STRING("AT+CIPSTART=0,\"UDP\",\"10.0.0.2\",123,8888,2", s_sim->cmds[s_sim->cmds.size() - 2].c_str());
+  TEST_ASSERT_EQUAL_STRING("AT+CIPSEND=0,48,\"10.0.0.2\",123", s_sim->lastCommand().c_str());
+  TEST_ASSERT_EQUAL(48, s_sim->sent.size());
+  TEST_ASSERT_EQUAL(0, udp.parsePacket());
+  s_sim->reply("+IPD,0,48,10.0.0.2,123:" + std::string(48, 'n'));
+  TEST_ASSERT_EQUAL(48, udp.parsePacket());
+  TEST_ASSERT_TRUE(udp.remoteIP() == IPAddress(10, 0, 0, 2));
+  TEST_ASSERT_EQUAL(123, udp.remotePort());
+  char buf[8];
+  TEST_ASSERT_EQUAL(8, udp.read(buf, 8));
+  TEST_ASSERT_EQUAL('n', buf[0]);
+}
+
+void test_rx_overflow_is_drained()
+{
+  startUp();
+  EspClient c(*s_esp);
+  connect(c);
+  // more data than the link buffer, nobody reads, followed by a response
+  s_sim->hold_send = true;
+  TEST_ASSERT_EQUAL(4, c.write(bytes("ping"), 4));
+  run(2);
+  TEST_ASSERT_TRUE(s_sim->send_held);
+  s_sim->reply("+IPD,0,300:" + std::string(300, 'x'));
+  s_sim->confirmSend();
+  run(2);
+  // all bytes were taken from the UART and the response was still parsed
+  TEST_ASSERT_EQUAL(0, s_sim->available());
+  TEST_ASSERT_EQUAL_UINT32(300 - (EspAT::LINK_RX_SIZE - 1), s_esp->getOverflowCount());
+  TEST_ASSERT_TRUE(s_esp->flush(0));
+  TEST_ASSERT_EQUAL_UINT32(0, s_esp->getTimeoutCount());
+  // the stream has a gap, so the link is closed
+  TEST_ASSERT_EQUAL_UINT32(1, s_esp->getOverflowCloseCount());
+  TEST_ASSERT_EQUAL_STRING("AT+CIPCLOSE=0", s_sim->lastCommand().c_str());
+  TEST_ASSERT_TRUE(s_esp->isLinkUp());
+  // data received before can still be read
+  int count = 0;
+  while (c.read() >= 0)
+    ++count;
+  TEST_ASSERT_EQUAL(EspAT::LINK_RX_SIZE - 1, count);
+  TEST_ASSERT_FALSE(c.connected());
+}
+
+void test_server_rx_overflow_keeps_newest()
+{
+  startUp();
+  s_esp->listen(9100);
+  run(5);
+  // a request larger than the link buffer arrives before the server polls
+  std::string request = "GET /metrics HTTP/1.1\r\n" + std::string(250, 'h') + "\r\nTAIL\r\n\r\n";
+  s_sim->reply("1,CONNECT\r\n+IPD,1," + std::to_string(request.size()) + ":" + request);
+  run(2);
+  TEST_ASSERT_EQUAL(0, s_sim->available());
+  TEST_ASSERT_EQUAL_UINT32(request.size() - (EspAT::LINK_RX_SIZE - 1), s_esp->getOverflowCount());
+  // the link stays open and the end of the request is readable
+  TEST_ASSERT_EQUAL_UINT32(0, s_esp->getOverflowCloseCount());
+  TEST_ASSERT_FALSE(s_sim->hasCommand("AT+CIPCLOSE=1"));
+  auto link = s_esp->accept();
+  TEST_ASSERT_EQUAL(1, link);
+  EspClient c(*s_esp);
+  c.attach(uint8_t(link));
+  TEST_ASSERT_TRUE(c.connected());
+  std::string received;
+  int ch;
+  while ((ch = c.read()) >= 0)
+    received += char(ch);
+  TEST_ASSERT_EQUAL(EspAT::LINK_RX_SIZE - 1, received.size());
+  std::string tail = request.substr(request.size() - received.size());
+  TEST_ASSERT_EQUAL_STRING(tail.c_str(), received.c_str());
+}
+
+void test_truncated_datagram_discarded()
+{
+  startUp();
+  EspUDP udp(*s_esp);
+  TEST_ASSERT_TRUE(udp.begin(8888));
+  TEST_ASSERT_TRUE(udp.beginPacket(IPAddress(10, 0, 0, 2), 123));
+  TEST_ASSERT_TRUE(udp.endPacket());
+  run(5);
+  s_sim->reply("+IPD,0,100,10.0.0.2,123:" + std::string(100, 'n') + "\r\nOK\r\n");
+  TEST_ASSERT_EQUAL(0, udp.parsePacket());
+  TEST_ASSERT_EQUAL(0, udp.available());
+  TEST_ASSERT_EQUAL(0, s_sim->available());
+}
+
+void test_write_does_not_wait()
+{
+  startUp();
+  EspClient c(*s_esp);
+  connect(c);
+  EspUDP udp(*s_esp);
+  TEST_ASSERT_TRUE(udp.begin(8888));
+  TEST_ASSERT_TRUE(udp.beginPacket(IPAddress(10, 0, 0, 2), 123));
+  run(5);
+  s_sim->hold_send = true;
+  TEST_ASSERT_EQUAL(10, c.write(bytes("0123456789"), 10));
+  run(2);
+  TEST_ASSERT_TRUE(s_sim->send_held);
+  auto start = micros();
+  // buffer is in use by the TCP link, other link can't write
+  TEST_ASSERT_EQUAL(0, udp.write(bytes("x"), 1));
+  TEST_ASSERT_FALSE(udp.endPacket());
+  // same link can append while the send is in flight
+  std::string big(EspAT::TX_SIZE, 'b');
+  TEST_ASSERT_EQUAL(EspAT::TX_SIZE - 10, c.availableForWrite());
+  TEST_ASSERT_EQUAL(0, c.write(bytes(big.c_str()), EspAT::TX_SIZE - 6));
+  TEST_ASSERT_EQUAL(100, c.write(bytes(big.c_str()), 100));
+  // data larger than the buffer is accepted partially
+  std::string huge(EspAT::TX_SIZE + 50, 'h');
+  TEST_ASSERT_EQUAL(EspAT::TX_SIZE - 110, c.write(bytes(huge.c_str()), huge.size()));
+  TEST_ASSERT_EQUAL(0, c.availableForWrite());
+  TEST_ASSERT_EQUAL_UINT32(start, micros());
+  // confirmation sends the appended data
+  s_sim->hold_send = false;
+  s_sim->confirmSend();
+  run(5);
+  TEST_ASSERT_EQUAL(EspAT::TX_SIZE - 10, s_sim->sent.size());
+  TEST_ASSERT_EQUAL('b', s_sim->sent[0]);
+  TEST_ASSERT_EQUAL(EspAT::TX_SIZE, c.availableForWrite());
+}
+
+void test_failed_send_closes_link()
+{
+  startUp();
+  EspClient c(*s_esp);
+  connect(c);
+  s_sim->hold_send = true;
+  TEST_ASSERT_EQUAL(4, c.write(bytes("ping"), 4));
+  run(2);
+  s_sim->send_held = false;
+  s_sim->reply("\r\nSEND FAIL\r\n");
+  run(2);
+  TEST_ASSERT_FALSE(s_esp->flush(0));
+  TEST_ASSERT_EQUAL_STRING("AT+CIPCLOSE=0", s_sim->lastCommand().c_str());
+  TEST_ASSERT_FALSE(c.connected());
+}
+
+void test_connect_is_bounded()
+{
+  startUp();
+  s_sim->mute = true;
+  EspClient c(*s_esp);
+  ArduinoHost::setAutoAdvance(100);
+  auto start = millis();
+  TEST_ASSERT_EQUAL(0, c.connect(IPAddress(10, 0, 0, 1), 1883));
+  TEST_ASSERT_TRUE(millis() - start <= 1010);
+  ArduinoHost::setAutoAdvance(0);
+}
+
+void test_failed_open()
+{
+  startUp();
+  s_sim->fail_open = true;
+  EspClient c(*s_esp);
+  TEST_ASSERT_TRUE(c.connectAsync(IPAddress(10, 0, 0, 9), 80));
+  run(5);
+  TEST_ASSERT_FALSE(c.isConnecting());
+  TEST_ASSERT_FALSE(c.connected());
+}
+
+void test_status_detects_lost_close()
+{
+  startUp();
+  EspClient c(*s_esp);
+  connect(c);
+  run(10100);
+  TEST_ASSERT_FALSE(c.connected());
+}
+
+void test_restart_resets_parser()
+{
+  startUp();
+  EspClient c(*s_esp);
+  connect(c);
+  // module stops in the middle of data, e.g., after a crash
+  s_sim->reply("+IPD,0,100:abc");
+  run(2);
+  s_sim->mute = true;
+  run(11000);
+  TEST_ASSERT_TRUE(s_esp->getTimeoutCount() >= 1);
+  TEST_ASSERT_FALSE(s_esp->isReady());
+  TEST_ASSERT_TRUE(s_esp->getLinkState(0) == EspAT::LinkState::Closed);
+  // responses after restart are parsed as lines again
+  s_sim->mute = false;
+  run(1100);
+  TEST_ASSERT_TRUE(s_esp->isReady());
+  run(100);
+  TEST_ASSERT_TRUE(s_esp->isLinkUp());
+}
+
+void test_module_reset()
+{
+  startUp();
+  s_sim->reply("ready\r\n");
+  run(1);
+  TEST_ASSERT_FALSE(s_esp->isReady());
+  TEST_ASSERT_FALSE(s_esp->isLinkUp());
+  run(2000);
+  TEST_ASSERT_TRUE(s_esp->isReady());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_init_and_join);
+  RUN_TEST(test_join_escapes_parameters);
+  RUN_TEST(test_tcp_send_receive);
+  RUN_TEST(test_udp);
+  RUN_TEST(test_rx_overflow_is_drained);
+  RUN_TEST(test_server_rx_overflow_keeps_newest);
+  RUN_TEST(test_truncated_datagram_discarded);
+  RUN_TEST(test_write_does_not_wait);
+  RUN_TEST(test_failed_send_closes_link);
+  RUN_TEST(test_connect_is_bounded);
+  RUN_TEST(test_failed_open);
+  RUN_TEST(test_status_detects_lost_close);
+  RUN_TEST(test_restart_resets_parser);
+  RUN_TEST(test_module_reset);
+  return UNITY_END();
+}
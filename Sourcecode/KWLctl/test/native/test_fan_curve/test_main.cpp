@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Learned PWM to RPM characteristic of a fan.
+ *
+ * Checks FanCurve learning, inversion, monotonicity and its compact
+ * persistent form, then lets Fan::learnCurve() learn the curve of a
+ * simulated fan in closed loop and checks, that the hourly store writes
+ * only curves, which moved by more than one storage unit.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "DacOutput.h"
+#include "FanControl.h"
+#include "KWLConfig.h"
+
+#include <FanCurve.h>
+#include <TimeScheduler.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+/// Curve with knots at 0, 200, ..., 2000 rpm.
+FanCurve linearCurve()
+{
+  uint8_t stored[FanCurve::POINTS];
+  memset(stored, FanCurve::UNKNOWN, sizeof(stored));
+  FanCurve curve;
+  curve.load(stored, 2000);
+  return curve;
+}
+
+/// Simulated fan without inertia: speed follows PWM immediately.
+double plantSpeed(int pwm)
+{
+  if (pwm <= 80)
+    return 0;
+  return 3300 * (1 - exp(-(pwm - 80) / 920.0 * 1.8)) / (1 - exp(-1.8));
+}
+
+struct NullPrint : public Print
+{
+  virtual size_t write(uint8_t) override { return 1; }
+};
+
+NullPrint s_out;
+KWLPersistentConfig s_config;
+DacOutput s_dac;
+FanControl* s_fans;
+Scheduler::PollingScheduler s_scheduler;
+double s_phase[2] = {0, 0};
+unsigned long s_time = 0;
+
+/// Simulate given time in milliseconds, delivering tacho impulses of both fans.
+void simulate(unsigned long ms)
+{
+  static const uint8_t pwm_pins[2] = {KWLConfig::PinFan1PWM, KWLConfig::PinFan2PWM};
+  static const uint8_t tacho_pins[2] = {KWLConfig::PinFan1Tacho, KWLConfig::PinFan2Tacho};
+  static const double ipr[2] = {KWLConfig::StandardFan1ImpulsesPerRotation, KWLConfig::StandardFan2ImpulsesPerRotation};
+  while (ms--) {
+    for (int f = 0; f < 2; ++f) {
+      // Fan::setSpeed() writes PWM / 4
+      const double inc = plantSpeed(ArduinoHost::getPinOutput(pwm_pins[f]) * 4) / 60 * 0.001 * ipr[f];
+      const double before = s_phase[f];
+      s_phase[f] += inc;
+      for (int k = 1; s_phase[f] >= k; ++k) {
+        ArduinoHost::setMicros(s_time + (unsigned long)((k - before) / inc * 1000));
+        ArduinoHost::raiseInterrupt(uint8_t(digitalPinToInterrupt(tacho_pins[f])));
+      }
+      s_phase[f] -= floor(s_phase[f]);
+    }
+    s_time += 1000;
+    ArduinoHost::setMicros(s_time);
+    s_scheduler.loop();
+  }
+}
+
+/// Deviation of the learned curve of fan 1 from the plant at the current PWM signal in percent.
+double curveError()
+{
+  const int pwm = ArduinoHost::getPinOutput(KWLConfig::PinFan1PWM) * 4;
+  const double expected = plantSpeed(pwm);
+  return fabs(s_fans->getFan1().getCurve().getSpeed(pwm) - expected) / expected * 100;
+}
+
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_learn()
+{
+  // error splits between the neighboring knots by distance
+  FanCurve curve = linearCurve();
+  curve.learn(130, curve.getSpeed(130) + 160, 0);
+  TEST_ASSERT_EQUAL(200 + 112, curve.getKnot(1));
+  TEST_ASSERT_EQUAL(400 + 48, curve.getKnot(2));
+  TEST_ASSERT_EQUAL(600, curve.getKnot(3));
+  // ... so the curve moves towards the observation by the weighted share
+  TEST_ASSERT_EQUAL(312 + (448 - 312) * 30 / 100, curve.getSpeed(130));
+
+  // with learning rate 1/16, errors below 16 rpm at a knot are truncated away in both directions
+  curve = linearCurve();
+  curve.learn(500, curve.getSpeed(500) + 15, 4);
+  curve.learn(500, curve.getSpeed(500) - 15, 4);
+  TEST_ASSERT_EQUAL(1000, curve.getKnot(5));
+  curve.learn(500, curve.getSpeed(500) + 16, 4);
+  TEST_ASSERT_EQUAL(1001, curve.getKnot(5));
+  curve.learn(500, curve.getSpeed(500) - 32, 4);
+  TEST_ASSERT_EQUAL(999, curve.getKnot(5));
+  curve.learn(550, curve.getSpeed(550) + 31, 4);
+  TEST_ASSERT_EQUAL(999, curve.getKnot(5));
+  TEST_ASSERT_EQUAL(1200, curve.getKnot(6));
+
+  // PWM out of range is ignored
+  curve.learn(-1, 3000, 0);
+  curve.learn(FanCurve::MAX_PWM + 1, 3000, 0);
+  TEST_ASSERT_EQUAL(0, curve.getKnot(0));
+  TEST_ASSERT_EQUAL(2000, curve.getKnot(FanCurve::POINTS - 1));
+}
+
+void test_get_pwm_inverse()
+{
+  FanCurve curve = linearCurve();
+  for (uint8_t i = 0; i < FanCurve::POINTS; ++i)
+    curve.setKnot(i, int(plantSpeed(i * FanCurve::PWM_STEP)));
+  for (int pwm = 90; pwm <= FanCurve::MAX_PWM; pwm += 7) {
+    TEST_ASSERT_INT_WITHIN(1, pwm, curve.getPWM(curve.getSpeed(pwm)));
+    // PWM for the speed reaches it (truncation doesn't undershoot by more than one PWM step)
+    const int speed = curve.getSpeed(pwm);
+    TEST_ASSERT_TRUE(curve.getSpeed(curve.getPWM(speed)) <= speed);
+    TEST_ASSERT_TRUE(curve.getSpeed(curve.getPWM(speed) + 1) >= speed);
+  }
+  // out of reach below and above
+  TEST_ASSERT_EQUAL(0, curve.getPWM(0));
+  TEST_ASSERT_EQUAL(FanCurve::MAX_PWM, curve.getPWM(curve.getKnot(FanCurve::POINTS - 1) + 1));
+  // PWM beyond range is limited
+  TEST_ASSERT_EQUAL(0, curve.getSpeed(-100));
+  TEST_ASSERT_EQUAL(curve.getKnot(FanCurve::POINTS - 1), curve.getSpeed(FanCurve::MAX_PWM + 100));
+
+  // flat segments (fan stands still below 100 PWM) yield the end of the flat part
+  curve.setKnot(0, 0);
+  curve.setKnot(1, 0);
+  TEST_ASSERT_EQUAL(0, curve.getPWM(0));
+  TEST_ASSERT_INT_WITHIN(1, 150, curve.getPWM(curve.getSpeed(150)));
+}
+
+void test_monotonic()
+{
+  // decreasing stored knots are raised to the previous knot
+  uint8_t stored[FanCurve::POINTS] = {0, 20, 40, 30, 50, 60, 55, 70, 80, 90, 100};
+  FanCurve curve;
+  curve.load(stored, 2000);
+  for (uint8_t i = 1; i < FanCurve::POINTS; ++i)
+    TEST_ASSERT_TRUE(curve.getKnot(i) >= curve.getKnot(i - 1));
+  TEST_ASSERT_EQUAL(40 * FanCurve::SPEED_UNIT, curve.getKnot(3));
+  TEST_ASSERT_EQUAL(60 * FanCurve::SPEED_UNIT, curve.getKnot(6));
+
+  // setting or learning a knot above the next one pulls the rest of the curve up
+  curve = linearCurve();
+  curve.setKnot(4, 1500);
+  TEST_ASSERT_EQUAL(1500, curve.getKnot(4));
+  TEST_ASSERT_EQUAL(1500, curve.getKnot(5));
+  TEST_ASSERT_EQUAL(1500, curve.getKnot(6));
+  TEST_ASSERT_EQUAL(1600, curve.getKnot(8));
+  // ... and a knot below the previous one stays at it
+  curve.setKnot(2, 100);
+  TEST_ASSERT_EQUAL(200, curve.getKnot(2));
+  curve.learn(300, 0, 0);
+  for (uint8_t i = 1; i < FanCurve::POINTS; ++i)
+    TEST_ASSERT_TRUE(curve.getKnot(i) >= curve.getKnot(i - 1));
+}
+
+void test_save_load()
+{
+  FanCurve curve = linearCurve();
+  static const int speeds[] = {0, 7, 8, 1000, 1007, 1008, 1015, 1016, 2047, 3000, 4064};
+  for (uint8_t i = 0; i < FanCurve::POINTS; ++i)
+    curve.setKnot(i, speeds[i]);
+  uint8_t stored[FanCurve::POINTS];
+  curve.save(stored);
+  static const uint8_t expected[] = {0, 0, 1, 63, 63, 63, 63, 64, 128, 188, 254};
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, stored, FanCurve::POINTS);
+  FanCurve loaded;
+  loaded.load(stored, 2000);
+  for (uint8_t i = 0; i < FanCurve::POINTS; ++i)
+    TEST_ASSERT_INT_WITHIN(FanCurve::SPEED_UNIT / 2, speeds[i], loaded.getKnot(i));
+
+  // unknown knots are linear up to the nominal speed
+  stored[5] = FanCurve::UNKNOWN;
+  memset(stored + 8, FanCurve::UNKNOWN, 3);
+  loaded.load(stored, 3200);
+  TEST_ASSERT_EQUAL(1600, loaded.getKnot(5));
+  TEST_ASSERT_EQUAL(3200, loaded.getKnot(10));
+  TEST_ASSERT_EQUAL(1600, loaded.getKnot(6));  // monotonic over the loaded knot 6
+}
+
+void test_saturation()
+{
+  FanCurve curve = linearCurve();
+  curve.setKnot(10, 5000);
+  TEST_ASSERT_EQUAL(FanCurve::MAX_SPEED, curve.getKnot(10));
+  TEST_ASSERT_EQUAL(4064, FanCurve::MAX_SPEED);
+  curve.learn(1000, 10000, 0);
+  TEST_ASSERT_EQUAL(FanCurve::MAX_SPEED, curve.getKnot(10));
+  curve.learn(0, -1000, 0);
+  TEST_ASSERT_EQUAL(0, curve.getKnot(0));
+  // saturated knot doesn't collide with unknown marker
+  uint8_t stored[FanCurve::POINTS];
+  curve.save(stored);
+  TEST_ASSERT_EQUAL(FanCurve::UNKNOWN - 1, stored[10]);
+  // unreachable speed yields maximum PWM
+  TEST_ASSERT_EQUAL(FanCurve::MAX_PWM, curve.getPWM(5000));
+}
+
+void test_moved_from()
+{
+  FanCurve curve = linearCurve();
+  uint8_t stored[FanCurve::POINTS];
+  curve.save(stored);
+  TEST_ASSERT_FALSE(curve.movedFrom(stored));
+  // one unit is tolerated, more is a move
+  curve.setKnot(5, curve.getKnot(5) + FanCurve::SPEED_UNIT);
+  TEST_ASSERT_FALSE(curve.movedFrom(stored));
+  curve.setKnot(5, curve.getKnot(5) + FanCurve::SPEED_UNIT);
+  TEST_ASSERT_TRUE(curve.movedFrom(stored));
+  curve.setKnot(5, 1000 - 2 * FanCurve::SPEED_UNIT);
+  TEST_ASSERT_TRUE(curve.movedFrom(stored));
+  // unknown knots always need to be stored
+  curve = linearCurve();
+  stored[3] = FanCurve::UNKNOWN;
+  TEST_ASSERT_TRUE(curve.movedFrom(stored));
+}
+
+void test_learn_curve_in_loop()
+{
+  // initial curve is linear up to nominal speed, the plant is not
+  s_fans->setVentilationMode(2);
+  simulate(600000);
+  const double error = curveError();
+  char buffer[120];
+  snprintf(buffer, sizeof(buffer), "learned curve at PWM %d: error %.2f%%",
+           ArduinoHost::getPinOutput(KWLConfig::PinFan1PWM) * 4, error);
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_TRUE(error < 2);
+
+  // switched off fan doesn't learn
+  uint8_t before[FanCurve::POINTS], after[FanCurve::POINTS];
+  s_fans->getFan1().getCurve().save(before);
+  s_fans->setVentilationMode(0);
+  simulate(60000);
+  s_fans->getFan1().getCurve().save(after);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(before, after, FanCurve::POINTS);
+
+  // in another mode, the curve is learned at the new operating point
+  s_fans->setVentilationMode(3);
+  simulate(600000);
+  TEST_ASSERT_TRUE(curveError() < 2);
+}
+
+void test_store_hysteresis()
+{
+  // first store after an hour writes the learned curve
+  s_fans->setVentilationMode(2);
+  simulate(3600000UL);
+  uint8_t stored[FanCurve::POINTS];
+  s_fans->getFan1().getCurve().save(stored);
+  const int knot = ArduinoHost::getPinOutput(KWLConfig::PinFan1PWM) * 4 / FanCurve::PWM_STEP;
+  TEST_ASSERT_TRUE(stored[knot] != FanCurve::UNKNOWN);
+  TEST_ASSERT_FALSE(s_fans->getFan1().getCurve().movedFrom(s_config.getFanCurve(0)));
+
+  // a knot off by one unit is not rewritten
+  uint8_t modified[FanCurve::POINTS];
+  memcpy(modified, s_config.getFanCurve(0), sizeof(modified));
+  ++modified[knot];
+  s_config.setFanCurve(0, modified);
+  simulate(3600000UL);
+  TEST_ASSERT_EQUAL(modified[knot], s_config.getFanCurve(0)[knot]);
+
+  // a knot off by more is rewritten
+  modified[knot] = uint8_t(modified[knot] + 2);
+  s_config.setFanCurve(0, modified);
+  simulate(3600000UL);
+  TEST_ASSERT_INT_WITHIN(1, modified[knot] - 3, s_config.getFanCurve(0)[knot]);
+  TEST_ASSERT_FALSE(s_fans->getFan1().getCurve().movedFrom(s_config.getFanCurve(0)));
+}
+
+int main(int, char**)
+{
+  ArduinoHost::clearEEPROM();
+  s_config.begin(s_out);
+  FanControl fans(s_config, s_dac, nullptr);
+  s_fans = &fans;
+  fans.begin(s_out);
+  fans.setCalculateSpeedMode(FanCalculateSpeedMode::PID);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_learn);
+  RUN_TEST(test_get_pwm_inverse);
+  RUN_TEST(test_monotonic);
+  RUN_TEST(test_save_load);
+  RUN_TEST(test_saturation);
+  RUN_TEST(test_moved_from);
+  RUN_TEST(test_learn_curve_in_loop);
+  RUN_TEST(test_store_hysteresis);
+  return UNITY_END();
+}
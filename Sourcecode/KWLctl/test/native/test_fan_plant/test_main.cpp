@@ -0,0 +1,578 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Fan regulation against simulated fans with inertia.
+ *
+ * Each fan is modeled by a static curve (PWM to rpm) and a first-order lag
+ * with time constant tau, driven by the fan channels of a simulated DAC.
+ * Tacho impulses are generated from the simulated rotation and delivered to
+ * the tacho interrupt at their exact time, so the real FanControl, FanRPM and
+ * PID run in a closed loop. The tests step through ventilation modes and
+ * report how fast the fans settle within 3 % of the setpoint (the band
+ * FanControl considers stable) and how often the regulation runs.
+ * Calibration is checked for time and precision, also with jitter on the
+ * tacho impulses, against the previous calibration by PID averaging on the
+ * same fans. Stepless airflow commands are checked for payload validation,
+ * ramp rate and switching off and on.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "DacOutput.h"
+#include "FanControl.h"
+#include "KWLConfig.h"
+#include "MQTTTopic.hpp"
+
+#include <FanRPM.h>
+#include <FixedPID.h>
+#include <TimeScheduler.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <string>
+
+namespace {
+
+/// Simulated fan.
+struct Plant
+{
+  double gain;    ///< Speed at full PWM.
+  double shape;   ///< Curvature of the static curve.
+  double dead;    ///< PWM below which the fan stands still.
+  double tau;     ///< Time constant of the fan inertia in seconds.
+  double jitter;  ///< Maximum deviation of tacho impulses as fraction of impulse period.
+  double rpm;     ///< Current true speed.
+  double phase;   ///< Fraction of rotation since the last tacho impulse.
+  std::deque<unsigned long> edges;  ///< Times of pending tacho impulses.
+
+  /// Steady-state speed for given PWM (0-1000).
+  double steady(int pwm) const
+  {
+    if (pwm <= dead)
+      return 0;
+    double x = (pwm - dead) / (1000 - dead);
+    if (shape > 0)
+      return gain * (1 - exp(-x * shape)) / (1 - exp(-shape));
+    return gain * pow(x, -shape);
+  }
+};
+
+/// Simulated DAC, the fans follow its 0-10 V outputs.
+class DacSlave : public AsyncTWI::Slave
+{
+public:
+  virtual bool start(uint8_t address) override
+  {
+    pos_ = 0;
+    return address == KWLConfig::DacI2COutAddr;
+  }
+
+  virtual bool receive(uint8_t data) override
+  {
+    if (pos_ == 0)
+      channel_ = data;
+    else if (pos_ & 1)
+      low_ = data;
+    else if (channel_ < DacOutput::CHANNELS)
+      out[channel_++] = uint16_t(low_ | (data << 8));
+    ++pos_;
+    return true;
+  }
+
+  virtual void stop() override {}
+
+  uint16_t out[DacOutput::CHANNELS] = {0, 0, 0, 0};   ///< Output values.
+
+private:
+  uint8_t pos_ = 0;
+  uint8_t channel_ = 0;
+  uint8_t low_ = 0;
+};
+
+/*!
+ * @brief Calibration of one fan as implemented before the sweep and fit.
+ *
+ * Regulates each ventilation mode by the PID once per second until 30 PWM
+ * values with the speed within the precision were found and averages them.
+ * Kept as a reference to compare the current calibration with.
+ */
+class PreviousCalibration
+{
+public:
+  explicit PreviousCalibration(double ipr) :
+    rpm_(FanRPM::multiplier_t(FanRPM::RPM_MULTIPLIER_BASE / ipr)),
+    pid_(CONS_TUNINGS, 1000, 0, FixedPID::fromInt(1000))
+  {}
+
+  /// Start calibration from current output.
+  void start(int standard_speed, int pwm)
+  {
+    standard_speed_ = standard_speed;
+    tech_setpoint_ = pwm;
+    pid_.stop();
+    pid_.start(FixedPID::input_t(rpm_.getSpeed()), FixedPID::fromInt(pwm));
+  }
+
+  void prepare() { good_count_ = 0; }
+
+  bool step(unsigned mode)
+  {
+    const int current_speed = rpm_.getSpeed();
+    if (fabs(KWLConfig::StandardKwlModeFactor[mode]) < 0.01) {
+      pwm_[mode] = 0;
+      return true;
+    }
+    const int speed_setpoint = int(standard_speed_ * KWLConfig::StandardKwlModeFactor[mode]);
+    const unsigned max_gap = unsigned(speed_setpoint * KWLConfig::StandardKwlFanPrecisionPercent / 100) + 1;
+    const unsigned gap = unsigned(abs(speed_setpoint - current_speed));
+    if (gap < max_gap && good_count_ < REQUIRED_GOOD_PWM_COUNT)
+      good_pwm_[good_count_++] = tech_setpoint_;
+    if (good_count_ >= REQUIRED_GOOD_PWM_COUNT) {
+      long sum = 0;
+      for (unsigned i = 0; i < REQUIRED_GOOD_PWM_COUNT; ++i)
+        sum += good_pwm_[i];
+      pwm_[mode] = int(sum / REQUIRED_GOOD_PWM_COUNT);
+      return true;
+    }
+    pid_.setTunings((gap < 1000) ? CONS_TUNINGS : AGG_TUNINGS);
+    FixedPID::value_t output;
+    if (pid_.compute(FixedPID::input_t(current_speed), FixedPID::input_t(speed_setpoint), output))
+      tech_setpoint_ = constrain(FixedPID::toInt(output), 0, 1000);
+    return false;
+  }
+
+  FanRPM& rpm() { return rpm_; }
+  int getOutput() const { return tech_setpoint_; }
+  int getPWM(unsigned mode) const { return pwm_[mode]; }
+
+private:
+  static constexpr unsigned REQUIRED_GOOD_PWM_COUNT = 30;
+  static constexpr FixedPID::Tunings AGG_TUNINGS = FixedPID::tunings(0.25, 0.1, 0.001, 1000);
+  static constexpr FixedPID::Tunings CONS_TUNINGS = FixedPID::tunings(0.05, 0.1, 0.001, 1000);
+
+  FanRPM rpm_;
+  FixedPID pid_;
+  int standard_speed_ = 0;
+  int tech_setpoint_ = 0;
+  int good_pwm_[REQUIRED_GOOD_PWM_COUNT];
+  unsigned good_count_ = 0;
+  int pwm_[MAX_FAN_MODE_CNT] = {};
+};
+
+constexpr FixedPID::Tunings PreviousCalibration::AGG_TUNINGS;
+constexpr FixedPID::Tunings PreviousCalibration::CONS_TUNINGS;
+
+struct NullPrint : public Print
+{
+  virtual size_t write(uint8_t) override { return 1; }
+};
+
+NullPrint s_out;
+DacSlave s_slave;
+KWLPersistentConfig s_config;
+DacOutput s_dac;
+FanControl* s_fans;
+Scheduler::PollingScheduler s_scheduler;
+Plant s_plant[2];
+PreviousCalibration s_previous[2] = {
+  PreviousCalibration(KWLConfig::StandardFan1ImpulsesPerRotation),
+  PreviousCalibration(KWLConfig::StandardFan2ImpulsesPerRotation)
+};
+bool s_previous_drives = false;   ///< Set, if the fans follow the previous calibration instead of the DAC.
+unsigned long s_time = 0;
+
+/// Count of regulation runs so far.
+unsigned long regulationRuns()
+{
+  for (auto i = Scheduler::TaskTimingStats::begin(); i != Scheduler::TaskTimingStats::end(); ++i)
+    if (strcmp(reinterpret_cast<const char*>(i->getName()), "FanControl") == 0)
+      return i->getMeasurementCount();
+  return 0;
+}
+
+/// Simulate one millisecond of both fans, then run the scheduler.
+void tick()
+{
+  static const uint8_t channels[2] = {KWLConfig::DacChannelFan1, KWLConfig::DacChannelFan2};
+  static const uint8_t tacho_pins[2] = {KWLConfig::PinFan1Tacho, KWLConfig::PinFan2Tacho};
+  static const double ipr[2] = {KWLConfig::StandardFan1ImpulsesPerRotation, KWLConfig::StandardFan2ImpulsesPerRotation};
+  for (int f = 0; f < 2; ++f) {
+    Plant& p = s_plant[f];
+    const int pwm = s_previous_drives ? s_previous[f].getOutput() : s_slave.out[channels[f]];
+    p.rpm += (p.steady(pwm) - p.rpm) * 0.001 / p.tau;
+    double inc = p.rpm / 60 * 0.001 * ipr[f];
+    double before = p.phase;
+    p.phase += inc;
+    for (int k = 1; p.phase >= k; ++k) {
+      double noise = p.jitter * (2.0 * rand() / RAND_MAX - 1) * 60000000 / (p.rpm * ipr[f]);
+      p.edges.push_back(s_time + (unsigned long)((k - before) / inc * 1000 + noise));
+    }
+    p.phase -= floor(p.phase);
+    // jitter is below half of the period, so impulses stay in order
+    while (!p.edges.empty() && long(p.edges.front() - s_time) < 1000) {
+      ArduinoHost::setMicros(p.edges.front());
+      ArduinoHost::raiseInterrupt(uint8_t(digitalPinToInterrupt(tacho_pins[f])));
+      s_previous[f].rpm().interrupt();
+      p.edges.pop_front();
+    }
+  }
+  s_time += 1000;
+  ArduinoHost::setMicros(s_time);
+  s_scheduler.loop();
+}
+
+void simulate(unsigned long ms)
+{
+  while (ms--)
+    tick();
+}
+
+/// Start both fans with given inertia and let them settle in mode 2.
+void startFans(double tau)
+{
+  s_plant[0] = {3300, 1.8, 50, tau, 0, 0, 0, {}};
+  s_plant[1] = {3100, -0.8, 80, tau * 1.5, 0, 0, 0, {}};
+  s_fans->setVentilationMode(2);
+  simulate(120000);
+}
+
+/// Result of a mode step.
+struct StepResult
+{
+  double settle;      ///< Time until both fans stay within 3 % of setpoint (seconds).
+  double overshoot;   ///< Maximum overshoot in percent of the step.
+  double error;       ///< Maximum steady-state error at the end of the step (percent).
+  double runs;        ///< Regulation runs per second in the last 30 seconds.
+};
+
+/// Switch to given mode and observe the fans for given time.
+StepResult stepMode(int mode, unsigned long ms)
+{
+  double target[2], start[2];
+  Fan* fans[2] = {&s_fans->getFan1(), &s_fans->getFan2()};
+  for (int f = 0; f < 2; ++f) {
+    target[f] = fans[f]->getStandardSpeed() * KWLConfig::StandardKwlModeFactor[mode];
+    start[f] = s_plant[f].rpm;
+  }
+  s_fans->setVentilationMode(mode);
+  StepResult r = {0, 0, 0, 0};
+  unsigned long runs_start = 0;
+  for (unsigned long t = 1; t <= ms; ++t) {
+    tick();
+    for (int f = 0; f < 2; ++f) {
+      double err = (s_plant[f].rpm - target[f]) / target[f] * 100;
+      if (fabs(err) > 3)
+        r.settle = t / 1000.0;
+      double over = (s_plant[f].rpm - target[f]) / (target[f] - start[f]) * 100;
+      if (over > r.overshoot)
+        r.overshoot = over;
+      if (t == ms && fabs(err) > r.error)
+        r.error = fabs(err);
+    }
+    if (t == ms - 30000)
+      runs_start = regulationRuns();
+  }
+  r.runs = (regulationRuns() - runs_start) / 30.0;
+  return r;
+}
+
+void checkSteps(double tau)
+{
+  startFans(tau);
+  static const int modes[] = {3, 1, 2, 3, 2, 1, 2};
+  for (int mode : modes) {
+    StepResult r = stepMode(mode, 120000);
+    char buffer[160];
+    snprintf(buffer, sizeof(buffer), "tau %.0f s, mode %d: settled in %5.1f s, overshoot %4.1f%%, error %.2f%%, %.2f runs/s",
+             tau, mode, r.settle, r.overshoot, r.error, r.runs);
+    TEST_MESSAGE(buffer);
+    TEST_ASSERT_TRUE(r.settle < 5 * tau + 10);
+    TEST_ASSERT_TRUE(r.error < 2);
+    // stable fans are regulated every 2 seconds only
+    TEST_ASSERT_TRUE(r.runs < 0.6);
+  }
+}
+
+/// Calibrate fans with given inertia and tacho jitter, return true on success.
+bool calibrate(double tau, double jitter, unsigned long& seconds)
+{
+  startFans(tau);
+  s_plant[0].jitter = s_plant[1].jitter = jitter;
+  ArduinoHost::clearSerialOutput();
+  s_fans->speedCalibrationStart();
+  seconds = 0;
+  while (s_fans->getMode() == FanMode::Calibration && seconds < 900) {
+    simulate(1000);
+    ++seconds;
+  }
+  s_plant[0].jitter = s_plant[1].jitter = 0;
+  s_fans->setCalculateSpeedMode(FanCalculateSpeedMode::PID);
+  return ArduinoHost::getSerialOutput().find("Kalibrierung erfolgreich beendet") != std::string::npos;
+}
+
+/// Calibrate fans by the previous calibration, return true on success.
+bool calibratePrevious(double tau, double jitter, unsigned long& seconds)
+{
+  startFans(tau);
+  s_plant[0].jitter = s_plant[1].jitter = jitter;
+  static const uint8_t channels[2] = {KWLConfig::DacChannelFan1, KWLConfig::DacChannelFan2};
+  Fan* fans[2] = {&s_fans->getFan1(), &s_fans->getFan2()};
+  for (int f = 0; f < 2; ++f) {
+    s_previous[f].start(int(fans[f]->getStandardSpeed()), s_slave.out[channels[f]]);
+    s_previous[f].prepare();
+  }
+  s_previous_drives = true;
+  // timeouts of 10 minutes for all and 5 minutes for one ventilation mode
+  unsigned mode = 0;
+  unsigned long mode_start = 0;
+  bool ok = false;
+  for (seconds = 0; seconds < 600 && seconds - mode_start < 300 && !ok; ) {
+    simulate(1000);
+    ++seconds;
+    const bool r1 = s_previous[0].step(mode);
+    const bool r2 = s_previous[1].step(mode);
+    if (r1 && r2) {
+      ok = (++mode == KWLConfig::StandardModeCnt);
+      mode_start = seconds;
+      s_previous[0].prepare();
+      s_previous[1].prepare();
+    }
+  }
+  s_previous_drives = false;
+  s_plant[0].jitter = s_plant[1].jitter = 0;
+  return ok;
+}
+
+/// Compute maximum deviation of speed at calibrated PWM values from ventilation mode speeds in percent.
+template<typename Calibrated>
+double calibrationError(Calibrated&& pwm)
+{
+  Fan* fans[2] = {&s_fans->getFan1(), &s_fans->getFan2()};
+  double max_error = 0;
+  for (unsigned mode = 1; mode < KWLConfig::StandardModeCnt; ++mode) {
+    for (int f = 0; f < 2; ++f) {
+      double target = fans[f]->getStandardSpeed() * KWLConfig::StandardKwlModeFactor[mode];
+      double err = fabs(s_plant[f].steady(pwm(f, mode)) - target) / target * 100;
+      if (err > max_error)
+        max_error = err;
+    }
+  }
+  return max_error;
+}
+
+/// Calibrate fans by the previous and the current calibration, check time and precision of calibrated PWM values.
+void checkCalibration(double tau, double jitter)
+{
+  unsigned long prev_seconds, seconds;
+  const bool prev_ok = calibratePrevious(tau, jitter, prev_seconds);
+  const double prev_error = calibrationError([](int f, unsigned mode) { return s_previous[f].getPWM(mode); });
+  const bool ok = calibrate(tau, jitter, seconds);
+  Fan* fans[2] = {&s_fans->getFan1(), &s_fans->getFan2()};
+  const double error = calibrationError([&fans](int f, unsigned mode) { return fans[f]->getPWM(mode); });
+  char buffer[160];
+  snprintf(buffer, sizeof(buffer), "tau %.0f s, tacho jitter %2.0f%%: previous %s in %3lu s, max. error %.2f%%; new %s in %3lu s, max. error %.2f%%",
+           tau, jitter * 100, prev_ok ? "succeeded" : "failed", prev_seconds, prev_error,
+           ok ? "succeeded" : "failed", seconds, error);
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_TRUE(ok);
+  TEST_ASSERT_TRUE(error < KWLConfig::StandardKwlFanPrecisionPercent);
+  // never noticeably worse or slower, more precise with jitter on the tacho impulses
+  TEST_ASSERT_TRUE(error < prev_error + 0.1);
+  TEST_ASSERT_TRUE(seconds < prev_seconds * 1.1);
+  if (jitter >= 0.1)
+    TEST_ASSERT_TRUE(error < prev_error);
+}
+
+const char* s_command = nullptr;
+bool s_command_result = false;
+
+/// Dispatch pending command from within the scheduler loop, like the network client does.
+void pollCommand()
+{
+  if (!s_command)
+    return;
+  s_command_result = MessageHandler::dispatch(StringView(MQTTTopic::CmdAirflow.data_P()), StringView(s_command));
+  s_command = nullptr;
+}
+
+Scheduler::UnaccountedPollTask<> s_command_task(&pollCommand);
+
+/// Send stepless airflow command, return true if accepted.
+bool sendAirflow(const char* payload)
+{
+  s_command = payload;
+  tick();
+  return s_command_result;
+}
+
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_steps_light_fans() { checkSteps(1); }
+
+void test_steps_medium_fans() { checkSteps(2); }
+
+void test_steps_heavy_fans() { checkSteps(4); }
+
+void test_calibration()
+{
+  checkCalibration(1, 0);
+  checkCalibration(4, 0);
+}
+
+void test_calibration_noisy_tacho()
+{
+  checkCalibration(1, 0.05);
+  checkCalibration(2, 0.1);
+  checkCalibration(4, 0.15);
+}
+
+void test_calibration_broken_tacho()
+{
+  // measured speed doesn't settle, calibration must fail soon
+  unsigned long prev_seconds, seconds;
+  const bool prev_ok = calibratePrevious(2, 0.45, prev_seconds);
+  const bool ok = calibrate(2, 0.45, seconds);
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer), "tacho jitter 45%%: previous %s in %3lu s, new %s in %3lu s",
+           prev_ok ? "succeeded" : "failed", prev_seconds, ok ? "succeeded" : "failed", seconds);
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_FALSE(ok);
+  TEST_ASSERT_TRUE(seconds < prev_seconds);
+}
+
+void test_stepless_payload()
+{
+  startFans(1);
+  static const char* const malformed[] = {"", "%", "abc", "<no value>", "-5", "-5%", "80%%", "12x", "200%", "99999"};
+  for (auto payload : malformed) {
+    TEST_ASSERT_FALSE_MESSAGE(sendAirflow(payload), payload);
+    TEST_ASSERT_FALSE_MESSAGE(s_fans->isStepless(), payload);
+    TEST_ASSERT_EQUAL_MESSAGE(2, s_fans->getVentilationMode(), payload);
+  }
+  // only a real zero switches off, small values are limited to the minimum
+  TEST_ASSERT_TRUE(sendAirflow("1"));
+  TEST_ASSERT_EQUAL(int(KWLConfig::StandardSteplessMinPercent), s_fans->getAirflow());
+  TEST_ASSERT_TRUE(sendAirflow("20%"));
+  TEST_ASSERT_EQUAL(int(KWLConfig::StandardSteplessMinPercent), s_fans->getAirflow());
+  TEST_ASSERT_TRUE(sendAirflow("85%"));
+  TEST_ASSERT_EQUAL(85, s_fans->getAirflow());
+  TEST_ASSERT_TRUE(sendAirflow("0"));
+  TEST_ASSERT_EQUAL(0, s_fans->getVentilationMode());
+  TEST_ASSERT_TRUE(sendAirflow("1300"));
+  TEST_ASSERT_EQUAL(int((1300L * 100 + s_fans->getFan1().getStandardSpeed() / 2) / s_fans->getFan1().getStandardSpeed()),
+                    s_fans->getAirflow());
+  TEST_ASSERT_TRUE(sendAirflow("0%"));
+  TEST_ASSERT_EQUAL(0, s_fans->getAirflow());
+  // validation doesn't change the airflow
+  TEST_ASSERT_TRUE(MessageHandler::validate(StringView(MQTTTopic::CmdAirflow.data_P()), StringView("70%")));
+  TEST_ASSERT_EQUAL(0, s_fans->getAirflow());
+}
+
+void test_stepless_ramp()
+{
+  startFans(1);
+  const int rate = int(KWLConfig::StandardSteplessRampPercent);
+  TEST_ASSERT_TRUE(sendAirflow("60%"));
+  // from mode 2 (100 %) downwards, at the configured rate per second
+  const int start = s_fans->getCurrentAirflow();
+  simulate(3000);
+  TEST_ASSERT_INT_WITHIN(1, start - 3 * rate, s_fans->getCurrentAirflow());
+  simulate(20000);
+  TEST_ASSERT_EQUAL(60, s_fans->getCurrentAirflow());
+  TEST_ASSERT_TRUE(sendAirflow("90%"));
+  simulate(5000);
+  TEST_ASSERT_INT_WITHIN(1, 60 + 5 * rate, s_fans->getCurrentAirflow());
+  simulate(20000);
+  TEST_ASSERT_EQUAL(90, s_fans->getCurrentAirflow());
+  simulate(30000);
+  const double target = s_fans->getFan1().getStandardSpeed() * 0.9;
+  TEST_ASSERT_TRUE(fabs(s_plant[0].rpm - target) / target < 0.03);
+}
+
+void test_stepless_off_on()
+{
+  static const uint8_t pwm_pins[2] = {KWLConfig::PinFan1PWM, KWLConfig::PinFan2PWM};
+  const int min = int(KWLConfig::StandardSteplessMinPercent);
+  startFans(1);
+  // off immediately, without ramping through speeds below the minimum
+  TEST_ASSERT_TRUE(sendAirflow("0%"));
+  TEST_ASSERT_EQUAL(0, s_fans->getCurrentAirflow());
+  simulate(100);
+  TEST_ASSERT_EQUAL(0, ArduinoHost::getPinOutput(pwm_pins[0]));
+  TEST_ASSERT_EQUAL(0, ArduinoHost::getPinOutput(pwm_pins[1]));
+  simulate(30000);
+
+  // on again starts at the minimum and ramps up from there
+  TEST_ASSERT_TRUE(sendAirflow("70%"));
+  TEST_ASSERT_EQUAL(min, s_fans->getCurrentAirflow());
+  simulate(100);
+  TEST_ASSERT_TRUE(ArduinoHost::getPinOutput(pwm_pins[0]) > 0);
+  TEST_ASSERT_TRUE(ArduinoHost::getPinOutput(pwm_pins[1]) > 0);
+  simulate(2000);
+  TEST_ASSERT_INT_WITHIN(1, min + 2 * int(KWLConfig::StandardSteplessRampPercent), s_fans->getCurrentAirflow());
+
+  // from mode 0 as well
+  s_fans->setVentilationMode(0);
+  simulate(30000);
+  TEST_ASSERT_TRUE(sendAirflow("80%"));
+  TEST_ASSERT_EQUAL(min, s_fans->getCurrentAirflow());
+  simulate(60000);
+  TEST_ASSERT_EQUAL(80, s_fans->getCurrentAirflow());
+  const double target = s_fans->getFan2().getStandardSpeed() * 0.8;
+  TEST_ASSERT_TRUE(fabs(s_plant[1].rpm - target) / target < 0.03);
+  s_fans->setVentilationMode(2);
+}
+
+int main(int, char**)
+{
+  ArduinoHost::clearEEPROM();
+  srand(1);
+  AsyncTWI::setSlave(&s_slave);
+  s_dac.begin(s_out);
+  s_config.begin(s_out);
+  FanControl fans(s_config, s_dac, nullptr);
+  s_fans = &fans;
+  fans.begin(s_out);
+  fans.setCalculateSpeedMode(FanCalculateSpeedMode::PID);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_steps_light_fans);
+  RUN_TEST(test_steps_medium_fans);
+  RUN_TEST(test_steps_heavy_fans);
+  RUN_TEST(test_calibration);
+  RUN_TEST(test_calibration_noisy_tacho);
+  RUN_TEST(test_calibration_broken_tacho);
+  RUN_TEST(test_stepless_payload);
+  RUN_TEST(test_stepless_ramp);
+  RUN_TEST(test_stepless_off_on);
+  return UNITY_END();
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Benchmark of fan speed measurement over tacho traces.
+ *
+ * Replays synthetic speed profiles and the speeds recorded in
+ * Docs/debug_fans/example-debug as tacho signal trains with jitter, doubled
+ * (spurious) and missing pulses. Compares accuracy of FanRPM::getSpeed()
+ * and time per signal with the previous implementation, which stored
+ * 32-bit intervals and limited each interval to 25% of the last one.
+ * Checks that FanRPM::getAverageSpeed() isn't biased by strong jitter.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include <FanRPM.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+  /// Previous implementation of FanRPM (measurement part), reference for the benchmark.
+  class PreviousFanRPM
+  {
+  public:
+    void interrupt() noexcept { edge(micros()); }
+
+    // not inlined, like FanRPM::edge() in its own translation unit
+    __attribute__((noinline)) void edge(unsigned long timer) noexcept
+    {
+      if (!last_time_) {
+        last_time_ = timer;
+        return;
+      }
+      unsigned long measurement = timer - last_time_;
+      if (measurement > 60000000UL / FanRPM::MIN_RPM) {
+        last_time_ = 0;
+        last_ = 0;
+        valid_ = false;
+        return;
+      }
+      if (measurement < 60000000UL / FanRPM::MAX_RPM)
+        return;
+      last_time_ = timer;
+      if (last_) {
+        // not more than 25% off the last measurement
+        auto diff = measurement >> 2;
+        if (measurement < last_ - diff) {
+          last_ = last_ - diff;
+          return;
+        }
+        if (measurement > last_ + diff) {
+          last_ = last_ + diff;
+          return;
+        }
+      }
+      sum_ = sum_ + measurement - measurements_[index_];
+      measurements_[index_] = measurement;
+      index_ = (index_ + 1) & (MAX_MEASUREMENTS - 1);
+      valid_ = true;
+      last_ = measurement;
+    }
+
+    int getSpeed() noexcept
+    {
+      if (!valid_ || micros() - last_time_ > 60000000UL / FanRPM::MIN_RPM)
+        return 0;
+      return sum_ ? int(60000000UL * MAX_MEASUREMENTS / sum_) : 0;
+    }
+
+  private:
+    static constexpr unsigned MAX_MEASUREMENTS = 32;
+    unsigned long last_time_ = 0;
+    unsigned long measurements_[MAX_MEASUREMENTS] = {};
+    unsigned char index_ = 0;
+    bool valid_ = false;
+    unsigned long last_ = 0;
+    unsigned long sum_ = 0;
+  };
+
+  /// Tacho signal train with expected speed at the end of each second.
+  struct Trace
+  {
+    std::string name;                 ///< Trace name.
+    std::vector<unsigned long> edges; ///< Signal times in microseconds.
+    std::vector<double> rpm;          ///< Expected speed at the end of each second.
+  };
+
+  double urand() { return rand() / double(RAND_MAX); }
+
+  /**
+   * @brief Create signal train from speed profile.
+   *
+   * @param name trace name.
+   * @param profile speed for each second, interpolated linearly.
+   * @param doubled probability of a spurious signal within a rotation.
+   * @param missing probability of a missing signal.
+   */
+  Trace makeTrace(const std::string& name, const std::vector<double>& profile, double doubled, double missing)
+  {
+    constexpr double JITTER_US = 40;
+    Trace t;
+    t.name = name;
+    std::vector<double> edges;
+    double time = 1e6;
+    for (size_t s = 0; s < profile.size(); ++s) {
+      double start = 1e6 * (s + 1), end = start + 1e6;
+      double rpm0 = profile[s], rpm1 = s + 1 < profile.size() ? profile[s + 1] : rpm0;
+      while (time < end) {
+        double rpm = rpm0 + (rpm1 - rpm0) * (time - start) / 1e6;
+        double period = 60e6 / rpm;
+        if (urand() < doubled)
+          edges.push_back(time + period * (0.1 + 0.8 * urand()));
+        time += period;
+        if (urand() >= missing)
+          edges.push_back(time + JITTER_US * (urand() - 0.5));
+      }
+      t.rpm.push_back(rpm1);
+    }
+    std::sort(edges.begin(), edges.end());
+    for (auto e : edges)
+      t.edges.push_back((unsigned long)e);
+    return t;
+  }
+
+  /// Result of replaying a trace.
+  struct Result
+  {
+    double mean_error = 0;  ///< Mean error in percent.
+    double max_error = 0;   ///< Maximum error in percent.
+  };
+
+  /// Replay trace and compare speed at the end of each second (after 3s to settle).
+  template<typename RPM>
+  Result replay(const Trace& t)
+  {
+    RPM rpm;
+    Result result;
+    size_t e = 0;
+    unsigned count = 0;
+    for (size_t s = 0; s < t.rpm.size(); ++s) {
+      unsigned long end = 1000000UL * (s + 2);
+      for (; e < t.edges.size() && t.edges[e] <= end; ++e) {
+        ArduinoHost::setMicros(t.edges[e]);
+        rpm.interrupt();
+      }
+      ArduinoHost::setMicros(end);
+      auto speed = rpm.getSpeed();
+      if (s < 3)
+        continue;
+      double error = fabs(speed - t.rpm[s]) / t.rpm[s] * 100;
+      result.mean_error += error;
+      result.max_error = fmax(result.max_error, error);
+      ++count;
+    }
+    result.mean_error /= count;
+    return result;
+  }
+
+  /// Measure time per signal in nanoseconds.
+  template<typename RPM>
+  double timePerEdge(const Trace& t)
+  {
+    constexpr unsigned REPEAT = 50;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < REPEAT; ++r) {
+      RPM rpm;
+      for (auto time : t.edges)
+        rpm.edge(time);
+      if (rpm.getSpeed() < 0)
+        TEST_FAIL();  // keep the measurement
+    }
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / (REPEAT * t.edges.size());
+  }
+
+  /// Load speeds of a fan recorded in debug log.
+  std::vector<double> loadRecorded(const char* fan)
+  {
+    std::ifstream in("../../Docs/debug_fans/example-debug/example-debug.log");
+    std::string key = std::string("kwl/") + fan + " ";
+    std::vector<double> result;
+    std::string line;
+    while (std::getline(in, line)) {
+      auto pos = line.find("rpm: ");
+      if (line.find(key) == std::string::npos || pos == std::string::npos)
+        continue;
+      double rpm = atof(line.c_str() + pos + 5);
+      if (rpm >= 300)
+        result.push_back(rpm);
+    }
+    return result;
+  }
+
+  std::vector<Trace> s_traces;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_make_traces()
+{
+  srand(1);
+  std::vector<double> steady(60, 1222), ramp, steps;
+  for (int i = 0; i < 60; ++i) {
+    ramp.push_back(600 + 2400.0 * i / 59);
+    steps.push_back((i / 10) % 2 ? 2600 : 900);
+  }
+  s_traces.push_back(makeTrace("steady 1222", steady, 0, 0));
+  s_traces.push_back(makeTrace("steady 5% doubled", steady, 0.05, 0));
+  s_traces.push_back(makeTrace("steady 20% doubled", steady, 0.2, 0));
+  s_traces.push_back(makeTrace("steady 5% missing", steady, 0, 0.05));
+  s_traces.push_back(makeTrace("ramp 600-3000", ramp, 0, 0));
+  s_traces.push_back(makeTrace("ramp 5% dbl 5% miss", ramp, 0.05, 0.05));
+  s_traces.push_back(makeTrace("steps 900/2600", steps, 0, 0));
+  s_traces.push_back(makeTrace("steps 5% dbl 5% miss", steps, 0.05, 0.05));
+  for (auto fan : {"fan1", "fan2"}) {
+    auto recorded = loadRecorded(fan);
+    TEST_ASSERT_TRUE_MESSAGE(recorded.size() > 100, "recorded debug log not found");
+    s_traces.push_back(makeTrace(std::string("recorded ") + fan, recorded, 0, 0));
+    s_traces.push_back(makeTrace(std::string("recorded ") + fan + " 5% dbl 5% miss", recorded, 0.05, 0.05));
+  }
+}
+
+void test_accuracy()
+{
+  TEST_MESSAGE("trace                              prev avg  prev max   new avg   new max");
+  for (auto& t : s_traces) {
+    auto prev = replay<PreviousFanRPM>(t);
+    auto cur = replay<FanRPM>(t);
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%-32s %8.2f%% %8.2f%% %8.2f%% %8.2f%%",
+      t.name.c_str(), prev.mean_error, prev.max_error, cur.mean_error, cur.max_error);
+    TEST_MESSAGE(buffer);
+    // never noticeably worse, better with spurious signals
+    TEST_ASSERT_TRUE_MESSAGE(cur.mean_error <= prev.mean_error + 0.1, t.name.c_str());
+    if (t.name.find("dbl") != std::string::npos || t.name.find("doubled") != std::string::npos)
+      TEST_ASSERT_TRUE_MESSAGE(cur.mean_error < prev.mean_error, t.name.c_str());
+  }
+}
+
+void test_average_jitter()
+{
+  TEST_MESSAGE("jitter     speed   average");
+  srand(2);
+  for (double jitter : {0.0, 0.05, 0.1, 0.15}) {
+    // steady 1222 rpm, each signal off by up to given fraction of the period
+    constexpr double RPM = 1222, PERIOD = 60e6 / RPM;
+    FanRPM rpm;
+    double speed_error = 0, average_error = 0;
+    for (unsigned i = 1; i <= 20 * 60; ++i) {
+      ArduinoHost::setMicros((unsigned long)(1e6 + i * PERIOD + jitter * PERIOD * (2 * urand() - 1)));
+      rpm.interrupt();
+      if (i == 3 * 60)
+        rpm.startAverage();
+      else if (i > 3 * 60 && i % 60 == 0) {
+        speed_error = fmax(speed_error, fabs(rpm.getSpeed() - RPM) / RPM * 100);
+        average_error = fmax(average_error, fabs(rpm.getAverageSpeed() - RPM) / RPM * 100);
+      }
+    }
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%5.0f%% %8.2f%% %8.2f%%", jitter * 100, speed_error, average_error);
+    TEST_MESSAGE(buffer);
+    TEST_ASSERT_TRUE(average_error < 0.5);
+    TEST_ASSERT_TRUE(average_error <= speed_error + 0.1);
+  }
+}
+
+void test_time_and_size()
+{
+  double prev = 0, cur = 0;
+  for (auto& t : s_traces) {
+    prev += timePerEdge<PreviousFanRPM>(t);
+    cur += timePerEdge<FanRPM>(t);
+  }
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer), "time per signal: previous %.1f ns, new %.1f ns; size: previous %u, new %u bytes",
+    prev / s_traces.size(), cur / s_traces.size(), unsigned(sizeof(PreviousFanRPM)), unsigned(sizeof(FanRPM)));
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_TRUE(sizeof(FanRPM) < sizeof(PreviousFanRPM));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_make_traces);
+  RUN_TEST(test_accuracy);
+  RUN_TEST(test_average_jitter);
+  RUN_TEST(test_time_and_size);
+  return UNITY_END();
+}
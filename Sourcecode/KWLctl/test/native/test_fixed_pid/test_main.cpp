@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Regression tests and benchmark of the fixed-point PID controller.
+ *
+ * The controller is compared with a floating-point implementation of the
+ * PID_v1 algorithm (proportional on measurement, direct), which the fan and
+ * preheater regulation used before, on simple plant models with the tunings
+ * used by the firmware.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include <FixedPID.h>
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+
+namespace {
+
+  /// PID_v1 algorithm with proportional on measurement in double precision.
+  struct ReferencePID
+  {
+    double kp, ki, kd;
+    double out_min, out_max;
+    double sum = 0, last_input = 0;
+
+    ReferencePID(double p, double i, double d, unsigned long sample_time_ms, double mn, double mx) :
+      out_min(mn), out_max(mx)
+    {
+      setTunings(p, i, d, sample_time_ms);
+    }
+
+    void setTunings(double p, double i, double d, unsigned long sample_time_ms)
+    {
+      kp = p;
+      ki = i * sample_time_ms / 1000;
+      kd = d * 1000 / sample_time_ms;
+    }
+
+    void start(double input, double output)
+    {
+      sum = clamp(output);
+      last_input = input;
+    }
+
+    double compute(double input, double setpoint)
+    {
+      auto d_input = input - last_input;
+      sum = clamp(sum + ki * (setpoint - input) - kp * d_input);
+      last_input = input;
+      return clamp(sum - kd * d_input);
+    }
+
+    double clamp(double v) const { return v > out_max ? out_max : v < out_min ? out_min : v; }
+  };
+
+  /// Fan tunings as in FanControl.cpp.
+  constexpr double CONS_KP = 0.05, CONS_KI = 0.1, CONS_KD = 0.001;
+  constexpr double AGG_KP = 0.25, AGG_KI = 0.1, AGG_KD = 0.001;
+
+  /// Advance simulated time by one sample and return whether the controller computed.
+  bool step(FixedPID& pid, FixedPID::input_t input, FixedPID::input_t setpoint, FixedPID::value_t& output, unsigned long ms)
+  {
+    ArduinoHost::advanceMicros(ms * 1000);
+    return pid.compute(input, setpoint, output);
+  }
+}
+
+void setUp()
+{
+  ArduinoHost::setMicros(100000000);
+}
+
+void tearDown() {}
+
+void test_fan_steps_match_reference()
+{
+  // first-order fan: rpm = 3.5 * PWM setpoint, time constant 3 samples, both
+  // controllers drive their own plant and switch tunings like Fan does
+  constexpr unsigned long SAMPLE_MS = 200;
+  const auto cons = FixedPID::tunings(CONS_KP, CONS_KI, CONS_KD, SAMPLE_MS);
+  const auto agg = FixedPID::tunings(AGG_KP, AGG_KI, AGG_KD, SAMPLE_MS);
+  FixedPID pid(cons, SAMPLE_MS, 0, FixedPID::fromInt(1000));
+  ReferencePID ref(CONS_KP, CONS_KI, CONS_KD, SAMPLE_MS, 0, 1000);
+  pid.start(0, 0);
+  ref.start(0, 0);
+
+  const int setpoints[] = { 2240, 3200, 3500, 2240, 1500, 3200, 0, 900 };
+  double rpm_fix = 0, rpm_ref = 0;
+  int max_out_diff = 0, max_rpm_diff = 0;
+  for (auto sp : setpoints) {
+    for (int i = 0; i < 300; ++i) {
+      auto in_fix = int(rpm_fix), in_ref = int(rpm_ref);
+      pid.setTunings(abs(sp - in_fix) < 1000 ? cons : agg);
+      bool far = abs(sp - in_ref) < 1000;
+      ref.setTunings(far ? CONS_KP : AGG_KP, far ? CONS_KI : AGG_KI, far ? CONS_KD : AGG_KD, SAMPLE_MS);
+      FixedPID::value_t out;
+      TEST_ASSERT_TRUE(step(pid, FixedPID::input_t(in_fix), FixedPID::input_t(sp), out, SAMPLE_MS));
+      auto out_fix = FixedPID::toInt(out);
+      auto out_ref = int(ref.compute(in_ref, sp));
+      rpm_fix += (3.5 * out_fix - rpm_fix) / 3;
+      rpm_ref += (3.5 * out_ref - rpm_ref) / 3;
+      max_out_diff = max(max_out_diff, abs(out_fix - out_ref));
+      max_rpm_diff = max(max_rpm_diff, abs(int(rpm_fix) - int(rpm_ref)));
+    }
+    // both settle at the setpoint (within plant resolution)
+    TEST_ASSERT_INT_WITHIN(4, sp, int(rpm_fix));
+  }
+  char buffer[96];
+  snprintf(buffer, sizeof(buffer), "fan: max output difference %d of 1000, max speed difference %d rpm", max_out_diff, max_rpm_diff);
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_LESS_OR_EQUAL(3, max_out_diff);
+  TEST_ASSERT_LESS_OR_EQUAL(10, max_rpm_diff);
+}
+
+void test_preheater_matches_reference()
+{
+  // exhaust temperature = -8 + 0.012 * output with time constant 5 samples,
+  // measured with 1/16 degree resolution, input unit of PID is 1/16 degree
+  constexpr unsigned long SAMPLE_MS = 2000;
+  constexpr double SCALE = 16;
+  FixedPID pid(FixedPID::tunings(50 / SCALE, 0.1 / SCALE, 0.025 / SCALE, SAMPLE_MS), SAMPLE_MS,
+    FixedPID::fromInt(100), FixedPID::fromInt(1000));
+  ReferencePID ref(50, 0.1, 0.025, SAMPLE_MS, 100, 1000);
+  double t_fix = -2, t_ref = -2;
+  const double setpoint = 1.5 + 1;
+  pid.start(FixedPID::input_t(floor(t_fix * SCALE)), 0);
+  ref.start(floor(t_ref * SCALE) / SCALE, 0);
+  int max_out_diff = 0;
+  for (int i = 0; i < 3000; ++i) {
+    FixedPID::value_t out;
+    TEST_ASSERT_TRUE(step(pid, FixedPID::input_t(floor(t_fix * SCALE)), FixedPID::input_t(setpoint * SCALE), out, SAMPLE_MS));
+    auto out_fix = FixedPID::toInt(out);
+    auto out_ref = int(ref.compute(floor(t_ref * SCALE) / SCALE, setpoint));
+    t_fix += (-8 + 0.012 * out_fix - t_fix) / 5;
+    t_ref += (-8 + 0.012 * out_ref - t_ref) / 5;
+    max_out_diff = max(max_out_diff, abs(out_fix - out_ref));
+  }
+  TEST_ASSERT_DOUBLE_WITHIN(1 / SCALE, setpoint, t_fix);
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "preheater: max output difference %d of 1000", max_out_diff);
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_LESS_OR_EQUAL(5, max_out_diff);
+}
+
+void test_start_is_bumpless()
+{
+  FixedPID pid(FixedPID::tunings(AGG_KP, AGG_KI, AGG_KD, 1000), 1000, 0, FixedPID::fromInt(1000));
+  FixedPID::value_t out = 0;
+  TEST_ASSERT_FALSE(pid.compute(1000, 1000, out));  // stopped
+  pid.start(1000, FixedPID::fromInt(400));
+  TEST_ASSERT_TRUE(step(pid, 1000, 1000, out, 1000));
+  TEST_ASSERT_EQUAL(FixedPID::fromInt(400), out);
+  // not computed before 15/16 of sample time elapsed
+  TEST_ASSERT_FALSE(step(pid, 1000, 2000, out, 900));
+  TEST_ASSERT_TRUE(step(pid, 1000, 2000, out, 40));
+  TEST_ASSERT_EQUAL(FixedPID::fromInt(400) + FixedPID::toGain(AGG_KI) * 1000, out);
+}
+
+void test_saturation()
+{
+  // maximum gains and full-range input jumps must not overflow
+  const FixedPID::Tunings max_gains = { INT16_MAX, INT16_MAX, INT16_MAX };
+  const FixedPID::Tunings min_gains = { -INT16_MAX, -INT16_MAX, -INT16_MAX };
+  FixedPID pid(max_gains, 1000, FixedPID::fromInt(-500), FixedPID::fromInt(500));
+  pid.start(INT16_MIN, 0);
+  FixedPID::value_t out;
+  TEST_ASSERT_TRUE(step(pid, INT16_MAX, INT16_MIN, out, 1000));
+  TEST_ASSERT_EQUAL(FixedPID::fromInt(-500), out);
+  TEST_ASSERT_TRUE(step(pid, INT16_MIN, INT16_MAX, out, 1000));
+  TEST_ASSERT_EQUAL(FixedPID::fromInt(500), out);
+
+  pid.setTunings(min_gains);
+  TEST_ASSERT_TRUE(step(pid, INT16_MAX, INT16_MIN, out, 1000));
+  TEST_ASSERT_EQUAL(FixedPID::fromInt(500), out);
+
+  // limits reaching the range of 32 bits
+  pid.stop();
+  pid.setOutputLimits(INT32_MIN, INT32_MAX);
+  pid.setTunings(max_gains);
+  pid.start(0, INT32_MAX - 5);
+  TEST_ASSERT_TRUE(step(pid, INT16_MIN, INT16_MAX, out, 1000));
+  TEST_ASSERT_EQUAL(INT32_MAX, out);
+  pid.stop();
+  pid.start(0, INT32_MIN + 5);
+  TEST_ASSERT_TRUE(step(pid, INT16_MAX, INT16_MIN, out, 1000));
+  TEST_ASSERT_EQUAL(INT32_MIN, out);
+
+  // gains out of range saturate
+  TEST_ASSERT_EQUAL(INT16_MAX, FixedPID::toGain(100));
+  TEST_ASSERT_EQUAL(-INT16_MAX, FixedPID::toGain(-100));
+  TEST_ASSERT_EQUAL(205, FixedPID::toGain(0.05));
+}
+
+void test_compute_benchmark()
+{
+  // cycles on AVR are measured by test/embedded/test_fixed_pid
+  constexpr unsigned long COUNT = 2000000;
+  FixedPID pid(FixedPID::tunings(CONS_KP, CONS_KI, CONS_KD, 1), 1, 0, FixedPID::fromInt(1000));
+  pid.start(0, 0);
+  FixedPID::value_t out = 0;
+  long check = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < COUNT; ++i) {
+    ArduinoHost::advanceMicros(1000);
+    pid.compute(FixedPID::input_t(i & 2047), 1000, out);
+    check += out;
+  }
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  char buffer[80];
+  snprintf(buffer, sizeof(buffer), "host: %.1f ns per compute (checksum %ld)", secs * 1e9 / COUNT, check);
+  TEST_MESSAGE(buffer);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fan_steps_match_reference);
+  RUN_TEST(test_preheater_matches_reference);
+  RUN_TEST(test_start_is_bumpless);
+  RUN_TEST(test_saturation);
+  RUN_TEST(test_compute_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+/*!
+ * @file
+ * @brief Benchmark of MQTT message handling over the loopback transport.
+ *
+ * Runs the real network client with PubSubClient against the in-process
+ * broker stand-in and measures how many commands and publishes per second
+ * the message path handles on the host. Simulated time drives the
+ * scheduler, throughput is measured in wall clock time. Streamed messages,
+ * which can't be finished, must abort the connection.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+
+#include "KWLConfig.h"
+#include "NetworkClient.h"
+#include "LoopbackTransport.h"
+#include "MessageHandler.h"
+
+#include <MicroNTP.h>
+#include <TimeScheduler.h>
+
+namespace {
+
+  /// Count of messages in one benchmark run.
+  constexpr unsigned MESSAGE_COUNT = 20000;
+  /// Count of messages injected at once (fits broker output queue).
+  constexpr unsigned BATCH_SIZE = 16;
+
+  /// Handler counting benchmark commands.
+  class BenchHandler : public MessageHandler
+  {
+  public:
+    BenchHandler() : MessageHandler(F("Bench")) {}
+
+    unsigned long count = 0;
+
+  private:
+    virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override
+    {
+      if (topic != "bench/cmd")
+        return false;
+      if (s == "x")
+        ++count;
+      return true;
+    }
+  };
+
+  KWLPersistentConfig s_config;
+  LoopbackTransport s_transport;
+  MicroNTP s_ntp(s_transport.getUDP());
+  NetworkClient s_client(s_config, s_ntp, s_transport);
+  Scheduler::PollingScheduler s_scheduler;
+  BenchHandler s_handler;
+
+  /// Run scheduler in 1ms steps until the condition holds or time runs out.
+  template<typename Cond>
+  bool runUntil(Cond&& cond, unsigned long max_ms)
+  {
+    for (unsigned long i = 0; i < max_ms; ++i) {
+      if (cond())
+        return true;
+      s_scheduler.loop();
+      ArduinoHost::advanceMicros(1000);
+    }
+    return cond();
+  }
+
+  double seconds(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void report(const char* what, unsigned count, double secs)
+  {
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%s: %u messages in %.3f s, %.0f msg/s, %.2f us/msg",
+      what, count, secs, count / secs, secs * 1e6 / count);
+    TEST_MESSAGE(buffer);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_connect()
+{
+  ArduinoHost::clearEEPROM();
+  s_config.begin(Serial);
+  s_client.begin(Serial);
+  // first connect is delayed by per-device phase of up to one reconnect interval
+  TEST_ASSERT_TRUE(runUntil([]() { return s_client.isMQTTOk(); }, 60000));
+  TEST_ASSERT_TRUE(s_transport.getBroker().isConnected());
+}
+
+void test_command_throughput()
+{
+  auto& broker = s_transport.getBroker();
+  // let subscriptions settle
+  runUntil([]() { return false; }, 100);
+  broker.resetStats();
+  s_handler.count = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned sent = 0; sent < MESSAGE_COUNT; ) {
+    for (unsigned i = 0; i < BATCH_SIZE; ++i, ++sent)
+      TEST_ASSERT_TRUE(broker.inject("d15/set/kwl/bench/cmd", "x"));
+    TEST_ASSERT_TRUE(runUntil([sent]() { return s_handler.count == sent; }, 1000));
+  }
+  report("commands", MESSAGE_COUNT, seconds(start));
+  TEST_ASSERT_EQUAL_UINT32(MESSAGE_COUNT, s_handler.count);
+  TEST_ASSERT_EQUAL_UINT32(MESSAGE_COUNT, broker.getDeliveredCount());
+  TEST_ASSERT_EQUAL_UINT32(0, broker.getDroppedCount());
+  TEST_ASSERT_TRUE(s_client.isMQTTOk());
+}
+
+void test_publish_throughput()
+{
+  auto& broker = s_transport.getBroker();
+  broker.resetStats();
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < MESSAGE_COUNT; ++i) {
+    TEST_ASSERT_TRUE(MessageHandler::publish("bench/state", long(i)));
+    if ((i % BATCH_SIZE) == 0)
+      s_scheduler.loop();
+  }
+  report("publishes", MESSAGE_COUNT, seconds(start));
+  TEST_ASSERT_EQUAL_UINT32(MESSAGE_COUNT, broker.getPublishedCount());
+  TEST_ASSERT_TRUE(s_client.isMQTTOk());
+}
+
+void test_incomplete_stream_aborts_connection()
+{
+  auto& broker = s_transport.getBroker();
+  broker.resetStats();
+  TEST_ASSERT_TRUE(MessageHandler::publishStream("bench/stream", [](Print& out) { out.print(F("complete")); }));
+  TEST_ASSERT_EQUAL_UINT32(1, broker.getPublishedCount());
+
+  // writer producing less on the second pass, the broker would read following data as payload
+  unsigned pass = 0;
+  TEST_ASSERT_FALSE(MessageHandler::publishStream("bench/stream", [&pass](Print& out) {
+    out.print(pass++ ? F("short") : F("much longer"));
+  }));
+  TEST_ASSERT_FALSE(broker.isConnected());
+  TEST_ASSERT_EQUAL_UINT32(1, broker.getPublishedCount());
+
+  // the client reconnects after backoff
+  TEST_ASSERT_TRUE(runUntil([]() { return s_client.isMQTTOk() && s_transport.getBroker().isConnected(); }, 600000));
+  TEST_ASSERT_TRUE(MessageHandler::publishStream("bench/stream", [](Print& out) { out.print(F("complete")); }));
+  TEST_ASSERT_EQUAL_UINT32(2, broker.getPublishedCount());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_connect);
+  RUN_TEST(test_command_throughput);
+  RUN_TEST(test_publish_throughput);
+  RUN_TEST(test_incomplete_stream_aborts_connection);
+  return UNITY_END();
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Tests of the Modbus TCP server with a real client socket.
+ *
+ * The server listens via the loopback transport on 127.0.0.1 and the test
+ * talks to it like a building management system. Register values come from
+ * a fake register source and writes go to a handler, which checks values
+ * like the real command handlers.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "KWLConfig.h"
+#include "LoopbackTransport.h"
+#include "MessageHandler.h"
+#include "ModbusServer.h"
+#include "MQTTTopic.hpp"
+
+#include <TimeScheduler.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+  /// Port for tests (502 needs root privileges).
+  constexpr uint16_t TEST_PORT = 15020;
+
+  /// Register source returning address-based values for input registers.
+  class FakeRegisters : public ModbusServer::Registers
+  {
+  public:
+    virtual uint16_t modbusReadInput(uint16_t addr) override { return uint16_t(1000 + addr); }
+
+    virtual uint16_t modbusReadHolding(uint16_t addr) override
+    {
+      switch (addr) {
+        case 0: return uint16_t(mode_);
+        case 1: return uint16_t(fan1_);
+        case 2: return uint16_t(fan2_);
+        case 3: return bypass_auto_ ? 0 : 1;
+        case 4: return flap_open_ ? 2 : 1;
+        default: return 0;
+      }
+    }
+
+    int mode_ = 2;
+    int fan1_ = 1300;
+    int fan2_ = 1350;
+    bool bypass_auto_ = true;
+    bool flap_open_ = false;
+  };
+
+  FakeRegisters s_registers;
+
+  /// Handler of commands written via holding registers, which supports validation like the real ones.
+  class FakeHandler : public MessageHandler
+  {
+  public:
+    FakeHandler() : MessageHandler(F("Fake")) {}
+
+    virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override
+    {
+      long i;
+      if (topic == MQTTTopic::CmdMode) {
+        if (!s.parseInt(i) || i < 0 || i >= long(KWLConfig::StandardModeCnt))
+          reportMalformed();
+        else if (!isValidating())
+          s_registers.mode_ = int(i);
+      } else if (topic == MQTTTopic::CmdFan1Speed || topic == MQTTTopic::CmdFan2Speed) {
+        if (!s.parseInt(i) || i < 60 || i > 10000)
+          reportMalformed();
+        else if (!isValidating())
+          (topic == MQTTTopic::CmdFan1Speed ? s_registers.fan1_ : s_registers.fan2_) = int(i);
+      } else if (topic == MQTTTopic::CmdBypassMode) {
+        if (s != F("auto") && s != F("manual"))
+          reportMalformed();
+        else if (!isValidating())
+          s_registers.bypass_auto_ = (s == F("auto"));
+      } else if (topic == MQTTTopic::CmdBypassManualFlap) {
+        if (s != F("open") && s != F("close"))
+          reportMalformed();
+        else if (!isValidating())
+          s_registers.flap_open_ = (s == F("open"));
+      } else {
+        return false;
+      }
+      return true;
+    }
+  };
+
+  KWLPersistentConfig s_config;
+  LoopbackTransport s_transport;
+  ModbusServer s_server(s_transport, s_config);
+  Scheduler::PollingScheduler s_scheduler;
+  FakeHandler s_handler;
+  int s_socket = -1;
+  uint16_t s_transaction = 0;
+
+  /// Run scheduler in 1ms steps until the condition holds or time runs out.
+  template<typename Cond>
+  bool runUntil(Cond&& cond, unsigned long max_ms)
+  {
+    for (unsigned long i = 0; i < max_ms; ++i) {
+      if (cond())
+        return true;
+      s_scheduler.loop();
+      ArduinoHost::advanceMicros(1000);
+    }
+    return cond();
+  }
+
+  /// Check whether the server sent something or closed the connection.
+  bool readable()
+  {
+    uint8_t c;
+    return ::recv(s_socket, &c, 1, MSG_DONTWAIT | MSG_PEEK) >= 0;
+  }
+
+  void connectClient()
+  {
+    if (s_socket >= 0)
+      ::close(s_socket);
+    s_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TEST_ASSERT_EQUAL(0, ::connect(s_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+  }
+
+  /*!
+   * @brief Send request PDU and receive response PDU.
+   *
+   * @param pdu request PDU (function code and data).
+   * @return response PDU or empty, if the connection was closed.
+   */
+  std::vector<uint8_t> request(const std::vector<uint8_t>& pdu, uint16_t protocol = 0)
+  {
+    std::vector<uint8_t> frame = {
+      uint8_t(++s_transaction >> 8), uint8_t(s_transaction),
+      uint8_t(protocol >> 8), uint8_t(protocol),
+      uint8_t((pdu.size() + 1) >> 8), uint8_t(pdu.size() + 1), 0x11
+    };
+    frame.insert(frame.end(), pdu.begin(), pdu.end());
+    TEST_ASSERT_EQUAL(int(frame.size()), int(::send(s_socket, frame.data(), frame.size(), 0)));
+    TEST_ASSERT_TRUE(runUntil(readable, 1000));
+
+    uint8_t header[7];
+    if (::recv(s_socket, header, sizeof(header), MSG_WAITALL) != sizeof(header))
+      return {};
+    TEST_ASSERT_EQUAL_UINT8(frame[0], header[0]);
+    TEST_ASSERT_EQUAL_UINT8(frame[1], header[1]);
+    TEST_ASSERT_EQUAL_UINT8(0x11, header[6]);
+    std::vector<uint8_t> response(size_t((header[4] << 8) | header[5]) - 1);
+    TEST_ASSERT_EQUAL(int(response.size()), int(::recv(s_socket, response.data(), response.size(), MSG_WAITALL)));
+    return response;
+  }
+
+  /// Build PDU of a write of multiple registers.
+  std::vector<uint8_t> writeMultiple(uint16_t addr, const std::vector<uint16_t>& values)
+  {
+    std::vector<uint8_t> pdu = {
+      16, uint8_t(addr >> 8), uint8_t(addr), 0, uint8_t(values.size()), uint8_t(values.size() * 2)
+    };
+    for (auto v : values) {
+      pdu.push_back(uint8_t(v >> 8));
+      pdu.push_back(uint8_t(v));
+    }
+    return pdu;
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_read_input_registers()
+{
+  auto r = request({ 4, 0, 0, 0, 14 });
+  TEST_ASSERT_EQUAL(2 + 28, int(r.size()));
+  TEST_ASSERT_EQUAL_UINT8(4, r[0]);
+  TEST_ASSERT_EQUAL_UINT8(28, r[1]);
+  for (unsigned i = 0; i < 14; ++i)
+    TEST_ASSERT_EQUAL_UINT16(1000 + i, (r[2 + i * 2] << 8) | r[3 + i * 2]);
+}
+
+void test_read_out_of_range()
+{
+  std::vector<uint8_t> exc = { 0x83, 2 };
+  TEST_ASSERT_TRUE(exc == request({ 3, 0, 4, 0, 2 }));
+  exc = { 0x84, 3 };
+  TEST_ASSERT_TRUE(exc == request({ 4, 0, 0, 0, 0 }));
+  exc = { 0x81, 1 };
+  TEST_ASSERT_TRUE(exc == request({ 1, 0, 0, 0, 1 }));
+}
+
+void test_write_multiple()
+{
+  std::vector<uint8_t> echo = { 16, 0, 0, 0, 5 };
+  TEST_ASSERT_TRUE(echo == request(writeMultiple(0, { 1, 1500, 1550, 1, 2 })));
+  TEST_ASSERT_EQUAL(1, s_registers.mode_);
+  TEST_ASSERT_EQUAL(1500, s_registers.fan1_);
+  TEST_ASSERT_EQUAL(1550, s_registers.fan2_);
+  TEST_ASSERT_FALSE(s_registers.bypass_auto_);
+  TEST_ASSERT_TRUE(s_registers.flap_open_);
+
+  auto r = request({ 3, 0, 0, 0, 5 });
+  std::vector<uint8_t> expected = { 3, 10, 0, 1, 1500 >> 8, 1500 & 0xff, 1550 >> 8, 1550 & 0xff, 0, 1, 0, 2 };
+  TEST_ASSERT_TRUE(expected == r);
+}
+
+void test_write_is_atomic()
+{
+  // fan speed 0 is rejected by the handler, so nothing may be applied
+  std::vector<uint8_t> exc = { 0x90, 3 };
+  TEST_ASSERT_TRUE(exc == request(writeMultiple(0, { 3, 1200, 0 })));
+  TEST_ASSERT_EQUAL(1, s_registers.mode_);
+  TEST_ASSERT_EQUAL(1500, s_registers.fan1_);
+  TEST_ASSERT_EQUAL(1550, s_registers.fan2_);
+
+  // flap value 3 has no command
+  exc = { 0x86, 3 };
+  TEST_ASSERT_TRUE(exc == request({ 6, 0, 4, 0, 3 }));
+  TEST_ASSERT_TRUE(s_registers.flap_open_);
+  std::vector<uint8_t> echo = { 6, 0, 4, 0, 1 };
+  TEST_ASSERT_TRUE(echo == request({ 6, 0, 4, 0, 1 }));
+  TEST_ASSERT_FALSE(s_registers.flap_open_);
+}
+
+void test_invalid_frame_closes_connection()
+{
+  TEST_ASSERT_TRUE(request({ 3, 0, 0, 0, 1 }, 1).empty());
+  connectClient();
+  TEST_ASSERT_EQUAL(4, int(request({ 3, 0, 0, 0, 1 }).size()));
+}
+
+int main()
+{
+  s_server.begin(Serial, s_registers, TEST_PORT);
+  MessageHandler::begin([](void*, const char*, const char*, bool) { return true; }, nullptr);
+  connectClient();
+  UNITY_BEGIN();
+  RUN_TEST(test_read_input_registers);
+  RUN_TEST(test_read_out_of_range);
+  RUN_TEST(test_write_multiple);
+  RUN_TEST(test_write_is_atomic);
+  RUN_TEST(test_invalid_frame_closes_connection);
+  return UNITY_END();
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Tests of network connection setup with a scripted fake transport.
+ *
+ * The transport joins the network and opens TCP connections with a delay,
+ * like the ESP module, and drops connections on request. The network
+ * client must reconnect in steps, none of which may block the loop.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "KWLConfig.h"
+#include "LoopbackTransport.h"
+#include "NetworkClient.h"
+
+#include <MicroNTP.h>
+#include <TimeScheduler.h>
+
+#include <stdio.h>
+
+namespace {
+
+  /// Loopback transport with scripted delays and failures.
+  class ScriptedTransport : public LoopbackTransport
+  {
+  public:
+    virtual bool join(const Settings& settings) override
+    {
+      ++join_calls_;
+      join_done_ = micros() + join_time_;
+      joining_ = true;
+      return LoopbackTransport::join(settings);
+    }
+
+    virtual bool isJoining() override
+    {
+      if (joining_ && long(micros() - join_done_) >= 0)
+        joining_ = false;
+      return joining_;
+    }
+
+    virtual unsigned long getRejoinInterval() const override { return 60000000; }
+
+    virtual bool isLinkUp() override { return link_ && !isJoining(); }
+
+    virtual bool connect(IPAddress ip, uint16_t port) override
+    {
+      ++connect_calls_;
+      connect_ip_ = ip;
+      connect_port_ = port;
+      connect_done_ = micros() + connect_time_;
+      connecting_ = true;
+      return true;
+    }
+
+    virtual bool isConnecting() override
+    {
+      if (!connecting_)
+        return false;
+      if (long(micros() - connect_done_) < 0)
+        return true;
+      connecting_ = false;
+      if (link_ && connect_failures_ == 0)
+        LoopbackTransport::connect(connect_ip_, connect_port_);
+      else if (connect_failures_)
+        --connect_failures_;
+      return false;
+    }
+
+    bool link_ = true;                        ///< Network link state.
+    unsigned long join_time_ = 5000000;       ///< Time to join the network.
+    unsigned long connect_time_ = 3000000;    ///< Time to open TCP connection.
+    unsigned connect_failures_ = 0;           ///< Count of TCP connects still to fail.
+    unsigned join_calls_ = 0;                 ///< Count of join requests.
+    unsigned connect_calls_ = 0;              ///< Count of TCP connect requests.
+
+  private:
+    bool joining_ = false;
+    bool connecting_ = false;
+    unsigned long join_done_ = 0;
+    unsigned long connect_done_ = 0;
+    IPAddress connect_ip_;
+    uint16_t connect_port_ = 0;
+  };
+
+  KWLPersistentConfig s_config;
+  ScriptedTransport s_transport;
+  MicroNTP s_ntp(s_transport.getUDP());
+  NetworkClient s_client(s_config, s_ntp, s_transport);
+  Scheduler::PollingScheduler s_scheduler;
+
+  unsigned long s_max_loop_time = 0;  ///< Longest scheduler loop in simulated microseconds.
+
+  /// Run scheduler in 10ms steps until the condition holds or time runs out.
+  template<typename Cond>
+  bool runUntil(Cond&& cond, unsigned long max_ms)
+  {
+    for (unsigned long i = 0; i < max_ms; i += 10) {
+      if (cond())
+        return true;
+      auto start = micros();
+      s_scheduler.loop();
+      auto time = micros() - start;
+      if (time > s_max_loop_time)
+        s_max_loop_time = time;
+      ArduinoHost::advanceMicros(10000);
+    }
+    return cond();
+  }
+
+  bool connected() { return s_client.isMQTTOk() && s_transport.getBroker().isConnected(); }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_connect_with_delayed_join_and_failed_connects()
+{
+  s_transport.connect_failures_ = 2;
+  ArduinoHost::clearEEPROM();
+  s_config.begin(Serial);
+  s_client.begin(Serial);
+  TEST_ASSERT_FALSE(s_client.isLANOk());
+  // join takes 5s, then 2 failed connects with backoff 15s and 30s + jitter
+  TEST_ASSERT_TRUE(runUntil(connected, 120000));
+  TEST_ASSERT_TRUE(s_client.isLANOk());
+  TEST_ASSERT_EQUAL(1, s_transport.join_calls_);
+  TEST_ASSERT_EQUAL(3, s_transport.connect_calls_);
+}
+
+void test_reconnect_after_drop()
+{
+  auto calls = s_transport.connect_calls_;
+  s_transport.getBroker().close();
+  TEST_ASSERT_TRUE(runUntil([]() { return !s_client.isMQTTOk(); }, 1000));
+  // reconnect starts immediately and takes 3s for TCP connect
+  TEST_ASSERT_TRUE(runUntil(connected, 5000));
+  TEST_ASSERT_EQUAL(calls + 1, s_transport.connect_calls_);
+}
+
+void test_link_loss()
+{
+  s_transport.link_ = false;
+  TEST_ASSERT_TRUE(runUntil([]() { return !s_client.isLANOk(); }, 2000));
+  TEST_ASSERT_FALSE(s_client.isMQTTOk());
+  // long outage, the link is checked with backoff and joined at most once per rejoin interval
+  auto joins = s_transport.join_calls_;
+  runUntil([]() { return false; }, 300000);
+  TEST_ASSERT_FALSE(s_client.isLANOk());
+  TEST_ASSERT_LESS_OR_EQUAL(joins + 5, s_transport.join_calls_);
+  s_transport.link_ = true;
+  TEST_ASSERT_TRUE(runUntil(connected, 300000));
+}
+
+void test_loop_never_blocks()
+{
+  // joining and connecting are asynchronous, MQTT connect over open TCP connection is fast,
+  // so no loop comes near to the watchdog period
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "longest loop: %lu us of simulated time", s_max_loop_time);
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_LESS_THAN(100000, s_max_loop_time);
+}
+
+int main()
+{
+  // waiting loops polling the clock advance time, so blocking shows in loop time
+  ArduinoHost::setAutoAdvance(10);
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_with_delayed_join_and_failed_connects);
+  RUN_TEST(test_reconnect_after_drop);
+  RUN_TEST(test_link_loss);
+  RUN_TEST(test_loop_never_blocks);
+  return UNITY_END();
+}
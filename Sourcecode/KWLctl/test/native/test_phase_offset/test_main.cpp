@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Simulation of broker load of many devices restarted at once.
+ *
+ * 100 devices with different MAC and IP addresses start at the same time,
+ * e.g., after a power outage. Phase offsets are computed by the real
+ * KWLPersistentConfig::getPhaseOffset() for the same periods as the tasks
+ * publishing periodic messages (MQTT connect and heartbeat, temperatures,
+ * fan speeds and mode, summer bypass state) with default reporting
+ * configuration. Measurements are assumed to be stable, so only periodic
+ * messages are sent (worst case for lockstep bursts). The peak count of
+ * messages per second is compared with and without phase offsets.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "KWLConfig.h"
+
+#include <stdio.h>
+#include <vector>
+
+namespace {
+
+  /// Count of simulated devices.
+  constexpr unsigned DEVICES = 100;
+  /// Simulated time in seconds.
+  constexpr unsigned DURATION = 3600;
+  /// MQTT reconnect interval in microseconds, as in NetworkClient.cpp.
+  constexpr unsigned long MQTT_RECONNECT_INTERVAL = 15000000;
+  /// Interval of summer bypass checks in microseconds, as in SummerBypass.cpp.
+  constexpr unsigned long INTERVAL_BYPASS_CHECK = 20000000;
+
+  struct NullPrint : public Print
+  {
+    virtual size_t write(uint8_t) override { return 1; }
+  };
+
+  NullPrint s_out;
+  KWLPersistentConfig s_config;
+
+  /// Add messages sent every period seconds starting at first to the load.
+  void schedule(std::vector<unsigned>& load, unsigned long first, unsigned long period, unsigned messages)
+  {
+    for (auto t = first; t < load.size(); t += period)
+      load[t] += messages;
+  }
+
+  /// Simulate all devices, return count of messages sent in each second.
+  std::vector<unsigned> simulate(bool use_offsets)
+  {
+    std::vector<unsigned> load(DURATION);
+    for (unsigned i = 0; i < DEVICES; ++i) {
+      s_config.setNetworkMACAddress(MACAddressLiteral(0xde, 0xed, 0xba, 0xfe, uint8_t(i >> 8), uint8_t(i)));
+      s_config.setNetworkIPAddress(IPAddressLiteral(192, 168, uint8_t(1 + (i >> 8)), uint8_t(10 + i)));
+      auto offset = [use_offsets](unsigned long period) { return use_offsets ? s_config.getPhaseOffset(period) : 0; };
+
+      // MQTT connect and heartbeat
+      const auto connect = offset(MQTT_RECONNECT_INTERVAL) / 1000000;
+      const unsigned long heartbeat = KWLConfig::HeartbeatPeriod * 1000000UL;
+      schedule(load, connect + (1 + offset(heartbeat)) / 1000000, KWLConfig::HeartbeatPeriod, 1);
+
+      // temperatures (4 messages) at maximum interval, first one delayed by the offset
+      const auto temp = s_config.getMeasurementInterval(ReportingParam::TempMaxInterval);
+      schedule(load, offset(temp) + temp, temp, 4);
+
+      // fan speeds (2 messages) and ventilation mode
+      const auto fan = s_config.getMeasurementInterval(ReportingParam::FanMaxInterval);
+      schedule(load, 1 + offset(fan), fan, 2);
+      const auto mode = s_config.getReporting(ReportingParam::FanModeInterval);
+      schedule(load, 1 + offset(mode), mode, 1);
+
+      // summer bypass state, counted down in bypass checks
+      const auto bypass = s_config.getReporting(ReportingParam::BypassInterval);
+      const auto checks = bypass * 1000000UL / INTERVAL_BYPASS_CHECK;
+      schedule(load, (1 + offset(checks)) * (INTERVAL_BYPASS_CHECK / 1000000), bypass, 1);
+    }
+    return load;
+  }
+
+  /// Report load and return the peak count of messages per second.
+  unsigned report(const char* title, const std::vector<unsigned>& load)
+  {
+    unsigned long total = 0;
+    unsigned peak = 0, busy = 0;
+    for (auto l : load) {
+      total += l;
+      if (l > peak)
+        peak = l;
+      if (l)
+        ++busy;
+    }
+    char buffer[160];
+    snprintf(buffer, sizeof(buffer), "%-16s total %6lu msgs, peak %4u msgs/s, avg %6.2f msgs/s, %4u of %u seconds with traffic",
+             title, total, peak, double(total) / load.size(), busy, unsigned(load.size()));
+    TEST_MESSAGE(buffer);
+    return peak;
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_stable_offset()
+{
+  // same identity and period give the same offset, below the period
+  s_config.setNetworkMACAddress(MACAddressLiteral(0xde, 0xed, 0xba, 0xfe, 0, 1));
+  s_config.setNetworkIPAddress(IPAddressLiteral(192, 168, 1, 11));
+  const auto offset = s_config.getPhaseOffset(60);
+  TEST_ASSERT_TRUE(offset < 60);
+  TEST_ASSERT_EQUAL(offset, s_config.getPhaseOffset(60));
+  TEST_ASSERT_EQUAL(0, s_config.getPhaseOffset(0));
+}
+
+void test_broker_load()
+{
+  const auto lockstep = simulate(false);
+  const auto shifted = simulate(true);
+  const unsigned peak_lockstep = report("without offsets:", lockstep);
+  const unsigned peak_shifted = report("with offsets:", shifted);
+  unsigned long total = 0;
+  for (auto l : shifted)
+    total += l;
+  // without offsets, all devices send in the same second
+  TEST_ASSERT_TRUE(peak_lockstep >= DEVICES);
+  // with offsets, the peak stays within a small multiple of the average load
+  TEST_ASSERT_TRUE(peak_shifted * 10 <= peak_lockstep);
+  TEST_ASSERT_TRUE(peak_shifted <= 8 * total / DURATION);
+}
+
+int main(int, char**)
+{
+  ArduinoHost::clearEEPROM();
+  s_config.begin(s_out);
+  UNITY_BEGIN();
+  RUN_TEST(test_stable_offset);
+  RUN_TEST(test_broker_load);
+  return UNITY_END();
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Tests of streamed publishing with a simulated network stream.
+ *
+ * A streamed message announces its payload length up front, so a payload
+ * of a different length or a failed write must not be finished, but abort
+ * the connection.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "MessageHandler.h"
+
+#include <string>
+
+namespace {
+
+  /// Network stream accepting a limited number of bytes.
+  class FakeStream : public Print
+  {
+  public:
+    virtual size_t write(uint8_t c) override { return write(&c, 1); }
+
+    virtual size_t write(const uint8_t* buffer, size_t size) override
+    {
+      ++writes_;
+      if (size > capacity_)
+        size = capacity_;
+      capacity_ -= size;
+      data_.append(reinterpret_cast<const char*>(buffer), size);
+      return size;
+    }
+
+    std::string data_;          ///< Data written.
+    size_t capacity_ = 10000;   ///< Count of bytes still accepted.
+    unsigned writes_ = 0;       ///< Count of write calls.
+  };
+
+  FakeStream s_stream;
+  unsigned s_announced;   ///< Announced payload length.
+  int s_complete;         ///< Result of the last message (-1 = not finished).
+
+  bool publishCallback(void*, const char*, const char*, bool) { return true; }
+
+  Print* beginStream(void*, const char*, unsigned length, bool)
+  {
+    s_announced = length;
+    return &s_stream;
+  }
+
+  bool endStream(void*, bool complete)
+  {
+    s_complete = complete;
+    return true;
+  }
+
+  /// Writer producing different lengths on sizing and writing pass.
+  struct VaryingWriter
+  {
+    VaryingWriter(unsigned f, unsigned s) : first(f), second(s) {}
+
+    unsigned first, second;
+    unsigned pass = 0;
+
+    void operator()(Print& out)
+    {
+      auto count = pass++ ? second : first;
+      for (unsigned i = 0; i < count; ++i)
+        out.write(char('a' + i % 26));
+    }
+  };
+
+}
+
+void setUp()
+{
+  s_stream = FakeStream();
+  s_announced = 0;
+  s_complete = -1;
+}
+
+void tearDown() {}
+
+void test_complete_payload()
+{
+  TEST_ASSERT_TRUE(MessageHandler::publishStream("topic", VaryingWriter(100, 100)));
+  TEST_ASSERT_EQUAL(100, s_announced);
+  TEST_ASSERT_EQUAL(1, s_complete);
+  TEST_ASSERT_EQUAL(100, s_stream.data_.size());
+  std::string start = s_stream.data_.substr(0, 32);
+  TEST_ASSERT_EQUAL_STRING("abcdefghijklmnopqrstuvwxyzabcdef", start.c_str());
+  // written in chunks, not byte by byte
+  TEST_ASSERT_EQUAL(4, s_stream.writes_);
+}
+
+void test_short_payload_aborts()
+{
+  // no padding, which would send garbage as valid message
+  TEST_ASSERT_FALSE(MessageHandler::publishStream("topic", VaryingWriter(50, 40)));
+  TEST_ASSERT_EQUAL(50, s_announced);
+  TEST_ASSERT_EQUAL(0, s_complete);
+  TEST_ASSERT_EQUAL(40, s_stream.data_.size());
+}
+
+void test_long_payload_aborts()
+{
+  // no truncation, which would send a wrong message as valid one
+  TEST_ASSERT_FALSE(MessageHandler::publishStream("topic", VaryingWriter(50, 60)));
+  TEST_ASSERT_EQUAL(0, s_complete);
+  TEST_ASSERT_EQUAL(50, s_stream.data_.size());
+}
+
+void test_failed_write_aborts()
+{
+  s_stream.capacity_ = 40;
+  TEST_ASSERT_FALSE(MessageHandler::publishStream("topic", VaryingWriter(100, 100)));
+  TEST_ASSERT_EQUAL(0, s_complete);
+  // nothing written after the failed chunk
+  TEST_ASSERT_EQUAL(40, s_stream.data_.size());
+  TEST_ASSERT_EQUAL(2, s_stream.writes_);
+}
+
+int main()
+{
+  MessageHandler::begin(publishCallback, nullptr);
+  MessageHandler::setStreamCallbacks(beginStream, endStream);
+  UNITY_BEGIN();
+  RUN_TEST(test_complete_payload);
+  RUN_TEST(test_short_payload_aborts);
+  RUN_TEST(test_long_payload_aborts);
+  RUN_TEST(test_failed_write_aborts);
+  return UNITY_END();
+}
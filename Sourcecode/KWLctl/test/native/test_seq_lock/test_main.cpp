@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Stress test of SeqLock readers against a simulated interrupt.
+ *
+ * A POSIX interval timer raises SIGALRM every few microseconds. Its handler
+ * plays the interrupt routine and writes the protected data, while the test
+ * reads it in a loop, like the main loop on the controller. Each read must
+ * be consistent. The same is checked for FanRPM, which shares its state
+ * with the tacho interrupt via SeqLock.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include <FanRPM.h>
+#include <SeqLock.h>
+
+#include <chrono>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+namespace {
+
+/// Data to protect, all fields derived from a.
+struct Data
+{
+  unsigned long a, b, c, d;
+  unsigned char e;
+};
+
+/// Count of interrupts to run in each test.
+constexpr unsigned long INTERRUPTS = 100000;
+
+SeqLock<Data> s_lock;
+volatile Data s_naive;
+volatile unsigned long s_interrupts = 0;
+FanRPM s_rpm;
+volatile unsigned long s_time = 0;
+void (*volatile s_handler)() = nullptr;
+
+unsigned long timeSource() { return s_time; }
+
+bool consistent(const Data& d)
+{
+  return d.b == d.a * 3 && d.c == ~d.a && d.d == (d.a ^ 0x5555) && d.e == (unsigned char)d.a;
+}
+
+void onSignal(int)
+{
+  s_interrupts = s_interrupts + 1;
+  s_handler();
+}
+
+/// Write data protected by SeqLock and the same data unprotected.
+void writeData()
+{
+  SeqLock<Data>::Writer w(s_lock);
+  auto& d = w.data();
+  d.a = d.a + 1;
+  d.b = d.a * 3;
+  d.c = ~d.a;
+  d.d = d.a ^ 0x5555;
+  d.e = (unsigned char)d.a;
+  s_naive.a = s_naive.a + 1;
+  s_naive.b = s_naive.a * 3;
+  s_naive.c = ~s_naive.a;
+  s_naive.d = s_naive.a ^ 0x5555;
+}
+
+/*!
+ * @brief Tacho signal of a fan at 1500 rpm (40ms per rotation), stopping for 2 seconds every 50 rotations.
+ *
+ * After each stop, the measurement restarts, so the count of measurements
+ * changes together with their sum and a torn read gives a wrong speed.
+ */
+void writeEdge()
+{
+  const unsigned long t = s_time + ((s_interrupts % 50) == 0 ? 2000000 : 40000);
+  s_time = t;
+  s_rpm.edge(t);
+}
+
+/// Start simulated interrupt calling handler every 10us.
+void startInterrupts(void (*handler)())
+{
+  s_handler = handler;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onSignal;
+  sigaction(SIGALRM, &sa, nullptr);
+  struct itimerval timer;
+  timer.it_value.tv_sec = 0;
+  timer.it_value.tv_usec = 10;
+  timer.it_interval = timer.it_value;
+  setitimer(ITIMER_REAL, &timer, nullptr);
+}
+
+void stopInterrupts()
+{
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_REAL, &timer, nullptr);
+  signal(SIGALRM, SIG_IGN);
+}
+
+/// Check whether the test should go on (enough interrupts, but at most 30 seconds).
+bool running(unsigned long start_interrupts, std::chrono::steady_clock::time_point start_time)
+{
+  return s_interrupts - start_interrupts < INTERRUPTS &&
+         std::chrono::steady_clock::now() - start_time < std::chrono::seconds(30);
+}
+
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_consistent_reads()
+{
+  unsigned long torn = 0, naive_torn = 0, reads = 0;
+  writeData();  // zero-initialized data is not consistent
+  const auto start_time = std::chrono::steady_clock::now();
+  const unsigned long start = s_interrupts;
+  startInterrupts(writeData);
+  while (running(start, start_time)) {
+    const Data d = s_lock.read();
+    if (!consistent(d))
+      ++torn;
+    Data n;
+    n.a = s_naive.a;
+    n.b = s_naive.b;
+    n.c = s_naive.c;
+    n.d = s_naive.d;
+    n.e = (unsigned char)n.a;
+    if (!consistent(n))
+      ++naive_torn;
+    ++reads;
+  }
+  stopInterrupts();
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer), "SeqLock: %lu reads, %lu interrupts, %lu torn (unprotected copy: %lu torn)",
+           reads, s_interrupts - start, torn, naive_torn);
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_GREATER_THAN(1000, s_interrupts - start);
+  TEST_ASSERT_EQUAL(0, torn);
+}
+
+void test_fan_rpm_reads()
+{
+  s_rpm.setTimeSource(timeSource);
+  unsigned long wrong = 0, none = 0, reads = 0;
+  int wrong_speed = 0;
+  const auto start_time = std::chrono::steady_clock::now();
+  const unsigned long start = s_interrupts;
+  startInterrupts(writeEdge);
+  while (running(start, start_time)) {
+    // alternate both averages, they read the same state
+    const int speed = (reads & 1) ? s_rpm.getRecentSpeed() : s_rpm.getSpeed();
+    if (speed == 0) {
+      ++none;  // restarted after the fan stopped
+    } else if (speed != 1500) {
+      wrong_speed = speed;
+      ++wrong;
+    }
+    ++reads;
+  }
+  stopInterrupts();
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer), "FanRPM: %lu reads, %lu interrupts, %lu wrong (last %d), %lu without speed",
+           reads, s_interrupts - start, wrong, wrong_speed, none);
+  TEST_MESSAGE(buffer);
+  TEST_ASSERT_GREATER_THAN(1000, s_interrupts - start);
+  TEST_ASSERT_EQUAL(0, wrong);
+}
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_consistent_reads);
+  RUN_TEST(test_fan_rpm_reads);
+  return UNITY_END();
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Serial console: command lines and binary configuration frames.
+ *
+ * Feeds bytes to Serial of the host environment and polls the console via
+ * the scheduler. Lines are dispatched to a recording message handler,
+ * binary frames are checked byte by byte against an independent
+ * CRC-16/MODBUS, including all error responses and the frame timeout.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "KWLConfig.h"
+#include "SerialConsole.h"
+
+#include <MessageHandler.h>
+#include <TimeScheduler.h>
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct NullPrint : public Print
+{
+  virtual size_t write(uint8_t) override { return 1; }
+};
+
+/// Handler recording all messages as topic=payload.
+class Recorder : public MessageHandler
+{
+public:
+  Recorder() : MessageHandler(F("Recorder")) {}
+
+  std::vector<std::string> messages;
+
+private:
+  virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override
+  {
+    messages.push_back(std::string(topic.c_str(), topic.length()) + '=' + std::string(s.c_str(), s.length()));
+    return true;
+  }
+};
+
+NullPrint s_out;
+KWLPersistentConfig s_config;
+SerialConsole s_console(s_config);
+Recorder s_recorder;
+Scheduler::PollingScheduler s_scheduler;
+
+/// CRC-16/MODBUS, computed bitwise.
+uint16_t crc16(const std::string& data)
+{
+  uint16_t crc = 0xffff;
+  for (unsigned char c : data) {
+    crc ^= c;
+    for (int i = 0; i < 8; ++i)
+      crc = (crc & 1) ? uint16_t((crc >> 1) ^ 0xa001) : uint16_t(crc >> 1);
+  }
+  return crc;
+}
+
+/// Build a frame with given command and payload.
+std::string frame(char cmd, const std::string& payload)
+{
+  std::string body(1, cmd);
+  body.push_back(char(payload.size()));
+  body.push_back(char(payload.size() >> 8));
+  body += payload;
+  const uint16_t crc = crc16(body);
+  return '\x02' + body + char(crc) + char(crc >> 8);
+}
+
+void feed(const std::string& data)
+{
+  ArduinoHost::addSerialInput(data.data(), data.size());
+}
+
+/// Poll the console once.
+void poll()
+{
+  ArduinoHost::advanceMicros(1000);
+  s_scheduler.loop();
+}
+
+/// Send a frame and return the response.
+std::string request(const std::string& data)
+{
+  ArduinoHost::clearSerialOutput();
+  feed(data);
+  poll();
+  return ArduinoHost::getSerialOutput();
+}
+
+/// Check that response is a valid frame with given command and return its payload.
+std::string checkFrame(const std::string& response, char cmd)
+{
+  TEST_ASSERT_TRUE(response.size() >= 6);
+  TEST_ASSERT_EQUAL(0x02, response[0]);
+  TEST_ASSERT_EQUAL(cmd, response[1]);
+  const size_t len = uint8_t(response[2]) | (uint8_t(response[3]) << 8);
+  TEST_ASSERT_EQUAL(len + 6, response.size());
+  const uint16_t crc = crc16(response.substr(1, len + 3));
+  TEST_ASSERT_EQUAL_HEX16(crc, uint8_t(response[len + 4]) | (uint8_t(response[len + 5]) << 8));
+  return response.substr(4, len);
+}
+
+/// Check that response is an error frame with given code.
+void checkError(const std::string& response, SerialConsole::ErrorCode code)
+{
+  const std::string payload = checkFrame(response, 'E');
+  TEST_ASSERT_EQUAL(1, payload.size());
+  TEST_ASSERT_EQUAL(uint8_t(code), uint8_t(payload[0]));
+}
+
+/// Current in-memory configuration image.
+std::string image()
+{
+  return std::string(reinterpret_cast<const char*>(&s_config), sizeof(s_config));
+}
+
+}
+
+void setUp()
+{
+  s_recorder.messages.clear();
+  ArduinoHost::setAutoAdvance(0);
+}
+
+void tearDown() {}
+
+void test_crc()
+{
+  // check value of CRC-16/MODBUS
+  TEST_ASSERT_EQUAL_HEX16(0x4b37, crc16("123456789"));
+}
+
+void test_lines()
+{
+  // all available bytes are read in one poll, but at most one line is dispatched
+  feed("kwl/a 1\nkwl/b \t 2\r\n\nkwl/c\n");
+  poll();
+  TEST_ASSERT_EQUAL(1, s_recorder.messages.size());
+  TEST_ASSERT_EQUAL_STRING("kwl/a=1", s_recorder.messages[0].c_str());
+  TEST_ASSERT_TRUE(Serial.available() > 0);
+  poll();
+  TEST_ASSERT_EQUAL(2, s_recorder.messages.size());
+  TEST_ASSERT_EQUAL_STRING("kwl/b=2", s_recorder.messages[1].c_str());
+  // empty line is skipped, line without value gets a placeholder
+  poll();
+  TEST_ASSERT_EQUAL(3, s_recorder.messages.size());
+  TEST_ASSERT_EQUAL_STRING("kwl/c=<no value>", s_recorder.messages[2].c_str());
+  poll();
+  TEST_ASSERT_EQUAL(3, s_recorder.messages.size());
+  TEST_ASSERT_EQUAL(0, Serial.available());
+}
+
+void test_partial_line()
+{
+  // incomplete line is drained and kept until the end of line arrives
+  feed("kwl/lueftungsstufe 1");
+  poll();
+  TEST_ASSERT_EQUAL(0, Serial.available());
+  TEST_ASSERT_EQUAL(0, s_recorder.messages.size());
+  feed("23");
+  poll();
+  feed("\r");
+  poll();
+  TEST_ASSERT_EQUAL(1, s_recorder.messages.size());
+  TEST_ASSERT_EQUAL_STRING("kwl/lueftungsstufe=123", s_recorder.messages[0].c_str());
+
+  // too long line is truncated
+  feed("kwl/x " + std::string(200, 'y') + "\n");
+  poll();
+  TEST_ASSERT_EQUAL(2, s_recorder.messages.size());
+  TEST_ASSERT_EQUAL(127, s_recorder.messages[1].size());
+}
+
+void test_info_and_read()
+{
+  const std::string info = checkFrame(request(frame('I', "")), 'I');
+  TEST_ASSERT_EQUAL(4, info.size());
+  TEST_ASSERT_EQUAL(s_config.getVersion(), uint8_t(info[0]) | (uint8_t(info[1]) << 8));
+  TEST_ASSERT_EQUAL(sizeof(KWLPersistentConfig), uint8_t(info[2]) | (uint8_t(info[3]) << 8));
+
+  const std::string data = checkFrame(request(frame('R', "")), 'R');
+  TEST_ASSERT_TRUE(data == image());
+
+  // frame after a line in the same input is handled in the next poll
+  feed("kwl/a 1\n");
+  const std::string response = request(frame('I', ""));
+  TEST_ASSERT_EQUAL(0, response.size());
+  TEST_ASSERT_EQUAL(1, s_recorder.messages.size());
+  ArduinoHost::clearSerialOutput();
+  poll();
+  checkFrame(ArduinoHost::getSerialOutput(), 'I');
+}
+
+void test_errors()
+{
+  // checksum
+  std::string bad = frame('I', "");
+  bad.back() ^= 0x55;
+  checkError(request(bad), SerialConsole::ErrorCode::Checksum);
+  // length
+  checkError(request(frame('I', "x")), SerialConsole::ErrorCode::Length);
+  checkError(request(frame('R', "xy")), SerialConsole::ErrorCode::Length);
+  checkError(request(frame('W', "xyz")), SerialConsole::ErrorCode::Length);
+  // command
+  checkError(request(frame('X', "")), SerialConsole::ErrorCode::Command);
+  // nothing left over to be taken as a line
+  poll();
+  TEST_ASSERT_EQUAL(0, s_recorder.messages.size());
+  TEST_ASSERT_EQUAL(0, Serial.available());
+}
+
+void test_write_rejected()
+{
+  const std::string original = image();
+  const unsigned version = s_config.getVersion();
+  TEST_ASSERT_EQUAL(0, memcmp(original.data(), &version, sizeof(version)));
+
+  // version mismatch, configuration in memory is restored from EEPROM
+  std::string other = original;
+  for (size_t i = sizeof(version); i < other.size(); ++i)
+    other[i] = char(~other[i]);
+  other[0] = char(other[0] + 1);
+  checkError(request(frame('W', other)), SerialConsole::ErrorCode::Version);
+  TEST_ASSERT_TRUE(image() == original);
+
+  // checksum error after the image was received into memory
+  other[0] = original[0];
+  std::string bad = frame('W', other);
+  bad[bad.size() - 2] ^= 1;
+  checkError(request(bad), SerialConsole::ErrorCode::Checksum);
+  TEST_ASSERT_TRUE(image() == original);
+
+  // timeout in the middle of the image
+  ArduinoHost::setAutoAdvance(100);
+  checkError(request(frame('W', other).substr(0, 100)), SerialConsole::ErrorCode::Timeout);
+  TEST_ASSERT_TRUE(image() == original);
+}
+
+void test_timeout()
+{
+  // frame is read at once, missing bytes are awaited for 2 seconds
+  ArduinoHost::setAutoAdvance(100);
+  const std::string partial = frame('I', "").substr(0, 3);
+  const auto start = micros();
+  const std::string response = request(partial);
+  const auto elapsed = micros() - start;
+  checkError(response, SerialConsole::ErrorCode::Timeout);
+  TEST_ASSERT_TRUE(elapsed >= 2000000UL);
+  TEST_ASSERT_TRUE(elapsed < 2010000UL);
+
+  // complete frame delivered at once doesn't wait
+  const auto start2 = micros();
+  checkFrame(request(frame('I', "")), 'I');
+  TEST_ASSERT_TRUE(micros() - start2 < 10000UL);
+}
+
+void test_write()
+{
+  // prepare image with changed fan speed
+  const auto speed = s_config.getSpeedSetpointFan1();
+  s_config.setSpeedSetpointFan1(speed + 111);
+  const std::string changed = image();
+  s_config.setSpeedSetpointFan1(speed);
+
+  TEST_ASSERT_EQUAL(0, checkFrame(request(frame('W', changed)), 'W').size());
+  TEST_ASSERT_EQUAL(speed + 111, s_config.getSpeedSetpointFan1());
+  // stored in EEPROM (restart doesn't happen on host)
+  s_config.reload();
+  TEST_ASSERT_EQUAL(speed + 111, s_config.getSpeedSetpointFan1());
+}
+
+int main(int, char**)
+{
+  ArduinoHost::clearEEPROM();
+  s_config.begin(s_out);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_crc);
+  RUN_TEST(test_lines);
+  RUN_TEST(test_partial_line);
+  RUN_TEST(test_info_and_read);
+  RUN_TEST(test_errors);
+  RUN_TEST(test_write_rejected);
+  RUN_TEST(test_timeout);
+  RUN_TEST(test_write);
+  return UNITY_END();
+}
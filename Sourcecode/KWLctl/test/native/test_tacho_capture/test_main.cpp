@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Validation of tacho input capture against a register stand-in.
+ *
+ * Timers 4 and 5 are simulated on the register level (counter, capture
+ * register and overflow flag). Tacho edges are delivered with interrupt
+ * latency, sometimes long enough for a timer overflow to be pending when
+ * the capture interrupt runs. Speed measured via input capture is compared
+ * with the measurement via micros() in an external interrupt. The time spent
+ * in the interrupt routines of both fans at 500, 2000 and 5000 rpm is
+ * measured on the build host, cycles on the controller are measured by
+ * embedded/test_tacho_capture.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include <FanRPM.h>
+#include <TachoCapture.h>
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+  /// Simulated timer, counter is derived from simulated time in microseconds.
+  struct Timer
+  {
+    Timer(double tick, unsigned long long period) : tick_us(tick), period(period) {}
+
+    /// Count of wraps until given time.
+    unsigned long long wraps(double us) const { return (unsigned long long)(us / tick_us) / period; }
+    /// Counter value at given time.
+    uint16_t count(double us) const { return uint16_t((unsigned long long)(us / tick_us) % period); }
+
+    /// Interrupts disabled until given time, at most one overflow stays pending.
+    void block(double us)
+    {
+      if (wraps(us) > delivered) {
+        pending = true;
+        delivered = wraps(us);
+      }
+    }
+
+    /// Interrupts enabled until given time, deliver all overflows.
+    void run(double us, void (*overflow)())
+    {
+      if (pending) {
+        pending = false;
+        overflow();
+      }
+      while (delivered < wraps(us)) {
+        ++delivered;
+        overflow();
+      }
+    }
+
+    double tick_us;                     ///< Duration of one timer tick.
+    unsigned long long period;          ///< Ticks per wrap.
+    unsigned long long delivered = 0;   ///< Wraps accounted for (interrupt run or pending).
+    bool pending = false;               ///< Overflow flag set, interrupt not run yet.
+  };
+
+  Timer s_t4(0.5, 65536);   // prescaler 8, 16 bits
+  Timer s_t5(4, 256);       // prescaler 64, 8 bits
+  double s_now;
+
+  void syncRegisters()
+  {
+    TCNT4 = s_t4.count(s_now);
+    TCNT5 = s_t5.count(s_now);
+    TIFR4 = s_t4.pending ? _BV(TOV4) : 0;
+    TIFR5 = s_t5.pending ? _BV(TOV5) : 0;
+    ArduinoHost::setMicros((unsigned long)s_now);
+  }
+
+  /// Run with interrupts enabled until given time.
+  void runTo(double us)
+  {
+    s_now = us;
+    s_t4.run(us, TachoCapture::overflowICP4);
+    s_t5.run(us, TachoCapture::overflowICP5);
+    syncRegisters();
+  }
+
+  /// Print collecting output in a string.
+  class StringPrint : public Print
+  {
+  public:
+    virtual size_t write(uint8_t c) override { text += char(c); return 1; }
+    using Print::write;
+    std::string text;
+  };
+
+  /// Get time of the last edge accepted by the measurement.
+  unsigned long lastEdge(FanRPM& rpm)
+  {
+    StringPrint out;
+    rpm.dump(out);
+    auto pos = out.text.find('@');
+    return pos == std::string::npos ? 0 : strtoul(out.text.c_str() + pos + 1, nullptr, 10);
+  }
+
+  /// Absolute difference of edge time to the real time in microseconds.
+  double edgeError(FanRPM& rpm, double t) { return fabs(double(long(lastEdge(rpm) - (unsigned long)t))); }
+
+  /// Relative error in percent.
+  double error(int speed, double rpm) { return fabs(speed - rpm) / rpm * 100; }
+
+  /// Maximum errors of one simulation run.
+  struct Errors
+  {
+    double isr = 0;   ///< Error of measurement via micros().
+    double icp4 = 0;  ///< Error of measurement via Timer 4 capture.
+    double icp5 = 0;  ///< Error of measurement via Timer 5 capture.
+    double edge4 = 0; ///< Maximum error of edge time via Timer 4 in microseconds.
+    double edge5 = 0; ///< Maximum error of edge time via Timer 5 in microseconds.
+  };
+
+  /**
+   * @brief Simulate fan at given speed with interrupt latency.
+   *
+   * @param rpm fan speed.
+   * @param burst maximum latency of every 7th edge in microseconds, others have at most 40us.
+   */
+  Errors simulate(double rpm, double burst)
+  {
+    FanRPM isr, icp4, icp5;
+    s_t4.delivered = s_t5.delivered = 0;
+    s_t4.pending = s_t5.pending = false;
+    s_now = 0;
+    syncRegisters();
+    TEST_ASSERT_TRUE(TachoCapture::begin(TachoCapture::PIN_ICP4, icp4, true));
+    TEST_ASSERT_TRUE(TachoCapture::begin(TachoCapture::PIN_ICP5, icp5, true));
+    runTo(1e6);
+    Errors result;
+    double period = 60e6 / rpm, t = s_now;
+    for (int i = 0; i < 400; ++i) {
+      t += period * (1 + 0.002 * ((rand() % 2001) - 1000) / 1000.0);
+      double latency = rand() % 41;
+      if (i % 7 == 0)
+        latency = burst * (rand() % 1001) / 1000.0;
+      // interrupts were disabled up to the same time before the edge
+      double cli_start = t - (rand() % (int(latency) + 21));
+      if (cli_start > s_now)
+        runTo(cli_start);
+      ICR4 = s_t4.count(t);
+      ICR5 = s_t5.count(t);
+      s_now = t + latency;
+      s_t4.block(s_now);
+      s_t5.block(s_now);
+      syncRegisters();
+      // interrupts run in vector order: INT3, TIMER4_CAPT, TIMER4_OVF, TIMER5_CAPT, TIMER5_OVF
+      isr.interrupt();
+      TachoCapture::captureICP4();
+      s_t4.run(s_now, TachoCapture::overflowICP4);
+      syncRegisters();
+      TachoCapture::captureICP5();
+      runTo(s_now);
+      result.edge4 = fmax(result.edge4, edgeError(icp4, t));
+      result.edge5 = fmax(result.edge5, edgeError(icp5, t));
+      if (i > 40) {
+        result.isr = fmax(result.isr, error(isr.getSpeed(), rpm));
+        result.icp4 = fmax(result.icp4, error(icp4.getSpeed(), rpm));
+        result.icp5 = fmax(result.icp5, error(icp5.getSpeed(), rpm));
+      }
+    }
+    // fan stops
+    runTo(s_now + 2e6);
+    TEST_ASSERT_EQUAL(0, isr.getSpeed());
+    TEST_ASSERT_EQUAL(0, icp4.getSpeed());
+    TEST_ASSERT_EQUAL(0, icp5.getSpeed());
+    return result;
+  }
+
+  /**
+   * @brief Simulate all speeds with given latency and check capture error.
+   *
+   * @param burst maximum latency of every 7th edge in microseconds.
+   * @param check_icp5 if set, check Timer 5 as well. Timer 5 loses overflows
+   *    if interrupts are disabled for more than 1ms, just like micros().
+   */
+  void simulateLatency(double burst, bool check_icp5)
+  {
+    srand(42);
+    const double speeds[] = {300, 900, 1500, 2400, 3200, 6000};
+    for (auto rpm : speeds) {
+      auto e = simulate(rpm, burst);
+      char buffer[128];
+      snprintf(buffer, sizeof(buffer), "latency up to %.0fus, %4.0f rpm: error micros() %.3f%%, ICP4 %.3f%%, ICP5 %.3f%%",
+        burst, rpm, e.isr, e.icp4, e.icp5);
+      TEST_MESSAGE(buffer);
+      // capture is independent of latency, error is given by noise of the fan and timer resolution
+      TEST_ASSERT_TRUE(e.icp4 < 0.5);
+      TEST_ASSERT_TRUE(e.edge4 <= 1);
+      if (check_icp5) {
+        TEST_ASSERT_TRUE(e.icp5 < 0.5);
+        TEST_ASSERT_TRUE(e.edge5 <= 4);
+      }
+    }
+  }
+  /// Interrupt of a tacho signal or a timer overflow.
+  struct Event
+  {
+    double us;      ///< Time of the interrupt.
+    uint8_t source; ///< 0, 1 tacho of fan 1, 2; 2, 3 overflow of Timer 4, 5.
+  };
+
+  /// Simulated time of the benchmark in seconds.
+  constexpr unsigned BENCHMARK_SECONDS = 10;
+
+  /// Create interrupts of both fans at given speed (fan 2 is 3% slower, so the fans don't run in sync).
+  std::vector<Event> makeEvents(double rpm, bool capture)
+  {
+    std::vector<Event> events;
+    const double end = 1e6 * (BENCHMARK_SECONDS + 1);
+    for (uint8_t f = 0; f < 2; ++f) {
+      const double period = 60e6 / (rpm * (f ? 0.97 : 1));
+      for (double t = 1e6 + period * f / 2; t < end; t += period)
+        events.push_back({t, f});
+    }
+    if (capture) {
+      for (double t = s_t4.tick_us * s_t4.period; t < end; t += s_t4.tick_us * s_t4.period)
+        events.push_back({t, 2});
+      for (double t = s_t5.tick_us * s_t5.period; t < end; t += s_t5.tick_us * s_t5.period)
+        events.push_back({t, 3});
+    }
+    std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.us < b.us; });
+    return events;
+  }
+
+  /**
+   * @brief Replay interrupts and measure host time per simulated second.
+   *
+   * @param events interrupts to replay.
+   * @param capture if set, tacho signals are captured by Timer 4 and 5, else measured via micros().
+   * @param call if not set, only the registers and simulated time are set, to measure the overhead.
+   * @return time in nanoseconds per simulated second (minimum of several runs).
+   */
+  double replayEvents(const std::vector<Event>& events, bool capture, bool call)
+  {
+    constexpr unsigned REPEAT = 20, RUNS = 5;
+    double best = 1e99;
+    for (unsigned run = 0; run < RUNS; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      for (unsigned r = 0; r < REPEAT; ++r) {
+        FanRPM rpm1, rpm2;
+        TIFR4 = TIFR5 = 0;
+        if (capture) {
+          TachoCapture::begin(TachoCapture::PIN_ICP4, rpm1, true);
+          TachoCapture::begin(TachoCapture::PIN_ICP5, rpm2, true);
+        }
+        for (auto& e : events) {
+          switch (e.source) {
+            case 0:
+            case 1:
+              if (capture) {
+                if (e.source == 0)
+                  ICR4 = s_t4.count(e.us);
+                else
+                  ICR5 = s_t5.count(e.us);
+                if (call)
+                  (e.source == 0) ? TachoCapture::captureICP4() : TachoCapture::captureICP5();
+              } else {
+                ArduinoHost::setMicros((unsigned long)e.us);
+                if (call)
+                  (e.source == 0) ? rpm1.interrupt() : rpm2.interrupt();
+              }
+              break;
+            case 2:
+              if (call)
+                TachoCapture::overflowICP4();
+              break;
+            default:
+              if (call)
+                TachoCapture::overflowICP5();
+              break;
+          }
+        }
+        if (rpm1.getSpeed() < 0 || rpm2.getSpeed() < 0)
+          TEST_FAIL();  // keep the measurement
+      }
+      auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      best = fmin(best, ns / (REPEAT * BENCHMARK_SECONDS));
+    }
+    return best;
+  }
+
+  /// Load of the interrupt routines of both fans.
+  struct Load
+  {
+    double ips;   ///< Interrupts per second.
+    double ns;    ///< Host time per interrupt in nanoseconds.
+  };
+
+  /// Measure the load of the interrupt routines of both fans at given speed.
+  Load measureLoad(double rpm, bool capture)
+  {
+    auto events = makeEvents(rpm, capture);
+    Load load;
+    load.ips = double(events.size()) / BENCHMARK_SECONDS;
+    const double total = replayEvents(events, capture, true) - replayEvents(events, capture, false);
+    load.ns = fmax(total, 0) / load.ips;
+    return load;
+  }
+}
+
+
+void setUp() {}
+void tearDown() {}
+
+void test_begin_configures_timers()
+{
+  FanRPM rpm;
+  TEST_ASSERT_FALSE(TachoCapture::begin(18, rpm, true));
+  TCCR5A = _BV(WGM50);   // phase correct PWM as set up by Arduino core
+  TEST_ASSERT_TRUE(TachoCapture::begin(TachoCapture::PIN_ICP4, rpm, true));
+  TEST_ASSERT_EQUAL_HEX8(0, TCCR4A);
+  TEST_ASSERT_EQUAL_HEX8(_BV(ICNC4) | _BV(ICES4) | _BV(CS41), TCCR4B);
+  TEST_ASSERT_EQUAL_HEX8(_BV(ICIE4) | _BV(TOIE4), TIMSK4);
+  TEST_ASSERT_TRUE(TachoCapture::begin(TachoCapture::PIN_ICP5, rpm, false));
+  // fast PWM 8 bits with prescaler 64, i.e., 976Hz on PWM pins 44, 45, 46
+  TEST_ASSERT_EQUAL_HEX8(_BV(WGM50), TCCR5A);
+  TEST_ASSERT_EQUAL_HEX8(_BV(ICNC5) | _BV(WGM52) | _BV(CS51) | _BV(CS50), TCCR5B);
+  TEST_ASSERT_EQUAL_HEX8(_BV(ICIE5) | _BV(TOIE5), TIMSK5);
+}
+
+void test_short_latency()
+{
+  simulateLatency(40, true);
+}
+
+void test_pending_overflow()
+{
+  // longer than a Timer 5 period, overflows are pending during capture
+  simulateLatency(500, true);
+}
+
+void test_long_blocking()
+{
+  // blocking operations (e.g., reading DHT sensors) with interrupts disabled,
+  // micros() of the host doesn't lose time here, unlike on the controller
+  simulateLatency(4500, false);
+}
+
+void test_handler_time()
+{
+  TEST_MESSAGE(" rpm   micros() irq/s  ns/irq  us/s   capture irq/s  ns/irq  us/s");
+  Load previous_isr = {0, 0}, previous_icp = {0, 0};
+  for (double rpm : {500.0, 2000.0, 5000.0}) {
+    auto isr = measureLoad(rpm, false);
+    auto icp = measureLoad(rpm, true);
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%4.0f %15.0f %7.1f %5.1f %15.0f %7.1f %5.1f",
+      rpm, isr.ips, isr.ns, isr.ips * isr.ns / 1000, icp.ips, icp.ns, icp.ips * icp.ns / 1000);
+    TEST_MESSAGE(buffer);
+    // Timer 5 overflows dominate the count of interrupts with input capture
+    TEST_ASSERT_TRUE(icp.ips > isr.ips + 1000);
+    // interrupt routines don't depend on the speed, the load grows with the count of tacho signals only
+    if (previous_isr.ips > 0) {
+      TEST_ASSERT_TRUE(isr.ips * isr.ns > previous_isr.ips * previous_isr.ns);
+      TEST_ASSERT_TRUE(isr.ns < 2 * previous_isr.ns + 5);
+      TEST_ASSERT_TRUE(icp.ns < 2 * previous_icp.ns + 5);
+    }
+    previous_isr = isr;
+    previous_icp = icp;
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_configures_timers);
+  RUN_TEST(test_short_latency);
+  RUN_TEST(test_pending_overflow);
+  RUN_TEST(test_long_blocking);
+  RUN_TEST(test_handler_time);
+  return UNITY_END();
+}
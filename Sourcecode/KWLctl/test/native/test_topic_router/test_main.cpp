@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2018 Ivan Schréter (schreter@gmx.net)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This copyright notice MUST APPEAR in all copies of the software!
+ */
+
+
+
+/*!
+ * @file
+ * @brief Table-driven tests and benchmark of MQTT topic routing.
+ *
+ * Topic patterns from MQTTTopic.hpp are matched against concrete topics.
+ * Fan and program commands go through the real FanControl and
+ * ProgramManager handlers.
+ */
+
+#include <Arduino.h>
+#include <ArduinoHost.h>
+#include <unity.h>
+
+#include "DacOutput.h"
+#include "FanControl.h"
+#include "KWLConfig.h"
+#include "LoopbackTransport.h"
+#include "MQTTTopic.hpp"
+#include "ProgramManager.h"
+
+#include <MicroNTP.h>
+#include <TopicRouter.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+  std::vector<std::string> s_published;  ///< Published messages as topic=payload.
+
+  bool publishCallback(void*, const char* topic, const char* payload, bool)
+  {
+    s_published.push_back(std::string(topic) + '=' + payload);
+    return true;
+  }
+
+  /// Stream collecting a streamed message.
+  class StreamedMessage : public Print
+  {
+  public:
+    virtual size_t write(uint8_t c) override { message_.push_back(char(c)); return 1; }
+
+    std::string message_;  ///< Topic and payload written so far.
+  };
+
+  StreamedMessage s_stream;
+
+  Print* beginStream(void*, const char* topic, unsigned, bool)
+  {
+    s_stream.message_ = std::string(topic) + '=';
+    return &s_stream;
+  }
+
+  bool endStream(void*, bool complete)
+  {
+    if (complete)
+      s_published.push_back(s_stream.message_);
+    return complete;
+  }
+
+  /// One row of the matching table.
+  struct MatchCase
+  {
+    const char* topic;    ///< Topic to match.
+    const char* pattern;  ///< Pattern from MQTTTopic.hpp in Flash memory.
+    bool matches;         ///< Expected match result.
+    unsigned param;       ///< Expected first numeric parameter.
+  };
+
+  const MatchCase MATCH_CASES[] = {
+    { "fan1/standardspeed", MQTTTopic::CmdFanSpeed.data_P(), true, 1 },
+    { "fan2/standardspeed", MQTTTopic::CmdFanSpeed.data_P(), true, 2 },
+    { "fan/standardspeed", MQTTTopic::CmdFanSpeed.data_P(), false, 0 },
+    { "fan256/standardspeed", MQTTTopic::CmdFanSpeed.data_P(), false, 0 },
+    { "fan1/standardspeed/x", MQTTTopic::CmdFanSpeed.data_P(), false, 0 },
+    { "/fan2/getvalues", MQTTTopic::KwlDebugsetFanGetvalues.data_P(), true, 2 },
+    { "/fan1/pwm", MQTTTopic::KwlDebugsetFanPWM.data_P(), true, 1 },
+    { "/fan/pwm/store_IKNOWWHATIMDOING", MQTTTopic::KwlDebugsetFanPWM.data_P(), false, 0 },
+    { "program/05/data", MQTTTopic::CmdProgramData.data_P(), true, 5 },
+    { "program/15/enable", MQTTTopic::CmdProgramEnable.data_P(), true, 15 },
+    { "program/7/get", MQTTTopic::CmdProgramGet.data_P(), true, 7 },
+    { "program/all/get", MQTTTopic::CmdProgramGet.data_P(), false, 0 },
+    { "program/all/get", MQTTTopic::CmdProgramGetAll.data_P(), true, 0 },
+    { "program/300/get", MQTTTopic::CmdProgramGet.data_P(), false, 0 },
+    { "program/300/get", MQTTTopic::CmdProgramInvalid.data_P(), true, 0 },
+    { "program//get", MQTTTopic::CmdProgramInvalid.data_P(), false, 0 },
+    { "program/set", MQTTTopic::CmdSetProgramSet.data_P(), true, 0 },
+    { "program/set", MQTTTopic::CmdProgramInvalid.data_P(), false, 0 },
+    { "ntp/timezone", MQTTTopic::CmdTimezone.data_P(), true, 0 },
+    { "ntp/timezon", MQTTTopic::CmdTimezone.data_P(), false, 0 },
+    { "ntp/timezone/x", MQTTTopic::CmdTimezone.data_P(), false, 0 },
+  };
+
+  /// Fixed command topics, which must match only themselves.
+  const char* const FIXED_TOPICS[] = {
+    MQTTTopic::CmdResetAll.data_P(), MQTTTopic::CmdRestart.data_P(), MQTTTopic::CmdMode.data_P(),
+    MQTTTopic::CmdAirflow.data_P(), MQTTTopic::CmdFansCalculateSpeedMode.data_P(),
+    MQTTTopic::CmdCalibrateFans.data_P(), MQTTTopic::CmdGetSpeed.data_P(), MQTTTopic::CmdGetvalues.data_P(),
+    MQTTTopic::CmdTimezone.data_P(), MQTTTopic::CmdDST.data_P(), MQTTTopic::CmdNTPServer.data_P(),
+    MQTTTopic::CmdScreenshot.data_P(), MQTTTopic::CmdScreen.data_P(), MQTTTopic::CmdTouch.data_P(),
+    MQTTTopic::CmdSetProgramSet.data_P(), MQTTTopic::CmdProgramGetAll.data_P(),
+    MQTTTopic::KwlDebugsetSchedulerGetvalues.data_P(), MQTTTopic::KwlDebugsetSchedulerResetvalues.data_P(),
+    MQTTTopic::KwlDebugsetMqttGetvalues.data_P(), MQTTTopic::KwlDebugsetMqttResetvalues.data_P(),
+    MQTTTopic::KwlDebugsetCrashGetvalues.data_P(), MQTTTopic::KwlDebugsetCrashResetvalues.data_P(),
+    MQTTTopic::KwlDebugsetCrashProvoke.data_P(), MQTTTopic::KwlDebugsetNTPTime.data_P(),
+    MQTTTopic::KwlDebugsetFanPWMStore.data_P(),
+  };
+
+  /// Handler comparing topics directly instead of using a router.
+  class FakeBypass : public MessageHandler
+  {
+  public:
+    FakeBypass() : MessageHandler(F("FakeBypass")) {}
+
+    virtual bool mqttReceiveMsg(const StringView& topic, const StringView& s) override
+    {
+      if (topic != MQTTTopic::CmdBypassMode)
+        return false;
+      if (s != F("auto") && s != F("manual"))
+        reportMalformed();
+      return true;
+    }
+  };
+
+  FakeBypass s_bypass;
+  KWLPersistentConfig s_config;
+  DacOutput s_dac;
+  FanControl s_fan(s_config, s_dac, nullptr);
+  LoopbackTransport s_transport;
+  MicroNTP s_ntp(s_transport.getUDP());
+  ProgramManager s_programs(s_config, s_fan, s_ntp);
+
+  /// Send a message like the MQTT client and run publishing tasks.
+  void send(const char* topic, const char* payload)
+  {
+    std::string t(topic), p(payload);
+    p.push_back(0);
+    MessageHandler::mqttMessageReceived(&t[0], reinterpret_cast<uint8_t*>(&p[0]), unsigned(p.size() - 1));
+    PublishTask::loop();
+  }
+
+  /// Get statistics of a command by its pattern.
+  const MessageStats* findCommand(const char* pattern)
+  {
+    for (uint8_t i = 0; i < MessageHandler::getCommandCount(); ++i) {
+      if (!strcmp_P(pattern, MessageHandler::getCommandName(i)))
+        return &MessageHandler::getCommandStats(i);
+    }
+    return nullptr;
+  }
+
+  /// Check whether a message with given topic was published.
+  bool published(const char* topic)
+  {
+    for (auto& m : s_published)
+      if (m.compare(0, m.find('='), topic) == 0)
+        return true;
+    return false;
+  }
+
+}
+
+void setUp()
+{
+  MessageHandler::resetStats();
+  PublishTask::loop();
+  s_published.clear();
+}
+
+void tearDown() {}
+
+void test_pattern_table()
+{
+  for (auto& c : MATCH_CASES) {
+    TopicParams params;
+    bool result = TopicRouter::match(c.pattern, StringView(c.topic), params);
+    TEST_ASSERT_EQUAL_MESSAGE(c.matches, result, c.topic);
+    if (c.matches && params.size() > 0)
+      TEST_ASSERT_EQUAL_MESSAGE(c.param, params.getNumber(0), c.topic);
+  }
+}
+
+void test_fixed_topics_match_only_themselves()
+{
+  for (auto pattern : FIXED_TOPICS) {
+    for (auto topic : FIXED_TOPICS) {
+      TopicParams params;
+      bool result = TopicRouter::match(pattern, StringView(topic), params);
+      TEST_ASSERT_EQUAL_MESSAGE(pattern == topic, result, topic);
+    }
+  }
+}
+
+void test_fan_commands()
+{
+  send("fan1/standardspeed", "1300");
+  send("fan2/standardspeed", "1350");
+  TEST_ASSERT_EQUAL(1300, s_fan.getFan1().getStandardSpeed());
+  TEST_ASSERT_EQUAL(1350, s_fan.getFan2().getStandardSpeed());
+  TEST_ASSERT_EQUAL(1300, s_config.getSpeedSetpointFan1());
+  TEST_ASSERT_EQUAL(1350, s_config.getSpeedSetpointFan2());
+
+  // both fans are counted as one command, with the invalid value as malformed
+  send("fan2/standardspeed", "5");
+  TEST_ASSERT_EQUAL(1350, s_fan.getFan2().getStandardSpeed());
+  auto stats = findCommand(MQTTTopic::CmdFanSpeed.data_P());
+  TEST_ASSERT_NOT_NULL(stats);
+  TEST_ASSERT_EQUAL(3, stats->getCount());
+  TEST_ASSERT_EQUAL(1, stats->getMalformedCount());
+
+  // there is no third fan
+  send("fan3/standardspeed", "1000");
+  TEST_ASSERT_EQUAL(1, MessageHandler::getUnhandledCount());
+}
+
+void test_program_get_invalid_index()
+{
+  send("program/7/get", "");
+  TEST_ASSERT_TRUE(published("program/index"));
+  PublishTask::loop();
+  TEST_ASSERT_EQUAL_STRING("program/07/data=00:00 00:00 0 0000000 00000000", s_published[1].c_str());
+  TEST_ASSERT_EQUAL_STRING("program/07/enable=00000000", s_published[3].c_str());
+
+  // index not fitting {u8} goes to the invalid program route, but still reports the program index
+  s_published.clear();
+  send("program/300/get", "");
+  TEST_ASSERT_TRUE(published("program/index"));
+  auto stats = findCommand(MQTTTopic::CmdProgramInvalid.data_P());
+  TEST_ASSERT_NOT_NULL(stats);
+  TEST_ASSERT_EQUAL(1, stats->getMalformedCount());
+
+  s_published.clear();
+  send("program/xx/data", "");
+  TEST_ASSERT_FALSE(published("program/index"));
+  TEST_ASSERT_EQUAL(2, stats->getMalformedCount());
+
+  send("program/300/unknown", "");
+  TEST_ASSERT_EQUAL(1, MessageHandler::getUnhandledCount());
+}
+
+void test_stats_without_router()
+{
+  // messages of handlers without router are counted for the handler only, they don't take command slots
+  send("summerbypass/mode", "auto");
+  send("summerbypass/mode", "never");
+  TEST_ASSERT_EQUAL(0, MessageHandler::getCommandCount());
+  auto& stats = s_bypass.getStats();
+  TEST_ASSERT_EQUAL(2, stats.getCount());
+  TEST_ASSERT_EQUAL(1, stats.getMalformedCount());
+
+  // dispatched routed commands are counted, validated ones not
+  TEST_ASSERT_TRUE(MessageHandler::dispatch(StringView("lueftungsstufe"), StringView("2")));
+  TEST_ASSERT_TRUE(MessageHandler::validate(StringView("lueftungsstufe"), StringView("3")));
+  auto mode = findCommand(MQTTTopic::CmdMode.data_P());
+  TEST_ASSERT_NOT_NULL(mode);
+  TEST_ASSERT_EQUAL(1, mode->getCount());
+  TEST_ASSERT_EQUAL(1, MessageHandler::getCommandCount());
+}
+
+void test_stats_overflow()
+{
+  // malformed payloads, so the commands don't change anything
+  static const char* const TOPICS[] = {
+    "fan1/standardspeed", "lueftungsstufe", "luftmenge", "fans/calculatespeed", "program/set",
+    "program/01/data", "program/01/enable", "program/xx/data", "fan2/standardspeed",
+  };
+  for (auto topic : TOPICS)
+    send(topic, "x");
+  TEST_ASSERT_EQUAL(MESSAGE_HANDLER_COMMAND_STATS, MessageHandler::getCommandCount());
+  TEST_ASSERT_EQUAL(0, MessageHandler::getCommandOverflowCount());
+
+  // further command doesn't get a slot, but isn't lost silently
+  send("fans/getspeed", "");
+  send("fans/getspeed", "");
+  TEST_ASSERT_NULL(findCommand(MQTTTopic::CmdGetSpeed.data_P()));
+  TEST_ASSERT_EQUAL(2, MessageHandler::getCommandOverflowCount());
+  TEST_ASSERT_EQUAL(2, findCommand(MQTTTopic::CmdFanSpeed.data_P())->getCount());
+
+  // reset frees the slots
+  MessageHandler::resetStats();
+  TEST_ASSERT_EQUAL(0, MessageHandler::getCommandCount());
+  TEST_ASSERT_EQUAL(0, MessageHandler::getCommandOverflowCount());
+  send("fans/getspeed", "");
+  TEST_ASSERT_EQUAL(1, findCommand(MQTTTopic::CmdGetSpeed.data_P())->getCount());
+}
+
+void test_dispatch_benchmark()
+{
+  static const char* const TOPICS[] = {
+    "fan1/standardspeed", "kwl/mode", "program/05/enable", "program/all/get", "unknown/topic",
+  };
+  constexpr unsigned long COUNT = 200000;
+  auto start = std::chrono::steady_clock::now();
+  unsigned long handled = 0;
+  for (unsigned long i = 0; i < COUNT; ++i) {
+    auto topic = TOPICS[i % (sizeof(TOPICS) / sizeof(TOPICS[0]))];
+    handled += MessageHandler::validate(StringView(topic), StringView("1300"));
+  }
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  char buffer[80];
+  snprintf(buffer, sizeof(buffer), "host: %.1f ns per validated message (%lu accepted)", secs * 1e9 / COUNT, handled);
+  TEST_MESSAGE(buffer);
+
+  constexpr unsigned long MATCH_COUNT = 2000000;
+  start = std::chrono::steady_clock::now();
+  unsigned long matched = 0;
+  for (unsigned long i = 0; i < MATCH_COUNT; ++i) {
+    TopicParams params;
+    auto& c = MATCH_CASES[i % (sizeof(MATCH_CASES) / sizeof(MATCH_CASES[0]))];
+    matched += TopicRouter::match(c.pattern, StringView(c.topic), params);
+  }
+  secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  snprintf(buffer, sizeof(buffer), "host: %.1f ns per pattern match (%lu matched)", secs * 1e9 / MATCH_COUNT, matched);
+  TEST_MESSAGE(buffer);
+}
+
+int main()
+{
+  MessageHandler::begin(publishCallback, nullptr);
+  MessageHandler::setStreamCallbacks(beginStream, endStream);
+  UNITY_BEGIN();
+  RUN_TEST(test_pattern_table);
+  RUN_TEST(test_fixed_topics_match_only_themselves);
+  RUN_TEST(test_fan_commands);
+  RUN_TEST(test_program_get_invalid_index);
+  RUN_TEST(test_stats_without_router);
+  RUN_TEST(test_stats_overflow);
+  RUN_TEST(test_dispatch_benchmark);
+  return UNITY_END();
+}